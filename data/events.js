@@ -5,8 +5,16 @@
  * @typedef {Object} Readings
  * @property {number} temperature Temperature value as an integer
  * @property {number} humidity Humidity value as a percentage (0 - 100)
+ * @property {number} tq Quality bits of the temperature, 0 is a good reading
+ * @property {number} hq Quality bits of the humidity
  */
 
+/**
+ * Quality bits that mean the sensor failed (fault, or no reading yet): the value is the last good one
+ * @type {number}
+ */
+const QUALITY_UNUSABLE = 0x0c;
+
 /**
  * Timer type config
  * @typedef {Object} Timer
@@ -22,6 +30,21 @@
  * @property {boolean} motor3 The state of the third switch (motor 3)
  */
 
+/**
+ * Roast analytics type config
+ * @typedef {Object} Analytics
+ * @property {number} ror Rate of rise over 30 seconds, in tenths of °C/min
+ * @property {number} ror60 Rate of rise over 60 seconds, in tenths of °C/min
+ * @property {number} above Seconds at or above the roast temperature
+ * @property {number} phase 0 no roast, 1 drying, 2 browning, 3 development
+ * @property {number[]} phases Seconds of drying, browning & development
+ */
+
+/**
+ * History sample as returned by /history: [n, temperature, humidity, timer, flags]
+ * @typedef {number[]} Sample
+ */
+
 // ELEMENTS & OBJECTS
 
 /**
@@ -131,34 +154,252 @@ const count = document.querySelector(".count");
 let total;
 let time;
 
+// Get temperature curve element
+const chart = document.querySelector("#chart-temperature");
+const chartContext = chart.getContext("2d");
+
+/**
+ * Temperature of every second of the roast
+ * @type {number[]}
+ */
+let curve = [];
+
+/**
+ * Rate of rise of every second since the page loaded (°C/min)
+ * @type {number[]}
+ */
+let rorCurve = [];
+
+// Samples kept by the esp32 (68 minutes at 1 Hz)
+const CURVE_LENGTH = 4096;
+
+// Top of the scale of the rate of rise curve (°C/min)
+const MAX_ROR = 50;
+
+// Get analytics element
+const analyticsText = document.querySelector("#analytics");
+
 // Get switches elements
 const switch1 = document.querySelector("#switch1");
 const switch2 = document.querySelector("#switch2");
 const switch3 = document.querySelector("#switch3");
 
+// CURVE
+
+// Draw the temperature curve, using the same scale as the temperature gauge
+function drawCurve() {
+  const { width, height } = chart;
+  const maxTemperature = 250;
+  const span = Math.max(curve.length, 60); // Show at least one minute
+
+  chartContext.clearRect(0, 0, width, height);
+
+  // Horizontal lines every 50°C
+  chartContext.strokeStyle = "#e0e0e0";
+  chartContext.lineWidth = 1;
+  chartContext.beginPath();
+  for (let t = 50; t < maxTemperature; t += 50) {
+    const y = height - (t * height) / maxTemperature;
+    chartContext.moveTo(0, y);
+    chartContext.lineTo(width, y);
+  }
+  chartContext.stroke();
+
+  // Curve
+  chartContext.strokeStyle = "#db3e6c";
+  chartContext.lineWidth = 2;
+  chartContext.beginPath();
+  curve.forEach((temperature, i) => {
+    const x = (i * width) / span;
+    const y = height - (Math.min(temperature, maxTemperature) * height) / maxTemperature;
+    i ? chartContext.lineTo(x, y) : chartContext.moveTo(x, y);
+  });
+  chartContext.stroke();
+
+  // Rate of rise, lined up with the latest temperatures
+  const offset = Math.max(curve.length - rorCurve.length, 0);
+  chartContext.strokeStyle = "#049faa";
+  chartContext.lineWidth = 1;
+  chartContext.beginPath();
+  rorCurve.forEach((ror, i) => {
+    const x = ((offset + i) * width) / span;
+    const y = height - (Math.min(Math.max(ror, 0), MAX_ROR) * height) / MAX_ROR;
+    i ? chartContext.lineTo(x, y) : chartContext.moveTo(x, y);
+  });
+  chartContext.stroke();
+}
+
+// Add the latest rate of rise to the curve
+function addToRorCurve(ror) {
+  rorCurve.push(ror);
+  if (rorCurve.length > CURVE_LENGTH) rorCurve.shift();
+}
+
+// Add the latest temperature to the curve
+function addToCurve(temperature) {
+  curve.push(temperature);
+  if (curve.length > CURVE_LENGTH) curve.shift();
+  drawCurve();
+}
+
 // EVENTS
 
+// Get the curve recorded so far
+function loadCurve() {
+  fetch("/history")
+    .then((res) => res.json())
+    .then((/** @type {Sample[]} */ samples) => {
+      curve = samples.map((sample) => sample[1]);
+      drawCurve();
+    });
+}
+
 // Get current sensor readings when the page loads
 window.addEventListener("load", () => {
-  fetch("/data")
-    .then((res) => res.json())
-    .then(({ readings, timer, states }) => {
-      temperatureGauge.value = readings.temperature;
-      humidityGauge.value = readings.humidity;
+  // The event source sends the latest values as soon as it connects
+  if (!window.EventSource) {
+    fetch("/data")
+      .then((res) => res.json())
+      .then(({ readings, timer, states, analytics }) => {
+        temperatureGauge.value = readings.temperature;
+        humidityGauge.value = readings.humidity;
+        showQuality(readings.tq, readings.hq);
 
-      total = timer.total;
-      time = timer.time <= 0 ? 0 : timer.time;
+        total = timer.total;
+        time = timer.time <= 0 ? 0 : timer.time;
 
-      switch1.checked = states.motor1;
-      switch2.checked = states.motor2;
-      switch3.checked = states.motor3;
-    });
+        updateStates(states);
+        updateAnalytics(analytics);
+      });
+  }
+
+  loadCurve();
 });
 
+// UPDATES
+
+/**
+ * Mark the gauges of the sensors that failed
+ * @param {number} temperatureQuality
+ * @param {number} humidityQuality
+ */
+function showQuality(temperatureQuality, humidityQuality) {
+  const failed = " - sin sensor";
+  const temperatureUnits = "Temperatura (°C)" + (temperatureQuality & QUALITY_UNUSABLE ? failed : "");
+  const humidityUnits = "Humedad (%)" + (humidityQuality & QUALITY_UNUSABLE ? failed : "");
+
+  if (temperatureGauge.options.units !== temperatureUnits) temperatureGauge.update({ units: temperatureUnits });
+  if (humidityGauge.options.units !== humidityUnits) humidityGauge.update({ units: humidityUnits });
+}
+
+/**
+ * Update the timer clock
+ * @param {Timer} timer
+ */
+function updateTimer(timer) {
+  // update time values
+  total = timer.total;
+  time = timer.time <= 0 ? 0 : timer.time;
+
+  // update circular progress bar
+  clock.style.background = `conic-gradient(#db3e6c, ${
+    (time * 360) / total
+  }deg, #feeff4 0deg)`;
+
+  // format clock
+  let minutes = Math.floor(time / 60);
+  let seconds = time - minutes * 60;
+
+  count.textContent = `${minutes < 10 ? "0" : ""}${minutes}:${
+    seconds < 10 ? "0" : ""
+  }${seconds}`;
+}
+
+/**
+ * Format seconds as m:ss
+ * @param {number} seconds
+ */
+function formatDuration(seconds) {
+  const minutes = Math.floor(seconds / 60);
+  return `${minutes}:${seconds % 60 < 10 ? "0" : ""}${seconds % 60}`;
+}
+
+/**
+ * Update the rate of rise & the phases of the roast
+ * @param {Analytics} analytics
+ */
+function updateAnalytics(analytics) {
+  const [drying, browning, development] = analytics.phases;
+  const ror = (analytics.ror / 10).toFixed(1);
+  const ror60 = (analytics.ror60 / 10).toFixed(1);
+
+  analyticsText.textContent =
+    `RoR ${ror} °C/min (${ror60} en 60 s) · Secado ${formatDuration(drying)} · ` +
+    `Maillard ${formatDuration(browning)} · Desarrollo ${formatDuration(development)} · ` +
+    `Sobre la temperatura ${formatDuration(analytics.above)}`;
+}
+
+/**
+ * Update the motor switches
+ * @param {States} states
+ */
+function updateStates(states) {
+  switch1.checked = states.motor1;
+  switch2.checked = states.motor2;
+  switch3.checked = states.motor3;
+}
+
+// COMPACT STREAM
+
+/**
+ * Values of the compact stream, by field letter:
+ * T temperature, H humidity, N total time, C remaining time, M motor bits,
+ * Q quality bits (temperature, & humidity shifted 4 bits), R rate of rise (tenths of °C/min)
+ * @type {Object<string, number>}
+ */
+let compactValues = {};
+
+/**
+ * Sequence number of the last applied frame, null until a keyframe arrives
+ * @type {number | null}
+ */
+let compactSequence = null;
+
+/**
+ * Apply a compact frame ("<seq><letter><int>...", e.g. "42C1233") and update the page
+ * @param {string} data Frame
+ * @param {boolean} keyframe Whether the frame carries every value
+ */
+function applyCompactFrame(data, keyframe) {
+  const seq = parseInt(data, 10);
+
+  // A delta only applies on top of the previous frame, wait for the next keyframe after a gap
+  if (!keyframe && (compactSequence === null || seq !== compactSequence + 1)) {
+    compactSequence = null;
+    return;
+  }
+
+  if (keyframe) compactValues = {};
+  for (const [, field, value] of data.matchAll(/([A-Z])(-?\d+)/g)) {
+    compactValues[field] = parseInt(value, 10);
+  }
+  compactSequence = seq;
+
+  const { T, H, N, C, M, Q } = compactValues;
+  temperatureGauge.value = T;
+  humidityGauge.value = H;
+  showQuality(Q & 0x0f, Q >> 4);
+  updateTimer({ total: N, time: C });
+  updateStates({ motor1: !!(M & 1), motor2: !!(M & 2), motor3: !!(M & 4) });
+}
+
 if (window.EventSource) {
+  // Open the page with ?mode=compact to only receive the values that change
+  const compact = new URLSearchParams(window.location.search).get("mode") === "compact";
+
   // let source = new EventSource("http://localhost:3000/events"); // use this when sse-local-server is on
   // let source = new EventSource("http://192.168.0.177:3000/events"); // use this when sse-local-server is on
-  let source = new EventSource("/events");
+  let source = new EventSource(compact ? "/events/compact" : "/events");
 
   // Start event listener
   source.addEventListener("open", function (e) {
@@ -177,18 +418,40 @@ if (window.EventSource) {
     console.log("\nmessage\n", e.data);
   });
 
+  // Sent on reconnection when the missed events are no longer available
+  source.addEventListener("resync", function (e) {
+    loadCurve();
+  });
+
+  // Compact stream keyframe & delta handlers
+  source.addEventListener("k", (e) => applyCompactFrame(e.data, true));
+  source.addEventListener("d", (e) => applyCompactFrame(e.data, false));
+
+  // The compact stream only sends changes, sample the curve every second
+  if (compact) {
+    setInterval(() => {
+      if (compactSequence === null) return;
+      addToRorCurve(compactValues.R / 10);
+      addToCurve(compactValues.T);
+    }, 1000);
+  }
+
   // Readings / Gauges event handler
   source.addEventListener("readings", function (e) {
+    /**
+     * An object holding the temperature & humidity values
+     * @type {Readings}
+     */
+    let readings = JSON.parse(e.data);
+
+    addToCurve(readings.temperature);
+
     if (!delay) {
-      /**
-       * An object holding the temperature & humidity values
-       * @type {Readings}
-       */
-      let readings = JSON.parse(e.data);
       console.log("readings", readings);
 
       temperatureGauge.value = readings.temperature;
       humidityGauge.value = readings.humidity;
+      showQuality(readings.tq, readings.hq);
 
       delay = !delay;
     } else {
@@ -205,22 +468,7 @@ if (window.EventSource) {
     let timer = JSON.parse(e.data);
     console.log("timer", timer);
 
-    // update time values
-    total = timer.total;
-    time = timer.time <= 0 ? 0 : timer.time;
-
-    // update circular progress bar
-    clock.style.background = `conic-gradient(#db3e6c, ${
-      (time * 360) / total
-    }deg, #feeff4 0deg)`;
-
-    // format clock
-    let minutes = Math.floor(time / 60);
-    let seconds = time - minutes * 60;
-
-    count.textContent = `${minutes < 10 ? "0" : ""}${minutes}:${
-      seconds < 10 ? "0" : ""
-    }${seconds}`;
+    updateTimer(timer);
   });
 
   // Switches states event handler
@@ -232,23 +480,151 @@ if (window.EventSource) {
     let states = JSON.parse(e.data);
     console.log("states", states);
 
-    switch1.checked = states.motor1;
-    switch2.checked = states.motor2;
-    switch3.checked = states.motor3;
+    updateStates(states);
+  });
+
+  // Roast analytics event handler, sent every second before the next readings
+  source.addEventListener("analytics", function (e) {
+    /**
+     * An object holding the rate of rise & the phases
+     * @type {Analytics}
+     */
+    let analytics = JSON.parse(e.data);
+
+    addToRorCurve(analytics.ror / 10);
+    updateAnalytics(analytics);
+  });
+}
+
+// Control channel: the commands as binary frames on a WebSocket kept open,
+// each one acked, and the motors & timer pushed on every change (see
+// src/control_channel.h). The POSTs are used while it's closed
+const CONTROL_HELLO = 0x00;
+const CONTROL_MOTOR = 0x01;
+const CONTROL_TIME = 0x02;
+const CONTROL_ACK = 0x81;
+const CONTROL_STATE = 0x82;
+const CONTROL_BUSY = 2;
+
+// Lets the board tell a command sent again after a reconnection from a new one
+const controlSession = (Math.random() * 0x100000000) >>> 0;
+let controlSeq = 0;
+let controlSocket = null;
+
+/**
+ * Commands not acked yet, by sequence number
+ * @type {Map<number, ArrayBuffer>}
+ */
+const controlUnacked = new Map();
+
+// Commands acked busy & sent again: the newer ones wait for them, held in
+// order, so the board applies the commands in the order they were made
+const controlRetrying = new Set();
+const controlHeld = [];
+
+function openControl() {
+  const socket = new WebSocket(`ws://${window.location.host}/control`);
+  socket.binaryType = "arraybuffer";
+
+  socket.addEventListener("open", () => {
+    const hello = new DataView(new ArrayBuffer(7));
+    hello.setUint8(0, CONTROL_HELLO);
+    hello.setUint32(3, controlSession, true);
+    socket.send(hello.buffer);
+
+    // The board skips those it already applied
+    controlRetrying.clear();
+    controlHeld.length = 0;
+    controlUnacked.forEach((frame) => socket.send(frame));
+    controlSocket = socket;
+  });
+
+  socket.addEventListener("message", (e) => {
+    const frame = new DataView(e.data);
+
+    if (frame.getUint8(0) === CONTROL_ACK) {
+      const seq = frame.getUint16(1, true);
+      if (frame.getUint8(3) !== CONTROL_BUSY) {
+        controlUnacked.delete(seq);
+        controlRetrying.delete(seq);
+        if (!controlRetrying.size) {
+          controlHeld.splice(0).forEach((held) => controlSocket && controlSocket.send(held));
+        }
+      } else {
+        controlRetrying.add(seq);
+        setTimeout(() => {
+          if (controlSocket && controlUnacked.has(seq)) {
+            controlSocket.send(controlUnacked.get(seq));
+          }
+        }, 100);
+      }
+    } else if (frame.getUint8(0) === CONTROL_STATE) {
+      const motors = frame.getUint8(1);
+      updateStates({
+        motor1: !!(motors & 1),
+        motor2: !!(motors & 2),
+        motor3: !!(motors & 4),
+      });
+      updateTimer({
+        total: frame.getUint16(2, true),
+        time: frame.getUint16(4, true),
+      });
+    }
+  });
+
+  socket.addEventListener("close", () => {
+    controlSocket = null;
+    setTimeout(openControl, 1000);
   });
 }
 
+/**
+ * Send a command on the control channel
+ * @param {number} type CONTROL_MOTOR or CONTROL_TIME
+ * @param {function(DataView)} write Writes the arguments, from byte 3
+ * @returns {boolean} False when the channel is closed
+ */
+function sendControl(type, write) {
+  if (!controlSocket) return false;
+
+  controlSeq = (controlSeq + 1) & 0xffff;
+  const frame = new DataView(new ArrayBuffer(5));
+  frame.setUint8(0, type);
+  frame.setUint16(1, controlSeq, true);
+  write(frame);
+
+  controlUnacked.set(controlSeq, frame.buffer);
+  if (controlRetrying.size) {
+    controlHeld.push(frame.buffer);
+  } else {
+    controlSocket.send(frame.buffer);
+  }
+  return true;
+}
+
+if (window.WebSocket) {
+  openControl();
+}
+
 // handle update of motor status to the esp32
 document.querySelectorAll('[type="checkbox"]').forEach((sw) => {
   sw.addEventListener("click", () => {
     if (navigator.vibrate) window.navigator.vibrate(50);
+    const motor = parseInt(sw.id.match(/[123]/g)[0], 10);
+
+    const sent = sendControl(CONTROL_MOTOR, (frame) => {
+      frame.setUint8(3, motor);
+      frame.setUint8(4, sw.checked ? 1 : 0);
+    });
+    if (sent) return;
+
     fetch("/motors", {
       method: "POST",
       headers: {
         "Content-Type": "application/json",
       },
       body: JSON.stringify({
-        [`motor${sw.id.match(/[123]/g)[0]}`]: sw.checked,
+        [`motor${motor}`]: sw.checked,
       }),
     });
   });
@@ -258,6 +634,13 @@ document.querySelectorAll('[type="checkbox"]').forEach((sw) => {
 document.querySelectorAll(".timer-button").forEach((timer_button) => {
   timer_button.addEventListener("click", () => {
     if (navigator.vibrate) window.navigator.vibrate(50);
+    const reduce = timer_button.ariaLabel.includes("reduce-time");
+
+    const sent = sendControl(CONTROL_TIME, (frame) =>
+      frame.setInt16(3, reduce ? -60 : 60, true)
+    );
+    if (sent) return;
+
     fetch("/time", {
       method: "POST",
       headers: {
@@ -265,9 +648,7 @@ document.querySelectorAll(".timer-button").forEach((timer_button) => {
       },
       body: JSON.stringify({
         time: 60,
-        action: timer_button.ariaLabel.includes("reduce-time")
-          ? "reduce"
-          : "add",
+        action: reduce ? "reduce" : "add",
       }),
     });
   });
@@ -82,11 +82,11 @@ void LiquidCrystal_I2C::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
 	// SEE PAGE 45/46 FOR INITIALIZATION SPECIFICATION!
 	// according to datasheet, we need at least 40ms after power rises above 2.7V
 	// before sending commands. Arduino can turn on way befer 4.5V so we'll wait 50
-	delay(50); 
+	wait(50000); 
   
 	// Now we pull both RS and R/W low to begin commands
 	expanderWrite(_backlightval);	// reset expanderand turn backlight off (Bit 8 =1)
-	delay(1000);
+	wait(1000000);
 
   	//put the LCD into 4 bit mode
 	// this is according to the hitachi HD44780 datasheet
@@ -94,15 +94,15 @@ void LiquidCrystal_I2C::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
 	
 	  // we start in 8bit mode, try to set 4 bit mode
    write4bits(0x03 << 4);
-   delayMicroseconds(4500); // wait min 4.1ms
+   wait(4500); // wait min 4.1ms
    
    // second try
    write4bits(0x03 << 4);
-   delayMicroseconds(4500); // wait min 4.1ms
+   wait(4500); // wait min 4.1ms
    
    // third go!
    write4bits(0x03 << 4); 
-   delayMicroseconds(150);
+   wait(150);
    
    // finally, set to 4-bit interface
    write4bits(0x02 << 4); 
@@ -131,13 +131,13 @@ void LiquidCrystal_I2C::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
 /********** high level commands, for the user! */
 void LiquidCrystal_I2C::clear(){
 	command(LCD_CLEARDISPLAY);// clear display, set cursor position to zero
-	delayMicroseconds(2000);  // this command takes a long time!
+	wait(2000);  // this command takes a long time!
   if (_oled) setCursor(0,0);
 }
 
 void LiquidCrystal_I2C::home(){
 	command(LCD_RETURNHOME);  // set cursor position to zero
-	delayMicroseconds(2000);  // this command takes a long time!
+	wait(2000);  // this command takes a long time!
 }
 
 void LiquidCrystal_I2C::setCursor(uint8_t col, uint8_t row){
@@ -251,8 +251,194 @@ inline void LiquidCrystal_I2C::command(uint8_t value) {
 
 /************ low level data pushing commands **********/
 
+// Expander bytes per byte sent in writeAt(): En high & En low for each nibble
+#define RUN_BYTES_PER_SEND 4
+// Bytes the Wire buffer takes in one transaction
+#ifdef I2C_BUFFER_LENGTH
+#define RUN_TRANSACTION_BYTES I2C_BUFFER_LENGTH
+#else
+#define RUN_TRANSACTION_BYTES 32
+#endif
+
+// Append the expander bytes of a command or data byte. The data lines are
+// already valid with the En high byte, the display latches them when En falls
+static uint8_t packSend(uint8_t *out, uint8_t value, uint8_t mode, uint8_t backlight) {
+	uint8_t nibbles[2] = { (uint8_t)((value & 0xf0) | mode | backlight), (uint8_t)(((value << 4) & 0xf0) | mode | backlight) };
+	uint8_t n = 0;
+	for (uint8_t i = 0; i < 2; i++) {
+		out[n++] = nibbles[i] | En;
+		out[n++] = nibbles[i] & ~En;
+	}
+	return n;
+}
+
+// Set the cursor & write a run of characters, packing the nibble & enable
+// sequences of several characters in each I2C transaction instead of 6
+// transactions per character. At 100/400 kHz each byte on the bus takes
+// longer than the 37us the display needs per character.
+// Returns false if it was dropped (async queue full)
+bool LiquidCrystal_I2C::writeAt(uint8_t col, uint8_t row, const uint8_t *data, uint8_t length){
+	int row_offsets[] = { 0x00, 0x40, 0x14, 0x54 };
+	if ( row >= _numlines ) {
+		row = _numlines-1;    // we count rows starting w/0
+	}
+
+	uint8_t transactionBytes = RUN_TRANSACTION_BYTES;
+#ifdef ESP32
+	if (_queue) {
+		transactionBytes = LCD_OP_BYTES;
+		uint32_t bytes = (uint32_t)(length + 1) * RUN_BYTES_PER_SEND;
+		if (!hasRoom((bytes + transactionBytes - 1) / transactionBytes)) {
+			return false;
+		}
+	}
+#endif
+
+	uint8_t buffer[RUN_TRANSACTION_BYTES];
+	uint8_t used = packSend(buffer, LCD_SETDDRAMADDR | (col + row_offsets[row]), 0, _backlightval);
+
+	for (uint8_t i = 0; i <= length; i++) {
+		bool full = used + RUN_BYTES_PER_SEND > transactionBytes;
+		if (i == length || full) {
+			transmit(buffer, used);
+			used = 0;
+		}
+		if (i < length) {
+			used += packSend(buffer + used, data[i], Rs, _backlightval);
+		}
+	}
+	return true;
+}
+
+// Send bytes (backlight bit included) to the expander, now or through the async queue
+void LiquidCrystal_I2C::transmit(const uint8_t *bytes, uint8_t length){
+#ifdef ESP32
+	if (_queue) {
+		queueOp(bytes, length, 0);
+		return;
+	}
+#endif
+	Wire.beginTransmission(_Addr);
+	Wire.write(bytes, length);
+	Wire.endTransmission();
+	_i2cBytes += length;
+	_i2cTransactions++;
+}
+
+// Give the display time to execute, now or through the async queue
+void LiquidCrystal_I2C::wait(uint32_t us){
+#ifdef ESP32
+	if (_queue) {
+		while (us > 0) {
+			uint16_t chunk = us > 60000 ? 60000 : us;
+			queueOp(NULL, 0, chunk);
+			us -= chunk;
+		}
+		return;
+	}
+#endif
+	if (us >= 1000 && us % 1000 == 0) {
+		delay(us / 1000);
+	} else {
+		delayMicroseconds(us);
+	}
+}
+
+#ifdef ESP32
+
+bool LiquidCrystal_I2C::beginAsync(uint8_t depth, UBaseType_t priority, BaseType_t core){
+	if (_queue) {
+		return true;
+	}
+
+	_queue = xQueueCreate(depth, sizeof(Op));
+	if (!_queue) {
+		return false;
+	}
+
+	if (xTaskCreatePinnedToCore(drainTask, "lcd", 2048, this, priority, NULL, core) != pdPASS) {
+		vQueueDelete(_queue);
+		_queue = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool LiquidCrystal_I2C::hasRoom(uint32_t ops){
+	if (uxQueueSpacesAvailable(_queue) >= ops) {
+		return true;
+	}
+	_droppedOps += ops;
+	return false;
+}
+
+bool LiquidCrystal_I2C::queueOp(const uint8_t *bytes, uint8_t length, uint16_t waitUs){
+	Op op;
+	op.length = length;
+	if (length) {
+		memcpy(op.bytes, bytes, length);
+	}
+	op.waitUs = waitUs;
+
+	if (xQueueSend(_queue, &op, 0) != pdTRUE) {
+		_droppedOps++;
+		return false;
+	}
+
+	// Counted when queued, so the counters only change in the caller's task
+	if (length) {
+		_i2cBytes += length;
+		_i2cTransactions++;
+	}
+	return true;
+}
+
+// Send the queued transfers in order, sleeping (or spinning below 1ms) for the time each one needs
+void LiquidCrystal_I2C::drain(){
+	Op op;
+	for (;;) {
+		if (xQueueReceive(_queue, &op, portMAX_DELAY) != pdTRUE) {
+			continue;
+		}
+
+		if (op.length) {
+			Wire.beginTransmission(_Addr);
+			Wire.write(op.bytes, op.length);
+			Wire.endTransmission();
+		}
+
+		// One tick more than the wait: the first one may come right away
+		if (op.waitUs >= 1000) {
+			vTaskDelay((op.waitUs + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000) + 1);
+		} else if (op.waitUs) {
+			delayMicroseconds(op.waitUs);
+		}
+	}
+}
+
+void LiquidCrystal_I2C::drainTask(void *lcd){
+	static_cast<LiquidCrystal_I2C *>(lcd)->drain();
+}
+
+#endif
+
 // write either command or data
 void LiquidCrystal_I2C::send(uint8_t value, uint8_t mode) {
+#ifdef ESP32
+	// Both nibbles in one queued transaction, so they can't be split by a full
+	// queue: the bytes of write4bits() for each, as the sync path sends them
+	if (_queue) {
+		uint8_t bytes[6];
+		uint8_t nibbles[2] = { (uint8_t)((value & 0xf0) | mode | _backlightval), (uint8_t)(((value << 4) & 0xf0) | mode | _backlightval) };
+		for (uint8_t i = 0; i < 2; i++) {
+			bytes[i * 3] = nibbles[i];
+			bytes[i * 3 + 1] = nibbles[i] | En;
+			bytes[i * 3 + 2] = nibbles[i] & ~En;
+		}
+		queueOp(bytes, sizeof(bytes), 50);
+		return;
+	}
+#endif
 	uint8_t highnib=value&0xf0;
 	uint8_t lownib=(value<<4)&0xf0;
        write4bits((highnib)|mode);
@@ -260,14 +446,30 @@ void LiquidCrystal_I2C::send(uint8_t value, uint8_t mode) {
 }
 
 void LiquidCrystal_I2C::write4bits(uint8_t value) {
+#ifdef ESP32
+	if (_queue) {
+		uint8_t bytes[3] = { (uint8_t)(value | _backlightval), (uint8_t)(value | En | _backlightval), (uint8_t)((value & ~En) | _backlightval) };
+		queueOp(bytes, sizeof(bytes), 50);
+		return;
+	}
+#endif
 	expanderWrite(value);
 	pulseEnable(value);
 }
 
 void LiquidCrystal_I2C::expanderWrite(uint8_t _data){                                        
+#ifdef ESP32
+	if (_queue) {
+		uint8_t byte = _data | _backlightval;
+		queueOp(&byte, 1, 0);
+		return;
+	}
+#endif
 	Wire.beginTransmission(_Addr);
 	printIIC((int)(_data) | _backlightval);
 	Wire.endTransmission();   
+	_i2cBytes++;
+	_i2cTransactions++;
 }
 
 void LiquidCrystal_I2C::pulseEnable(uint8_t _data){
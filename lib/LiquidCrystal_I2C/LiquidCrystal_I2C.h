@@ -6,6 +6,15 @@
 #include "Print.h" 
 #include <Wire.h>
 
+#ifdef ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+// Async mode: bytes of one queued I2C transaction
+#define LCD_OP_BYTES 32
+#endif
+
 // commands
 #define LCD_CLEARDISPLAY 0x01
 #define LCD_RETURNHOME 0x02
@@ -87,6 +96,7 @@ public:
   virtual void write(uint8_t);
 #endif
   void command(uint8_t);
+  bool writeAt(uint8_t col, uint8_t row, const uint8_t *data, uint8_t length);
   void init();
   void oled_init();
 
@@ -99,6 +109,21 @@ void setBacklight(uint8_t new_val);				// alias for backlight() and nobacklight(
 void load_custom_character(uint8_t char_num, uint8_t *rows);	// alias for createChar()
 void printstr(const char[]);
 
+#ifdef ESP32
+////Async mode: call before init(). Every transfer & wait is queued and sent
+////by a background task, so no call blocks. A call that doesn't fit whole in
+////the queue is dropped (and counted). Only one task may use the display
+bool beginAsync(uint8_t depth = 64, UBaseType_t priority = 1, BaseType_t core = tskNO_AFFINITY);
+bool isAsync() const { return _queue != NULL; }
+uint32_t droppedOps() const { return _droppedOps; }
+uint32_t pendingOps() const { return _queue ? uxQueueMessagesWaiting(_queue) : 0; }
+#endif
+
+////I2C traffic counters
+uint32_t i2cBytes() const { return _i2cBytes; }
+uint32_t i2cTransactions() const { return _i2cTransactions; }
+void resetI2CCounters() { _i2cBytes = 0; _i2cTransactions = 0; }
+
 ////Unsupported API functions (not implemented in this library)
 uint8_t status();
 void setContrast(uint8_t new_val);
@@ -112,6 +137,21 @@ void draw_vertical_graph(uint8_t row, uint8_t column, uint8_t len,  uint8_t pixe
 	 
 
 private:
+  void wait(uint32_t us);
+  void transmit(const uint8_t *bytes, uint8_t length);
+#ifdef ESP32
+  struct Op {
+    uint8_t length;              // I2C bytes, 0 for a wait only
+    uint8_t bytes[LCD_OP_BYTES]; // Expander bytes, backlight bit included
+    uint16_t waitUs;             // Time the display needs after the bytes
+  };
+  bool queueOp(const uint8_t *bytes, uint8_t length, uint16_t waitUs);
+  bool hasRoom(uint32_t ops);
+  void drain();
+  static void drainTask(void *lcd);
+  QueueHandle_t _queue = NULL;
+  uint32_t _droppedOps = 0;
+#endif
   void init_priv();
   void send(uint8_t, uint8_t);
   void write4bits(uint8_t);
@@ -126,6 +166,8 @@ private:
   uint8_t _cols;
   uint8_t _rows;
   uint8_t _backlightval;
+  uint32_t _i2cBytes = 0;
+  uint32_t _i2cTransactions = 0;
 };
 
 #endif
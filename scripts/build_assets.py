@@ -0,0 +1,91 @@
+# Build step of the web page (env:esp32doit-devkit-v1, before the filesystem
+# image): gzips the files of data/ into .pio/data with a content hash in the
+# name of everything index.html links, so the board can serve them as
+# immutable, and writes /assets.txt, the list the board keeps in memory to
+# answer with ETags & 304s without reading the flash. Also runs alone:
+# python3 scripts/build_assets.py
+
+import gzip
+import hashlib
+import os
+import re
+import shutil
+
+SOURCE = "data"
+TARGET = os.path.join(".pio", "data")
+PAGE = "index.html"
+MANIFEST = "assets.txt"
+KEEP = (".json",)  # Read by the firmware itself, copied as they are
+NAME_MAX = 31  # SPIFFS names, with the leading slash
+
+
+def digest(content):
+    return hashlib.sha256(content).hexdigest()[:8]
+
+
+def write_asset(target, name, content, immutable, sizes):
+    """Write the gzipped file (unless it doesn't get smaller), returns its line of the manifest"""
+    packed = gzip.compress(content, 9, mtime=0)
+    packed_smaller = len(packed) < len(content)
+    stored = name + (".gz" if packed_smaller else "")
+    if len(stored) + 1 > NAME_MAX:
+        raise SystemExit("Asset name too long for SPIFFS: /" + stored)
+
+    with open(os.path.join(target, stored), "wb") as file:
+        file.write(packed if packed_smaller else content)
+
+    sizes.append((name, len(content), len(packed) if packed_smaller else len(content)))
+    return "/%s %s %d %d" % (name, digest(content), packed_smaller, immutable)
+
+
+def build(project):
+    source = os.path.join(project, SOURCE)
+    target = os.path.join(project, TARGET)
+    shutil.rmtree(target, ignore_errors=True)
+    os.makedirs(target)
+
+    manifest = []
+    sizes = []
+    hashed = {}  # Name linked by the page -> name with the hash
+
+    for name in sorted(os.listdir(source)):
+        path = os.path.join(source, name)
+        if not os.path.isfile(path) or name == PAGE:
+            continue
+        if name.endswith(KEEP):
+            shutil.copy(path, os.path.join(target, name))
+            continue
+
+        with open(path, "rb") as file:
+            content = file.read()
+        base, extension = os.path.splitext(name)
+        hashed[name] = "%s.%s%s" % (base, digest(content), extension)
+        manifest.append(write_asset(target, hashed[name], content, True, sizes))
+
+    # The page keeps its name, it's revalidated on every load
+    with open(os.path.join(source, PAGE), "rb") as file:
+        page = file.read().decode("utf-8")
+    page = re.sub(r'(href|src)="([^"/:]+)"',
+                  lambda link: '%s="%s"' % (link.group(1), hashed.get(link.group(2), link.group(2))), page)
+    manifest.append(write_asset(target, PAGE, page.encode("utf-8"), False, sizes))
+
+    with open(os.path.join(target, MANIFEST), "w") as file:
+        file.write("\n".join(manifest) + "\n")
+
+    raw = sum(size[1] for size in sizes)
+    served = sum(size[2] for size in sizes)
+    print("Web assets (%s -> %s):" % (SOURCE, TARGET))
+    for name, before, after in sizes:
+        print("  %-28s %7d -> %7d bytes" % (name, before, after))
+    print("  %-28s %7d -> %7d bytes (%.0f%%)" % ("page load", raw, served, 100.0 * served / raw))
+
+
+try:
+    Import("env")  # noqa: F821 (run by PlatformIO)
+except NameError:
+    env = None
+
+if env is not None:
+    build(env.subst("$PROJECT_DIR"))
+elif __name__ == "__main__":
+    build(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
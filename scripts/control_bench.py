@@ -0,0 +1,261 @@
+# Time the commands of the page to a roaster, as a stand-in for it: through
+# the POST it used to send (a connection per command, the feedback on
+# /events) and through the control channel (binary frames on the /control
+# WebSocket, see src/control_channel.h). Each motor command is timed to its
+# answer (the POST response / the ack) & to its feedback (the states event /
+# the STATE frame). Then checks that a command sent again, on the same or a
+# new connection, isn't applied twice. Also runs against the simulated roaster
+# (server/sse-local.js):
+# python3 scripts/control_bench.py http://192.168.1.50 [commands]
+
+import base64
+import json
+import os
+import queue
+import socket
+import struct
+import sys
+import threading
+import time
+import urllib.parse
+import urllib.request
+import http.client
+
+CONTROL_HELLO = 0x00
+CONTROL_MOTOR = 0x01
+CONTROL_TIME = 0x02
+CONTROL_STATE_REQUEST = 0x03
+CONTROL_ACK = 0x81
+CONTROL_STATE = 0x82
+
+CONTROL_APPLIED = 0
+CONTROL_DUPLICATE = 1
+
+TIMEOUT = 5
+
+
+def follow_states(host, port, states):
+    """Put (time, motor1) in states for every states event of /events"""
+    connection = http.client.HTTPConnection(host, port)
+    connection.request("GET", "/events", headers={"Accept": "text/event-stream"})
+    response = connection.getresponse()
+
+    event, data = "", ""
+    while True:
+        line = response.readline()
+        if not line:
+            return
+        line = line.decode("utf-8").rstrip("\r\n")
+        if line == "":
+            if event == "states":
+                states.put((time.perf_counter(), json.loads(data)["motor1"]))
+            event, data = "", ""
+        elif line.startswith("event:"):
+            event = line[6:].strip()
+        elif line.startswith("data:"):
+            data = line[5:].strip()
+
+
+def bench_post(base, host, port, count):
+    """Times of the POSTs to their response & to their states event (ms)"""
+    states = queue.Queue()
+    threading.Thread(target=follow_states, args=(host, port, states), daemon=True).start()
+    time.sleep(0.5)  # The stream is open & its first events are in
+
+    answers, feedbacks = [], []
+    for i in range(count):
+        on = i % 2 == 0
+        while not states.empty():
+            states.get()
+
+        request = urllib.request.Request(
+            base + "/motors",
+            data=json.dumps({"motor1": on}).encode(),
+            headers={"Content-Type": "application/json", "Connection": "close"},
+        )
+        start = time.perf_counter()
+        with urllib.request.urlopen(request, timeout=TIMEOUT) as response:
+            response.read()
+        answers.append((time.perf_counter() - start) * 1000)
+
+        while True:
+            at, motor1 = states.get(timeout=TIMEOUT)
+            if motor1 == on:
+                feedbacks.append((at - start) * 1000)
+                break
+
+    return answers, feedbacks
+
+
+class ControlSocket:
+    """A client of /control: binary frames, masked as a browser sends them"""
+
+    def __init__(self, host, port):
+        self.socket = socket.create_connection((host, port), timeout=TIMEOUT)
+        self.socket.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        key = base64.b64encode(os.urandom(16)).decode()
+        self.socket.sendall(
+            (
+                "GET /control HTTP/1.1\r\nHost: %s:%d\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n" % (host, port, key)
+            ).encode()
+        )
+
+        self.buffer = b""
+        while b"\r\n\r\n" not in self.buffer:
+            self.buffer += self.read_some()
+        head, self.buffer = self.buffer.split(b"\r\n\r\n", 1)
+        if b" 101 " not in head.split(b"\r\n")[0]:
+            raise RuntimeError("No WebSocket at /control: %s" % head.split(b"\r\n")[0].decode())
+
+    def read_some(self):
+        chunk = self.socket.recv(4096)
+        if not chunk:
+            raise RuntimeError("/control closed")
+        return chunk
+
+    def send(self, payload):
+        mask = os.urandom(4)
+        masked = bytes(byte ^ mask[i % 4] for i, byte in enumerate(payload))
+        self.socket.sendall(bytes([0x82, 0x80 | len(payload)]) + mask + masked)
+
+    def receive(self):
+        """The payload of the next binary frame"""
+        while True:
+            while len(self.buffer) < 4:  # The shortest frames of the board are 4 bytes
+                self.buffer += self.read_some()
+            length, offset = self.buffer[1] & 0x7F, 2
+            if length == 126:
+                length, offset = struct.unpack(">H", self.buffer[2:4])[0], 4
+            while len(self.buffer) < offset + length:
+                self.buffer += self.read_some()
+
+            opcode = self.buffer[0] & 0x0F
+            payload, self.buffer = self.buffer[offset : offset + length], self.buffer[offset + length :]
+            if opcode == 0x2:
+                return payload
+
+    def close(self):
+        self.socket.close()
+
+
+def hello(channel, session):
+    channel.send(struct.pack("<BHI", CONTROL_HELLO, 0, session))
+
+
+def command(channel, seq, kind, argument):
+    """Send a MOTOR (argument: motor1 on) or a TIME (argument: seconds) command"""
+    if kind == CONTROL_MOTOR:
+        frame = struct.pack("<BHBB", CONTROL_MOTOR, seq, 1, 1 if argument else 0)
+    else:
+        frame = struct.pack("<BHh", CONTROL_TIME, seq, argument)
+    channel.send(frame)
+    return frame
+
+
+def wait(channel, seq, until_state):
+    """Read frames until the ack of seq & a STATE frame that satisfies until_state (or None). Returns the ack's status, when it & the state came, & the state"""
+    status, acked, changed, state = None, None, None, None
+    while status is None or (until_state and changed is None):
+        frame = channel.receive()
+        if frame[0] == CONTROL_ACK and struct.unpack("<H", frame[1:3])[0] == seq:
+            status, acked = frame[3], time.perf_counter()
+        elif frame[0] == CONTROL_STATE:
+            motors, total, remaining = struct.unpack("<BHH", frame[1:6])
+            if until_state and until_state(motors, total):
+                changed, state = time.perf_counter(), (motors, total, remaining)
+    return status, acked, changed, state
+
+
+def request_state(channel):
+    """The (motors, total, time) of the board"""
+    channel.send(struct.pack("<BH", CONTROL_STATE_REQUEST, 0))
+    while True:
+        frame = channel.receive()
+        if frame[0] == CONTROL_STATE:
+            return struct.unpack("<BHH", frame[1:6])
+
+
+def bench_control(host, port, count):
+    """Times of the commands to their ack & to their STATE frame (ms), & the outcome of the duplicates"""
+    session = struct.unpack("<I", os.urandom(4))[0]
+    channel = ControlSocket(host, port)
+    hello(channel, session)
+    channel.receive()  # The state sent on connection
+
+    seq = 0
+    answers, feedbacks = [], []
+    for i in range(count):
+        on = i % 2 == 0
+        seq += 1
+        start = time.perf_counter()
+        command(channel, seq, CONTROL_MOTOR, on)
+        status, acked, changed, _ = wait(channel, seq, lambda motors, total: bool(motors & 1) == on)
+        if status != CONTROL_APPLIED:
+            raise RuntimeError("Command %d not applied: %d" % (seq, status))
+        answers.append((acked - start) * 1000)
+        feedbacks.append((changed - start) * 1000)
+
+    # A minute added, then the same frame again as after a lost ack: on the same connection & on a new one
+    total = request_state(channel)[1]
+    seq += 1
+    frame = command(channel, seq, CONTROL_TIME, 60)
+    applied, _, _, _ = wait(channel, seq, lambda motors, now: now != total)
+    added = request_state(channel)[1]
+
+    channel.send(frame)
+    again = wait(channel, seq, None)[0]
+    channel.close()
+
+    channel = ControlSocket(host, port)
+    hello(channel, session)
+    channel.receive()
+    channel.send(frame)
+    reconnected = wait(channel, seq, None)[0]
+    after = request_state(channel)[1]
+
+    seq += 1
+    command(channel, seq, CONTROL_TIME, -60)
+    wait(channel, seq, None)
+    channel.close()
+
+    duplicates = applied == CONTROL_APPLIED and again == CONTROL_DUPLICATE and reconnected == CONTROL_DUPLICATE and after == added
+    return answers, feedbacks, duplicates
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p))]
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit("Usage: %s http://roaster [commands]" % sys.argv[0])
+
+    base = sys.argv[1].rstrip("/")
+    url = urllib.parse.urlparse(base)
+    host, port = url.hostname, url.port or 80
+    count = int(sys.argv[2]) if len(sys.argv) == 3 else 100
+
+    post_answers, post_feedbacks = bench_post(base, host, port, count)
+    control_answers, control_feedbacks, duplicates = bench_control(host, port, count)
+
+    print("%d motor commands to %s" % (count, base))
+    print("%-26s %8s %8s %8s %8s" % ("Round trip (ms)", "p50", "p90", "p99", "max"))
+    for name, values in (
+        ("POST -> response", post_answers),
+        ("POST -> states event", post_feedbacks),
+        ("control -> ack", control_answers),
+        ("control -> state frame", control_feedbacks),
+    ):
+        print(
+            "%-26s %8.2f %8.2f %8.2f %8.2f"
+            % (name, percentile(values, 0.5), percentile(values, 0.9), percentile(values, 0.99), max(values))
+        )
+
+    print("Commands sent again: %s" % ("acked as duplicates, applied once" if duplicates else "APPLIED TWICE or lost"))
+    sys.exit(0 if duplicates else 1)
+
+
+if __name__ == "__main__":
+    main()
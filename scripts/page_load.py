@@ -0,0 +1,68 @@
+# Load the page of a roaster as a browser would, first with an empty cache,
+# then again with what it cached (immutable files aren't asked for, the rest
+# is revalidated with its ETag), and print the requests, bytes & time of
+# each. Run it against the old & the new firmware to compare:
+# python3 scripts/page_load.py http://192.168.1.50
+
+import gzip
+import re
+import sys
+import time
+import urllib.error
+import urllib.request
+
+
+def fetch(url, headers):
+    """Returns the status, the headers & the body as sent (still gzipped)"""
+    request = urllib.request.Request(url, headers=dict(headers, **{"Accept-Encoding": "gzip"}))
+    try:
+        with urllib.request.urlopen(request, timeout=30) as response:
+            return response.status, response.headers, response.read()
+    except urllib.error.HTTPError as error:  # The 304s
+        return error.code, error.headers, error.read()
+
+
+def load(base, cache):
+    """Load the page & everything it links, using & filling the cache. Returns requests, bytes & seconds"""
+    requests = 0
+    received = 0
+    start = time.monotonic()
+
+    def get(path):
+        nonlocal requests, received
+        cached = cache.get(path)
+        if cached and "immutable" in cached["cache"]:
+            return cached["body"]
+
+        headers = {"If-None-Match": cached["etag"]} if cached and cached["etag"] else {}
+        status, response, body = fetch(base + path, headers)
+        requests += 1
+        received += len(body)
+        if status == 304:
+            return cached["body"]
+
+        if response.get("Content-Encoding") == "gzip":
+            body = gzip.decompress(body)
+        cache[path] = {"etag": response.get("ETag"), "cache": response.get("Cache-Control") or "", "body": body}
+        return body
+
+    page = get("/").decode("utf-8", "replace")
+    for link in re.findall(r'(?:href|src)="([^"/:]+)"', page):
+        get("/" + link)
+
+    return requests, received, time.monotonic() - start
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("Usage: %s http://roaster" % sys.argv[0])
+
+    base = sys.argv[1].rstrip("/")
+    cache = {}
+    for name in ("cold", "warm"):
+        requests, received, seconds = load(base, cache)
+        print("%s load: %2d requests, %7d bytes, %6.0f ms" % (name, requests, received, seconds * 1000))
+
+
+if __name__ == "__main__":
+    main()
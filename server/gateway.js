@@ -0,0 +1,488 @@
+const express = require("express");
+const bodyParser = require("body-parser");
+const cors = require("cors");
+const http = require("http");
+const { Upstream } = require("./upstream");
+
+// Gateway of a shop's roasters: it reads the /events stream of every board
+// once and sends it to any number of dashboards, keeps the latest state & the
+// samples of each roaster, and passes the /motors & /time commands on. The
+// boards only ever have one client, whatever the number of tablets:
+//
+//   ROASTERS="left=http://192.168.0.177,right=http://192.168.0.178" node gateway.js
+//
+// | Resource                   | Description                                                           |
+// | -------------------------- | --------------------------------------------------------------------- |
+// | /events                    | Events of every roaster, as `{"roaster": id, "data": {...}}`          |
+// | /roasters                  | **GET** - Roasters, whether they're connected & their latest state    |
+// | /roasters/:id/events       | Events of a roaster, as the board sends them                          |
+// | /roasters/:id/data         | **GET** - Latest state of a roaster, as the /data of the board        |
+// | /roasters/:id/history      | **GET** - Samples of a roaster, as the /history of the board          |
+// | /roasters/:id/motors       | **POST** - Passed on to the board                                     |
+// | /roasters/:id/time         | **POST** - Passed on to the board                                     |
+// | /status                    | **GET** - Clients, memory, events sent & coalesced, clients dropped   |
+
+const PORT = parseInt(process.env.PORT || "3001", 10);
+
+const HISTORY_MAX = 4096; // Samples kept per roaster (68 minutes at 1 Hz, as the board)
+const CLIENT_STALL_TIMEOUT = 30000; // ms a client can stay unable to take more before it's dropped
+const KEEPALIVE_PERIOD = 5000; // ms between two comments to the clients (& checks of the stalled ones)
+const COMMAND_TIMEOUT = 3000; // ms for a board to answer a command
+
+const STATE_EVENTS = ["readings", "timer", "states", "analytics"];
+
+// Flags of a sample, as in src/history.h
+const SAMPLE_MOTOR1 = 0x01;
+const SAMPLE_MOTOR2 = 0x02;
+const SAMPLE_MOTOR3 = 0x04;
+const SAMPLE_TIMER_ON = 0x08;
+
+/**
+ * Gateway counters
+ * @typedef {Object} GatewayStats
+ * @property {number} sent Events written to the clients
+ * @property {number} coalesced Events replaced by a newer one of the same kind before a slow client took them
+ * @property {number} dropped Clients closed after being stalled for CLIENT_STALL_TIMEOUT
+ */
+
+/**
+ * SSE message serializer
+ * @param {String} event Event name, "message" for none
+ * @param {String} data Event data, already serialized
+ * @param {String} id Event id, "" for none
+ */
+function serializeEvent(event, data, id) {
+  return (
+    (id ? `id: ${id}\n` : "") +
+    (event !== "message" ? `event: ${event}\n` : "") +
+    `data: ${data}\n\n`
+  );
+}
+
+/**
+ * A dashboard connected to the gateway. Events are written as they come; when
+ * its socket is full, only the latest event of each kind is kept until it
+ * drains, so a slow tablet gets the current state late instead of the gateway
+ * buffering for it without end
+ */
+class Client {
+  /**
+   * @param {http.ServerResponse} response Its open event stream
+   * @param {GatewayStats} stats
+   */
+  constructor(response, stats) {
+    this.response = response;
+    this.stats = stats;
+    this.pending = new Map();
+    this.blockedSince = 0;
+    response.on("drain", () => this.flush());
+  }
+
+  /**
+   * @param {String} key Kind of the event, a newer one of the same kind replaces it while blocked
+   * @param {String} frame Serialized event
+   */
+  send(key, frame) {
+    if (this.blockedSince) {
+      if (this.pending.has(key)) {
+        this.stats.coalesced++;
+      }
+      this.pending.set(key, frame);
+      return;
+    }
+    this.write(frame);
+  }
+
+  write(frame) {
+    this.stats.sent++;
+    if (!this.response.write(frame)) {
+      this.blockedSince = Date.now();
+    }
+  }
+
+  flush() {
+    this.blockedSince = 0;
+    for (const [key, frame] of this.pending) {
+      this.pending.delete(key);
+      this.write(frame);
+      if (this.blockedSince) {
+        return;
+      }
+    }
+  }
+
+  stalled(now) {
+    return this.blockedSince && now - this.blockedSince > CLIENT_STALL_TIMEOUT;
+  }
+}
+
+/**
+ * A roaster of the shop: its stream, its latest state & its samples
+ */
+class Roaster {
+  /**
+   * @param {String} id Name of the roaster in the URLs
+   * @param {String} url Base URL of the board
+   * @param {Gateway} gateway
+   */
+  constructor(id, url, gateway) {
+    this.id = id;
+    this.url = url;
+    this.gateway = gateway;
+    this.clients = new Set();
+    this.state = {}; // Latest data of each of STATE_EVENTS, as the board sent it
+    this.flags = 0;
+    this.timer = 0;
+    this.history = [];
+    this.lastEventAt = 0;
+
+    // Commands go one at a time on a kept connection, the board serves few sockets
+    this.agent = new http.Agent({ keepAlive: true, maxSockets: 1 });
+
+    this.upstream = new Upstream(url);
+    this.upstream.on("open", () => this.loadHistory());
+    this.upstream.on("event", (event) => this.onEvent(event));
+  }
+
+  /**
+   * @param {import("./upstream").StreamEvent} event
+   */
+  onEvent({ event, data, id }) {
+    this.lastEventAt = Date.now();
+
+    if (STATE_EVENTS.includes(event)) {
+      this.state[event] = data;
+      this.keep(event, data);
+    } else if (event === "resync") {
+      // The board no longer has the events missed while disconnected
+      this.loadHistory();
+    }
+
+    const frame = serializeEvent(event, data, id);
+    this.clients.forEach((client) => client.send(event, frame));
+
+    if (event !== "message") {
+      const shared = serializeEvent(
+        event,
+        `{"roaster":${JSON.stringify(this.id)},"data":${data}}`,
+        ""
+      );
+      this.gateway.clients.forEach((client) =>
+        client.send(`${this.id}/${event}`, shared)
+      );
+    }
+  }
+
+  // Add a sample for each readings, as the board does every second
+  keep(event, data) {
+    try {
+      const values = JSON.parse(data);
+      if (event === "states") {
+        this.flags =
+          (values.motor1 ? SAMPLE_MOTOR1 : 0) |
+          (values.motor2 ? SAMPLE_MOTOR2 : 0) |
+          (values.motor3 ? SAMPLE_MOTOR3 : 0);
+      } else if (event === "timer") {
+        this.timer = values.time;
+      } else if (event === "readings") {
+        const last = this.history[this.history.length - 1];
+        this.history.push([
+          last ? last[0] + 1 : 0,
+          values.temperature,
+          values.humidity,
+          this.timer,
+          this.flags | (this.timer > 0 ? SAMPLE_TIMER_ON : 0),
+        ]);
+        if (this.history.length > HISTORY_MAX) {
+          this.history.shift();
+        }
+      }
+    } catch (error) {
+      // Not JSON, not kept
+    }
+  }
+
+  // Take the samples of the board, e.g. those of the roast before the gateway started
+  loadHistory() {
+    http
+      .get(`${this.url}/history`, (response) => {
+        let text = "";
+        response.setEncoding("utf8");
+        response.on("data", (chunk) => (text += chunk));
+        response.on("end", () => {
+          try {
+            const samples = JSON.parse(text);
+            if (Array.isArray(samples)) {
+              this.history = samples.slice(-HISTORY_MAX);
+            }
+          } catch (error) {
+            // Keep ours
+          }
+        });
+      })
+      .on("error", () => {});
+  }
+
+  /**
+   * Pass a command on to the board & its answer back
+   * @param {String} path /motors or /time
+   * @param {Object} body JSON body of the command
+   * @param {express.Response} response
+   */
+  command(path, body, response) {
+    const payload = JSON.stringify(body);
+    const request = http.request(
+      `${this.url}${path}`,
+      {
+        method: "POST",
+        agent: this.agent,
+        timeout: COMMAND_TIMEOUT,
+        headers: {
+          "Content-Type": "application/json",
+          "Content-Length": Buffer.byteLength(payload),
+        },
+      },
+      (answer) => {
+        let text = "";
+        answer.setEncoding("utf8");
+        answer.on("data", (chunk) => (text += chunk));
+        answer.on("end", () =>
+          response.status(answer.statusCode).type("text/plain").send(text)
+        );
+      }
+    );
+
+    request.on("timeout", () => request.destroy(new Error("timeout")));
+    request.on("error", (error) => {
+      if (!response.headersSent) {
+        response.status(502).type("text/plain").send(error.message);
+      }
+    });
+    request.end(payload);
+  }
+
+  /**
+   * Latest state & stream of the roaster
+   */
+  describe() {
+    const parsed = {};
+    for (const event of STATE_EVENTS) {
+      parsed[event] = this.state[event] ? JSON.parse(this.state[event]) : null;
+    }
+    return {
+      id: this.id,
+      url: this.url,
+      connected: this.upstream.connected,
+      clients: this.clients.size,
+      lastEventAgeMs: this.lastEventAt ? Date.now() - this.lastEventAt : null,
+      connects: this.upstream.stats.connects,
+      events: this.upstream.stats.events,
+      ...parsed,
+    };
+  }
+}
+
+/**
+ * The gateway of a set of roasters
+ */
+class Gateway {
+  /**
+   * @param {Object<string, string>} roasters URL of the board of each roaster, by name
+   */
+  constructor(roasters) {
+    this.clients = new Set();
+    /** @type {GatewayStats} */
+    this.stats = { sent: 0, coalesced: 0, dropped: 0 };
+    this.roasters = new Map(
+      Object.entries(roasters).map(([id, url]) => [
+        id,
+        new Roaster(id, url, this),
+      ])
+    );
+    this.app = this.routes();
+  }
+
+  start() {
+    this.roasters.forEach((roaster) => roaster.upstream.start());
+    this.timer = setInterval(() => this.sweep(), KEEPALIVE_PERIOD);
+  }
+
+  stop() {
+    clearInterval(this.timer);
+    this.roasters.forEach((roaster) => roaster.upstream.stop());
+  }
+
+  // Keep the idle streams open through proxies, close those that stopped reading
+  sweep() {
+    const now = Date.now();
+    const check = (clients) =>
+      clients.forEach((client) => {
+        if (client.stalled(now)) {
+          this.stats.dropped++;
+          client.response.destroy();
+        } else {
+          client.send("keepalive", ":\n\n");
+        }
+      });
+
+    check(this.clients);
+    this.roasters.forEach((roaster) => check(roaster.clients));
+  }
+
+  /**
+   * Open an event stream to a client, starting with the latest state
+   * @param {express.Request} request
+   * @param {express.Response} response
+   * @param {Set<Client>} clients Clients it joins
+   * @param {Roaster[]} roasters Roasters whose state it gets first
+   * @param {boolean} shared Events of every roaster, with its id
+   */
+  stream(request, response, clients, roasters, shared) {
+    response.writeHead(200, {
+      "Content-Type": "text/event-stream",
+      Connection: "keep-alive",
+      "Cache-Control": "no-cache",
+    });
+    response.socket.setNoDelay(true);
+
+    const client = new Client(response, this.stats);
+    roasters.forEach((roaster) =>
+      STATE_EVENTS.forEach((event) => {
+        const data = roaster.state[event];
+        if (data) {
+          client.send(
+            shared ? `${roaster.id}/${event}` : event,
+            serializeEvent(
+              event,
+              shared
+                ? `{"roaster":${JSON.stringify(roaster.id)},"data":${data}}`
+                : data,
+              ""
+            )
+          );
+        }
+      })
+    );
+
+    clients.add(client);
+    request.on("close", () => clients.delete(client));
+  }
+
+  routes() {
+    const app = express();
+
+    app.use(cors());
+    app.use(bodyParser.json());
+
+    // The roaster of the URL, or a 404
+    const roaster = (request, response) => {
+      const found = this.roasters.get(request.params.id);
+      if (!found) {
+        response.status(404).type("text/plain").send("Unknown roaster");
+      }
+      return found;
+    };
+
+    app.get("/events", (request, response) =>
+      this.stream(request, response, this.clients, [...this.roasters.values()], true)
+    );
+
+    app.get("/roasters", (request, response) =>
+      response.json([...this.roasters.values()].map((found) => found.describe()))
+    );
+
+    app.get("/roasters/:id/events", (request, response) => {
+      const found = roaster(request, response);
+      if (found) {
+        this.stream(request, response, found.clients, [found], false);
+      }
+    });
+
+    app.get("/roasters/:id/data", (request, response) => {
+      const found = roaster(request, response);
+      if (found) {
+        const { readings, timer, states, analytics } = found.describe();
+        response.json({ timer, readings, states, analytics });
+      }
+    });
+
+    // Samples in [from, to), as the board
+    app.get("/roasters/:id/history", (request, response) => {
+      const found = roaster(request, response);
+      if (found) {
+        const from = parseInt(request.query.from || "0", 10);
+        const to = parseInt(request.query.to || `${Number.MAX_SAFE_INTEGER}`, 10);
+        response.json(found.history.filter(([n]) => n >= from && n < to));
+      }
+    });
+
+    app.post("/roasters/:id/motors", (request, response) => {
+      const found = roaster(request, response);
+      if (found) {
+        found.command("/motors", request.body, response);
+      }
+    });
+
+    app.post("/roasters/:id/time", (request, response) => {
+      const found = roaster(request, response);
+      if (found) {
+        found.command("/time", request.body, response);
+      }
+    });
+
+    app.get("/status", (request, response) => {
+      const memory = process.memoryUsage();
+      let clients = this.clients.size;
+      this.roasters.forEach((found) => (clients += found.clients.size));
+
+      response.json({
+        clients,
+        rss: memory.rss,
+        heapUsed: memory.heapUsed,
+        ...this.stats,
+        roasters: [...this.roasters.values()].map((found) => ({
+          id: found.id,
+          connected: found.upstream.connected,
+          connects: found.upstream.stats.connects,
+          events: found.upstream.stats.events,
+          clients: found.clients.size,
+        })),
+      });
+    });
+
+    return app;
+  }
+}
+
+/**
+ * Roasters of `ROASTERS`: "name=url,name=url..."
+ * @param {String} list
+ * @returns {Object<string, string>}
+ */
+function parseRoasters(list) {
+  const roasters = {};
+  (list || "")
+    .split(",")
+    .filter((entry) => entry.includes("="))
+    .forEach((entry) => {
+      const [id, url] = entry.split("=");
+      roasters[id.trim()] = url.trim().replace(/\/$/, "");
+    });
+  return roasters;
+}
+
+if (require.main === module) {
+  const roasters = parseRoasters(
+    process.env.ROASTERS || "local=http://localhost:3000"
+  );
+  const gateway = new Gateway(roasters);
+
+  gateway.start();
+  gateway.app.listen(PORT, () => {
+    console.log(
+      `Gateway of ${Object.keys(roasters).join(", ")} listening at http://localhost:${PORT}`
+    );
+  });
+}
+
+module.exports = { Gateway, Client, parseRoasters };
@@ -0,0 +1,289 @@
+const http = require("http");
+const path = require("path");
+const { spawn } = require("child_process");
+const { EventEmitter } = require("events");
+const { Upstream } = require("./upstream");
+const { Client } = require("./gateway");
+
+// Load test of the gateway, without hardware: `ROASTERS` simulated roasters
+// (sse-local.js) sending their events every `PERIOD` ms, a gateway in front of
+// them, and `CLIENTS` dashboards reading it for `DURATION` seconds, `SLOW` of
+// them never reading what they get. Meanwhile a command goes through every
+// `COMMAND_PERIOD` ms. Fails (exit code 1) if a dashboard misses events, the
+// events are late, a board gets more than one client, the gateway's memory
+// grows with the slow clients, or a client whose socket is full gets more than
+// the latest event of each kind (the kernel buffers megabytes on loopback, so
+// that one is checked on a socket that takes nothing):
+//
+//   CLIENTS=500 node load-test.js
+
+const ROASTERS = parseInt(process.env.ROASTERS || "8", 10);
+const CLIENTS = parseInt(process.env.CLIENTS || "400", 10);
+const SLOW = parseInt(process.env.SLOW || "20", 10);
+const DURATION = parseInt(process.env.DURATION || "20", 10);
+const PERIOD = parseInt(process.env.PERIOD || "100", 10); // 10 times the rate of the board
+const COMMAND_PERIOD = 250;
+
+const ROASTER_PORT = 3100;
+const GATEWAY_PORT = 3099;
+const GATEWAY = `http://localhost:${GATEWAY_PORT}`;
+
+const MIN_DELIVERED = 0.95; // Of the readings sent while measuring, for every dashboard
+const MAX_LATENCY_P99 = 250; // ms from the roaster to the dashboard
+const MAX_RSS = 256 * 1024 * 1024;
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+/**
+ * GET a JSON resource
+ * @param {String} url
+ * @returns {Promise<Object>}
+ */
+function getJson(url) {
+  return new Promise((resolve, reject) => {
+    http
+      .get(url, { agent: false }, (response) => {
+        let text = "";
+        response.setEncoding("utf8");
+        response.on("data", (chunk) => (text += chunk));
+        response.on("end", () => {
+          try {
+            resolve(JSON.parse(text));
+          } catch (error) {
+            reject(error);
+          }
+        });
+      })
+      .on("error", reject);
+  });
+}
+
+/**
+ * POST a command, resolving with its round trip (ms)
+ * @param {String} url
+ * @param {Object} body
+ * @returns {Promise<number>}
+ */
+function post(url, body) {
+  const payload = JSON.stringify(body);
+  const start = process.hrtime.bigint();
+  return new Promise((resolve, reject) => {
+    const request = http.request(
+      url,
+      {
+        method: "POST",
+        headers: {
+          "Content-Type": "application/json",
+          "Content-Length": Buffer.byteLength(payload),
+        },
+      },
+      (response) => {
+        response.resume();
+        response.on("end", () =>
+          response.statusCode === 200
+            ? resolve(Number(process.hrtime.bigint() - start) / 1e6)
+            : reject(new Error(`${response.statusCode}`))
+        );
+      }
+    );
+    request.on("error", reject);
+    request.end(payload);
+  });
+}
+
+/**
+ * Send the events of a roaster at 10 Hz for a minute to a client whose socket is
+ * full from the start, then let it drain
+ * @returns {{kept: number, written: number, coalesced: number}} Events it holds while blocked & writes once drained
+ */
+function checkBackpressure() {
+  const response = new EventEmitter();
+  let written = 0;
+  let full = true;
+  response.write = () => {
+    written++;
+    return !full;
+  };
+
+  const stats = { sent: 0, coalesced: 0, dropped: 0 };
+  const client = new Client(response, stats);
+  client.send("readings", "first"); // Fills the socket
+
+  for (let i = 0; i < 600; i++) {
+    ["readings", "timer", "analytics", "message"].forEach((event) =>
+      client.send(event, `${event} ${i}`)
+    );
+  }
+  const kept = client.pending.size;
+
+  full = false;
+  written = 0;
+  response.emit("drain");
+  return { kept, written, coalesced: stats.coalesced };
+}
+
+function percentile(sorted, p) {
+  return sorted.length
+    ? sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))]
+    : 0;
+}
+
+/**
+ * Start a node script & wait for its first line
+ * @param {String} script
+ * @param {Object} env
+ */
+function launch(script, env) {
+  const child = spawn(process.execPath, [path.join(__dirname, script)], {
+    env: { ...process.env, ...env },
+    stdio: ["ignore", "pipe", "inherit"],
+  });
+  return new Promise((resolve) =>
+    child.stdout.once("data", () => resolve(child))
+  );
+}
+
+async function main() {
+  const roasters = await launch("sse-local.js", {
+    COUNT: ROASTERS,
+    PORT: ROASTER_PORT,
+    PERIOD,
+  });
+  const ids = Array.from({ length: ROASTERS }, (_, i) => `r${i}`);
+  const gateway = await launch("gateway.js", {
+    PORT: GATEWAY_PORT,
+    ROASTERS: ids
+      .map((id, i) => `${id}=http://localhost:${ROASTER_PORT + i}`)
+      .join(","),
+  });
+
+  const stop = (code) => {
+    roasters.kill();
+    gateway.kill();
+    process.exit(code);
+  };
+
+  // Every roaster connected to the gateway
+  for (let tries = 0; ; tries++) {
+    const status = await getJson(`${GATEWAY}/status`).catch(() => null);
+    if (status && status.roasters.every((roaster) => roaster.connected)) {
+      break;
+    }
+    if (tries > 50) {
+      console.log("The gateway didn't connect to the roasters");
+      stop(1);
+    }
+    await sleep(100);
+  }
+  const before = await getJson(`${GATEWAY}/status`);
+
+  // Dashboards: most on a roaster, a quarter on the stream of the shop
+  let measuring = false;
+  const latencies = [];
+  const dashboards = Array.from({ length: CLIENTS }, (_, i) => {
+    const shared = i % 4 === 3;
+    const upstream = new Upstream(
+      shared ? GATEWAY : `${GATEWAY}/roasters/${ids[i % ROASTERS]}`
+    );
+    const dashboard = { upstream, shared, readings: 0 };
+
+    upstream.on("event", ({ event, id }) => {
+      if (!measuring || event !== "readings") {
+        return;
+      }
+      dashboard.readings++;
+      if (id) {
+        latencies.push(Date.now() - parseInt(id, 10));
+      }
+    });
+    upstream.start();
+    return dashboard;
+  });
+
+  // Slow dashboards: on the stream of the shop (the busiest), never reading
+  const slow = Array.from({ length: SLOW }, () =>
+    http
+      .get(`${GATEWAY}/events`, { agent: false }, (response) => response.pause())
+      .on("error", () => {})
+  );
+
+  while (dashboards.some((dashboard) => !dashboard.upstream.connected)) {
+    await sleep(100);
+  }
+
+  // Commands to the roasters, through the gateway
+  const commands = [];
+  let failures = 0;
+  let toggle = false;
+  const commander = setInterval(() => {
+    toggle = !toggle;
+    post(`${GATEWAY}/roasters/${ids[commands.length % ROASTERS]}/motors`, {
+      motor1: toggle,
+    })
+      .then((ms) => commands.push(ms))
+      .catch(() => failures++);
+  }, COMMAND_PERIOD);
+
+  measuring = true;
+  const start = Date.now();
+  await sleep(DURATION * 1000);
+  measuring = false;
+  const elapsed = Date.now() - start;
+  clearInterval(commander);
+
+  const after = await getJson(`${GATEWAY}/status`);
+  const boards = await Promise.all(
+    ids.map((_, i) => getJson(`http://localhost:${ROASTER_PORT + i}/status`))
+  );
+
+  // Every dashboard gets the readings of its roaster, or of all of them for the shop stream
+  const expected = Math.floor(elapsed / PERIOD);
+  const delivered = dashboards.map(
+    (dashboard) => dashboard.readings / (dashboard.shared ? ROASTERS : 1) / expected
+  );
+  const worst = Math.min(...delivered);
+
+  latencies.sort((a, b) => a - b);
+  commands.sort((a, b) => a - b);
+  const p99 = percentile(latencies, 0.99);
+  const boardClients = Math.max(...boards.map((board) => board.clients));
+
+  console.log(
+    `${ROASTERS} roasters every ${PERIOD} ms, ${CLIENTS} dashboards + ${SLOW} slow ones, ${(elapsed / 1000).toFixed(1)} s`
+  );
+  console.log(
+    `Readings delivered: ${(worst * 100).toFixed(1)}% for the worst dashboard (${latencies.length} in all)`
+  );
+  console.log(
+    `Latency (ms)  p50 ${percentile(latencies, 0.5)}  p90 ${percentile(latencies, 0.9)}  p99 ${p99}  max ${latencies[latencies.length - 1]}`
+  );
+  console.log(
+    `Commands (ms) p50 ${percentile(commands, 0.5).toFixed(1)}  p99 ${percentile(commands, 0.99).toFixed(1)}  (${commands.length} ok, ${failures} failed)`
+  );
+  console.log(
+    `Gateway: ${after.clients} clients, RSS ${(before.rss / 1048576).toFixed(1)} -> ${(after.rss / 1048576).toFixed(1)} MB, ` +
+      `${after.sent} events sent, ${after.coalesced} coalesced for slow clients, ${after.dropped} dropped`
+  );
+  console.log(`Clients of each board: ${boardClients} at most`);
+
+  const backpressure = checkBackpressure();
+  console.log(
+    `Full socket: 2400 events kept as ${backpressure.kept} (${backpressure.coalesced} coalesced), ${backpressure.written} written once drained`
+  );
+
+  const passed =
+    backpressure.kept === 4 &&
+    backpressure.written === 4 &&
+    worst >= MIN_DELIVERED &&
+    p99 <= MAX_LATENCY_P99 &&
+    failures === 0 &&
+    boardClients === 1 &&
+    after.rss <= MAX_RSS;
+  console.log(passed ? "PASS" : "FAIL");
+
+  dashboards.forEach((dashboard) => dashboard.upstream.stop());
+  slow.forEach((request) => request.destroy());
+  stop(passed ? 0 : 1);
+}
+
+main();
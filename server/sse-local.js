@@ -1,17 +1,19 @@
+const crypto = require("crypto");
 const express = require("express");
 const bodyParser = require("body-parser");
 const cors = require("cors");
 const faker = require("faker");
 
-const app = express();
+// Simulated roasters: the /events, /data, /history, /motors, /time & /control
+// of the firmware, without the hardware. `COUNT` roasters are served on the ports
+// `PORT`, `PORT + 1`..., sending their events every `PERIOD` ms (1000 on the
+// board). The gateway & its load test use them as the roasters of a shop:
+//
+//   COUNT=4 PORT=3100 node sse-local.js
 
-app.use(cors());
-app.use(bodyParser.json());
-app.use(bodyParser.urlencoded({ extended: false }));
-
-const PORT = 3000;
-
-let clients = [];
+const PORT = parseInt(process.env.PORT || "3000", 10);
+const COUNT = parseInt(process.env.COUNT || "1", 10);
+const PERIOD = parseInt(process.env.PERIOD || "1000", 10);
 
 // TYPES
 
@@ -41,44 +43,204 @@ let clients = [];
  * SSE message serializer
  * @param {String} event Event name
  * @param {Readings | Timer | States | String} data Event data
+ * @param {number} id Event id: the time it was sent (ms), always increasing as on the board
  */
-function serializeEvent(event, data) {
+function serializeEvent(event, data, id) {
   const jsonString = JSON.stringify(data);
-  return `event: ${event}\ndata: ${jsonString}\n\n`;
+  return `id: ${id}\nevent: ${event}\ndata: ${jsonString}\n\n`;
 }
 
-// timer logic
-let server_total = 10;
-let server_time = server_total;
-
-// states
-let m1_state = false;
-let m2_state = false;
-let m3_state = false;
-
-app.get("/events", (request, response) => {
-  const headers = {
-    "Content-Type": "text/event-stream",
-    Connection: "keep-alive",
-    "Cache-Control": "no-cache",
-  };
-  response.writeHead(200, headers);
-
-  setInterval(() => {
-    response.write(`data: ping\n\n`);
-
-    response.write(
-      serializeEvent("readings", {
-        temperature: faker.datatype.number({ min: 10, max: 25 }),
-        humidity: faker.datatype.number({ min: 40, max: 45 }),
-      })
+/**
+ * A simulated roaster, heating up to its target & starting over
+ * @param {number} period Milliseconds between two sends of the events
+ * @returns {{app: Object, upgrade: Function, stop: Function}} Its express app, the handler of its
+ * WebSocket upgrades (for the "upgrade" event of its server) & a function stopping its events
+ */
+function createRoaster(period) {
+  const app = express();
+
+  app.use(cors());
+  app.use(bodyParser.json());
+  app.use(bodyParser.urlencoded({ extended: false }));
+
+  let clients = [];
+  let lastId = 0;
+
+  // timer logic
+  let server_total = 10;
+  let server_time = server_total;
+
+  // states
+  let m1_state = false;
+  let m2_state = false;
+  let m3_state = false;
+
+  // roast, one sample per send: [n, temperature, humidity, timer, flags]
+  let temperature = 20;
+  let samples = 0;
+  const history = [];
+
+  function nextId() {
+    lastId = Math.max(lastId + 1, Date.now());
+    return lastId;
+  }
+
+  function statesEvent() {
+    return serializeEvent(
+      "states",
+      { motor1: m1_state, motor2: m2_state, motor3: m3_state },
+      nextId()
     );
+  }
 
-    response.write(
-      serializeEvent("timer", {
-        total: server_total,
-        time: server_time,
-      })
+  function broadcast(message) {
+    clients.forEach((client) => client.response.write(message));
+  }
+
+  // Control channel, as in src/control_channel.h
+  let sockets = [];
+  const sessions = new Map(); // Last seq applied by each session
+
+  function controlState() {
+    const frame = Buffer.alloc(6);
+    frame[0] = 0x82;
+    frame[1] = (m1_state ? 1 : 0) | (m2_state ? 2 : 0) | (m3_state ? 4 : 0);
+    frame.writeUInt16LE(Math.max(0, server_total), 2);
+    frame.writeUInt16LE(Math.max(0, server_time), 4);
+    return frame;
+  }
+
+  // A binary WebSocket frame (always short, never masked from the server)
+  function sendFrame(socket, payload) {
+    socket.write(Buffer.concat([Buffer.from([0x82, payload.length]), payload]));
+  }
+
+  function setMotors(data) {
+    if ("motor1" in data) m1_state = !!data.motor1;
+    if ("motor2" in data) m2_state = !!data.motor2;
+    if ("motor3" in data) m3_state = !!data.motor3;
+
+    broadcast(statesEvent());
+    sockets.forEach((socket) => sendFrame(socket, controlState()));
+  }
+
+  function addTime(seconds) {
+    if (seconds > 0) {
+      server_total += seconds;
+      server_time += seconds;
+    } else {
+      server_time = Math.max(0, server_time + seconds);
+    }
+    sockets.forEach((socket) => sendFrame(socket, controlState()));
+  }
+
+  // Apply a frame of a page & ack it
+  function handleControl(socket, frame) {
+    const type = frame[0];
+    const seq = frame.length >= 3 ? frame.readUInt16LE(1) : 0;
+    let status = 0;
+
+    if (type === 0x00 && frame.length >= 7) {
+      socket.session = frame.readUInt32LE(3);
+    } else if (type === 0x03) {
+      sendFrame(socket, controlState());
+    } else if ((type === 0x01 || type === 0x02) && frame.length >= 5) {
+      const last = sessions.get(socket.session);
+      const ahead = (seq - last) & 0xffff; // Newer when in 1..0x7fff, with the wrap around
+      if (socket.session === undefined) {
+        status = 3;
+      } else if (last !== undefined && (ahead === 0 || ahead >= 0x8000)) {
+        status = 1; // Not newer than the last one applied
+      } else if (type === 0x01) {
+        setMotors({ [`motor${frame[3]}`]: frame[4] !== 0 });
+        sessions.set(socket.session, seq);
+      } else {
+        addTime(frame.readInt16LE(3));
+        sessions.set(socket.session, seq);
+      }
+    } else {
+      status = 3;
+    }
+
+    sendFrame(socket, Buffer.from([0x81, seq & 0xff, seq >> 8, status]));
+  }
+
+  function upgrade(request, socket) {
+    if (request.url !== "/control") {
+      socket.destroy();
+      return;
+    }
+
+    const accept = crypto
+      .createHash("sha1")
+      .update(request.headers["sec-websocket-key"] + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11")
+      .digest("base64");
+    socket.write(
+      "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n" +
+        `Sec-WebSocket-Accept: ${accept}\r\n\r\n`
+    );
+    socket.setNoDelay(true);
+    sockets.push(socket);
+    sendFrame(socket, controlState());
+
+    // Masked frames of the page
+    let buffer = Buffer.alloc(0);
+    socket.on("data", (chunk) => {
+      buffer = Buffer.concat([buffer, chunk]);
+      while (buffer.length >= 2) {
+        const opcode = buffer[0] & 0x0f;
+        let length = buffer[1] & 0x7f;
+        let offset = 2;
+        if (length === 126) {
+          if (buffer.length < 4) break;
+          length = buffer.readUInt16BE(2);
+          offset = 4;
+        }
+        if (buffer.length < offset + 4 + length) break;
+
+        const mask = buffer.subarray(offset, offset + 4);
+        const payload = Buffer.from(buffer.subarray(offset + 4, offset + 4 + length));
+        payload.forEach((byte, i) => (payload[i] = byte ^ mask[i % 4]));
+        buffer = buffer.subarray(offset + 4 + length);
+
+        if (opcode === 0x8) {
+          socket.end();
+        } else if (opcode === 0x2) {
+          handleControl(socket, payload);
+        }
+      }
+    });
+    socket.on("close", () => {
+      sockets = sockets.filter((open) => open !== socket);
+    });
+    socket.on("error", () => {});
+  }
+
+  // The same events for every client, as the board sends them
+  const interval = setInterval(() => {
+    temperature = temperature >= 200 ? 20 : temperature + 1;
+    const readings = {
+      temperature: temperature + faker.datatype.number({ min: -1, max: 1 }),
+      humidity: faker.datatype.number({ min: 40, max: 45 }),
+      tq: 0,
+      hq: 0,
+    };
+
+    history.push([
+      samples++,
+      readings.temperature,
+      readings.humidity,
+      server_time,
+      (m1_state ? 1 : 0) | (m2_state ? 2 : 0) | (m3_state ? 4 : 0),
+    ]);
+    if (history.length > 4096) {
+      history.shift();
+    }
+
+    broadcast(`id: ${nextId()}\ndata: ping\n\n`);
+    broadcast(serializeEvent("readings", readings, nextId()));
+    broadcast(
+      serializeEvent("timer", { total: server_total, time: server_time }, nextId())
     );
 
     // decrease time or reset
@@ -87,53 +249,74 @@ app.get("/events", (request, response) => {
     } else {
       server_time = server_total;
     }
+  }, period);
 
-    response.write(
-      serializeEvent("states", {
-        motor1: m1_state,
-        motor2: m2_state,
-        motor3: m3_state,
-      })
-    );
-  }, 1000);
+  app.get("/events", (request, response) => {
+    const headers = {
+      "Content-Type": "text/event-stream",
+      Connection: "keep-alive",
+      "Cache-Control": "no-cache",
+    };
+    response.writeHead(200, headers);
+    response.write(statesEvent());
 
-  const clientId = Date.now();
+    const clientId = nextId();
 
-  const newClient = {
-    id: clientId,
-    response,
-  };
+    const newClient = {
+      id: clientId,
+      response,
+    };
 
-  clients.push(newClient);
+    clients.push(newClient);
 
-  request.on("close", () => {
-    console.log(`${clientId} Connection closed`);
-    clients = clients.filter((client) => client.id !== clientId);
+    request.on("close", () => {
+      clients = clients.filter((client) => client.id !== clientId);
+    });
   });
-});
 
-app.get("/status", (request, response) =>
-  response.json({ clients: clients.length })
-);
+  app.get("/status", (request, response) =>
+    response.json({ clients: clients.length })
+  );
+
+  app.post("/motors", (request, response) => {
+    setMotors(request.body);
+    response.status(200).send("ok");
+  });
 
-app.post("/motors", (request, response) => {
-  let data = request.body;
+  app.post("/time", (request, response) => {
+    let data = request.body;
 
-  m1_state = data.motor1;
-  m2_state = data.motor2;
-  m3_state = data.motor3;
+    if (data.action === "add" || data.action === "reduce") {
+      addTime(data.action === "add" ? data.time : -data.time);
+    }
+    response.status(200).send("ok");
+  });
 
-  response.status(200);
-});
+  app.get("/data", (request, response) => {
+    response.json({
+      timer: { total: server_total, time: server_time },
+      readings: { temperature, humidity: 44, tq: 0, hq: 0 },
+      states: { motor1: m1_state, motor2: m2_state, motor3: m3_state },
+    });
+  });
 
-app.get("/data", (request, response) => {
-  response.json({
-    timer: { total: 60, time: 30 },
-    readings: { temperature: 25, humidity: 66 },
-    states: { motor1: m1_state, motor2: m2_state, motor3: m3_state },
+  app.get("/history", (request, response) => {
+    const from = parseInt(request.query.from || "0", 10);
+    response.json(history.filter(([n]) => n >= from));
   });
-});
 
-app.listen(PORT, () => {
-  console.log(`SSE service listening at http://localhost:${PORT}`);
-});
+  return { app, upgrade, stop: () => clearInterval(interval) };
+}
+
+if (require.main === module) {
+  for (let i = 0; i < COUNT; i++) {
+    const roaster = createRoaster(PERIOD);
+    roaster.app
+      .listen(PORT + i, () => {
+        console.log(`SSE service listening at http://localhost:${PORT + i}`);
+      })
+      .on("upgrade", roaster.upgrade);
+  }
+}
+
+module.exports = { createRoaster };
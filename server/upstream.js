@@ -0,0 +1,148 @@
+const http = require("http");
+const { EventEmitter } = require("events");
+
+const RETRY_MIN = 500; // ms before reconnecting, doubled on each failure
+const RETRY_MAX = 15000;
+const SILENCE_TIMEOUT = 10000; // ms without a byte (the board pings every second) before reconnecting
+
+/**
+ * An event of a roaster's stream
+ * @typedef {Object} StreamEvent
+ * @property {String} event Event name, "message" when it has none (the pings)
+ * @property {String} data Event data, as the board sent it
+ * @property {String} id Event id, "" when it has none
+ */
+
+/**
+ * The /events stream of a roaster, read once for every client of the gateway.
+ * It reconnects with a growing wait & resumes from the last event it got
+ * (Last-Event-ID), so the board only resends what was missed.
+ *
+ * Emits "open", "event" ({@link StreamEvent}) & "close"
+ */
+class Upstream extends EventEmitter {
+  /**
+   * @param {String} url Base URL of the roaster, e.g. http://192.168.0.177
+   */
+  constructor(url) {
+    super();
+    this.url = url;
+    this.lastId = "";
+    this.connected = false;
+    this.stopped = true;
+    this.retries = 0;
+    this.request = null;
+    this.timer = null;
+    this.stats = { connects: 0, events: 0, bytes: 0 };
+  }
+
+  start() {
+    this.stopped = false;
+    this.connect();
+  }
+
+  stop() {
+    this.stopped = true;
+    clearTimeout(this.timer);
+    if (this.request) {
+      this.request.destroy();
+    }
+  }
+
+  connect() {
+    const headers = { Accept: "text/event-stream" };
+    if (this.lastId) {
+      headers["Last-Event-ID"] = this.lastId;
+    }
+
+    let buffer = "";
+    let fields = { event: "", data: [], id: null };
+
+    // Lines of the stream, an event at each empty one
+    const parse = (chunk) => {
+      this.stats.bytes += chunk.length;
+      request.setTimeout(SILENCE_TIMEOUT);
+      buffer += chunk;
+
+      let end;
+      while ((end = buffer.search(/\r\n|\r|\n/)) >= 0) {
+        if (end === buffer.length - 1 && buffer[end] === "\r") {
+          break; // The \n of a \r\n may be in the next chunk
+        }
+        const line = buffer.slice(0, end);
+        buffer = buffer.slice(end + (buffer.startsWith("\r\n", end) ? 2 : 1));
+
+        if (line === "") {
+          if (fields.id !== null) {
+            this.lastId = fields.id;
+          }
+          if (fields.data.length) {
+            this.stats.events++;
+            this.emit("event", {
+              event: fields.event || "message",
+              data: fields.data.join("\n"),
+              id: fields.id || "",
+            });
+          }
+          fields = { event: "", data: [], id: null };
+          continue;
+        }
+
+        const colon = line.indexOf(":");
+        if (colon === 0) {
+          continue; // A comment
+        }
+        const name = colon < 0 ? line : line.slice(0, colon);
+        const value =
+          colon < 0 ? "" : line.slice(colon + (line[colon + 1] === " " ? 2 : 1));
+
+        if (name === "event") fields.event = value;
+        else if (name === "data") fields.data.push(value);
+        else if (name === "id") fields.id = value;
+      }
+    };
+
+    const request = http.get(`${this.url}/events`, { headers }, (response) => {
+      if (response.statusCode !== 200) {
+        response.resume();
+        request.destroy();
+        return;
+      }
+
+      this.connected = true;
+      this.retries = 0;
+      this.stats.connects++;
+      this.emit("open");
+
+      response.setEncoding("utf8");
+      response.on("data", parse);
+    });
+
+    request.setTimeout(SILENCE_TIMEOUT, () => request.destroy());
+    request.on("error", () => {});
+    request.on("close", () => {
+      if (this.connected) {
+        this.connected = false;
+        this.emit("close");
+      }
+      this.request = null;
+      this.retry();
+    });
+    this.request = request;
+  }
+
+  // Wait longer after each failure, ±25% so the gateway doesn't hit all the boards at once
+  retry() {
+    if (this.stopped) {
+      return;
+    }
+    const delay = Math.min(RETRY_MIN * 2 ** this.retries, RETRY_MAX);
+    this.retries = Math.min(this.retries + 1, 16);
+    this.timer = setTimeout(
+      () => this.connect(),
+      delay * (0.75 + Math.random() / 2)
+    );
+  }
+}
+
+module.exports = { Upstream };
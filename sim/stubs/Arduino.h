@@ -0,0 +1,23 @@
+// Host stand-in of the ESP32 Arduino core, just what LiquidCrystal_I2C uses,
+// so that the sim can check the library against a fake bus (src/sim_lcd.cpp
+// implements the functions)
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ARDUINO 100
+#define ESP32 1 // The library's async mode is for the ESP32
+
+#define B00000001 1
+#define B00000010 2
+#define B00000100 4
+
+#define pgm_read_byte_near(address) (*(const uint8_t *)(address))
+
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+#endif
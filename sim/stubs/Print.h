@@ -0,0 +1,23 @@
+#ifndef SIM_PRINT_H
+#define SIM_PRINT_H
+
+#include "Arduino.h"
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) = 0;
+
+  size_t print(const char *text)
+  {
+    size_t count = 0;
+    while (*text)
+    {
+      count += write((uint8_t)*text++);
+    }
+    return count;
+  }
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef SIM_WIRE_H
+#define SIM_WIRE_H
+
+#include "Arduino.h"
+
+// The I2C master, recording what goes on the bus
+class TwoWire
+{
+public:
+  void begin();
+  void beginTransmission(uint8_t address);
+  size_t write(uint8_t byte);
+  size_t write(const uint8_t *bytes, size_t length);
+  uint8_t endTransmission();
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,18 @@
+// Host stand-in of the FreeRTOS API the LCD library uses (src/sim_lcd.cpp)
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffUL
+#define portTICK_PERIOD_MS 1 // As the ESP32 Arduino core
+#define tskNO_AFFINITY 0x7fffffff
+
+#endif
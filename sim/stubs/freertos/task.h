@@ -0,0 +1,13 @@
+#ifndef SIM_TASK_H
+#define SIM_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+typedef void *TaskHandle_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack, void *parameter, UBaseType_t priority,
+                                   TaskHandle_t *handle, BaseType_t core);
+void vTaskDelay(TickType_t ticks);
+
+#endif
@@ -0,0 +1,115 @@
+#include "analytics.h"
+
+// Round a quotient to the nearest integer, for either sign
+static int64_t divideRounded(int64_t numerator, int64_t denominator)
+{
+  return (numerator < 0 ? numerator - denominator / 2 : numerator + denominator / 2) / denominator;
+}
+
+void RoastAnalytics::Window::reset()
+{
+  count = 0;
+  sum = 0;
+  moments = 0;
+}
+
+// Add a sample, & drop the one leaving the window once it's full
+void RoastAnalytics::Window::push(int16_t value, int16_t leaving)
+{
+  if (count < length)
+  {
+    moments += (int32_t)count * value;
+    sum += value;
+    count++;
+    return;
+  }
+
+  // Every x moves down by one: Σ x·y loses Σ y of the samples that stay
+  moments += (int32_t)(length - 1) * value - (sum - leaving);
+  sum += value - leaving;
+}
+
+// Slope = (12 Σ x·y - 6 (n - 1) Σ y) / (n (n² - 1)) per sample
+int16_t RoastAnalytics::Window::rate(uint16_t periodMs) const
+{
+  if (count < 2)
+  {
+    return 0;
+  }
+
+  int64_t n = count;
+  int64_t numerator = 12 * (int64_t)moments - 6 * (n - 1) * sum;
+  int64_t denominator = n * (n * n - 1) * periodMs;
+  return (int16_t)divideRounded(numerator * 600000, denominator);
+}
+
+RoastAnalytics::RoastAnalytics(uint16_t periodMs)
+    : periodMs(periodMs), next(0), dryEnd(0), roastTemperature(0), aboveMillis(0), metrics()
+{
+  for (uint8_t i = 0; i < ANALYTICS_LONG_WINDOW; i++)
+  {
+    samples[i] = 0;
+  }
+  shortWindow.length = ANALYTICS_SHORT_WINDOW;
+  longWindow.length = ANALYTICS_LONG_WINDOW;
+  shortWindow.reset();
+  longWindow.reset();
+  phaseMillis[0] = phaseMillis[1] = phaseMillis[2] = 0;
+}
+
+void RoastAnalytics::start(int16_t newDryEnd, int16_t newRoastTemperature)
+{
+  roastTemperature = newRoastTemperature;
+  dryEnd = newDryEnd < roastTemperature ? newDryEnd : roastTemperature;
+
+  phaseMillis[0] = phaseMillis[1] = phaseMillis[2] = 0;
+  aboveMillis = 0;
+  metrics.above = 0;
+  metrics.phases[0] = metrics.phases[1] = metrics.phases[2] = 0;
+  metrics.phase = PHASE_DRYING;
+}
+
+void RoastAnalytics::push(int16_t temperature, bool roasting)
+{
+  // The samples leaving each window, before the ring overwrites the oldest one
+  int16_t leavingShort = samples[(next + ANALYTICS_LONG_WINDOW - ANALYTICS_SHORT_WINDOW) % ANALYTICS_LONG_WINDOW];
+  int16_t leavingLong = samples[next];
+
+  samples[next] = temperature;
+  next = (next + 1) % ANALYTICS_LONG_WINDOW;
+
+  shortWindow.push(temperature, leavingShort);
+  longWindow.push(temperature, leavingLong);
+  metrics.ror = shortWindow.rate(periodMs);
+  metrics.rorLong = longWindow.rate(periodMs);
+
+  // The durations stay as they were once the roast ends
+  if (!roasting)
+  {
+    metrics.phase = PHASE_IDLE;
+    return;
+  }
+  if (metrics.phase == PHASE_IDLE)
+  {
+    return;
+  }
+
+  // The phases only move forward, a dip doesn't go back to drying
+  if (metrics.phase < PHASE_BROWNING && temperature >= dryEnd)
+  {
+    metrics.phase = PHASE_BROWNING;
+  }
+  if (metrics.phase < PHASE_DEVELOPMENT && temperature >= roastTemperature)
+  {
+    metrics.phase = PHASE_DEVELOPMENT;
+  }
+
+  phaseMillis[metrics.phase - 1] += periodMs;
+  metrics.phases[metrics.phase - 1] = phaseMillis[metrics.phase - 1] / 1000;
+
+  if (temperature >= roastTemperature)
+  {
+    aboveMillis += periodMs;
+    metrics.above = aboveMillis / 1000;
+  }
+}
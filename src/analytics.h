@@ -0,0 +1,67 @@
+#ifndef ANALYTICS_H
+#define ANALYTICS_H
+
+#include <stdint.h>
+
+#define ANALYTICS_SHORT_WINDOW 30 // Samples of the rate of rise shown while roasting
+#define ANALYTICS_LONG_WINDOW 60  // Samples of the smoother one
+
+// Phases of a roast
+#define PHASE_IDLE 0        // No roast
+#define PHASE_DRYING 1      // Until the end of drying (the water boils off)
+#define PHASE_BROWNING 2    // Until the roast temperature
+#define PHASE_DEVELOPMENT 3 // From the roast temperature on
+
+// Values derived from the temperature of a roast
+struct RoastMetrics
+{
+  int16_t ror;        // Rate of rise over the short window (tenths of ºC/min)
+  int16_t rorLong;    // Over the long window
+  uint16_t above;     // Seconds at or above the roast temperature
+  uint8_t phase;      // PHASE_*
+  uint16_t phases[3]; // Seconds of drying, browning & development
+};
+
+// Incremental analytics of the temperature, one sample per period: the rate
+// of rise is the slope of a least squares line over the latest samples, kept
+// as running sums, so every sample costs the same few integer operations and
+// nothing is allocated
+class RoastAnalytics
+{
+public:
+  RoastAnalytics(uint16_t periodMs);
+
+  // New roast: drying ends at dryEnd, development starts at the roast temperature (ºC)
+  void start(int16_t dryEnd, int16_t roastTemperature);
+
+  // Take the next sample. While not roasting only the rate of rise moves
+  void push(int16_t temperature, bool roasting);
+
+  const RoastMetrics &getMetrics() const { return metrics; }
+
+private:
+  // Least squares slope over the latest samples of the ring
+  struct Window
+  {
+    uint8_t length;
+    uint8_t count;   // Samples in the window, up to length
+    int32_t sum;     // Σ y
+    int32_t moments; // Σ x·y, x from 0 (oldest) to count - 1
+
+    void reset();
+    void push(int16_t value, int16_t leaving);
+    int16_t rate(uint16_t periodMs) const; // Tenths of ºC/min
+  };
+
+  uint16_t periodMs;
+  int16_t samples[ANALYTICS_LONG_WINDOW]; // Ring of the latest samples
+  uint8_t next;                           // Slot of the next sample
+  Window shortWindow, longWindow;
+
+  int16_t dryEnd, roastTemperature;
+  uint32_t phaseMillis[3];
+  uint32_t aboveMillis;
+  RoastMetrics metrics;
+};
+
+#endif
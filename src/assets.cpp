@@ -0,0 +1,120 @@
+#include "assets.h"
+
+#include <stdio.h>
+#include <string.h>
+
+AssetTable::AssetTable() : count(0) {}
+
+uint8_t AssetTable::load(const char *manifest)
+{
+  count = 0;
+
+  while (*manifest && count < ASSETS_MAX)
+  {
+    const char *end = strchr(manifest, '\n');
+    size_t length = end ? (size_t)(end - manifest) : strlen(manifest);
+
+    char line[ASSET_URL_LENGTH + ASSET_ETAG_LENGTH + 8];
+    if (length < sizeof(line))
+    {
+      memcpy(line, manifest, length);
+      line[length] = '\0';
+
+      Asset &asset = assets[count];
+      int gzip, immutable;
+      if (sscanf(line, "%31s %8s %d %d", asset.url, asset.etag, &gzip, &immutable) == 4 && asset.url[0] == '/')
+      {
+        asset.gzip = gzip;
+        asset.immutable = immutable;
+        count++;
+      }
+    }
+
+    manifest += length + (end ? 1 : 0);
+  }
+
+  return count;
+}
+
+const Asset *AssetTable::find(const char *url) const
+{
+  if (strcmp(url, "/") == 0)
+  {
+    url = "/index.html";
+  }
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (strcmp(assets[i].url, url) == 0)
+    {
+      return &assets[i];
+    }
+  }
+  return NULL;
+}
+
+bool etagMatches(const char *header, const char *etag)
+{
+  size_t length = strlen(etag);
+
+  while (*header)
+  {
+    // Next member of the list, without spaces, quotes or a weak prefix
+    while (*header == ' ' || *header == ',')
+    {
+      header++;
+    }
+    if (header[0] == 'W' && header[1] == '/')
+    {
+      header += 2;
+    }
+    if (*header == '*')
+    {
+      return true;
+    }
+
+    bool quoted = *header == '"';
+    const char *tag = header + quoted;
+    const char *end = tag;
+    while (*end && *end != (quoted ? '"' : ',') && (quoted || *end != ' '))
+    {
+      end++;
+    }
+
+    if ((size_t)(end - tag) == length && strncmp(tag, etag, length) == 0)
+    {
+      return true;
+    }
+
+    header = *end ? end + 1 : end;
+  }
+
+  return false;
+}
+
+const char *assetContentType(const char *url)
+{
+  static const struct
+  {
+    const char *extension;
+    const char *type;
+  } types[] = {
+      {".html", "text/html"},
+      {".js", "application/javascript"},
+      {".css", "text/css"},
+      {".ico", "image/x-icon"},
+      {".png", "image/png"},
+      {".svg", "image/svg+xml"},
+      {".json", "application/json"},
+  };
+
+  const char *extension = strrchr(url, '.');
+  for (size_t i = 0; extension && i < sizeof(types) / sizeof(types[0]); i++)
+  {
+    if (strcmp(extension, types[i].extension) == 0)
+    {
+      return types[i].type;
+    }
+  }
+  return "application/octet-stream";
+}
@@ -0,0 +1,51 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ASSETS_MAX 16
+#define ASSET_URL_LENGTH 32 // SPIFFS names, with the leading slash
+#define ASSET_ETAG_LENGTH 8 // Hex digits of the content hash
+#define ASSETS_MANIFEST "/assets.txt"
+#define ASSETS_MANIFEST_SIZE 1024
+
+#define ASSET_IMMUTABLE_CACHE "public, max-age=31536000, immutable"
+#define ASSET_REVALIDATE_CACHE "no-cache"
+
+// A file of the web page, as built by scripts/build_assets.py
+struct Asset
+{
+  char url[ASSET_URL_LENGTH];
+  char etag[ASSET_ETAG_LENGTH + 1]; // Hash of the content
+  bool gzip;                        // Stored as url + ".gz"
+  bool immutable;                   // The name has the hash, it can be cached for good
+};
+
+// Files of the page & their ETags, kept in memory from the manifest written
+// by the build, so a revalidation is answered without reading the flash
+class AssetTable
+{
+public:
+  AssetTable();
+
+  // Parse the manifest: a "url etag gzip immutable" line per file. Returns the assets read
+  uint8_t load(const char *manifest);
+
+  // The asset of a URL ("/" is the page), NULL if it isn't one
+  const Asset *find(const char *url) const;
+
+  uint8_t size() const { return count; }
+
+private:
+  Asset assets[ASSETS_MAX];
+  uint8_t count;
+};
+
+// Whether an If-None-Match header has the ETag (quoted or not, in a list, or *)
+bool etagMatches(const char *header, const char *etag);
+
+// MIME type from the extension of a URL
+const char *assetContentType(const char *url);
+
+#endif
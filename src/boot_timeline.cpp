@@ -0,0 +1,51 @@
+#include "boot_timeline.h"
+
+#include <string.h>
+
+BootTimeline::BootTimeline(BootClock clock) : clock(clock), stages(), count(0) {}
+
+int BootTimeline::begin(const char *name)
+{
+  uint32_t id = count.fetch_add(1);
+  if (id >= BOOT_STAGES_MAX)
+  {
+    return -1;
+  }
+
+  stages[id].startUs = clock();
+  stages[id].endUs = 0;
+  stages[id].name = name;
+  return id;
+}
+
+void BootTimeline::end(int id)
+{
+  if (id >= 0)
+  {
+    uint32_t now = clock();
+    stages[id].endUs = now ? now : 1; // 0 means it still runs
+  }
+}
+
+void BootTimeline::mark(const char *name)
+{
+  end(begin(name));
+}
+
+uint32_t BootTimeline::endOf(const char *name) const
+{
+  for (size_t i = 0; i < size(); i++)
+  {
+    if (stages[i].name && strcmp(stages[i].name, name) == 0)
+    {
+      return stages[i].endUs;
+    }
+  }
+  return 0;
+}
+
+size_t BootTimeline::size() const
+{
+  uint32_t added = count.load();
+  return added < BOOT_STAGES_MAX ? added : BOOT_STAGES_MAX;
+}
@@ -0,0 +1,47 @@
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BOOT_STAGES_MAX 16
+
+// Microseconds since the start of the firmware (micros() on the board)
+typedef uint32_t (*BootClock)();
+
+// A stage of the boot
+struct BootStage
+{
+  const char *name; // NULL while it's being added
+  uint32_t startUs;
+  uint32_t endUs; // 0 while it runs
+};
+
+// When each stage of the boot started & ended. Stages can run in several
+// tasks at once: begin() & end() never block and can be called from any of them
+class BootTimeline
+{
+public:
+  explicit BootTimeline(BootClock clock);
+
+  // Start a stage. Returns its id for end(), -1 when full
+  int begin(const char *name);
+  void end(int id);
+
+  // A point of the boot, e.g. the first run of a task (a stage without duration)
+  void mark(const char *name);
+
+  // When the stage or mark of that name ended, 0 if it didn't yet
+  uint32_t endOf(const char *name) const;
+
+  size_t size() const;
+  const BootStage &stage(size_t i) const { return stages[i]; }
+
+private:
+  BootClock clock;
+  BootStage stages[BOOT_STAGES_MAX];
+  std::atomic<uint32_t> count;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "commands.h"
+
+#include <string.h>
+
+#include <ArduinoJson.h>
+
+#include "telemetry.h"
+
+#define BODY_JSON_SIZE (JSON_OBJECT_SIZE(BODY_COMMANDS) + 32) // Memory to parse a body: the 3 motors & their names
+
+CommandPipeline::CommandPipeline() : log(), lastPressMicros(0) {}
+
+CommandBatch CommandPipeline::drain(Roaster &roaster, uint32_t nowMicros)
+{
+  CommandBatch batch = {0, false, false, false};
+
+  Command command;
+  while (batch.applied < COMMAND_BATCH && queue.pop(command))
+  {
+    uint8_t result = apply(roaster, command);
+    batch.applied++;
+
+    if (result == COMMAND_APPLIED)
+    {
+      batch.timeChanged |= command.type == COMMAND_BUTTON || command.type == COMMAND_TIME;
+      batch.statesChanged |= command.type == COMMAND_MOTOR;
+    }
+
+    LoggedCommand &entry = log.entries[log.count % COMMAND_LOG_SIZE];
+    entry.command = command;
+    entry.seq = log.count++;
+    entry.appliedMicros = nowMicros;
+    entry.result = result;
+  }
+
+  if (batch.applied)
+  {
+    published.write(log);
+  }
+  batch.more = queue.size() > 0;
+  return batch;
+}
+
+uint8_t CommandPipeline::apply(Roaster &roaster, const Command &command)
+{
+  switch (command.type)
+  {
+  case COMMAND_BUTTON:
+  {
+    bool bounce = command.micros - lastPressMicros <= BUTTON_DEBOUNCE;
+    lastPressMicros = command.micros;
+    if (bounce)
+    {
+      return COMMAND_IGNORED;
+    }
+    command.arg ? roaster.addTime(BUTTON_SECONDS) : roaster.reduceTime(BUTTON_SECONDS);
+    return COMMAND_APPLIED;
+  }
+
+  case COMMAND_TIME:
+    command.value > 0 ? roaster.addTime(command.value) : roaster.reduceTime(-command.value);
+    return COMMAND_APPLIED;
+
+  case COMMAND_MOTOR:
+    if (command.arg < 1 || command.arg > 3 || (command.value && roaster.getSafety().motorsHeld()))
+    {
+      return COMMAND_REJECTED;
+    }
+    roaster.setMotor(command.arg, command.value != 0);
+    return COMMAND_APPLIED;
+
+  case COMMAND_SWITCH:
+    if (command.arg > 3)
+    {
+      return COMMAND_REJECTED;
+    }
+    if (command.arg == roaster.getMode())
+    {
+      return COMMAND_IGNORED;
+    }
+    roaster.setMode(command.arg);
+    return COMMAND_APPLIED;
+
+  case COMMAND_PROFILE:
+    return roaster.selectProfile(command.value) ? COMMAND_APPLIED : COMMAND_REJECTED;
+
+  case COMMAND_AUTOTUNE:
+    return roaster.requestAutotune(command.value) ? COMMAND_APPLIED : COMMAND_REJECTED;
+
+  default:
+    return COMMAND_REJECTED;
+  }
+}
+
+const char *commandTypeName(uint8_t type)
+{
+  static const char *NAMES[] = {"button", "time", "motor", "switch", "profile", "autotune"};
+  return type < sizeof(NAMES) / sizeof(NAMES[0]) ? NAMES[type] : "unknown";
+}
+
+const char *commandSourceName(uint8_t source)
+{
+  static const char *NAMES[] = {"button", "switch", "web", "control"};
+  return source < sizeof(NAMES) / sizeof(NAMES[0]) ? NAMES[source] : "unknown";
+}
+
+size_t writeLoggedCommand(char *buffer, size_t size, const LoggedCommand &entry)
+{
+  JsonWriter json(buffer, size);
+  json.beginObject();
+  json.key("seq").unsignedNumber(entry.seq);
+  json.key("type").string(commandTypeName(entry.command.type));
+  json.key("source").string(commandSourceName(entry.command.source));
+  json.key("arg").unsignedNumber(entry.command.arg);
+  json.key("value").number(entry.command.value);
+  json.key("micros").unsignedNumber(entry.command.micros);
+  json.key("applied").unsignedNumber(entry.appliedMicros);
+  json.key("result").unsignedNumber(entry.result);
+  json.endObject();
+  return json.length();
+}
+
+// Add a command from the web to a parsed body
+static void addBodyCommand(BodyCommands &parsed, uint8_t type, uint8_t arg, int32_t value)
+{
+  Command command = {type, COMMAND_FROM_WEB, arg, value, 0};
+  parsed.commands[parsed.count++] = command;
+}
+
+BodyCommands parseBodyCommands(uint8_t type, const char *body, size_t length, const Roaster &roaster)
+{
+  BodyCommands parsed = {};
+  parsed.status = 200;
+
+  StaticJsonDocument<BODY_JSON_SIZE> document;
+  DeserializationError error = deserializeJson(document, body, length);
+  if (error)
+  {
+    parsed.status = 404;
+    parsed.error = error.c_str();
+    return parsed;
+  }
+
+  switch (type)
+  {
+  case COMMAND_PROFILE:
+  {
+    // {"profile": 0-n}, or {"profile": -1} to follow the switch again
+    int profile = document["profile"] | -1;
+    if (!roaster.hasProfile(profile))
+    {
+      parsed.status = 400;
+      parsed.error = "unknown profile";
+      return parsed;
+    }
+    addBodyCommand(parsed, COMMAND_PROFILE, 0, profile);
+    break;
+  }
+
+  case COMMAND_AUTOTUNE:
+    // {"mode": 1-3}, or {"cancel": true}
+    if (document.containsKey("mode"))
+    {
+      int mode = document["mode"].as<int>();
+      if (!roaster.canAutotune(mode))
+      {
+        parsed.status = 400;
+        parsed.error = "mode must be 1, 2 or 3";
+        return parsed;
+      }
+      addBodyCommand(parsed, COMMAND_AUTOTUNE, 0, mode);
+    }
+    else if (document["cancel"].as<bool>())
+    {
+      addBodyCommand(parsed, COMMAND_AUTOTUNE, 0, -1);
+    }
+    break;
+
+  case COMMAND_MOTOR:
+  {
+    // {"motor1": bool, "motor2": bool, "motor3": bool}, any of them
+    static const char *MOTORS[] = {"motor1", "motor2", "motor3"};
+    for (uint8_t motor = 1; motor <= 3; motor++)
+    {
+      if (document.containsKey(MOTORS[motor - 1]))
+      {
+        addBodyCommand(parsed, COMMAND_MOTOR, motor, document[MOTORS[motor - 1]].as<bool>());
+      }
+    }
+    break;
+  }
+
+  case COMMAND_TIME:
+  {
+    // {"time": seconds, "action": "add" or "reduce"}
+    const char *action = document["action"] | "";
+    int seconds = document["time"] | 0;
+    if (document.containsKey("time") && (!strcmp(action, "add") || !strcmp(action, "reduce")))
+    {
+      addBodyCommand(parsed, COMMAND_TIME, 0, !strcmp(action, "add") ? seconds : -seconds);
+    }
+    break;
+  }
+  }
+  return parsed;
+}
@@ -0,0 +1,126 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mpsc_queue.h"
+#include "roaster.h"
+#include "seqlock.h"
+
+#define COMMAND_QUEUE_SIZE 32 // Commands waiting for the loop, from every source
+#define COMMAND_BATCH 16      // Most commands applied per tick, the rest wait for the next one
+#define COMMAND_LOG_SIZE 64   // Latest commands kept for /debug/commands
+#define COMMAND_JSON_MAX 96   // Longest output of writeLoggedCommand()
+#define BODY_COMMANDS 3       // Most commands in the body of a POST (the 3 motors)
+
+#define BUTTON_DEBOUNCE 60000 // Presses of the timer buttons closer than this are bounces (µs)
+#define BUTTON_SECONDS 60     // Added or taken by a press
+
+// Types of command
+#define COMMAND_BUTTON 0   // A timer button: arg 1 adds BUTTON_SECONDS, 0 takes them
+#define COMMAND_TIME 1     // value: seconds to add, negative to take
+#define COMMAND_MOTOR 2    // arg: motor 1 - 3, value: 1 on, 0 off
+#define COMMAND_SWITCH 3   // arg: new position of the 3-state switch (0 - 3)
+#define COMMAND_PROFILE 4  // value: profile, -1 follows the switch again
+#define COMMAND_AUTOTUNE 5 // value: mode 1 - 3, -1 cancels
+
+// Where a command came from
+#define COMMAND_FROM_BUTTON 0
+#define COMMAND_FROM_SWITCH 1
+#define COMMAND_FROM_WEB 2     // A POST
+#define COMMAND_FROM_CONTROL 3 // The control channel (control_channel.h)
+
+// Outcome of a command
+#define COMMAND_APPLIED 0
+#define COMMAND_IGNORED 1  // A bounce of a button, or the switch where it was
+#define COMMAND_REJECTED 2 // No such type, motor, profile or mode, or a motor turned on while a trip holds them off
+
+// An input of the roaster, as a record any task or ISR can post
+struct Command
+{
+  uint8_t type;    // COMMAND_*
+  uint8_t source;  // COMMAND_FROM_*
+  uint8_t arg;
+  int32_t value;
+  uint32_t micros; // When it happened
+};
+
+// A command as the loop applied it
+struct LoggedCommand
+{
+  Command command;
+  uint32_t seq;           // Order in which it was applied, from 0 at boot
+  uint32_t appliedMicros; // When its batch was applied
+  uint8_t result;         // COMMAND_APPLIED...
+};
+
+// The latest commands applied: entry seq is at seq % COMMAND_LOG_SIZE
+struct CommandLog
+{
+  LoggedCommand entries[COMMAND_LOG_SIZE];
+  uint32_t count; // Commands applied since boot
+};
+
+// What a batch did, for the loop to follow up
+struct CommandBatch
+{
+  uint8_t applied;    // Commands taken from the queue
+  bool timeChanged;   // By a button or a time command
+  bool statesChanged; // A motor was set
+  bool more;          // Commands wait for the next tick
+};
+
+// Every input of the roaster (the buttons, the switch, the POSTs & the control
+// channel) goes through one queue as a Command, and the loop applies them in
+// batches at the start of each tick, in the order they were posted, so
+// nothing but the loop ever changes the roaster. The commands applied are
+// logged, & replaying the log with apply() on a roaster in the same state
+// gives the same results
+class CommandPipeline
+{
+public:
+  CommandPipeline();
+
+  // From any task or ISR. False (& counted) if the queue is full. Always inlined, for the ISRs in IRAM
+  inline __attribute__((always_inline)) bool post(const Command &command) { return queue.push(command); }
+
+  // Apply the waiting commands, at most COMMAND_BATCH (loop)
+  CommandBatch drain(Roaster &roaster, uint32_t nowMicros);
+
+  // Apply a command (drain(), or a replay). Returns COMMAND_APPLIED...
+  uint8_t apply(Roaster &roaster, const Command &command);
+
+  // Copy of the log, from any task
+  CommandLog getLog() const { return published.read(); }
+
+  uint32_t dropped() const { return queue.dropped(); } // Commands refused by a full queue
+
+private:
+  MpscQueue<Command, COMMAND_QUEUE_SIZE> queue;
+  CommandLog log;                // Working copy, loop only
+  Seqlock<CommandLog> published; // As of the last batch
+  uint32_t lastPressMicros;      // Of the timer buttons, for the debounce
+};
+
+const char *commandTypeName(uint8_t type);
+const char *commandSourceName(uint8_t source);
+
+// {"seq":n,"type":s,"source":s,"arg":n,"value":n,"micros":n,"applied":n,"result":n}
+size_t writeLoggedCommand(char *buffer, size_t size, const LoggedCommand &entry);
+
+// The commands in the JSON body of a POST of the page
+struct BodyCommands
+{
+  Command commands[BODY_COMMANDS]; // From the web, without their micros
+  uint8_t count;                   // May be 0, e.g. a /time without an action
+  uint16_t status;                 // 200, or the answer when it's refused: 404 unparseable, 400 no such profile or mode
+  const char *error;               // Text of that answer
+};
+
+// Parse the body of a POST to /profile, /autotune, /motors or /time (type:
+// COMMAND_PROFILE, COMMAND_AUTOTUNE, COMMAND_MOTOR or COMMAND_TIME), checking
+// the profile & the mode against the roaster (from any task)
+BodyCommands parseBodyCommands(uint8_t type, const char *body, size_t length, const Roaster &roaster);
+
+#endif
@@ -0,0 +1,174 @@
+#include "control_channel.h"
+
+static uint16_t read16(const uint8_t *data)
+{
+  return data[0] | (data[1] << 8);
+}
+
+static void write16(uint8_t *data, uint16_t value)
+{
+  data[0] = value & 0xff;
+  data[1] = value >> 8;
+}
+
+bool decodeControlCommand(const uint8_t *data, size_t length, ControlCommand &command)
+{
+  if (length < 3)
+  {
+    return false;
+  }
+
+  command.type = data[0];
+  command.seq = read16(data + 1);
+
+  switch (command.type)
+  {
+  case CONTROL_HELLO:
+    if (length < 7)
+    {
+      return false;
+    }
+    command.session = read16(data + 3) | ((uint32_t)read16(data + 5) << 16);
+    return true;
+
+  case CONTROL_MOTOR:
+    if (length < 5 || data[3] < 1 || data[3] > 3)
+    {
+      return false;
+    }
+    command.motor = data[3];
+    command.on = data[4] != 0;
+    return true;
+
+  case CONTROL_TIME:
+    if (length < 5)
+    {
+      return false;
+    }
+    command.seconds = (int16_t)read16(data + 3);
+    return true;
+
+  case CONTROL_STATE_REQUEST:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+size_t encodeControlAck(uint8_t *buffer, uint16_t seq, uint8_t status)
+{
+  buffer[0] = CONTROL_ACK;
+  write16(buffer + 1, seq);
+  buffer[3] = status;
+  return CONTROL_ACK_SIZE;
+}
+
+size_t encodeControlState(uint8_t *buffer, const MotorStates &states, const TimerValues &timer)
+{
+  buffer[0] = CONTROL_STATE;
+  buffer[1] = (states.motor1 ? 1 : 0) | (states.motor2 ? 2 : 0) | (states.motor3 ? 4 : 0);
+  write16(buffer + 2, timer.total > 0 ? timer.total : 0);
+  write16(buffer + 4, timer.time > 0 ? timer.time : 0);
+  return CONTROL_STATE_SIZE;
+}
+
+ControlSessions::ControlSessions() : slots(), clock(0) {}
+
+int ControlSessions::find(uint32_t connection) const
+{
+  for (int i = 0; i < CONTROL_SESSIONS; i++)
+  {
+    if (slots[i].connection == connection)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void ControlSessions::open(uint32_t connection, uint32_t session)
+{
+  close(connection);
+
+  // Its slot, or the least recently used one, preferably without a connection
+  int slot = 0;
+  for (int i = 0; i < CONTROL_SESSIONS; i++)
+  {
+    if (slots[i].used && slots[i].session == session)
+    {
+      slot = i;
+      break;
+    }
+    bool bound = slots[i].connection != 0, slotBound = slots[slot].connection != 0;
+    if (bound < slotBound || (bound == slotBound && slots[i].used < slots[slot].used))
+    {
+      slot = i;
+    }
+  }
+
+  if (!slots[slot].used || slots[slot].session != session)
+  {
+    slots[slot].session = session;
+    slots[slot].started = false;
+  }
+  slots[slot].connection = connection;
+  slots[slot].used = ++clock;
+}
+
+void ControlSessions::close(uint32_t connection)
+{
+  int slot = find(connection);
+  if (slot >= 0)
+  {
+    slots[slot].connection = 0;
+  }
+}
+
+uint8_t ControlSessions::check(uint32_t connection, uint16_t seq) const
+{
+  int slot = connection ? find(connection) : -1;
+  if (slot < 0)
+  {
+    return CONTROL_INVALID;
+  }
+
+  // Newer than the newest one applied (with the wrap around of the sequence),
+  // or in the window without having been applied
+  const Slot &s = slots[slot];
+  int32_t ahead = (int16_t)(seq - s.lastSeq);
+  if (!s.started || ahead > 0)
+  {
+    return CONTROL_APPLIED;
+  }
+  return -ahead < CONTROL_WINDOW && !(s.window >> -ahead & 1) ? CONTROL_APPLIED : CONTROL_DUPLICATE;
+}
+
+void ControlSessions::applied(uint32_t connection, uint16_t seq)
+{
+  int slot = connection ? find(connection) : -1;
+  if (slot < 0)
+  {
+    return;
+  }
+
+  // A newer one slides the window up to it
+  Slot &s = slots[slot];
+  int32_t ahead = (int16_t)(seq - s.lastSeq);
+  if (!s.started)
+  {
+    s.lastSeq = seq;
+    s.window = 1;
+  }
+  else if (ahead > 0)
+  {
+    s.window = ahead < CONTROL_WINDOW ? s.window << ahead | 1 : 1;
+    s.lastSeq = seq;
+  }
+  else if (-ahead < CONTROL_WINDOW)
+  {
+    s.window |= 1u << -ahead;
+  }
+  s.started = true;
+  s.used = ++clock;
+}
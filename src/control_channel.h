@@ -0,0 +1,101 @@
+#ifndef CONTROL_CHANNEL_H
+#define CONTROL_CHANNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "telemetry.h"
+
+// Binary protocol of the /control WebSocket, the page's persistent channel for
+// the motors & the timer (in place of a POST per command). Little endian.
+//
+// Page to board, [type][seq:2] then the arguments:
+//   HELLO  [0x00][0][session:4]     Binds the connection to a session of the page
+//   MOTOR  [0x01][seq:2][motor][on] Sets a motor (1-3) on or off
+//   TIME   [0x02][seq:2][seconds:2] Adds seconds to the timer, takes them if negative
+//   STATE  [0x03][seq:2]            Asks for a STATE frame
+//
+// Board to page:
+//   ACK    [0x81][seq:2][status]                 Outcome of a command (CONTROL_APPLIED...)
+//   STATE  [0x82][motors][total:2][time:2]      Sent on every change & on connection (motor bits as in TelemetryFrame)
+//
+// Sequence numbers grow by one with each command of a session. The board keeps
+// which of the last CONTROL_WINDOW it applied, so a command sent again (after
+// a reconnection, when its ack was lost) is acked as a duplicate & not applied
+// twice, while one acked busy is still applied when it's sent again after
+// newer ones
+
+#define CONTROL_HELLO 0x00
+#define CONTROL_MOTOR 0x01
+#define CONTROL_TIME 0x02
+#define CONTROL_STATE_REQUEST 0x03
+#define CONTROL_ACK 0x81
+#define CONTROL_STATE 0x82
+
+#define CONTROL_APPLIED 0   // Done (or handed to the loop)
+#define CONTROL_DUPLICATE 1 // Already applied, not again
+#define CONTROL_BUSY 2      // Not applied, the queue to the loop is full: send it again later
+#define CONTROL_INVALID 3   // Not applied: malformed, or no HELLO first
+
+#define CONTROL_ACK_SIZE 4
+#define CONTROL_STATE_SIZE 6
+#define CONTROL_SESSIONS 4 // Pages remembered at once (the board serves a few clients)
+#define CONTROL_WINDOW 32  // Latest sequence numbers of a session whose commands are told apart, older ones are duplicates
+
+// A decoded frame of the page
+struct ControlCommand
+{
+  uint8_t type;
+  uint16_t seq;
+  uint32_t session; // HELLO
+  uint8_t motor;    // MOTOR
+  bool on;
+  int16_t seconds; // TIME
+};
+
+// False if it's too short for its type, or of an unknown type
+bool decodeControlCommand(const uint8_t *data, size_t length, ControlCommand &command);
+
+// Write an ACK / a STATE into buffer (CONTROL_ACK_SIZE / CONTROL_STATE_SIZE bytes). Return the length
+size_t encodeControlAck(uint8_t *buffer, uint16_t seq, uint8_t status);
+size_t encodeControlState(uint8_t *buffer, const MotorStates &states, const TimerValues &timer);
+
+// Sessions of the pages & the last command each one applied, for the
+// connections they're bound to. Only used by the task of the web server
+class ControlSessions
+{
+public:
+  ControlSessions();
+
+  // Bind a connection to a session, taking the slot of the least recently used one if it's unknown
+  void open(uint32_t connection, uint32_t session);
+
+  // The connection closed (its session is kept for its next one)
+  void close(uint32_t connection);
+
+  // CONTROL_APPLIED if the command is new for the session of the connection,
+  // CONTROL_DUPLICATE if it was applied (or is older than the window),
+  // CONTROL_INVALID without a session
+  uint8_t check(uint32_t connection, uint16_t seq) const;
+
+  // The command was applied: the same seq is a duplicate from now on
+  void applied(uint32_t connection, uint16_t seq);
+
+private:
+  struct Slot
+  {
+    uint32_t session;
+    uint32_t connection; // 0 when no connection is bound
+    uint16_t lastSeq; // Newest applied
+    uint32_t window;  // Bit n: lastSeq - n was applied
+    bool started;     // A command was applied, lastSeq & window are valid
+    uint32_t used; // For the least recently used
+  };
+
+  int find(uint32_t connection) const;
+
+  Slot slots[CONTROL_SESSIONS];
+  uint32_t clock;
+};
+
+#endif
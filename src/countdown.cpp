@@ -0,0 +1,112 @@
+#include "countdown.h"
+
+#include <string.h>
+
+Countdown::Countdown() : deadlineMs(0), totalSeconds(0), shown(-1), active(false)
+{
+  resetStats();
+}
+
+void Countdown::start(int32_t seconds, uint32_t nowMs)
+{
+  deadlineMs = nowMs + seconds * 1000;
+  totalSeconds = seconds;
+  shown = -1;
+  active = true;
+}
+
+void Countdown::add(int32_t seconds, uint32_t nowMs)
+{
+  if (!active)
+  {
+    start(seconds, nowMs);
+    return;
+  }
+  deadlineMs += seconds * 1000;
+  totalSeconds += seconds;
+}
+
+void Countdown::reduce(int32_t seconds)
+{
+  if (active)
+  {
+    deadlineMs -= seconds * 1000;
+    totalSeconds -= seconds;
+    shown = -1; // A jump the user made: neither skipped seconds nor a late one
+  }
+}
+
+void Countdown::stop()
+{
+  active = false;
+  totalSeconds = 0;
+}
+
+int32_t Countdown::remaining(uint32_t nowMs) const
+{
+  int32_t left = (int32_t)(deadlineMs - nowMs);
+  if (!active || left <= 0)
+  {
+    return 0;
+  }
+  return (left + 999) / 1000;
+}
+
+uint32_t Countdown::untilNextSecond(uint32_t nowMs) const
+{
+  int32_t left = (int32_t)(deadlineMs - nowMs);
+  if (!active)
+  {
+    return 0;
+  }
+  if (left <= 0)
+  {
+    return 1; // Expired, the next update reports it
+  }
+  return (left - 1) % 1000 + 1;
+}
+
+uint8_t Countdown::update(uint32_t nowMs)
+{
+  if (!active)
+  {
+    return 0;
+  }
+
+  uint8_t changes = 0;
+  int32_t seconds = remaining(nowMs);
+
+  if (seconds != shown)
+  {
+    // Counting down, the time since the boundary of this second (& the ones missed). Otherwise time was added
+    if (shown >= 0 && seconds < shown)
+    {
+      uint32_t late = nowMs - (deadlineMs - seconds * 1000);
+      stats.seconds++;
+      stats.skipped += shown - seconds - 1;
+      stats.lastLateMs = late;
+      stats.totalLateMs += late;
+      if (late > stats.maxLateMs)
+      {
+        stats.maxLateMs = late;
+      }
+    }
+    shown = seconds;
+    changes |= COUNTDOWN_SECOND;
+  }
+
+  if ((int32_t)(nowMs - deadlineMs) >= 0)
+  {
+    stats.expiries++;
+    stats.lastExpiryLateMs = nowMs - deadlineMs;
+    stop();
+    changes |= COUNTDOWN_EXPIRED;
+  }
+
+  return changes;
+}
+
+void Countdown::resetStats()
+{
+  memset(&stats, 0, sizeof(stats));
+}
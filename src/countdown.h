@@ -0,0 +1,56 @@
+#ifndef COUNTDOWN_H
+#define COUNTDOWN_H
+
+#include <stdint.h>
+
+// Bits returned by Countdown::update()
+#define COUNTDOWN_SECOND 0x01  // The remaining whole seconds changed
+#define COUNTDOWN_EXPIRED 0x02 // The deadline passed (reported once)
+
+// How far behind the countdown was handled
+struct CountdownStats
+{
+  uint32_t seconds;          // Changes of the remaining seconds handled
+  uint32_t skipped;          // Seconds that went by without being handled
+  uint32_t lastLateMs;       // Time from the last second boundary to its handling
+  uint32_t maxLateMs;
+  uint32_t totalLateMs;      // For the average
+  uint32_t expiries;
+  uint32_t lastExpiryLateMs; // Time from the last deadline to its handling
+};
+
+// Countdown timer on an absolute deadline: the remaining time comes from the
+// clock, never from the number of updates, so late or missed updates don't
+// make it drift. Adding or taking time moves the deadline
+class Countdown
+{
+public:
+  Countdown();
+
+  void start(int32_t seconds, uint32_t nowMs); // Replaces the one running
+  void add(int32_t seconds, uint32_t nowMs);   // Starts it if stopped
+  void reduce(int32_t seconds);                // Only moves a running one
+  void stop();
+
+  // Check the clock. Returns COUNTDOWN_* bits
+  uint8_t update(uint32_t nowMs);
+
+  bool running() const { return active; }
+  int32_t remaining(uint32_t nowMs) const; // Whole seconds, rounded up
+  int32_t total() const { return totalSeconds; }
+
+  // Time until the remaining seconds change, 0 when stopped
+  uint32_t untilNextSecond(uint32_t nowMs) const;
+
+  const CountdownStats &getStats() const { return stats; }
+  void resetStats();
+
+private:
+  uint32_t deadlineMs;
+  int32_t totalSeconds;
+  int32_t shown; // Remaining seconds at the last update, -1 to report the next one
+  bool active;
+  CountdownStats stats;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "event_backlog.h"
+
+#include <string.h>
+
+#include "telemetry.h"
+
+EventBacklog::EventBacklog() : entries(), head(0), count(0), evictedId(0) {}
+
+void EventBacklog::add(uint32_t id, const char *event, const char *data)
+{
+  if (strlen(data) > EVENT_BACKLOG_DATA)
+  {
+    evictedId = id;
+    return;
+  }
+
+  Entry &entry = entries[head];
+  if (count == EVENT_BACKLOG_SIZE)
+  {
+    evictedId = entry.id;
+  }
+  else
+  {
+    count++;
+  }
+
+  entry.id = id;
+  entry.event = event;
+  strcpy(entry.data, data);
+
+  head = (head + 1) % EVENT_BACKLOG_SIZE;
+}
+
+bool EventBacklog::covers(uint32_t id) const
+{
+  return id >= evictedId;
+}
+
+const EventBacklog::Entry &EventBacklog::at(size_t age) const
+{
+  return entries[(head + EVENT_BACKLOG_SIZE - count + age) % EVENT_BACKLOG_SIZE];
+}
+
+// Append an event in SSE format, returns false if it didn't fit
+static bool writeEvent(char *buffer, size_t size, size_t *used, uint32_t id, const char *event, const char *data)
+{
+  JsonWriter out(buffer + *used, size - *used);
+  out.raw("id: ").unsignedNumber(id).raw("\r\n");
+  out.raw("event: ").raw(event).raw("\r\n");
+  out.raw("data: ").raw(data).raw("\r\n\r\n");
+
+  size_t length = out.length();
+  if (!length)
+  {
+    buffer[*used] = '\0';
+    return false;
+  }
+
+  *used += length;
+  return true;
+}
+
+size_t EventBacklog::replay(uint32_t *after, char *buffer, size_t size) const
+{
+  size_t used = 0;
+
+  for (size_t age = 0; age < count; age++)
+  {
+    const Entry &entry = at(age);
+    if (entry.id <= *after)
+    {
+      continue;
+    }
+    if (!writeEvent(buffer, size, &used, entry.id, entry.event, entry.data))
+    {
+      break;
+    }
+    *after = entry.id;
+  }
+
+  return used;
+}
+
+size_t EventBacklog::latest(char *buffer, size_t size) const
+{
+  size_t used = 0;
+
+  // In id order, skipping the events that have a newer one with the same name
+  for (size_t age = 0; age < count; age++)
+  {
+    const Entry &entry = at(age);
+
+    bool newer = false;
+    for (size_t other = age + 1; other < count && !newer; other++)
+    {
+      newer = strcmp(at(other).event, entry.event) == 0;
+    }
+
+    if (!newer && !writeEvent(buffer, size, &used, entry.id, entry.event, entry.data))
+    {
+      break;
+    }
+  }
+
+  return used;
+}
+
+uint32_t EventBacklog::lastId() const
+{
+  return count ? at(count - 1).id : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef EVENT_BACKLOG_H
+#define EVENT_BACKLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EVENT_BACKLOG_SIZE 64 // Events kept, about 30 seconds of the /events stream
+#define EVENT_BACKLOG_DATA 96 // Longest payload kept
+
+// Bounded backlog of the latest SSE events, keyed by their (increasing) ids,
+// so that a reconnecting client can get everything after its Last-Event-ID.
+// Not thread safe, the caller serializes the access
+class EventBacklog
+{
+public:
+  EventBacklog();
+
+  // Store an event. The name must be a string literal (only the pointer is kept)
+  void add(uint32_t id, const char *event, const char *data);
+
+  // Whether every event with an id greater than this one is still kept
+  bool covers(uint32_t id) const;
+
+  // Write the events with an id greater than *after, in SSE format, as many
+  // as fit whole in the buffer. *after is moved to the last one written.
+  // Returns the length written, 0 when there are no more
+  size_t replay(uint32_t *after, char *buffer, size_t size) const;
+
+  // Write the latest event of each name, in SSE format. Returns the length written
+  size_t latest(char *buffer, size_t size) const;
+
+  // Id of the newest event, 0 if empty
+  uint32_t lastId() const;
+
+private:
+  struct Entry
+  {
+    uint32_t id;
+    const char *event;
+    char data[EVENT_BACKLOG_DATA + 1];
+  };
+
+  const Entry &at(size_t age) const; // 0 is the oldest
+
+  Entry entries[EVENT_BACKLOG_SIZE];
+  size_t head;       // Next slot to write
+  size_t count;      // Entries in use
+  uint32_t evictedId; // Newest id dropped (overwritten or too long), events after it are all kept
+};
+
+#endif
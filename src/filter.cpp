@@ -0,0 +1,175 @@
+#include "filter.h"
+
+#include <math.h>
+
+#define MICROS_PER_RADIAN 159154943 // 1e6 / 2π: time constant (µs) of a 1 mHz cutoff
+
+// MAX6675: 0 - 1023.75 ºC, it reads NAN with the thermocouple open. A median
+// of 5 removes single spikes, nothing in the drum moves faster than 10 ºC/s
+const FilterConfig THERMOCOUPLE_FILTER = {
+    0, 500,      // ºC
+    5,           // median
+    10,          // ºC/s
+    FILTER_ONE_EURO,
+    0,           // alpha
+    300,         // mHz at rest
+    100,         // mHz per ºC/s
+    1000,        // mHz of the speed
+    5};          // failed reads, ~1 s
+
+// DHT: NAN when it doesn't answer, a fault after 3 reads (6 s)
+const FilterConfig HUMIDITY_FILTER = {
+    0, 100,      // %
+    3,           // median
+    5,           // %/s
+    FILTER_EMA,
+    32768,       // alpha, 0.5
+    0, 0, 0,
+    3};
+
+SensorFilter::SensorFilter(const FilterConfig &config) : config(config)
+{
+  if (this->config.median < 1 || this->config.median > FILTER_MEDIAN_MAX)
+  {
+    this->config.median = 1;
+  }
+  reset();
+}
+
+void SensorFilter::reset()
+{
+  for (uint8_t i = 0; i < FILTER_MEDIAN_MAX; i++)
+  {
+    window[i] = 0;
+  }
+  next = 0;
+  limited = speed = output = 0;
+  lastMs = 0;
+  failures = 0;
+  flags = QUALITY_STALE;
+}
+
+int SensorFilter::rounded() const
+{
+  return (output + FILTER_ONE / 2) >> FILTER_FRACTION_BITS;
+}
+
+// Start from a single good sample, as if it had been there forever
+void SensorFilter::restart(int32_t sample, uint32_t nowMs)
+{
+  for (uint8_t i = 0; i < FILTER_MEDIAN_MAX; i++)
+  {
+    window[i] = sample;
+  }
+  limited = output = sample;
+  speed = 0;
+  lastMs = nowMs;
+}
+
+// Median of the window, by rank: always the same comparisons, whatever the values
+int32_t SensorFilter::median() const
+{
+  uint8_t n = config.median;
+  uint8_t middle = n / 2;
+  int32_t result = window[0];
+
+  for (uint8_t i = 0; i < n; i++)
+  {
+    uint8_t below = 0, equal = 0;
+    for (uint8_t j = 0; j < n; j++)
+    {
+      below += window[j] < window[i];
+      equal += window[j] == window[i];
+    }
+    if (below <= middle && below + equal > middle)
+    {
+      result = window[i];
+    }
+  }
+  return result;
+}
+
+// Weight of a new sample (1/65536) for a cutoff (mHz) & the time since the last sample
+static int32_t smoothingWeight(uint32_t cutoff, uint32_t dtMs)
+{
+  uint32_t tau = MICROS_PER_RADIAN / (cutoff ? cutoff : 1);
+  uint32_t dt = dtMs * 1000;
+  return (int32_t)(((uint64_t)dt << 16) / ((uint64_t)dt + tau));
+}
+
+void SensorFilter::update(float raw, uint32_t nowMs)
+{
+  flags &= ~(QUALITY_CLAMPED | QUALITY_REJECTED);
+
+  // NAN fails both comparisons
+  if (!(raw >= config.min && raw <= config.max))
+  {
+    flags |= QUALITY_REJECTED;
+    if (failures < UINT8_MAX)
+    {
+      failures++;
+    }
+    if (failures >= config.faultReads)
+    {
+      flags |= QUALITY_FAULT;
+    }
+    return;
+  }
+
+  int32_t sample = (int32_t)lroundf(raw * FILTER_ONE);
+  failures = 0;
+
+  // First read, or back from a fault: what was before means nothing now
+  if (flags & QUALITY_UNUSABLE)
+  {
+    flags &= ~QUALITY_UNUSABLE;
+    restart(sample, nowMs);
+    return;
+  }
+
+  uint32_t dt = nowMs - lastMs;
+  if (dt == 0)
+  {
+    dt = 1;
+  }
+  lastMs = nowMs;
+
+  window[next] = sample;
+  next = next + 1 < config.median ? next + 1 : 0;
+  int32_t value = median();
+
+  if (config.maxRate)
+  {
+    int32_t step = (int32_t)((int64_t)config.maxRate * FILTER_ONE * dt / 1000);
+    if (value > limited + step)
+    {
+      value = limited + step;
+      flags |= QUALITY_CLAMPED;
+    }
+    else if (value < limited - step)
+    {
+      value = limited - step;
+      flags |= QUALITY_CLAMPED;
+    }
+  }
+  limited = value;
+
+  switch (config.smoothing)
+  {
+  case FILTER_EMA:
+    output += (int32_t)(((int64_t)(value - output) * config.alpha) >> 16);
+    break;
+
+  case FILTER_ONE_EURO:
+  {
+    int32_t rate = (int32_t)((int64_t)(value - output) * 1000 / (int32_t)dt);
+    speed += (int32_t)(((int64_t)(rate - speed) * smoothingWeight(config.derivativeCutoff, dt)) >> 16);
+    uint32_t cutoff = config.minCutoff + (uint32_t)(((int64_t)config.beta * (speed < 0 ? -speed : speed)) >> FILTER_FRACTION_BITS);
+    output += (int32_t)(((int64_t)(value - output) * smoothingWeight(cutoff, dt)) >> 16);
+    break;
+  }
+
+  default:
+    output = value;
+  }
+}
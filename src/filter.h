@@ -0,0 +1,73 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+
+#define FILTER_FRACTION_BITS 8 // Filtered values are fixed-point, in 1/256 of a unit (ºC or %)
+#define FILTER_ONE (1 << FILTER_FRACTION_BITS)
+#define FILTER_MEDIAN_MAX 5 // Longest median window
+
+// Smoothing stage of a filter
+#define FILTER_NONE 0
+#define FILTER_EMA 1      // Exponential moving average with a fixed weight
+#define FILTER_ONE_EURO 2 // EMA whose cutoff rises with the speed: smooth at rest, little lag when it moves
+
+// Bits of the quality of a filtered value, 0 is a good one
+#define QUALITY_CLAMPED 0x01  // The last sample moved faster than the rate limit & was cut
+#define QUALITY_REJECTED 0x02 // The last read failed or was out of range, the value is the previous one
+#define QUALITY_FAULT 0x04    // Too many failed reads in a row: open thermocouple, DHT timing out
+#define QUALITY_STALE 0x08    // No good read yet, there is no value
+#define QUALITY_UNUSABLE (QUALITY_FAULT | QUALITY_STALE)
+
+struct FilterConfig
+{
+  int16_t min, max;          // Range of the good reads, anything else (or NAN) is a failed read
+  uint8_t median;            // Samples of the median, odd & up to FILTER_MEDIAN_MAX. 1 turns it off
+  uint16_t maxRate;          // Fastest change the value can follow (units/s), 0 turns the clamp off
+  uint8_t smoothing;         // FILTER_NONE, FILTER_EMA or FILTER_ONE_EURO
+  uint16_t alpha;            // EMA: weight of a new sample, in 1/65536
+  uint16_t minCutoff;        // One euro: cutoff at rest (mHz)
+  uint16_t beta;             // One euro: cutoff added per unit/s of speed (mHz)
+  uint16_t derivativeCutoff; // One euro: cutoff of the speed (mHz)
+  uint8_t faultReads;        // Failed reads in a row that make a fault
+};
+
+// Filters of the sensors of the roaster
+extern const FilterConfig THERMOCOUPLE_FILTER;
+extern const FilterConfig HUMIDITY_FILTER;
+
+// Filter chain of one sensor: range check -> median -> rate clamp ->
+// smoothing. Failed reads hold the last value, and become a fault when they
+// go on. Everything after the range check is integer math on fixed-point
+// values, and every read takes the same time, whatever the config
+class SensorFilter
+{
+public:
+  SensorFilter(const FilterConfig &config);
+
+  // Forget everything, the next good read starts the filter again
+  void reset();
+
+  // Take a raw read (NAN if it failed) made at nowMs
+  void update(float raw, uint32_t nowMs);
+
+  int32_t value() const { return output; } // Fixed-point
+  int rounded() const;                     // Whole units
+  uint8_t quality() const { return flags; }
+
+private:
+  void restart(int32_t sample, uint32_t nowMs);
+  int32_t median() const;
+
+  FilterConfig config;
+  int32_t window[FILTER_MEDIAN_MAX]; // Latest samples, for the median
+  uint8_t next;                      // Slot of the next sample in the window
+  int32_t limited;                   // Output of the rate clamp
+  int32_t speed;                     // One euro: filtered rate of change (fixed-point/s)
+  int32_t output;
+  uint32_t lastMs;  // Time of the last good read
+  uint8_t failures; // Failed reads in a row
+  uint8_t flags;    // QUALITY_* bits
+};
+
+#endif
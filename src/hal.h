@@ -0,0 +1,101 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hardware used by the roaster logic. hal_esp32.cpp implements it on the
+// board, hal_linux.cpp on a workstation (env:native), where the sensors are
+// fed by the caller and the outputs are kept in memory
+
+#define HAL_INPUT 0
+#define HAL_OUTPUT 1
+
+// Clock
+uint32_t halMillis();
+uint32_t halMicros();
+void halDelay(uint32_t ms);
+
+// Cycle counter of the core it runs on, for the probes of metrics.h
+uint32_t halCycles();
+uint32_t halCyclesPerMicro();
+
+// Task watchdog: resets the board when the task that started it stops feeding it for timeoutMs
+void halWatchdogBegin(uint32_t timeoutMs);
+void halWatchdogFeed();
+
+// Heap
+struct HalMemoryStats
+{
+  uint32_t free;     // Bytes
+  uint32_t minFree;  // Lowest since the start
+  uint32_t maxBlock; // Largest block that can be allocated
+};
+
+HalMemoryStats halMemoryStats();
+
+// GPIO
+void halPinMode(uint8_t pin, uint8_t mode);
+bool halDigitalRead(uint8_t pin);
+void halDigitalWrite(uint8_t pin, bool level);
+
+// Sensors, NAN when a read fails
+void halSensorsBegin();
+float halReadThermocouple(); // ºC
+float halReadHumidity();     // %
+
+// Buzzer
+void halTone(uint8_t pin, uint16_t frequency);
+void halNoTone(uint8_t pin);
+
+// Log: a line on the serial port (stdout on Linux), formatted like printf
+void halLog(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// Display (character LCD)
+struct HalDisplayStats
+{
+  uint32_t bytes;        // Bytes sent since the last reset
+  uint32_t transactions; // Transfers since the last reset
+  uint32_t pending;      // Transfers waiting to be sent
+  uint32_t dropped;      // Transfers dropped because the queue was full
+};
+
+void halDisplayBegin();
+bool halDisplayWrite(uint8_t col, uint8_t row, const uint8_t *text, uint8_t length);
+HalDisplayStats halDisplayStats();
+void halDisplayResetStats();
+
+// Storage: files (SPIFFS on the board) & small settings (NVS on the board)
+bool halStorageBegin();
+size_t halReadFile(const char *path, char *buffer, size_t size); // Returns the length read, 0 if missing
+size_t halReadFileAt(const char *path, uint32_t offset, void *buffer, size_t size);
+bool halAppendFile(const char *path, const void *data, size_t length); // Creates it if missing. False if it didn't all make it
+int32_t halFileSize(const char *path);                                 // -1 if missing
+bool halRemoveFile(const char *path);                                  // True if it's gone (or wasn't there)
+bool halLoadSetting(const char *key, void *value, size_t size);    // False if missing or of another size
+void halSaveSetting(const char *key, const void *value, size_t size);
+
+// Network: a station joining the router, & an access point of its own as a
+// fallback. Nothing blocks, the outcome of a join arrives as an event
+#define HAL_NETWORK_CONNECTED 1    // Joined & got an address
+#define HAL_NETWORK_DISCONNECTED 2 // A join failed, or the connection was lost
+
+typedef void (*HalNetworkHandler)(uint8_t event); // Called from the network task (on Linux, as the virtual clock moves)
+
+// Router the station joined, to join it again without scanning every channel
+struct HalNetworkLink
+{
+  uint8_t bssid[6];
+  uint8_t channel;
+};
+
+void halNetworkBegin(HalNetworkHandler handler);
+void halNetworkJoin(const char *ssid, const char *password, const HalNetworkLink *link); // Scans for the ssid without a link
+void halNetworkDisconnect();
+bool halNetworkConnected();
+bool halNetworkLink(HalNetworkLink *link); // False if not connected
+void halNetworkStartAccessPoint(const char *ssid, const char *password);
+void halNetworkStopAccessPoint();
+void halNetworkAddress(char *buffer, size_t size); // Of the station, or of the access point when offline
+
+#endif
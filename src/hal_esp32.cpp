@@ -0,0 +1,293 @@
+#include "hal.h"
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include <WiFi.h>
+#include <Preferences.h>
+
+#include "SPIFFS.h"
+
+#include <Wire.h>
+#include <LiquidCrystal_I2C.h>
+
+#include <esp_task_wdt.h>
+
+#include "DHT.h"
+#include "max6675.h"
+
+#include "lcd_frame.h"
+#include "pins.h"
+
+#define SETTINGS_NAMESPACE "pid" // Where the PID gains have always been kept
+#define LOG_LINE 128             // Longer lines are cut
+
+DHT dht(DHT_PIN, DHT22);                       // PIN, MODEL
+MAX6675 thermocouple(MAX_SCK, MAX_CS, MAX_SO); // SCK, CS, SO
+
+LiquidCrystal_I2C lcd(0x27, LCD_COLUMNS, LCD_ROWS); // addr, width (16), height(2) -> 16x2 LCD
+
+Preferences preferences;
+
+static HalNetworkHandler networkHandler;
+
+uint32_t halMillis()
+{
+  return millis();
+}
+
+uint32_t halMicros()
+{
+  return micros();
+}
+
+void halDelay(uint32_t ms)
+{
+  delay(ms);
+}
+
+uint32_t halCycles()
+{
+  return ESP.getCycleCount();
+}
+
+uint32_t halCyclesPerMicro()
+{
+  return getCpuFrequencyMhz();
+}
+
+void halWatchdogBegin(uint32_t timeoutMs)
+{
+  // Already started by the core (for the idle tasks) on most builds: then its timeout is kept
+  esp_task_wdt_init((timeoutMs + 999) / 1000, true);
+  esp_task_wdt_add(NULL);
+}
+
+void halWatchdogFeed()
+{
+  esp_task_wdt_reset();
+}
+
+HalMemoryStats halMemoryStats()
+{
+  return {ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap()};
+}
+
+void halPinMode(uint8_t pin, uint8_t mode)
+{
+  pinMode(pin, mode == HAL_OUTPUT ? OUTPUT : INPUT);
+}
+
+bool halDigitalRead(uint8_t pin)
+{
+  return digitalRead(pin);
+}
+
+void halDigitalWrite(uint8_t pin, bool level)
+{
+  digitalWrite(pin, level ? HIGH : LOW);
+}
+
+void halSensorsBegin()
+{
+  dht.begin();
+}
+
+float halReadThermocouple()
+{
+  return thermocouple.readCelsius();
+}
+
+float halReadHumidity()
+{
+  return dht.readHumidity();
+}
+
+void halTone(uint8_t pin, uint16_t frequency)
+{
+  tone(pin, frequency);
+}
+
+void halNoTone(uint8_t pin)
+{
+  noTone(pin);
+}
+
+void halLog(const char *format, ...)
+{
+  char line[LOG_LINE];
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(line, sizeof(line), format, arguments);
+  va_end(arguments);
+  Serial.println(line);
+}
+
+void halDisplayBegin()
+{
+  Wire.begin(LCD_SDA, LCD_SCL);
+  lcd.beginAsync(); // Queue every LCD transfer, so neither the init nor the refreshes block the loop
+  lcd.init();
+  lcd.backlight();
+}
+
+bool halDisplayWrite(uint8_t col, uint8_t row, const uint8_t *text, uint8_t length)
+{
+  return lcd.writeAt(col, row, text, length);
+}
+
+HalDisplayStats halDisplayStats()
+{
+  return {lcd.i2cBytes(), lcd.i2cTransactions(), lcd.pendingOps(), lcd.droppedOps()};
+}
+
+void halDisplayResetStats()
+{
+  lcd.resetI2CCounters();
+}
+
+bool halStorageBegin()
+{
+  preferences.begin(SETTINGS_NAMESPACE);
+
+  if (!SPIFFS.begin(true))
+  {
+    Serial.println("An Error has occurred while mounting SPIFFS");
+    return false;
+  }
+  return true;
+}
+
+size_t halReadFile(const char *path, char *buffer, size_t size)
+{
+  File file = SPIFFS.open(path);
+  if (!file)
+  {
+    return 0;
+  }
+
+  size_t length = file.read((uint8_t *)buffer, size);
+  file.close();
+  return length;
+}
+
+size_t halReadFileAt(const char *path, uint32_t offset, void *buffer, size_t size)
+{
+  if (!SPIFFS.exists(path))
+  {
+    return 0;
+  }
+
+  File file = SPIFFS.open(path);
+  size_t length = file && file.seek(offset) ? file.read((uint8_t *)buffer, size) : 0;
+  file.close();
+  return length;
+}
+
+bool halAppendFile(const char *path, const void *data, size_t length)
+{
+  File file = SPIFFS.open(path, FILE_APPEND);
+  if (!file)
+  {
+    return false;
+  }
+
+  size_t written = file.write((const uint8_t *)data, length);
+  file.close();
+  return written == length;
+}
+
+int32_t halFileSize(const char *path)
+{
+  if (!SPIFFS.exists(path))
+  {
+    return -1;
+  }
+
+  File file = SPIFFS.open(path);
+  int32_t size = file ? file.size() : -1;
+  file.close();
+  return size;
+}
+
+bool halRemoveFile(const char *path)
+{
+  return !SPIFFS.exists(path) || SPIFFS.remove(path);
+}
+
+bool halLoadSetting(const char *key, void *value, size_t size)
+{
+  return preferences.getBytes(key, value, size) == size;
+}
+
+void halSaveSetting(const char *key, const void *value, size_t size)
+{
+  preferences.putBytes(key, value, size);
+}
+
+// Hand the connection events of the WiFi driver to the handler (WiFi event task)
+static void networkEvent(arduino_event_id_t event, arduino_event_info_t info)
+{
+  if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP)
+  {
+    networkHandler(HAL_NETWORK_CONNECTED);
+  }
+  else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED)
+  {
+    networkHandler(HAL_NETWORK_DISCONNECTED);
+  }
+}
+
+void halNetworkBegin(HalNetworkHandler handler)
+{
+  networkHandler = handler;
+  WiFi.persistent(false);       // The credentials come with the firmware, don't write them to the flash on every join
+  WiFi.setAutoReconnect(false); // The caller decides when to join again
+  WiFi.onEvent(networkEvent);
+  WiFi.mode(WIFI_STA);
+}
+
+void halNetworkJoin(const char *ssid, const char *password, const HalNetworkLink *link)
+{
+  WiFi.begin(ssid, password, link ? link->channel : 0, link ? link->bssid : NULL);
+}
+
+void halNetworkDisconnect()
+{
+  WiFi.disconnect();
+}
+
+bool halNetworkConnected()
+{
+  return WiFi.status() == WL_CONNECTED;
+}
+
+bool halNetworkLink(HalNetworkLink *link)
+{
+  if (!halNetworkConnected())
+  {
+    return false;
+  }
+
+  memcpy(link->bssid, WiFi.BSSID(), sizeof(link->bssid));
+  link->channel = WiFi.channel();
+  return true;
+}
+
+void halNetworkStartAccessPoint(const char *ssid, const char *password)
+{
+  WiFi.mode(WIFI_AP_STA); // The station goes on retrying
+  WiFi.softAP(ssid, password);
+}
+
+void halNetworkStopAccessPoint()
+{
+  WiFi.softAPdisconnect(true);
+  WiFi.mode(WIFI_STA);
+}
+
+void halNetworkAddress(char *buffer, size_t size)
+{
+  IPAddress address = !halNetworkConnected() && (WiFi.getMode() & WIFI_AP) ? WiFi.softAPIP() : WiFi.localIP();
+  snprintf(buffer, size, "%s", address.toString().c_str());
+}
+
@@ -0,0 +1,474 @@
+#include "hal.h"
+#include "hal_linux.h"
+
+#include <malloc.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <map>
+#include <string>
+
+#include "lcd_frame.h"
+
+#define PINS 64
+
+static bool pinLevels[PINS];
+static uint16_t pinTones[PINS];
+
+static float thermocoupleValue = NAN;
+static float humidityValue = NAN;
+
+static char displayRows[LCD_ROWS][LCD_COLUMNS + 1];
+static HalDisplayStats displayStats;
+
+static std::string storageRoot = "data";
+static int64_t writeBudget = -1; // Bytes the storage writes before losing power, -1 without limit
+static std::map<std::string, std::string> settings; // Kept in memory for the run
+
+// Router seen by the station, & the join in progress
+static HalNetworkHandler networkHandler = NULL;
+static HalNetworkLink routerLink = {{0x02, 0x00, 0x00, 0x00, 0x00, 0x01}, 6};
+static bool routerUp = true;
+static uint32_t routerScanMs = 2500; // Scan of every channel
+static uint32_t routerJoinMs = 500;  // Authentication, association & DHCP
+static bool stationConnected = false;
+static bool accessPointOn = false;
+static uint64_t pendingEventMicros = 0; // When the outcome of the join is due, 0 without one
+static uint8_t pendingEvent = 0;
+
+static bool virtualClock = false;
+static uint64_t virtualMicros = 0;
+
+// Time since the first call, or the virtual time
+static uint64_t elapsedMicros()
+{
+  if (virtualClock)
+  {
+    return virtualMicros;
+  }
+
+  static timespec start;
+  static bool started = false;
+
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!started)
+  {
+    start = now;
+    started = true;
+  }
+
+  return (uint64_t)(now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+// Hand the outcome of the join to the handler once the virtual clock gets there, as the
+// network task of the board would
+static void deliverNetworkEvent()
+{
+  if (pendingEventMicros && elapsedMicros() >= pendingEventMicros)
+  {
+    pendingEventMicros = 0;
+    stationConnected = pendingEvent == HAL_NETWORK_CONNECTED;
+    if (networkHandler)
+    {
+      networkHandler(pendingEvent);
+    }
+  }
+}
+
+uint32_t halMillis()
+{
+  return elapsedMicros() / 1000;
+}
+
+uint32_t halMicros()
+{
+  return elapsedMicros();
+}
+
+void halDelay(uint32_t ms)
+{
+  if (virtualClock)
+  {
+    virtualMicros += (uint64_t)ms * 1000;
+    deliverNetworkEvent();
+    return;
+  }
+
+  timespec wait = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000};
+  nanosleep(&wait, NULL);
+}
+
+void halLinuxUseVirtualClock(uint64_t startMicros)
+{
+  virtualClock = true;
+  virtualMicros = startMicros;
+}
+
+void halLinuxAdvance(uint32_t micros)
+{
+  virtualMicros += micros;
+  deliverNetworkEvent();
+}
+
+// The real time in ns, whatever the clock of the HAL: the probes time the work of this process
+uint32_t halCycles()
+{
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+uint32_t halCyclesPerMicro()
+{
+  return 1000;
+}
+
+static uint32_t watchdogTimeoutMs = 0; // 0 until started
+static uint64_t watchdogFedMicros = 0;
+
+void halWatchdogBegin(uint32_t timeoutMs)
+{
+  watchdogTimeoutMs = timeoutMs;
+  watchdogFedMicros = elapsedMicros();
+}
+
+void halWatchdogFeed()
+{
+  watchdogFedMicros = elapsedMicros();
+}
+
+bool halLinuxWatchdogExpired()
+{
+  return watchdogTimeoutMs && elapsedMicros() - watchdogFedMicros > (uint64_t)watchdogTimeoutMs * 1000;
+}
+
+// The free memory of the heap of malloc (not of the system), & the lowest seen by a call
+HalMemoryStats halMemoryStats()
+{
+  static uint32_t minFree = UINT32_MAX;
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 info = mallinfo2();
+#else
+  struct mallinfo info = mallinfo();
+#endif
+
+  HalMemoryStats stats = {(uint32_t)info.fordblks, 0, (uint32_t)info.fordblks};
+  minFree = stats.free < minFree ? stats.free : minFree;
+  stats.minFree = minFree;
+  return stats;
+}
+
+void halPinMode(uint8_t pin, uint8_t mode) {}
+
+bool halDigitalRead(uint8_t pin)
+{
+  return pin < PINS && pinLevels[pin];
+}
+
+void halDigitalWrite(uint8_t pin, bool level)
+{
+  if (pin < PINS)
+  {
+    pinLevels[pin] = level;
+  }
+}
+
+void halLinuxSetPin(uint8_t pin, bool level)
+{
+  halDigitalWrite(pin, level);
+}
+
+void halSensorsBegin() {}
+
+float halReadThermocouple()
+{
+  return thermocoupleValue;
+}
+
+float halReadHumidity()
+{
+  return humidityValue;
+}
+
+void halLinuxSetReadings(float temperature, float humidity)
+{
+  thermocoupleValue = temperature;
+  humidityValue = humidity;
+}
+
+void halTone(uint8_t pin, uint16_t frequency)
+{
+  if (pin < PINS)
+  {
+    pinTones[pin] = frequency;
+  }
+}
+
+void halNoTone(uint8_t pin)
+{
+  halTone(pin, 0);
+}
+
+void halLog(const char *format, ...)
+{
+  va_list arguments;
+  va_start(arguments, format);
+  vprintf(format, arguments);
+  va_end(arguments);
+  putchar('\n');
+}
+
+uint16_t halLinuxTone(uint8_t pin)
+{
+  return pin < PINS ? pinTones[pin] : 0;
+}
+
+void halDisplayBegin()
+{
+  for (uint8_t row = 0; row < LCD_ROWS; row++)
+  {
+    memset(displayRows[row], ' ', LCD_COLUMNS);
+    displayRows[row][LCD_COLUMNS] = '\0';
+  }
+}
+
+bool halDisplayWrite(uint8_t col, uint8_t row, const uint8_t *text, uint8_t length)
+{
+  if (row >= LCD_ROWS || col + length > LCD_COLUMNS)
+  {
+    return false;
+  }
+
+  memcpy(displayRows[row] + col, text, length);
+  displayStats.bytes += length;
+  displayStats.transactions++;
+  return true;
+}
+
+HalDisplayStats halDisplayStats()
+{
+  return displayStats;
+}
+
+void halDisplayResetStats()
+{
+  displayStats.bytes = 0;
+  displayStats.transactions = 0;
+}
+
+const char *halLinuxDisplayRow(uint8_t row)
+{
+  return row < LCD_ROWS ? displayRows[row] : "";
+}
+
+bool halStorageBegin()
+{
+  return true;
+}
+
+void halLinuxSetStorageRoot(const char *path)
+{
+  storageRoot = path;
+}
+
+size_t halReadFile(const char *path, char *buffer, size_t size)
+{
+  FILE *file = fopen((storageRoot + path).c_str(), "rb");
+  if (!file)
+  {
+    return 0;
+  }
+
+  size_t length = fread(buffer, 1, size, file);
+  fclose(file);
+  return length;
+}
+
+size_t halReadFileAt(const char *path, uint32_t offset, void *buffer, size_t size)
+{
+  FILE *file = fopen((storageRoot + path).c_str(), "rb");
+  if (!file)
+  {
+    return 0;
+  }
+
+  size_t length = fseek(file, offset, SEEK_SET) == 0 ? fread(buffer, 1, size, file) : 0;
+  fclose(file);
+  return length;
+}
+
+bool halAppendFile(const char *path, const void *data, size_t length)
+{
+  if (writeBudget == 0)
+  {
+    return false;
+  }
+
+  FILE *file = fopen((storageRoot + path).c_str(), "ab");
+  if (!file)
+  {
+    return false;
+  }
+
+  // The power goes during this write: a part of it is there, & the rest may be half programmed
+  bool cut = writeBudget >= 0 && (int64_t)length > writeBudget;
+  size_t kept = cut ? writeBudget : length;
+  fwrite(data, 1, kept, file);
+  if (cut)
+  {
+    for (size_t garbage = rand() % (length - kept + 1); garbage > 0; garbage--)
+    {
+      fputc(rand() & 0xFF, file);
+    }
+  }
+  if (writeBudget >= 0)
+  {
+    writeBudget -= kept;
+  }
+
+  fclose(file);
+  return !cut;
+}
+
+int32_t halFileSize(const char *path)
+{
+  FILE *file = fopen((storageRoot + path).c_str(), "rb");
+  if (!file)
+  {
+    return -1;
+  }
+
+  fseek(file, 0, SEEK_END);
+  int32_t size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+bool halRemoveFile(const char *path)
+{
+  if (writeBudget == 0)
+  {
+    return false;
+  }
+
+  FILE *file = fopen((storageRoot + path).c_str(), "rb");
+  if (!file)
+  {
+    return true;
+  }
+  fclose(file);
+  return remove((storageRoot + path).c_str()) == 0;
+}
+
+void halLinuxCutPowerAfter(int64_t bytes)
+{
+  writeBudget = bytes;
+}
+
+bool halLoadSetting(const char *key, void *value, size_t size)
+{
+  std::map<std::string, std::string>::const_iterator setting = settings.find(key);
+  if (setting == settings.end() || setting->second.size() != size)
+  {
+    return false;
+  }
+
+  memcpy(value, setting->second.data(), size);
+  return true;
+}
+
+void halSaveSetting(const char *key, const void *value, size_t size)
+{
+  settings[key] = std::string((const char *)value, size);
+}
+
+// Emit a network event after that long
+static void scheduleNetworkEvent(uint8_t event, uint32_t ms)
+{
+  pendingEvent = event;
+  pendingEventMicros = elapsedMicros() + (uint64_t)ms * 1000 + 1;
+}
+
+void halNetworkBegin(HalNetworkHandler handler)
+{
+  networkHandler = handler;
+  stationConnected = false;
+  accessPointOn = false;
+  pendingEventMicros = 0;
+}
+
+void halNetworkJoin(const char *ssid, const char *password, const HalNetworkLink *link)
+{
+  stationConnected = false;
+
+  // A known router is probed on its channel only, & a wrong one isn't found there
+  bool known = link && memcmp(link, &routerLink, sizeof(routerLink)) == 0;
+  if (!routerUp || (link && !known))
+  {
+    scheduleNetworkEvent(HAL_NETWORK_DISCONNECTED, link ? routerJoinMs : routerScanMs);
+  }
+  else
+  {
+    scheduleNetworkEvent(HAL_NETWORK_CONNECTED, (link ? 0 : routerScanMs) + routerJoinMs);
+  }
+}
+
+void halNetworkDisconnect()
+{
+  stationConnected = false;
+  pendingEventMicros = 0;
+}
+
+bool halNetworkConnected()
+{
+  return stationConnected;
+}
+
+bool halNetworkLink(HalNetworkLink *link)
+{
+  if (stationConnected)
+  {
+    *link = routerLink;
+  }
+  return stationConnected;
+}
+
+void halNetworkStartAccessPoint(const char *ssid, const char *password)
+{
+  accessPointOn = true;
+}
+
+void halNetworkStopAccessPoint()
+{
+  accessPointOn = false;
+}
+
+void halNetworkAddress(char *buffer, size_t size)
+{
+  snprintf(buffer, size, stationConnected || !accessPointOn ? "127.0.0.1" : "192.168.4.1");
+}
+
+void halLinuxSetRouter(bool up, uint8_t channel, uint32_t scanMs, uint32_t joinMs)
+{
+  routerUp = up;
+  routerLink.channel = channel;
+  routerScanMs = scanMs;
+  routerJoinMs = joinMs;
+
+  // The station loses it
+  if (!up && stationConnected)
+  {
+    scheduleNetworkEvent(HAL_NETWORK_DISCONNECTED, 0);
+  }
+}
+
+bool halLinuxAccessPointOn()
+{
+  return accessPointOn;
+}
@@ -0,0 +1,43 @@
+#ifndef HAL_LINUX_H
+#define HAL_LINUX_H
+
+#include <stdint.h>
+
+// Controls of the Linux backend of the HAL, for the native build
+
+// Stop following the system clock: the time only moves with halLinuxAdvance()
+// (& halDelay()), so a simulation runs as fast as it can, always the same way
+void halLinuxUseVirtualClock(uint64_t startMicros);
+void halLinuxAdvance(uint32_t micros);
+
+// Whether the task watchdog went without a feed for its timeout since it was
+// started (or last fed): the board would have reset
+bool halLinuxWatchdogExpired();
+
+// Values returned by the next sensor reads (NAN for a failed read)
+void halLinuxSetReadings(float temperature, float humidity);
+
+// Level of an input pin (e.g. the positions of the rotary switch)
+void halLinuxSetPin(uint8_t pin, bool level);
+
+// Frequency the buzzer of a pin is playing, 0 if silent
+uint16_t halLinuxTone(uint8_t pin);
+
+// Text on a row of the display
+const char *halLinuxDisplayRow(uint8_t row);
+
+// Directory that holds the files of the storage (the data/ folder by default)
+void halLinuxSetStorageRoot(const char *path);
+
+// Router of the emulated network: whether it's up, its channel & how long
+// joining it takes, with a scan of every channel & once it's found. The
+// outcome of a join is delivered as the virtual clock gets there
+void halLinuxSetRouter(bool up, uint8_t channel, uint32_t scanMs, uint32_t joinMs);
+bool halLinuxAccessPointOn();
+
+// Emulate a power loss of the storage after that many more bytes written (-1
+// never): the write in progress is torn, possibly with garbage after it, &
+// the next writes fail until it's called again
+void halLinuxCutPowerAfter(int64_t bytes);
+
+#endif
@@ -0,0 +1,128 @@
+#include "history.h"
+
+#include <string.h>
+
+#include "telemetry.h"
+
+History::History() : samples(), count(0) {}
+
+void History::push(const HistorySample &sample)
+{
+  uint32_t total = count.load(std::memory_order_relaxed);
+  samples[total & (HISTORY_CAPACITY - 1)] = sample;
+  count.store(total + 1, std::memory_order_release);
+}
+
+uint32_t History::first() const
+{
+  uint32_t total = count.load(std::memory_order_acquire);
+  return total > HISTORY_CAPACITY ? total - HISTORY_CAPACITY : 0;
+}
+
+uint32_t History::end() const
+{
+  return count.load(std::memory_order_acquire);
+}
+
+size_t History::read(uint32_t *from, HistorySample *out, size_t max) const
+{
+  for (;;)
+  {
+    uint32_t total = count.load(std::memory_order_acquire);
+    uint32_t oldest = total > HISTORY_CAPACITY ? total - HISTORY_CAPACITY : 0;
+
+    if (*from < oldest)
+    {
+      *from = oldest;
+    }
+    if (*from >= total || max == 0)
+    {
+      return 0;
+    }
+
+    size_t copied = total - *from < max ? total - *from : max;
+    for (size_t i = 0; i < copied; i++)
+    {
+      out[i] = samples[(*from + i) & (HISTORY_CAPACITY - 1)];
+    }
+
+    // The writer may have wrapped over the oldest copied slots meanwhile. Keep a
+    // margin of one slot for the write in progress & one for the next one
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint32_t after = count.load(std::memory_order_relaxed);
+    uint32_t intact = after + 2 > HISTORY_CAPACITY ? after + 2 - HISTORY_CAPACITY : 0;
+
+    if (*from >= intact)
+    {
+      return copied;
+    }
+
+    uint32_t lost = intact - *from;
+    if (lost < copied)
+    {
+      memmove(out, out + lost, (copied - lost) * sizeof(HistorySample));
+      *from += lost;
+      return copied - lost;
+    }
+
+    // Everything copied was overwritten, start over from the new oldest sample
+    *from = intact;
+  }
+}
+
+HistoryStream::HistoryStream(const History &history, uint32_t from, uint32_t to) : history(&history), next(from), to(to), stage(Open) {}
+
+size_t HistoryStream::fill(uint8_t *buffer, size_t size)
+{
+  size_t used = 0;
+
+  if (stage == Open && size > 0)
+  {
+    buffer[used++] = '[';
+    stage = First;
+  }
+
+  HistorySample batch[16];
+  char sample[SAMPLE_JSON_MAX + 1];
+
+  while (stage == First || stage == Next)
+  {
+    size_t room = (size - used) / (SAMPLE_JSON_MAX + 1); // Samples that fit, with their comma
+    size_t wanted = to > next ? to - next : 0;
+    wanted = wanted < room ? wanted : room;
+    wanted = wanted < sizeof(batch) / sizeof(batch[0]) ? wanted : sizeof(batch) / sizeof(batch[0]);
+
+    if (room == 0)
+    {
+      break;
+    }
+
+    size_t count = wanted ? history->read(&next, batch, wanted) : 0;
+    if (count == 0 || next >= to)
+    {
+      stage = Close;
+      break;
+    }
+
+    for (size_t i = 0; i < count && next < to; i++, next++)
+    {
+      if (stage == Next)
+      {
+        buffer[used++] = ',';
+      }
+      stage = Next;
+
+      size_t length = writeSample(sample, sizeof(sample), next, batch[i]);
+      memcpy(buffer + used, sample, length);
+      used += length;
+    }
+  }
+
+  if (stage == Close && used < size)
+  {
+    buffer[used++] = ']';
+    stage = Done;
+  }
+
+  return used;
+}
@@ -0,0 +1,85 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HISTORY_CAPACITY 4096 // Samples kept, must be a power of two (68 minutes at 1 Hz)
+
+// Bits of HistorySample::flags
+#define SAMPLE_MOTOR1 0x01
+#define SAMPLE_MOTOR2 0x02
+#define SAMPLE_MOTOR3 0x04
+#define SAMPLE_TIMER_ON 0x08
+#define SAMPLE_MODE_SHIFT 4 // 2 bits: 0 Off, 1-3 position of the 3-state switch
+#define SAMPLE_MODE_MASK 0x30
+#define SAMPLE_NO_TEMPERATURE 0x40 // The thermocouple failed, the temperature is the last good one
+
+// One roast sample, 6 bytes. Its timestamp is implicit: sample n was taken
+// n sampling periods after the history started
+struct HistorySample
+{
+  int16_t temperature; // ºC
+  uint16_t timer;      // Remaining seconds of the timer
+  uint8_t humidity;    // %
+  uint8_t flags;       // SAMPLE_* bits
+};
+
+// Fixed-size ring of the latest samples. One task appends while any other
+// task reads ranges without locks: a read that raced with the writer over
+// the oldest slots drops them instead of returning overwritten values
+class History
+{
+public:
+  History();
+
+  // Append a sample (single writer)
+  void push(const HistorySample &sample);
+
+  // Sequence number of the oldest sample still kept
+  uint32_t first() const;
+
+  // Sequence number the next sample will get (one past the newest)
+  uint32_t end() const;
+
+  // Copy up to max samples from sequence number *from. Samples that are
+  // already gone are skipped and *from is moved to the first one copied.
+  // Returns the number of samples copied
+  size_t read(uint32_t *from, HistorySample *out, size_t max) const;
+
+private:
+  HistorySample samples[HISTORY_CAPACITY];
+  std::atomic<uint32_t> count; // Total samples pushed
+};
+
+// The samples in [from, to) as [[n,temperature,humidity,timer,flags],...],
+// written in chunks as the web server asks for them. The samples gone by the
+// time their chunk is written are left out, so a range that starts before
+// the oldest sample starts at it
+class HistoryStream
+{
+public:
+  HistoryStream(const History &history, uint32_t from, uint32_t to);
+
+  // Write the next chunk. Returns its length, 0 if nothing fit or at the end (see done())
+  size_t fill(uint8_t *buffer, size_t size);
+  bool done() const { return stage == Done; }
+
+private:
+  enum Stage
+  {
+    Open,   // Nothing written
+    First,  // The bracket is written, no sample yet
+    Next,   // Samples written, the next one takes a comma
+    Close,  // Every sample is written
+    Done
+  };
+
+  const History *history;
+  uint32_t next; // Sequence number of the next sample
+  uint32_t to;
+  Stage stage;
+};
+
+#endif
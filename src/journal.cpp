@@ -0,0 +1,596 @@
+#include "journal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "metrics.h"
+
+#define RECORD_MAGIC 0x4A // 'J'
+
+// Sizes of the payloads
+#define SEGMENT_PAYLOAD 4          // Sequence number
+#define BEGIN_PAYLOAD 19           // Id, mode, period & name
+#define SAMPLES_PAYLOAD(count) (8 + (count)) // Id, first, count, first temperature & the differences
+#define END_PAYLOAD 13             // Id, samples, finished & phases
+
+// Little endian fields of the records
+static void put16(uint8_t *bytes, uint16_t value)
+{
+  bytes[0] = value;
+  bytes[1] = value >> 8;
+}
+
+static void put32(uint8_t *bytes, uint32_t value)
+{
+  put16(bytes, value);
+  put16(bytes + 2, value >> 16);
+}
+
+static uint16_t get16(const uint8_t *bytes)
+{
+  return bytes[0] | (bytes[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *bytes)
+{
+  return get16(bytes) | ((uint32_t)get16(bytes + 2) << 16);
+}
+
+// CRC-32 (IEEE), bit by bit: records are small & rare, a table isn't worth its flash
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+  crc = ~crc;
+  while (length--)
+  {
+    crc ^= *data++;
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+// File of a segment slot
+static void slotPath(char *path, uint8_t slot)
+{
+  snprintf(path, JOURNAL_PATH_LENGTH, "/journal%u.log", slot);
+}
+
+void SegmentReader::open(uint8_t slot, uint32_t start)
+{
+  slotPath(path, slot);
+  offset = start;
+  bufferStart = 0;
+  bufferLength = 0;
+  bad = false;
+}
+
+bool SegmentReader::fill(uint32_t length)
+{
+  if (offset >= bufferStart && offset + length <= bufferStart + bufferLength)
+  {
+    return true;
+  }
+
+  bufferStart = offset;
+  bufferLength = halReadFileAt(path, offset, buffer, JOURNAL_CHUNK);
+  return bufferLength >= length;
+}
+
+bool SegmentReader::next(uint8_t &type, uint8_t *payload, uint16_t &length)
+{
+  if (bad)
+  {
+    return false;
+  }
+
+  // Nothing after the last record is the clean end, a part of a header is torn
+  if (!fill(RECORD_HEADER))
+  {
+    bad = bufferLength > 0;
+    return false;
+  }
+
+  uint16_t size = get16(buffer + (offset - bufferStart) + 2);
+  if (buffer[offset - bufferStart] != RECORD_MAGIC || size > RECORD_PAYLOAD_MAX || !fill(RECORD_HEADER + size))
+  {
+    bad = true;
+    return false;
+  }
+
+  const uint8_t *record = buffer + (offset - bufferStart);
+  uint32_t crc = crc32(0, record, 4);
+  if (get32(record + 4) != crc32(crc, record + RECORD_HEADER, size))
+  {
+    bad = true;
+    return false;
+  }
+
+  type = record[1];
+  length = size;
+  memcpy(payload, record + RECORD_HEADER, size);
+  offset += RECORD_HEADER + size;
+  return true;
+}
+
+RoastJournal::RoastJournal()
+    : firstEntry(0), entryCount(0), nextId(1), segment(0), segmentSize(0), hasSegment(false), needsSegment(false), writing(0)
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+void RoastJournal::begin()
+{
+  firstEntry = 0;
+  entryCount = 0;
+  nextId = 1;
+  hasSegment = false;
+  needsSegment = false;
+  writing = 0;
+
+  // Sequence number of the segment in each slot, from its first record
+  uint32_t sequences[JOURNAL_SLOTS];
+  bool pending[JOURNAL_SLOTS];
+  for (uint8_t slot = 0; slot < JOURNAL_SLOTS; slot++)
+  {
+    SegmentReader reader;
+    uint8_t type;
+    uint8_t payload[RECORD_PAYLOAD_MAX];
+    uint16_t length;
+
+    reader.open(slot, 0);
+    pending[slot] = reader.next(type, payload, length) && type == RECORD_SEGMENT && length == SEGMENT_PAYLOAD;
+    sequences[slot] = pending[slot] ? get32(payload) : 0;
+  }
+
+  // Oldest first, the last one scanned is appended to
+  while (true)
+  {
+    int oldest = -1;
+    for (uint8_t slot = 0; slot < JOURNAL_SLOTS; slot++)
+    {
+      if (pending[slot] && (oldest < 0 || sequences[slot] < sequences[oldest]))
+      {
+        oldest = slot;
+      }
+    }
+    if (oldest < 0)
+    {
+      break;
+    }
+
+    scan(oldest, sequences[oldest]);
+    pending[oldest] = false;
+  }
+}
+
+// Add the roasts of a segment to the index
+void RoastJournal::scan(uint8_t slot, uint32_t sequence)
+{
+  SegmentReader reader;
+  uint8_t type;
+  uint8_t payload[RECORD_PAYLOAD_MAX];
+  uint16_t length;
+
+  JournalEntry *open = NULL; // Roast whose records follow
+  uint32_t start = 0;
+
+  reader.open(slot, 0);
+  while (reader.next(type, payload, length))
+  {
+    uint32_t id = length >= 4 ? get32(payload) : 0;
+
+    if (type == RECORD_BEGIN && length == BEGIN_PAYLOAD)
+    {
+      open = add(id);
+      open->segment = sequence;
+      open->offset = start;
+      open->mode = payload[4];
+      open->periodMs = get16(payload + 5);
+      memcpy(open->name, payload + 7, PROFILE_NAME_LENGTH + 1);
+      open->name[PROFILE_NAME_LENGTH] = '\0';
+      if (id >= nextId)
+      {
+        nextId = id + 1;
+      }
+    }
+    else if (type == RECORD_SAMPLES && length >= SAMPLES_PAYLOAD(1) && open && open->id == id)
+    {
+      open->samples += payload[6];
+    }
+    else if (type == RECORD_END && length == END_PAYLOAD && open && open->id == id)
+    {
+      open->samples = get16(payload + 4);
+      open->finished = payload[6];
+      for (uint8_t i = 0; i < 3; i++)
+      {
+        open->phases[i] = get16(payload + 7 + 2 * i);
+      }
+      open->complete = true;
+      open = NULL;
+    }
+
+    start = reader.position();
+  }
+
+  // Don't append after a torn record, it would hide what follows
+  char path[JOURNAL_PATH_LENGTH];
+  slotPath(path, slot);
+  segment = sequence;
+  segmentSize = reader.position();
+  hasSegment = true;
+  needsSegment = reader.torn() || halFileSize(path) != (int32_t)segmentSize;
+}
+
+JournalEntry *RoastJournal::add(uint32_t id)
+{
+  if (entryCount == JOURNAL_INDEX_SIZE)
+  {
+    firstEntry = (firstEntry + 1) % JOURNAL_INDEX_SIZE;
+    entryCount--;
+  }
+
+  JournalEntry *added = &entries[(firstEntry + entryCount) % JOURNAL_INDEX_SIZE];
+  entryCount++;
+  memset(added, 0, sizeof(*added));
+  added->id = id;
+  return added;
+}
+
+const JournalEntry *RoastJournal::find(uint32_t id) const
+{
+  for (uint8_t i = 0; i < entryCount; i++)
+  {
+    if (entry(i).id == id)
+    {
+      return &entry(i);
+    }
+  }
+  return NULL;
+}
+
+JournalEntry *RoastJournal::findEntry(uint32_t id)
+{
+  return const_cast<JournalEntry *>(find(id));
+}
+
+// Reuse the slot of the oldest segment
+bool RoastJournal::nextSegment()
+{
+  uint32_t sequence = hasSegment ? segment + 1 : 0;
+
+  // Its roasts go
+  while (entryCount > 0 && entry(0).segment + JOURNAL_SLOTS <= sequence)
+  {
+    firstEntry = (firstEntry + 1) % JOURNAL_INDEX_SIZE;
+    entryCount--;
+  }
+
+  segment = sequence;
+  segmentSize = 0;
+  hasSegment = true;
+  stats.segments++;
+
+  char path[JOURNAL_PATH_LENGTH];
+  slotPath(path, sequence % JOURNAL_SLOTS);
+  if (!halRemoveFile(path))
+  {
+    stats.failures++;
+    needsSegment = true;
+    return false;
+  }
+
+  uint8_t payload[SEGMENT_PAYLOAD];
+  put32(payload, sequence);
+  needsSegment = false;
+  return append(RECORD_SEGMENT, payload, sizeof(payload));
+}
+
+bool RoastJournal::write(uint8_t type, const uint8_t *payload, uint16_t length)
+{
+  // The records of a roast stay in the segment of its begin record
+  if (needsSegment || !hasSegment || (type == RECORD_BEGIN && segmentSize >= JOURNAL_SEGMENT_SIZE))
+  {
+    if (type != RECORD_BEGIN)
+    {
+      stats.failures++;
+      return false;
+    }
+    if (!nextSegment())
+    {
+      return false;
+    }
+  }
+
+  return append(type, payload, length);
+}
+
+bool RoastJournal::append(uint8_t type, const uint8_t *payload, uint16_t length)
+{
+  uint8_t record[RECORD_HEADER + RECORD_PAYLOAD_MAX];
+  record[0] = RECORD_MAGIC;
+  record[1] = type;
+  put16(record + 2, length);
+  memcpy(record + RECORD_HEADER, payload, length);
+  put32(record + 4, crc32(crc32(0, record, 4), payload, length));
+
+  char path[JOURNAL_PATH_LENGTH];
+  slotPath(path, segment % JOURNAL_SLOTS);
+  if (!halAppendFile(path, record, RECORD_HEADER + length))
+  {
+    // Part of it may be there
+    stats.failures++;
+    needsSegment = true;
+    return false;
+  }
+
+  segmentSize += RECORD_HEADER + length;
+  stats.records++;
+  stats.bytes += RECORD_HEADER + length;
+  return true;
+}
+
+bool RoastJournal::beginRoast(uint8_t mode, const char *name, uint16_t periodMs)
+{
+  // An id is never given twice, even if its record didn't make it
+  uint32_t id = nextId++;
+  writing = 0;
+
+  uint8_t payload[BEGIN_PAYLOAD];
+  put32(payload, id);
+  payload[4] = mode;
+  put16(payload + 5, periodMs);
+  memset(payload + 7, 0, PROFILE_NAME_LENGTH + 1);
+  strncpy((char *)payload + 7, name, PROFILE_NAME_LENGTH);
+
+  if (!write(RECORD_BEGIN, payload, sizeof(payload)))
+  {
+    return false;
+  }
+
+  JournalEntry *added = add(id);
+  added->segment = segment;
+  added->offset = segmentSize - RECORD_HEADER - sizeof(payload);
+  added->mode = mode;
+  added->periodMs = periodMs;
+  memcpy(added->name, payload + 7, PROFILE_NAME_LENGTH + 1);
+  writing = id;
+  return true;
+}
+
+bool RoastJournal::appendSamples(uint16_t first, uint8_t count, const int16_t *temperatures)
+{
+  JournalEntry *roast = writing ? findEntry(writing) : NULL;
+  if (!roast || count == 0 || count > JOURNAL_BATCH)
+  {
+    return false;
+  }
+
+  // The first temperature, then the difference to the previous one (the recorder keeps them within a byte)
+  uint8_t payload[SAMPLES_PAYLOAD(JOURNAL_BATCH)];
+  put32(payload, writing);
+  put16(payload + 4, first);
+  payload[6] = count;
+  put16(payload + 7, temperatures[0]);
+  for (uint8_t i = 1; i < count; i++)
+  {
+    int delta = temperatures[i] - temperatures[i - 1];
+    payload[8 + i] = (int8_t)(delta > INT8_MAX ? INT8_MAX : delta < INT8_MIN ? INT8_MIN : delta);
+  }
+
+  // A roast with a lost record stays incomplete
+  if (!write(RECORD_SAMPLES, payload, SAMPLES_PAYLOAD(count)))
+  {
+    writing = 0;
+    return false;
+  }
+
+  roast->samples += count;
+  return true;
+}
+
+bool RoastJournal::endRoast(bool finished, const uint16_t phases[3])
+{
+  JournalEntry *roast = writing ? findEntry(writing) : NULL;
+  writing = 0;
+  if (!roast)
+  {
+    return false;
+  }
+
+  uint8_t payload[END_PAYLOAD];
+  put32(payload, roast->id);
+  put16(payload + 4, roast->samples);
+  payload[6] = finished;
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    put16(payload + 7 + 2 * i, phases[i]);
+  }
+
+  if (!write(RECORD_END, payload, sizeof(payload)))
+  {
+    return false;
+  }
+
+  roast->finished = finished;
+  memcpy(roast->phases, phases, sizeof(roast->phases));
+  roast->complete = true;
+  return true;
+}
+
+bool JournalReader::open(const JournalEntry &entry)
+{
+  uint8_t type;
+  uint8_t payload[RECORD_PAYLOAD_MAX];
+  uint16_t length;
+
+  id = entry.id;
+  batchCount = 0;
+  batchNext = 0;
+  done = false;
+
+  // The slot still holds the segment, & the roast starts there
+  reader.open(entry.segment % JOURNAL_SLOTS, 0);
+  if (!reader.next(type, payload, length) || type != RECORD_SEGMENT || get32(payload) != entry.segment)
+  {
+    return false;
+  }
+
+  reader.open(entry.segment % JOURNAL_SLOTS, entry.offset);
+  return reader.next(type, payload, length) && type == RECORD_BEGIN && get32(payload) == id;
+}
+
+bool JournalReader::load()
+{
+  uint8_t type;
+  uint8_t payload[RECORD_PAYLOAD_MAX];
+  uint16_t length;
+
+  // The roast ends at its end record, the next roast or the last good record
+  if (done || !reader.next(type, payload, length) || type != RECORD_SAMPLES || get32(payload) != id ||
+      length < SAMPLES_PAYLOAD(1) || length != SAMPLES_PAYLOAD(payload[6]))
+  {
+    done = true;
+    return false;
+  }
+
+  batchCount = payload[6];
+  batchNext = 0;
+  batch[0] = (int16_t)get16(payload + 7);
+  for (uint8_t i = 1; i < batchCount; i++)
+  {
+    batch[i] = batch[i - 1] + (int8_t)payload[8 + i];
+  }
+  return true;
+}
+
+size_t JournalReader::read(int16_t *temperatures, size_t max)
+{
+  size_t copied = 0;
+
+  while (copied < max && (batchNext < batchCount || load()))
+  {
+    temperatures[copied++] = batch[batchNext++];
+  }
+
+  return copied;
+}
+
+size_t JournalReader::nextBatch(const int16_t *&temperatures)
+{
+  if (batchNext == batchCount && !load())
+  {
+    return 0;
+  }
+
+  temperatures = batch + batchNext;
+  size_t count = batchCount - batchNext;
+  batchNext = batchCount;
+  return count;
+}
+
+RoastRecorder::RoastRecorder() : samples(0), active(false)
+{
+  memset(&batch, 0, sizeof(batch));
+}
+
+void RoastRecorder::begin(uint8_t mode, const char *name, uint16_t periodMs)
+{
+  JournalOp op;
+  memset(&op, 0, sizeof(op));
+  op.type = RECORD_BEGIN;
+  op.mode = mode;
+  strncpy(op.name, name, PROFILE_NAME_LENGTH);
+  op.periodMs = periodMs;
+  queue.push(op);
+
+  batch.type = RECORD_SAMPLES;
+  batch.count = 0;
+  samples = 0;
+  active = true;
+}
+
+void RoastRecorder::sample(int16_t temperature)
+{
+  if (!active || samples == UINT16_MAX)
+  {
+    return;
+  }
+
+  // A jump that doesn't fit a byte starts another record
+  if (batch.count > 0)
+  {
+    int delta = temperature - batch.temperatures[batch.count - 1];
+    if (delta > INT8_MAX || delta < INT8_MIN)
+    {
+      push();
+    }
+  }
+
+  if (batch.count == 0)
+  {
+    batch.first = samples;
+  }
+  batch.temperatures[batch.count++] = temperature;
+  samples++;
+
+  if (batch.count == JOURNAL_BATCH)
+  {
+    push();
+  }
+}
+
+void RoastRecorder::end(bool finished, const uint16_t phases[3])
+{
+  if (!active)
+  {
+    return;
+  }
+  if (batch.count > 0)
+  {
+    push();
+  }
+
+  JournalOp op;
+  memset(&op, 0, sizeof(op));
+  op.type = RECORD_END;
+  op.finished = finished;
+  memcpy(op.phases, phases, sizeof(op.phases));
+  queue.push(op);
+  active = false;
+}
+
+void RoastRecorder::push()
+{
+  queue.push(batch);
+  batch.count = 0;
+}
+
+uint8_t RoastRecorder::flush(RoastJournal &journal)
+{
+  METRIC_PROBE(journalFlushCycles);
+  JournalOp op;
+  uint8_t written = 0;
+
+  while (queue.pop(op))
+  {
+    bool ok = false;
+    switch (op.type)
+    {
+    case RECORD_BEGIN:
+      ok = journal.beginRoast(op.mode, op.name, op.periodMs);
+      break;
+    case RECORD_SAMPLES:
+      ok = journal.appendSamples(op.first, op.count, op.temperatures);
+      break;
+    case RECORD_END:
+      ok = journal.endRoast(op.finished, op.phases);
+      break;
+    }
+    written += ok;
+  }
+
+  return written;
+}
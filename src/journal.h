@@ -0,0 +1,190 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "profile.h"
+#include "spsc_queue.h"
+
+#define JOURNAL_SLOTS 8            // Segment files, reused as a ring
+#define JOURNAL_SEGMENT_SIZE 32768 // Bytes of a segment before the next roast goes to the next one
+#define JOURNAL_BATCH 60           // Samples per record (a minute at HISTORY_PERIOD)
+#define JOURNAL_INDEX_SIZE 64      // Latest roasts listed
+#define JOURNAL_CHUNK 512          // Bytes read from the flash at a time
+#define JOURNAL_PATH_LENGTH 20
+
+// Types of record
+#define RECORD_SEGMENT 1 // First of every segment: its sequence number
+#define RECORD_BEGIN 2   // A roast started
+#define RECORD_SAMPLES 3 // Batch of temperatures of the roast
+#define RECORD_END 4     // The roast ended
+
+#define RECORD_HEADER 8 // Magic, type, length (2) & CRC-32 (4)
+#define RECORD_PAYLOAD_MAX (8 + JOURNAL_BATCH)
+
+// A roast of the journal
+struct JournalEntry
+{
+  uint32_t id;
+  uint32_t segment;  // Sequence number of the segment that holds it
+  uint32_t offset;   // Of its begin record in the segment
+  uint16_t periodMs; // Between samples
+  uint16_t samples;  // In its records (a batch lost on the way leaves a gap)
+  uint8_t mode;
+  char name[PROFILE_NAME_LENGTH + 1];
+  bool complete;      // Its end record is there, it wasn't cut by a reset or a power loss
+  bool finished;      // The profile ran to the end (it wasn't switched off)
+  uint16_t phases[3]; // Seconds of drying, browning & development
+};
+
+// Writes to the flash
+struct JournalStats
+{
+  uint32_t records;
+  uint32_t bytes;
+  uint32_t segments; // Segments started, each one rewrites a slot once
+  uint32_t failures; // Writes that didn't make it
+};
+
+// Sequential reader of the records of a segment, a chunk of the file at a time
+class SegmentReader
+{
+public:
+  // Start at offset of the segment file in slot
+  void open(uint8_t slot, uint32_t offset);
+
+  // Next record with a good CRC. False at the end of the segment, or at
+  // bytes that aren't a record (see torn())
+  bool next(uint8_t &type, uint8_t *payload, uint16_t &length);
+
+  uint32_t position() const { return offset; } // Of the next record
+  bool torn() const { return bad; }
+
+private:
+  bool fill(uint32_t length); // Get [offset, offset + length) in the buffer
+
+  char path[JOURNAL_PATH_LENGTH];
+  uint32_t offset;
+  uint8_t buffer[JOURNAL_CHUNK];
+  uint32_t bufferStart;
+  uint32_t bufferLength;
+  bool bad;
+};
+
+// Log-structured journal of the roasts on the flash (through the storage of
+// the HAL). Records are only appended, to segment files reused as a ring, so
+// every byte of a slot is written once per turn of the ring, & the oldest
+// roasts go when their segment is reused. Every record has a CRC: after a
+// reset or a power loss the journal keeps the records up to the first torn
+// one, & goes on in the next segment. One task writes, the index can be read
+// by others with a lock held around both
+class RoastJournal
+{
+public:
+  RoastJournal();
+
+  // Scan the segments & rebuild the index
+  void begin();
+
+  // Writer. Each returns false if the record didn't make it to the flash
+  bool beginRoast(uint8_t mode, const char *name, uint16_t periodMs);
+  bool appendSamples(uint16_t first, uint8_t count, const int16_t *temperatures);
+  bool endRoast(bool finished, const uint16_t phases[3]);
+  uint32_t current() const { return writing; } // Id of the roast being written, 0 if none
+
+  // Index, 0 is the oldest roast
+  uint8_t count() const { return entryCount; }
+  const JournalEntry &entry(uint8_t index) const { return entries[(firstEntry + index) % JOURNAL_INDEX_SIZE]; }
+  const JournalEntry *find(uint32_t id) const;
+
+  const JournalStats &getStats() const { return stats; }
+
+private:
+  void scan(uint8_t slot, uint32_t segment);
+  JournalEntry *add(uint32_t id);
+  JournalEntry *findEntry(uint32_t id);
+  bool nextSegment();
+  bool write(uint8_t type, const uint8_t *payload, uint16_t length);  // Starts the next segment if needed
+  bool append(uint8_t type, const uint8_t *payload, uint16_t length); // To the current one
+
+  JournalEntry entries[JOURNAL_INDEX_SIZE]; // Ring of the latest roasts
+  uint8_t firstEntry;
+  uint8_t entryCount;
+
+  uint32_t nextId;
+  uint32_t segment;     // Sequence number of the segment appended to
+  uint32_t segmentSize; // Its bytes
+  bool hasSegment;      // There's a segment to append to
+  bool needsSegment;    // Its tail is torn (or a write failed), go on in the next one
+  uint32_t writing;     // Roast being written
+  JournalStats stats;
+};
+
+// Samples of a roast in the journal, in order
+class JournalReader
+{
+public:
+  // False if the segment of the roast was reused since
+  bool open(const JournalEntry &entry);
+
+  // Copy the next temperatures, up to max. Returns how many, 0 at the end
+  size_t read(int16_t *temperatures, size_t max);
+
+  // Point to the rest of the current batch, or to the next one: the differences
+  // between its temperatures fit a byte. Returns how many, 0 at the end
+  size_t nextBatch(const int16_t *&temperatures);
+
+private:
+  bool load(); // Decode the next record of the roast. False at its end
+
+  SegmentReader reader;
+  uint32_t id;
+  int16_t batch[JOURNAL_BATCH]; // Decoded record
+  uint8_t batchCount;
+  uint8_t batchNext;
+  bool done;
+};
+
+// Record to write, handed from the loop to the task that writes the journal
+struct JournalOp
+{
+  uint8_t type; // RECORD_BEGIN, RECORD_SAMPLES or RECORD_END
+  uint8_t mode;
+  char name[PROFILE_NAME_LENGTH + 1];
+  uint16_t periodMs;
+  bool finished;
+  uint16_t phases[3];
+  uint16_t first; // Of the samples
+  uint8_t count;
+  int16_t temperatures[JOURNAL_BATCH];
+};
+
+// Cuts the samples of a roast into batches on the loop, without touching the
+// flash: the records go through a queue to the task that writes them
+class RoastRecorder
+{
+public:
+  RoastRecorder();
+
+  // Producer side (the loop)
+  void begin(uint8_t mode, const char *name, uint16_t periodMs);
+  void sample(int16_t temperature);
+  void end(bool finished, const uint16_t phases[3]);
+  bool recording() const { return active; }
+  bool pending() const { return queue.size() > 0; }
+  uint32_t dropped() const { return queue.dropped(); } // Records lost to a full queue
+
+  // Consumer side: write the queued records. Returns how many were written
+  uint8_t flush(RoastJournal &journal);
+
+private:
+  void push(); // Queue the batch
+
+  SpscQueue<JournalOp, 4> queue;
+  JournalOp batch; // Being filled
+  uint16_t samples;
+  bool active;
+};
+
+#endif
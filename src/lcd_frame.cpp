@@ -0,0 +1,98 @@
+#include "lcd_frame.h"
+
+#include <string.h>
+
+// Unchanged cells a run may cover rather than starting a new one. Moving the
+// cursor costs as much as writing one character
+#define RUN_MAX_GAP 1
+
+LcdFrame::LcdFrame() : known(false)
+{
+  memset(wanted, ' ', sizeof(wanted));
+  memset(shown, ' ', sizeof(shown));
+}
+
+bool LcdFrame::print(uint8_t row, const char *text)
+{
+  if (row >= LCD_ROWS)
+  {
+    return false;
+  }
+
+  char line[LCD_COLUMNS];
+  uint8_t col = 0;
+  for (; col < LCD_COLUMNS && text[col]; col++)
+  {
+    line[col] = text[col];
+  }
+  for (; col < LCD_COLUMNS; col++)
+  {
+    line[col] = ' ';
+  }
+
+  if (memcmp(line, wanted[row], LCD_COLUMNS) == 0)
+  {
+    return false;
+  }
+
+  memcpy(wanted[row], line, LCD_COLUMNS);
+  return true;
+}
+
+void LcdFrame::invalidate()
+{
+  known = false;
+}
+
+bool LcdFrame::dirty() const
+{
+  return !known || memcmp(wanted, shown, sizeof(wanted)) != 0;
+}
+
+uint8_t LcdFrame::flush(LcdRunWriter writer)
+{
+  uint8_t runs = 0;
+
+  for (uint8_t row = 0; row < LCD_ROWS; row++)
+  {
+    uint8_t col = 0;
+    while (col < LCD_COLUMNS)
+    {
+      // Start of the next changed cell
+      if (known && wanted[row][col] == shown[row][col])
+      {
+        col++;
+        continue;
+      }
+
+      // Extend the run while the next changed cell is close enough
+      uint8_t end = col + 1;
+      uint8_t gap = 0;
+      for (uint8_t next = end; next < LCD_COLUMNS && gap <= RUN_MAX_GAP; next++)
+      {
+        if (!known || wanted[row][next] != shown[row][next])
+        {
+          end = next + 1;
+          gap = 0;
+        }
+        else
+        {
+          gap++;
+        }
+      }
+
+      if (!writer(col, row, (const uint8_t *)&wanted[row][col], end - col))
+      {
+        // The cells still differ from shown, they are retried on the next flush
+        return runs;
+      }
+
+      memcpy(&shown[row][col], &wanted[row][col], end - col);
+      runs++;
+      col = end;
+    }
+  }
+
+  known = true;
+  return runs;
+}
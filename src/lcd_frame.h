@@ -0,0 +1,37 @@
+#ifndef LCD_FRAME_H
+#define LCD_FRAME_H
+
+#include <stdint.h>
+
+#define LCD_COLUMNS 16
+#define LCD_ROWS 2
+
+// Writes a run of characters at a position of the display. Returns false if it couldn't (e.g. queue full)
+typedef bool (*LcdRunWriter)(uint8_t col, uint8_t row, const uint8_t *text, uint8_t length);
+
+// Text wanted on the 16x2 display & a shadow copy of what is on it. Only the
+// cells that differ are sent on flush, grouped in runs
+class LcdFrame
+{
+public:
+  LcdFrame();
+
+  // Set the text of a row, padded with spaces. Returns whether the row changed
+  bool print(uint8_t row, const char *text);
+
+  // Forget what is on the display (e.g. after it was cleared), so the next flush writes every cell
+  void invalidate();
+
+  // Whether some cell has to be written
+  bool dirty() const;
+
+  // Write the changed cells. Cells of a run the writer couldn't take stay dirty. Returns the number of runs written
+  uint8_t flush(LcdRunWriter writer);
+
+private:
+  char wanted[LCD_ROWS][LCD_COLUMNS];
+  char shown[LCD_ROWS][LCD_COLUMNS];
+  bool known; // shown matches the display
+};
+
+#endif
@@ -1,17 +1,37 @@
 #include <Arduino.h>
 
-#include <WiFi.h>
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <ArduinoJson.h>
 
 #include "SPIFFS.h"
-
-#include <Wire.h>
-#include <LiquidCrystal_I2C.h>
-
-#include "DHT.h"
-#include "max6675.h"
+#include <esp_timer.h>
+#include <esp_system.h>
+
+#include <memory>
+
+#include "assets.h"
+#include "boot_timeline.h"
+#include "commands.h"
+#include "control_channel.h"
+#include "filter.h"
+#include "hal.h"
+#include "pins.h"
+#include "roaster.h"
+#include "scheduler.h"
+#include "seqlock.h"
+#include "spsc_queue.h"
+#include "history.h"
+#include "journal.h"
+#include "roast_export.h"
+#include "event_backlog.h"
+#include "lcd_frame.h"
+#include "metrics.h"
+#include "periods.h"
+#include "request_body.h"
+#include "safety.h"
+#include "telemetry.h"
+#include "wifi_link.h"
 
 #if __has_include("env.h")
 
@@ -28,144 +48,527 @@
 
 #endif
 
-#define LCD_SDA 21
-#define LCD_SCL 22
-#define MAX_SCK 5
-#define MAX_CS 23
-#define MAX_SO 19
-#define DHT_PIN 18
-#define MOTOR1_PIN 25 // 25, but internal LED (2) for debugging
-#define MOTOR2_PIN 26
-#define MOTOR3_PIN 27
-#define BUZZER_PIN 14
-#define TIME_A 36
-#define TIME_B 34
-#define TIME_C 35
-#define TIME_ADDER 12
-#define TIME_REDUCER 13
+// Access point of the roaster when the router can't be joined (see WifiLink)
+#ifndef WIFI_AP_SSID
+#define WIFI_AP_SSID "Roaster"
+#endif
+#ifndef WIFI_AP_PASSWORD
+#define WIFI_AP_PASSWORD WIFI_PASSWORD
+#endif
+
+#define SAMPLER_CORE 0 // The loop runs on core 1, keep the slow sensor protocols away from it
+#define SAMPLER_PRIORITY 2
+#define SAMPLER_STACK 4096
+
+#define JOURNAL_CORE 0 // Flash writes of the roast journal, below the sampler
+#define JOURNAL_PRIORITY 1
+#define JOURNAL_STACK 4096
+
+#define SAFETY_CORE 1 // The safety supervisor, with the loop & above it: it runs whatever the loop is stuck in
+#define SAFETY_PRIORITY 5
+#define SAFETY_STACK 3072
+
+#define INIT_CORE 0 // Brings up the slow peripherals (LCD, WiFi, web server) while the loop already runs
+#define INIT_PRIORITY 1
+#define INIT_STACK 8192
+
+#define BOOT_CONTROL_TARGET 500000 // µs from the start of the firmware to the first control run
 
 AsyncWebServer server(80);          // Create AsyncWebServer object on port 80
 AsyncEventSource events("/events"); // Create an Event Source on /events
+EventBacklog eventBacklog;     // Latest /events events, replayed to reconnecting clients
+SemaphoreHandle_t eventsLock; // Serializes the /events ids, backlog & sends between the loop & AsyncTCP tasks
+uint32_t lastEventId = 0;     // Last id given to an /events event
 
-// As a thumb rule, 32 bytes for every key/value pair inside the json
-StaticJsonDocument<64> readings; // JSON Variable to Hold Sensor Readings
-StaticJsonDocument<64> timer;    // JSON Variable to Hold Time Values
-StaticJsonDocument<128> states;  // JSON Variable to Hold Motor States Values
+AsyncEventSource compactEvents("/events/compact"); // Opt-in Event Source with only the changed values (see DeltaEncoder)
 
-LiquidCrystal_I2C lcd(0x27, 16, 2); // addr, width (16), height(2) -> 16x2 LCD
+DeltaEncoder compactEncoder;                   // State of the compact stream
+volatile bool compactKeyframePending = true;  // A client connected to the compact stream & needs every value
 
-DHT dht(DHT_PIN, DHT22);                       // PIN, MODEL
-MAX6675 thermocouple(MAX_SCK, MAX_CS, MAX_SO); // SCK, CS, SO
+AsyncWebSocket control("/control"); // Binary channel of the page for the motors & the timer (see control_channel.h)
+ControlSessions controlSessions;    // Latest commands applied by each page, so a command sent again isn't applied twice
 
-int temperature, humidity; // Hold the current value of the temperature & humidity
+// Commands of the control channel
+struct
+{
+  uint32_t applied;
+  uint32_t duplicates; // Sent again after a lost ack, not applied again
+  uint32_t busy;       // Refused on a full queue to the loop
+  uint32_t invalid;
+} controlStats;
+
+LcdFrame lcdFrame; // Shadow of the display, only the changed cells are written
+
+BootTimeline bootTimeline(halMicros); // Stages of the boot, for /debug/boot
+volatile bool lcdReady = false;       // The display was set up by the init task
+volatile bool wifiReady = false;      // The WiFi link was started by the init task
+
+WifiLink wifiLink; // Connection to the router, joined in the background
+int wifiTaskId = -1;
+
+AssetTable assets; // Files of the page & their ETags (built by scripts/build_assets.py), kept in memory
+
+// Responses to the requests of the page files
+struct
+{
+  uint32_t served;      // Sent from the flash
+  uint32_t notModified; // 304s, answered from memory
+} assetStats;
+
+#ifdef METRICS
+// Probes of the board for /metrics (the scheduled tasks are timed by their scheduler)
+struct
+{
+  CycleHistogram eventSend;   // events.send() of an /events event
+  CycleHistogram compactSend; // compactEvents.send()
+  CycleHistogram httpData;    // Handlers of the web server (a chunk for the streamed ones)
+  CycleHistogram httpHistory;
+  CycleHistogram httpRoasts;
+  CycleHistogram httpMetrics;
+  uint32_t eventsSent;
+  uint32_t eventsDropped; // Sent while the queues of the clients were full, dropped by the library
+} boardMetrics;
+#endif
 
-const char *mainTitle = "Tostador                ";
+// I2C traffic & time of the LCD refreshes (time spent by the loop, the transfers are sent by the LCD task)
+struct LCDStats
+{
+  uint32_t frames;       // Refreshes that wrote something
+  uint32_t bytes;        // I2C bytes of the last refresh
+  uint32_t transactions; // I2C transactions of the last refresh
+  uint32_t micros;       // Duration of the last refresh
+  uint32_t maxMicros;    // Longest refresh
+} lcdStats;
+
+// Sensor values published by the sampler task
+struct SensorReadings
+{
+  Readings values;            // Filtered, with their quality
+  uint32_t temperatureMillis; // millis() of the last thermocouple read
+  uint32_t humidityMillis;    // millis() of the last DHT read
+};
+
+Seqlock<SensorReadings> sensorReadings; // Latest readings, can be read from any task without blocking the sampler
+SensorReadings sampledReadings;         // Working copy, only touched by the sampler task
+SensorFilter thermocoupleFilter(THERMOCOUPLE_FILTER); // Filters of the sampler task
+SensorFilter humidityFilter(HUMIDITY_FILTER);
+
+Scheduler scheduler(halMicros);        // Cooperative scheduler that runs every periodic job of the loop
+Scheduler samplerScheduler(halMicros); // Runs the sensor reads inside the sampler task
+TaskHandle_t samplerHandle;
+
+History history; // Latest samples of the roast, sample n was taken n * HISTORY_PERIOD ms after the loop started
+
+RoastJournal journal;        // Past roasts on the flash, written by the journal task only
+RoastRecorder roastRecorder; // Batches of the roast samples, from the loop to the journal task
+SemaphoreHandle_t journalLock; // Serializes the journal between its task & the AsyncTCP task
+TaskHandle_t journalTask;
+int lcdTaskId = -1;          // Scheduler id of the LCD task, used to trigger a refresh on change
+
+// The ISRs & the tasks that can't touch the roaster hand their inputs to the
+// loop as commands, through one queue, and their wakes through another, and wake it up
+CommandPipeline commands;              // From the button ISRs, the switches task & the AsyncTCP task
+SpscQueue<uint32_t, 4> countdownWakes; // From the countdown esp_timer: when it fired (µs)
+TaskHandle_t loopTask;                 // Task of setup() & loop()
+uint8_t lastSwitchPosition = 0xff;     // Last position of the 3-state switch posted, none at boot
+volatile uint32_t lastPressMicros = 0; // Last press posted by the button ISRs, so their bounces don't fill the queue
+
+esp_timer_handle_t countdownTimer; // Wakes the loop when the timer shows another second
+int64_t countdownWakeTarget = 0;   // When it should fire (µs)
+int timerTaskId = -1;
+
+// Lateness of the countdown esp_timer
+struct
+{
+  uint32_t wakes;
+  uint32_t lastLateUs;
+  uint32_t maxLateUs;
+} countdownWakeStats;
 
-int timerCount;                     // Used to count the number of timers that have run
-int counter;                        // Used to count (decrease) from totalTimeInSeconds to 0
-int totalTimeInSeconds;             // Used to hold the total number of seconds to run
-bool timerIsOn = false;             // Represent an active timer
-bool timerResponseIsActive = false; // Represent a timer response (after a timer finishes) is active
-bool isTimeA, isTimeB, isTimeC;     // Represent the selection of a timer configuration for the 3-state switch. Only one is true
-int lastMillis = 0;                 // Used to software dounce the push buttons for timer control
+void setLCDRow(uint8_t row, const char *text);
+void sendStatesEvent();
 
-bool motors23Activated = false; // Used to turn on the motors 2 & 3 only once every timer response
+Roaster roaster(setLCDRow, sendStatesEvent); // Switch, profiles, timer, motors & heater
 
-const int MAX_TEMP_LIMIT = 1000;      // Set a large value for max temperature limit
-const float TIMER_DURATION_DEBUG = 0; // Set a default timer duration for debugging. Set 0 for production
+// Set the text of a LCD row. It is only written to the display (by the LCD task) if it changed
+void setLCDRow(uint8_t row, const char *text)
+{
+  if (lcdFrame.print(row, text))
+  {
+    scheduler.trigger(lcdTaskId);
+  }
+}
 
-// Get Sensor Readings and return JSON object
-String getSensorReadings()
+// Write the changed cells to the LCD
+void refreshLCD()
 {
-  // Update readings
-  humidity = (int)dht.readHumidity();
-  temperature = (int)thermocouple.readCelsius();
+  if (!lcdReady || !lcdFrame.dirty())
+  {
+    return;
+  }
 
-  // LCD
-  lcd.setCursor(0, 1); // Set the cursor to column 0, row 1
-  lcd.printf("T: %dC H: %d%%   ", temperature, humidity);
+  halDisplayResetStats();
+  uint32_t start = micros();
 
-  // JSON
-  readings.clear();
-  readings["temperature"] = String(temperature);
-  readings["humidity"] = String(humidity);
+  lcdFrame.flush(halDisplayWrite);
 
-  String json;
-  serializeJson(readings, json);
+  HalDisplayStats display = halDisplayStats();
+  lcdStats.micros = micros() - start;
+  lcdStats.maxMicros = max(lcdStats.maxMicros, lcdStats.micros);
+  lcdStats.bytes = display.bytes;
+  lcdStats.transactions = display.transactions;
+  lcdStats.frames++;
+}
+
+// Get an id for an /events event: millis(), but always increasing (call with eventsLock taken)
+uint32_t nextEventId()
+{
+  lastEventId = max(lastEventId + 1, (uint32_t)millis());
+  return lastEventId;
+}
+
+// Send an event to the /events clients & keep it in the backlog (event must be a string literal)
+void publishEvent(const char *payload, const char *event)
+{
+  xSemaphoreTake(eventsLock, portMAX_DELAY);
+
+  uint32_t id = nextEventId();
+  if (event)
+  {
+    eventBacklog.add(id, event, payload);
+  }
+  {
+    METRIC_PROBE(boardMetrics.eventSend);
+    METRIC_ADD(boardMetrics.eventsDropped, events.count() && events.avgPacketsWaiting() >= SSE_MAX_QUEUED_MESSAGES);
+    events.send(payload, event, id);
+    METRIC_ADD(boardMetrics.eventsSent, 1);
+  }
 
-  return json;
+  xSemaphoreGive(eventsLock);
 }
 
-// Get Time Values and return JSON object
-String getTimeValues()
+// Send the latest Sensor Readings to the web clients
+void sendReadingsEvent()
 {
-  // JSON
-  timer.clear();
-  timer["total"] = String(totalTimeInSeconds);
-  timer["time"] = String(counter);
+  SensorReadings latest = sensorReadings.read();
 
-  String json;
-  serializeJson(timer, json);
+  char payload[TELEMETRY_BUFFER_SIZE];
+  if (writeReadings(payload, sizeof(payload), latest.values))
+  {
+    publishEvent(payload, "readings");
+  }
+}
 
-  return json;
+// Send the Time Values to the web clients
+void sendTimerEvent()
+{
+  char payload[TELEMETRY_BUFFER_SIZE];
+  if (writeTimer(payload, sizeof(payload), roaster.getTimeValues()))
+  {
+    publishEvent(payload, "timer");
+  }
 }
 
-// Get Motor States and return JSON object
-String getMotorStates()
+// Send the rate of rise & the phases of the roast to the web clients
+void sendAnalyticsEvent()
 {
-  states.clear();
-  states["motor1"] = !!digitalRead(MOTOR1_PIN);
-  states["motor2"] = !!digitalRead(MOTOR2_PIN);
-  states["motor3"] = !!digitalRead(MOTOR3_PIN);
+  char payload[TELEMETRY_BUFFER_SIZE];
+  if (writeAnalytics(payload, sizeof(payload), roaster.getMetrics()))
+  {
+    publishEvent(payload, "analytics");
+  }
+}
 
-  String json;
-  serializeJson(states, json);
+// Push the motors & the timer to the pages on the control channel
+void sendControlState()
+{
+  if (control.count())
+  {
+    uint8_t frame[CONTROL_STATE_SIZE];
+    control.binaryAll(frame, encodeControlState(frame, roaster.getMotorStates(), roaster.getTimeValues()));
+  }
+}
+
+// Send the Motor States to the web clients
+void sendStatesEvent()
+{
+  char payload[TELEMETRY_BUFFER_SIZE];
+  if (writeStates(payload, sizeof(payload), roaster.getMotorStates()))
+  {
+    publishEvent(payload, "states");
+  }
+  sendControlState();
+}
 
-  return json;
+// Hand a command to the loop & wake it up (AsyncTCP & switches tasks). False if the queue is full
+bool postCommand(uint8_t type, uint8_t source, uint8_t arg, int32_t value)
+{
+  Command command = {type, source, arg, value, (uint32_t)esp_timer_get_time()};
+  if (!commands.post(command))
+  {
+    return false;
+  }
+  xTaskNotifyGive(loopTask);
+  return true;
 }
 
-// Initialize SPIFFS
-void initSPIFFS()
+// Gather the JSON body of a command from its chunks & post the commands it
+// holds (AsyncTCP task). Answered once the last chunk is in
+void postCommandBody(uint8_t type, AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
 {
-  if (!SPIFFS.begin(true))
+  const char *body;
+  size_t length;
+  switch (gatherBody(&request->_tempObject, data, len, index, total, &body, &length))
+  {
+  case BODY_COMPLETE:
+    break;
+  case BODY_TOO_LARGE:
+    request->send(413, "text/plain", "too large");
+    return;
+  case BODY_NO_MEMORY:
+    request->send(503, "text/plain", "busy");
+    return;
+  default:
+    return;
+  }
+
+  BodyCommands parsed = parseBodyCommands(type, body, length, roaster);
+  if (parsed.status != 200)
   {
-    Serial.println("An Error has occurred while mounting SPIFFS");
+    request->send(parsed.status, "text/plain", parsed.error);
     return;
   }
+
+  // The loop applies them & sends the new states. Each sets a value, so sending them again after a 503 is harmless
+  for (uint8_t i = 0; i < parsed.count; i++)
+  {
+    const Command &command = parsed.commands[i];
+    if (!postCommand(command.type, command.source, command.arg, command.value))
+    {
+      request->send(503, "text/plain", "busy");
+      return;
+    }
+  }
+  request->send(200, "text/plain", "ok");
 }
 
-// Initialize WiFi
+// Apply a frame of the control channel & ack it (AsyncTCP task)
+void handleControlFrame(AsyncWebSocketClient *client, const uint8_t *data, size_t length)
+{
+  ControlCommand command;
+  uint8_t frame[CONTROL_STATE_SIZE];
+
+  if (!decodeControlCommand(data, length, command))
+  {
+    controlStats.invalid++;
+    client->binary(frame, encodeControlAck(frame, length >= 3 ? data[1] | (data[2] << 8) : 0, CONTROL_INVALID));
+    return;
+  }
+
+  uint8_t status = CONTROL_APPLIED;
+  switch (command.type)
+  {
+  case CONTROL_HELLO:
+    controlSessions.open(client->id(), command.session);
+    break;
+
+  case CONTROL_STATE_REQUEST:
+    client->binary(frame, encodeControlState(frame, roaster.getMotorStates(), roaster.getTimeValues()));
+    break;
+
+  default:
+    status = controlSessions.check(client->id(), command.seq);
+    if (status != CONTROL_APPLIED)
+    {
+      break;
+    }
+
+    // The loop applies it & pushes the new state
+    if (!(command.type == CONTROL_MOTOR ? postCommand(COMMAND_MOTOR, COMMAND_FROM_CONTROL, command.motor, command.on)
+                                        : postCommand(COMMAND_TIME, COMMAND_FROM_CONTROL, 0, command.seconds)))
+    {
+      status = CONTROL_BUSY;
+      break;
+    }
+    controlSessions.applied(client->id(), command.seq);
+  }
+
+  controlStats.applied += status == CONTROL_APPLIED;
+  controlStats.duplicates += status == CONTROL_DUPLICATE;
+  controlStats.busy += status == CONTROL_BUSY;
+  controlStats.invalid += status == CONTROL_INVALID;
+  client->binary(frame, encodeControlAck(frame, command.seq, status));
+}
+
+// Hand a connection event to the loop (WiFi event task)
+void networkEvent(uint8_t event)
+{
+  wifiLink.post(event);
+  xTaskNotifyGive(loopTask);
+}
+
+// Start joining the router (init task). It goes on in the background, the roaster works without it
 void initWifi(const char *ssid, const char *password)
 {
   Serial.print("Connecting to ");
   Serial.println(ssid);
-  WiFi.begin(ssid, password);
 
-  while (WiFi.status() != WL_CONNECTED)
+  halNetworkBegin(networkEvent);
+  wifiLink.begin(ssid, password, WIFI_AP_SSID, WIFI_AP_PASSWORD);
+  wifiReady = true;
+}
+
+// Follow the connection: joins, retries & the access point
+void handleWifi()
+{
+  if (!wifiReady || !wifiLink.poll())
   {
-    delay(1000);
-    Serial.println(".");
+    return;
   }
 
-  Serial.print("IP: ");
-  Serial.println(WiFi.localIP());
+  char address[16];
+  halNetworkAddress(address, sizeof(address));
 
-  lcd.setCursor(0, 1);
-  lcd.print(WiFi.localIP());
+  if (wifiLink.isOnline())
+  {
+    Serial.print("IP: ");
+    Serial.println(address);
+    setLCDRow(1, address);
+  }
+  else if (wifiLink.accessPointOn())
+  {
+    Serial.printf("Offline, access point %s on %s\n", WIFI_AP_SSID, address);
+  }
+  else
+  {
+    Serial.println("WiFi lost, joining again");
+  }
 }
 
-// Initialize LCD
-void initLCD(const char *title)
+// Initialize LCD (init task). The loop writes the rows it was given meanwhile
+void initLCD()
 {
-  Wire.begin(LCD_SDA, LCD_SCL);
-  lcd.init();
-  lcd.backlight();
-  lcd.print(title);
+  halDisplayBegin();
+  lcdReady = true;
 }
 
+// Serves the files of the asset list gzipped, with their ETag & how long they can be cached. A
+// client that already has one gets a 304 without the flash being read
+class AssetHandler : public AsyncWebHandler
+{
+public:
+  bool canHandle(AsyncWebServerRequest *request) override
+  {
+    if (request->method() != HTTP_GET || !assets.find(request->url().c_str()))
+    {
+      return false;
+    }
+    request->addInterestingHeader("If-None-Match");
+    return true;
+  }
+
+  void handleRequest(AsyncWebServerRequest *request) override
+  {
+    const Asset *asset = assets.find(request->url().c_str());
+    AsyncWebHeader *match = request->getHeader("If-None-Match");
+    AsyncWebServerResponse *response;
+
+    if (match && etagMatches(match->value().c_str(), asset->etag))
+    {
+      response = request->beginResponse(304);
+      assetStats.notModified++;
+    }
+    else
+    {
+      // Sends url.gz with its Content-Encoding when the file is gzipped
+      response = request->beginResponse(SPIFFS, asset->url, assetContentType(asset->url));
+      assetStats.served++;
+    }
+
+    char etag[ASSET_ETAG_LENGTH + 3];
+    snprintf(etag, sizeof(etag), "\"%s\"", asset->etag);
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", asset->immutable ? ASSET_IMMUTABLE_CACHE : ASSET_REVALIDATE_CACHE);
+    request->send(response);
+  }
+};
+
+// Load the asset list written by the build. Without it the files are served as they are
+void initAssets()
+{
+  char manifest[ASSETS_MANIFEST_SIZE];
+  size_t length = halReadFile(ASSETS_MANIFEST, manifest, sizeof(manifest) - 1);
+  manifest[length] = '\0';
+
+  if (assets.load(manifest) == 0)
+  {
+    Serial.println("No " ASSETS_MANIFEST ", serving the page uncompressed");
+  }
+}
+
+// Append a line of /metrics to its response
+void printMetricsLine(const char *line, void *response)
+{
+  ((AsyncResponseStream *)response)->print(line);
+}
+
+#ifdef METRICS
+// The probes of the board, the free stack of its tasks & the event streams
+void writeBoardMetrics(MetricsWriter &out)
+{
+  out.family("roaster_sse_send_cycles", "histogram", "CPU cycles of sending an event to the clients of a stream");
+  out.histogram("roaster_sse_send_cycles", "stream=\"events\"", boardMetrics.eventSend);
+  out.histogram("roaster_sse_send_cycles", "stream=\"compact\"", boardMetrics.compactSend);
+
+  out.family("roaster_http_cycles", "histogram", "CPU cycles of a request of the web server (a chunk for the streamed ones)");
+  out.histogram("roaster_http_cycles", "handler=\"data\"", boardMetrics.httpData);
+  out.histogram("roaster_http_cycles", "handler=\"history\"", boardMetrics.httpHistory);
+  out.histogram("roaster_http_cycles", "handler=\"roasts\"", boardMetrics.httpRoasts);
+  out.histogram("roaster_http_cycles", "handler=\"metrics\"", boardMetrics.httpMetrics);
+
+  out.family("roaster_sse_clients", "gauge", "Clients of an event stream");
+  out.value("roaster_sse_clients", "stream=\"events\"", events.count());
+  out.value("roaster_sse_clients", "stream=\"compact\"", compactEvents.count());
+  out.family("roaster_sse_queue_depth", "gauge", "Messages waiting to be sent, per client (average)");
+  out.value("roaster_sse_queue_depth", "stream=\"events\"", events.avgPacketsWaiting());
+  out.value("roaster_sse_queue_depth", "stream=\"compact\"", compactEvents.avgPacketsWaiting());
+  out.family("roaster_sse_events_total", "counter", "Events sent to the /events clients");
+  out.value("roaster_sse_events_total", NULL, boardMetrics.eventsSent);
+  out.family("roaster_sse_dropped_total", "counter", "Events sent while the queues of the /events clients were full");
+  out.value("roaster_sse_dropped_total", NULL, boardMetrics.eventsDropped);
+
+  const struct
+  {
+    const char *name;
+    TaskHandle_t handle;
+  } tasks[] = {
+      {"loop", loopTask},
+      {"sampler", samplerHandle},
+      {"journal", journalTask},
+      {"lcd", xTaskGetHandle("lcd")},
+      {"async_tcp", xTaskGetHandle("async_tcp")},
+      {"esp_timer", xTaskGetHandle("esp_timer")},
+  };
+
+  char labels[32];
+  out.family("roaster_stack_free_bytes", "gauge", "Lowest free stack of a task since it started");
+  for (size_t i = 0; i < sizeof(tasks) / sizeof(tasks[0]); i++)
+  {
+    if (tasks[i].handle)
+    {
+      snprintf(labels, sizeof(labels), "task=\"%s\"", tasks[i].name);
+      out.value("roaster_stack_free_bytes", labels, uxTaskGetStackHighWaterMark(tasks[i].handle));
+    }
+  }
+}
+#endif
+
 // Initialize Server
 void initServer()
 {
+  // The page files, gzipped & cached (before the plain files of the flash)
+  server.addHandler(new AssetHandler());
+
   // Web Server Root URL
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
             { request->send(SPIFFS, "/index.html", "text/html"); });
@@ -181,322 +584,883 @@ void initServer()
   // Request for the latest sensor readings
   server.on("/data", HTTP_GET, [](AsyncWebServerRequest *request)
             {
-              DynamicJsonDocument data(256);
-
-              // Create the objects
-              StaticJsonDocument<64> timerValues;
-              StaticJsonDocument<64> readingsValues;
-              StaticJsonDocument<128> statesValues;
-
-              // Get values into objects
-              deserializeJson(timerValues, getTimeValues());
-              deserializeJson(readingsValues, getSensorReadings());
-              deserializeJson(statesValues, getMotorStates());
-              
-              // Add objects to the DynamicJsonDocument
-              data["timer"] = timerValues.as<JsonVariant>();
-              data["readings"] = readingsValues.as<JsonVariant>();
-              data["states"] = statesValues.as<JsonVariant>();
-              
+              METRIC_PROBE(boardMetrics.httpData);
+              SensorReadings latest = sensorReadings.read();
+
+              char json[TELEMETRY_BUFFER_SIZE];
+              writeData(json, sizeof(json), latest.values, roaster.getTimeValues(), roaster.getMotorStates(), roaster.getMetrics());
+
+              request->send(200, "application/json", json); });
+
+  // Samples of the roast in [from, to) as [[n,temperature,humidity,timer,flags],...], streamed in chunks
+  server.on("/history", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              uint32_t from = history.first();
+              uint32_t to = history.end();
+
+              if (request->hasParam("from"))
+              {
+                from = max(from, (uint32_t)request->getParam("from")->value().toInt());
+              }
+              if (request->hasParam("to"))
+              {
+                to = min(to, (uint32_t)request->getParam("to")->value().toInt());
+              }
+
+              HistoryStream stream(history, from, to);
+              request->send(request->beginChunkedResponse("application/json", [stream](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t
+                                                          {
+                                                            METRIC_PROBE(boardMetrics.httpHistory);
+
+                                                            // Nothing fit but it isn't over, ask to be called again
+                                                            size_t length = stream.fill(buffer, maxLen);
+                                                            return length == 0 && !stream.done() ? RESPONSE_TRY_AGAIN : length; })); });
+
+  // Roasts of the journal as [{...},...], the latest first. /roasts/<id> gets one with its
+  // temperatures as JSON, /roasts/<id>.csv as CSV & /roasts/<id>.bin in binary (see
+  // RoastExport), streamed in chunks from the flash
+  server.on("/roasts", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              METRIC_PROBE(boardMetrics.httpRoasts);
+              char json[ROAST_JSON_MAX + 1];
+              const String &url = request->url();
+
+              if (url.length() > 8)
+              {
+                uint32_t id = url.substring(8).toInt();
+                uint8_t format = url.endsWith(".csv") ? EXPORT_CSV : url.endsWith(".bin") ? EXPORT_BINARY : EXPORT_JSON;
+
+                xSemaphoreTake(journalLock, portMAX_DELAY);
+                const JournalEntry *found = journal.find(id);
+                JournalEntry entry = found ? *found : JournalEntry();
+                xSemaphoreGive(journalLock);
+
+                std::shared_ptr<RoastExport> roast(new RoastExport(entry, format));
+                if (!found || !roast->open())
+                {
+                  request->send(404, "text/plain", "Unknown roast");
+                  return;
+                }
+
+                AsyncWebServerResponse *response = request->beginChunkedResponse(roast->contentType(), [roast](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+                                                                                 {
+                                                                                   // Nothing fit but it isn't over, ask to be called again
+                                                                                   size_t length = roast->fill(buffer, maxLen);
+                                                                                   return length == 0 && !roast->done() ? RESPONSE_TRY_AGAIN : length; });
+                if (format != EXPORT_JSON)
+                {
+                  response->addHeader("Content-Disposition", String("attachment; filename=\"roast-") + id + (format == EXPORT_CSV ? ".csv\"" : ".bin\""));
+                }
+                request->send(response);
+                return;
+              }
+
+              AsyncResponseStream *response = request->beginResponseStream("application/json");
+              response->print('[');
+
+              xSemaphoreTake(journalLock, portMAX_DELAY);
+              for (int i = journal.count() - 1; i >= 0; i--)
+              {
+                writeRoastEntry(json, sizeof(json), journal.entry(i));
+                response->print(json);
+                if (i > 0)
+                {
+                  response->print(',');
+                }
+              }
+              xSemaphoreGive(journalLock);
+
+              response->print(']');
+              request->send(response); });
+
+  // Timing statistics of the scheduled tasks (jitter & execution times in microseconds)
+  server.on("/debug/tasks", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              DynamicJsonDocument data(2048);
+
+              for (Scheduler *tasks : {&scheduler, &samplerScheduler})
+              {
+                for (size_t i = 0; i < tasks->size(); i++)
+                {
+                  const ScheduledTask &task = tasks->task(i);
+                  JsonObject stats = data.createNestedObject(task.name);
+                  stats["period"] = task.periodUs;
+                  stats["runs"] = task.runs;
+                  stats["misses"] = task.misses;
+                  stats["jitter"] = task.lastJitterUs;
+                  stats["maxJitter"] = task.maxJitterUs;
+                  stats["avgJitter"] = task.runs ? (uint32_t)(task.totalJitterUs / task.runs) : 0;
+                  stats["maxRun"] = task.maxRunUs;
+                }
+              }
+
               String json;
               serializeJson(data, json);
 
-              request->send(200, "application/json", json);
+              request->send(200, "application/json", json); });
 
-              json = String(); });
+  // How late the timer was handled: each second it shows, its end & the wakes of the countdown esp_timer
+  server.on("/debug/timer", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              const CountdownStats &countdown = roaster.getTimerStats();
+
+              char json[TELEMETRY_BUFFER_SIZE];
+              JsonWriter out(json, sizeof(json));
+              out.beginObject();
+              out.key("seconds").unsignedNumber(countdown.seconds);
+              out.key("skipped").unsignedNumber(countdown.skipped);
+              out.key("lateMs").unsignedNumber(countdown.lastLateMs);
+              out.key("maxLateMs").unsignedNumber(countdown.maxLateMs);
+              out.key("avgLateMs").unsignedNumber(countdown.seconds ? countdown.totalLateMs / countdown.seconds : 0);
+              out.key("ends").unsignedNumber(countdown.expiries);
+              out.key("endLateMs").unsignedNumber(countdown.lastExpiryLateMs);
+              out.key("wakes").unsignedNumber(countdownWakeStats.wakes);
+              out.key("wakeLateUs").unsignedNumber(countdownWakeStats.lastLateUs);
+              out.key("maxWakeLateUs").unsignedNumber(countdownWakeStats.maxLateUs);
+              out.key("droppedCommands").unsignedNumber(commands.dropped());
+              out.endObject();
+
+              request->send(200, "application/json", json); });
+
+  // Pages on the control channel & the outcome of their commands
+  server.on("/debug/control", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              char json[TELEMETRY_BUFFER_SIZE];
+              JsonWriter out(json, sizeof(json));
+              out.beginObject();
+              out.key("clients").unsignedNumber(control.count());
+              out.key("applied").unsignedNumber(controlStats.applied);
+              out.key("duplicates").unsignedNumber(controlStats.duplicates);
+              out.key("busy").unsignedNumber(controlStats.busy);
+              out.key("invalid").unsignedNumber(controlStats.invalid);
+              out.endObject();
+
+              request->send(200, "application/json", json); });
+
+  // The latest commands the loop applied, oldest first, with their outcome (?after=seq for the newer ones only)
+  server.on("/debug/commands", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              CommandLog log = commands.getLog();
+              uint32_t first = log.count > COMMAND_LOG_SIZE ? log.count - COMMAND_LOG_SIZE : 0;
+              if (request->hasParam("after"))
+              {
+                first = max(first, (uint32_t)request->getParam("after")->value().toInt() + 1);
+              }
+
+              char json[COMMAND_JSON_MAX];
+              AsyncResponseStream *response = request->beginResponseStream("application/json");
+              response->printf("{\"count\":%u,\"dropped\":%u,\"commands\":[", log.count, commands.dropped());
+              for (uint32_t seq = first; seq < log.count; seq++)
+              {
+                writeLoggedCommand(json, sizeof(json), log.entries[seq % COMMAND_LOG_SIZE]);
+                response->print(json);
+                if (seq + 1 < log.count)
+                {
+                  response->print(',');
+                }
+              }
+              response->print("]}");
+              request->send(response); });
+
+  // State of the safety supervisor: its trip, the limits it enforces & what it measured
+  server.on("/debug/safety", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              const SafetySupervisor &safety = roaster.getSafety();
+              const SafetyStats &stats = safety.getStats();
+              SafetyLimits limits = safety.getLimits();
+
+              char json[TELEMETRY_BUFFER_SIZE];
+              JsonWriter out(json, sizeof(json));
+              out.beginObject();
+              out.key("state").string(safetyCauseName(safety.getCause()));
+              out.key("armed").boolean(limits.armed);
+              out.key("maxTemperature").number(limits.maxTemperature);
+              out.key("maxRor").number(limits.maxRor);
+              out.key("ror").number(stats.ror);
+              out.key("loopStuck").unsignedNumber(stats.trips[SAFETY_LOOP_STUCK]);
+              out.key("sensorStale").unsignedNumber(stats.trips[SAFETY_SENSOR_STALE]);
+              out.key("overTemperature").unsignedNumber(stats.trips[SAFETY_OVER_TEMPERATURE]);
+              out.key("overRor").unsignedNumber(stats.trips[SAFETY_OVER_ROR]);
+              out.key("lastTripMs").unsignedNumber(stats.lastTripMs);
+              out.key("maxLoopGapMs").unsignedNumber(stats.maxLoopGapMs);
+              out.key("feeds").unsignedNumber(stats.feeds);
+              out.endObject();
+
+              request->send(200, "application/json", json); });
+
+  // Writes of the roast journal
+  server.on("/debug/journal", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              xSemaphoreTake(journalLock, portMAX_DELAY);
+              JournalStats stats = journal.getStats();
+              uint8_t roasts = journal.count();
+              xSemaphoreGive(journalLock);
+
+              char json[TELEMETRY_BUFFER_SIZE];
+              JsonWriter out(json, sizeof(json));
+              out.beginObject();
+              out.key("roasts").unsignedNumber(roasts);
+              out.key("records").unsignedNumber(stats.records);
+              out.key("bytes").unsignedNumber(stats.bytes);
+              out.key("segments").unsignedNumber(stats.segments);
+              out.key("failures").unsignedNumber(stats.failures);
+              out.key("dropped").unsignedNumber(roastRecorder.dropped());
+              out.endObject();
+
+              request->send(200, "application/json", json); });
+
+  // Page files in the asset list & how their requests were answered
+  server.on("/debug/assets", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              char json[TELEMETRY_BUFFER_SIZE];
+              JsonWriter out(json, sizeof(json));
+              out.beginObject();
+              out.key("assets").unsignedNumber(assets.size());
+              out.key("served").unsignedNumber(assetStats.served);
+              out.key("notModified").unsignedNumber(assetStats.notModified);
+              out.endObject();
+
+              request->send(200, "application/json", json); });
+
+  // Why the board started, when each stage of the boot ran & when the control task first ran (µs)
+  server.on("/debug/boot", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              static const char *RESETS[] = {"unknown", "power on", "external", "software", "panic", "interrupt watchdog",
+                                             "task watchdog", "watchdog", "deep sleep", "brownout", "sdio"};
+              esp_reset_reason_t reset = esp_reset_reason();
+              uint32_t control = bootTimeline.endOf("control");
+
+              char json[1024];
+              JsonWriter out(json, sizeof(json));
+              out.beginObject();
+              out.key("reset").string(reset < sizeof(RESETS) / sizeof(RESETS[0]) ? RESETS[reset] : "other");
+              out.key("control").unsignedNumber(control);
+              out.key("target").unsignedNumber(BOOT_CONTROL_TARGET);
+              out.key("met").boolean(control && control <= BOOT_CONTROL_TARGET);
+              out.key("stages").raw('[');
+              for (size_t i = 0; i < bootTimeline.size(); i++)
+              {
+                const BootStage &stage = bootTimeline.stage(i);
+                if (i > 0)
+                {
+                  out.raw(',');
+                }
+                out.beginObject();
+                out.key("name").string(stage.name ? stage.name : "");
+                out.key("start").unsignedNumber(stage.startUs);
+                out.key("end").unsignedNumber(stage.endUs);
+                out.endObject();
+              }
+              out.raw(']');
+              out.endObject();
+
+              request->send(200, "application/json", json); });
+
+  // The heap & the tasks, with the probes of the hot paths, the stacks & the event streams
+  // under -D METRICS, in the Prometheus text format (~20 KB)
+  server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              METRIC_PROBE(boardMetrics.httpMetrics);
+              AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+              MetricsWriter out(printMetricsLine, response);
+
+              const Scheduler *schedulers[] = {&scheduler, &samplerScheduler};
+              writeMetrics(out, schedulers, 2);
+#ifdef METRICS
+              writeBoardMetrics(out);
+#endif
+
+              request->send(response); });
+
+  // State of the connection, its joins & drops
+  server.on("/debug/wifi", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              static const char *STATES[] = {"off", "joining", "online", "waiting"};
+              const WifiStats &stats = wifiLink.getStats();
+
+              char json[TELEMETRY_BUFFER_SIZE];
+              JsonWriter out(json, sizeof(json));
+              out.beginObject();
+              out.key("state").string(STATES[wifiLink.getState()]);
+              out.key("accessPoint").boolean(wifiLink.accessPointOn());
+              out.key("joins").unsignedNumber(stats.joins);
+              out.key("fastJoins").unsignedNumber(stats.fastJoins);
+              out.key("failures").unsignedNumber(stats.failures);
+              out.key("drops").unsignedNumber(stats.drops);
+              out.key("lastJoinMs").unsignedNumber(stats.lastJoinMs);
+              out.key("maxOfflineMs").unsignedNumber(stats.maxOfflineMs);
+              out.key("accessPoints").unsignedNumber(stats.accessPoints);
+              out.endObject();
+
+              request->send(200, "application/json", json); });
+
+  // I2C traffic & time of the last LCD refresh
+  server.on("/debug/lcd", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              char json[TELEMETRY_BUFFER_SIZE];
+              JsonWriter out(json, sizeof(json));
+              out.beginObject();
+              out.key("frames").unsignedNumber(lcdStats.frames);
+              out.key("bytes").unsignedNumber(lcdStats.bytes);
+              out.key("transactions").unsignedNumber(lcdStats.transactions);
+              out.key("micros").unsignedNumber(lcdStats.micros);
+              out.key("maxMicros").unsignedNumber(lcdStats.maxMicros);
+              HalDisplayStats display = halDisplayStats();
+              out.key("pending").unsignedNumber(display.pending);
+              out.key("dropped").unsignedNumber(display.dropped);
+              out.endObject();
+
+              request->send(200, "application/json", json); });
+
+  // Heater regulation: mode, duty, autotune state & gains of each mode
+  server.on("/pid", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              DynamicJsonDocument data(512);
+
+              data["mode"] = roaster.getMode();
+              data["duty"] = roaster.getHeaterDuty();
+              data["autotune"] = roaster.getAutotuneState();
+
+              JsonArray gains = data.createNestedArray("gains");
+              for (uint8_t mode = 1; mode <= 3; mode++)
+              {
+                JsonObject modeValues = gains.createNestedObject();
+                modeValues["kp"] = roaster.getGains(mode).kp;
+                modeValues["ki"] = roaster.getGains(mode).ki;
+                modeValues["kd"] = roaster.getGains(mode).kd;
+              }
+
+              String json;
+              serializeJson(data, json);
+
+              request->send(200, "application/json", json); });
+
+  // Running profile: index, name, phase, segment & setpoint, and the names of every profile
+  server.on("/profile", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+              static const char *PHASES[] = {"idle", "ramp", "hold", "done"};
+              DynamicJsonDocument data(768);
+
+              const ProfileRunner &runner = roaster.getProfileRunner();
+              const Profile *running = runner.getProfile();
+              data["profile"] = running ? (int)(running - &roaster.getProfile(0)) : -1;
+              data["selected"] = roaster.getSelectedProfile();
+              data["phase"] = PHASES[runner.getPhase()];
+              data["segment"] = runner.getSegment();
+              data["setpoint"] = runner.getSetpoint();
+
+              JsonArray names = data.createNestedArray("profiles");
+              for (uint8_t i = 0; i < roaster.getProfileCount(); i++)
+              {
+                names.add(roaster.getProfile(i).name);
+              }
+
+              String json;
+              serializeJson(data, json);
+
+              request->send(200, "application/json", json); });
+
+  // Select the profile to run ({"profile": 0-n}), or follow the switch again ({"profile": -1})
+  server.on(
+      "/profile", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
+      [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+      { postCommandBody(COMMAND_PROFILE, request, data, len, index, total); });
+
+  // Start ({"mode": 1-3}) or cancel ({"cancel": true}) the autotuning of a mode
+  server.on(
+      "/autotune", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
+      [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+      { postCommandBody(COMMAND_AUTOTUNE, request, data, len, index, total); });
 
   // Update the latest status of the motors states
   server.on(
       "/motors", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
       [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
-      {
-        StaticJsonDocument<32> response;
-        DeserializationError error = deserializeJson(response, (const char *)data, len);
-
-        if (!error)
-        {
-          if (response.containsKey("motor1"))
-          {
-            digitalWrite(MOTOR1_PIN, response["motor1"].as<bool>());
-          }
-          if (response.containsKey("motor2"))
-          {
-            bool motor2state = response["motor2"].as<bool>();
-            digitalWrite(MOTOR2_PIN, motor2state);
-
-            // When motor2 or motor3 are manually turned off, then we reset the timerResponse so another timer can turn both motors on again
-            if (motor2state == false)
-            {
-              motors23Activated = false;
-              timerResponseIsActive = false;
-            }
-          }
-          if (response.containsKey("motor3"))
-          {
-            bool motor3state = response["motor3"].as<bool>();
-            digitalWrite(MOTOR3_PIN, motor3state);
-
-            if (motor3state == false)
-            {
-              motors23Activated = false;
-              timerResponseIsActive = false;
-            }
-          }
-          events.send(getMotorStates().c_str(), "states", millis());
-          request->send(200, "text/plain", "ok");
-        }
-        else
-        {
-          request->send(404, "text/plain", error.c_str());
-        }
-      });
+      { postCommandBody(COMMAND_MOTOR, request, data, len, index, total); });
 
   // Add or reduce 60sec and update the timer
   server.on(
       "/time", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
       [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
-      {
-        StaticJsonDocument<64> response;
-        DeserializationError error = deserializeJson(response, (const char *)data, len);
-
-        if (!error)
-        {
-          if (response.containsKey("time") && response.containsKey("action"))
-          {
-            String action = response["action"].as<String>();
-            int time_in_seconds = response["time"].as<int>();
-
-            if (action == "add")
-            {
-              counter += time_in_seconds;
-              totalTimeInSeconds += time_in_seconds;
-              timerIsOn = true;
-              timerCount += 1;
-            }
-            else if (action == "reduce")
-            {
-              counter -= time_in_seconds;
-            }
-          }
-
-          events.send(getTimeValues().c_str(), "timer", millis());
-          request->send(200, "text/plain", "ok");
-        }
-        else
-        {
-          request->send(404, "text/plain", error.c_str());
-        }
-      });
+      { postCommandBody(COMMAND_TIME, request, data, len, index, total); });
 
   events.onConnect([](AsyncEventSourceClient *client)
                    {
-    if(client->lastId()){
-      Serial.printf("Client reconnected! Last message ID that it got is: %u\n", client->lastId());
+    char burst[1024];
+    size_t length;
+    uint32_t after = client->lastId();
+
+    xSemaphoreTake(eventsLock, portMAX_DELAY);
+
+    // An id above the last one given is from before a reboot
+    if (after && after <= lastEventId && eventBacklog.covers(after))
+    {
+      Serial.printf("Client reconnected! Last message ID that it got is: %u\n", after);
+
+      // Replay everything it missed, in as few writes as possible
+      while ((length = eventBacklog.replay(&after, burst, sizeof(burst))))
+      {
+        client->write(burst, length);
+      }
+    }
+    else
+    {
+      // New client, or it missed more than the backlog: send the latest values
+      if ((length = eventBacklog.latest(burst, sizeof(burst))))
+      {
+        client->write(burst, length);
+      }
+
+      // Tell a reconnected page to get the whole curve again from /history
+      if (client->lastId())
+      {
+        client->send("history", "resync", nextEventId());
+      }
     }
+
     // send event with message "hello!", id current millis
     // and set reconnect delay to 1 second
-    client->send("hello!", NULL, millis(), 10000); });
+    client->send("hello!", NULL, nextEventId(), 10000);
+
+    xSemaphoreGive(eventsLock); });
   server.addHandler(&events);
 
+  // The new client gets a keyframe (for everyone) on the next compact tick
+  compactEvents.onConnect([](AsyncEventSourceClient *client)
+                          { compactKeyframePending = true; });
+  server.addHandler(&compactEvents);
+
+  // Commands of the page in binary frames, each one acked, & the state pushed on every change
+  control.onEvent([](AsyncWebSocket *socket, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t length)
+                  {
+                    if (type == WS_EVT_CONNECT)
+                    {
+                      uint8_t frame[CONTROL_STATE_SIZE];
+                      client->binary(frame, encodeControlState(frame, roaster.getMotorStates(), roaster.getTimeValues()));
+                    }
+                    else if (type == WS_EVT_DISCONNECT)
+                    {
+                      controlSessions.close(client->id());
+                    }
+                    else if (type == WS_EVT_DATA)
+                    {
+                      // The frames are a few bytes: always whole, in a single message
+                      AwsFrameInfo *info = (AwsFrameInfo *)arg;
+                      if (info->final && info->index == 0 && info->len == length && info->opcode == WS_BINARY)
+                      {
+                        handleControlFrame(client, data, length);
+                      }
+                    } });
+  server.addHandler(&control);
+
   // Start server
   server.begin();
 }
 
-// Format seconds into mm:ss
-String formatTime(int minutes, int seconds)
+// Wake the loop from an ISR
+void IRAM_ATTR wakeLoopFromISR()
 {
-  String time;
-  time = (minutes < 10) ? time + String("0") + String(minutes) : time + String(minutes);
-  time = time + String(":");
-  time = (seconds < 10) ? time + String("0") + String(seconds) : time + String(seconds);
-  if (isTimeA)
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(loopTask, &woken);
+  if (woken)
   {
-    time = time + String(" Mani"); // TODO: handle accents
+    portYIELD_FROM_ISR();
   }
-  else if (isTimeB)
-  {
-    time = time + String(" Cafe");
-  }
-  else if (isTimeC)
+}
+
+// Queue a press of a timer button (add: 1 to add 1 minute, 0 to reduce 1),
+// unless it's a bounce of the last one. The pipeline debounces them again
+static inline void IRAM_ATTR postButtonPress(uint8_t add)
+{
+  uint32_t now = (uint32_t)esp_timer_get_time();
+  if (now - lastPressMicros <= BUTTON_DEBOUNCE)
   {
-    time = time + String(" Cacao");
+    return;
   }
-  time = time + String("           ");
-  return time;
+  lastPressMicros = now;
+
+  Command press = {COMMAND_BUTTON, COMMAND_FROM_BUTTON, add, 0, now};
+  commands.post(press);
+  wakeLoopFromISR();
 }
 
-// Make noise with the buzzer
-void handleBuzzer()
+// Queue a press of the add 1 minute button
+void IRAM_ATTR handleAddTime()
 {
-  tone(BUZZER_PIN, 440);
-  // tone(BUZZER_PIN, 494, 1000);
-  // tone(BUZZER_PIN, 523, 1000);
+  postButtonPress(1);
 }
 
-// Handle all timer logic with the 3-state switch
-void handleTimerAndResponse()
+// Queue a press of the reduce 1 minute button
+void IRAM_ATTR handleReduceTime()
 {
-  if (timerCount > 0 && timerIsOn && counter >= 0)
+  postButtonPress(0);
+}
+
+// Countdown esp_timer callback (esp_timer task)
+void countdownWake(void *arg)
+{
+  countdownWakes.push((uint32_t)esp_timer_get_time());
+  xTaskNotifyGive(loopTask);
+}
+
+// Arm the countdown esp_timer for the next second the timer shows
+void armCountdownTimer()
+{
+  esp_timer_stop(countdownTimer); // Fails harmlessly when it isn't armed
+
+  uint32_t ms = roaster.untilNextSecond();
+  if (ms)
+  {
+    // millis() is esp_timer_get_time() / 1000, the second starts on a whole ms
+    int64_t now = esp_timer_get_time();
+    countdownWakeTarget = (now / 1000 + ms) * 1000;
+    esp_timer_start_once(countdownTimer, countdownWakeTarget - now);
+  }
+}
+
+// Apply what the ISRs, the web, the switches & the countdown esp_timer handed over (loop)
+void handleQueuedEvents()
+{
+  // A batch of commands, the rest on the next pass
+  CommandBatch batch = commands.drain(roaster, esp_timer_get_time());
+  bool timeChanged = batch.timeChanged;
+  if (batch.statesChanged)
   {
+    sendStatesEvent();
+  }
+  if (batch.more)
+  {
+    xTaskNotifyGive(loopTask);
+  }
 
-    int minutes = floor(counter / 60);
-    int remainingSeconds = counter - minutes * 60;
+  uint32_t fired;
+  bool wake = false;
+  while (countdownWakes.pop(fired))
+  {
+    uint32_t late = fired - (uint32_t)countdownWakeTarget;
+    countdownWakeStats.wakes++;
+    countdownWakeStats.lastLateUs = late;
+    countdownWakeStats.maxLateUs = max(countdownWakeStats.maxLateUs, late);
+    wake = true;
+  }
 
-    lcd.setCursor(0, 0);
-    lcd.print(formatTime(minutes, remainingSeconds));
+  // The connection changed, follow it now
+  if (wifiLink.pending())
+  {
+    scheduler.trigger(wifiTaskId);
+  }
 
-    counter--;
+  // Show the new time right away
+  if (timeChanged || wake)
+  {
+    scheduler.trigger(timerTaskId);
+  }
+  if (timeChanged)
+  {
+    sendTimerEvent();
+    sendControlState();
   }
+}
 
-  if (counter < 0)
+// Post the position of the 3-state switch when it moves (switches task)
+void postSwitch()
+{
+  uint8_t position = roaster.readSwitch();
+  if (position != lastSwitchPosition && postCommand(COMMAND_SWITCH, COMMAND_FROM_SWITCH, position, 0))
   {
-    timerIsOn = false;
-    timerResponseIsActive = true;
-    totalTimeInSeconds = 0;
-    counter = 0;
+    lastSwitchPosition = position;
+  }
+}
+
+// Follow the countdown & wait for its next second
+void handleTimer()
+{
+  roaster.handleTimer();
+  armCountdownTimer();
+}
 
-    // Print the title again
-    lcd.setCursor(0, 0);
-    lcd.print(mainTitle);
+// Read the thermocouple, filter it & publish it (sampler task)
+void sampleThermocouple()
+{
+  uint32_t now = millis();
+  thermocoupleFilter.update(halReadThermocouple(), now);
+  sampledReadings.values.temperature = thermocoupleFilter.rounded();
+  sampledReadings.values.temperatureQuality = thermocoupleFilter.quality();
+  sampledReadings.temperatureMillis = now;
+  sensorReadings.write(sampledReadings);
+}
+
+// Read the humidity sensor, filter it & publish it (sampler task)
+void sampleHumidity()
+{
+  uint32_t now = millis();
+  humidityFilter.update(halReadHumidity(), now);
+  sampledReadings.values.humidity = humidityFilter.rounded();
+  sampledReadings.values.humidityQuality = humidityFilter.quality();
+  sampledReadings.humidityMillis = now;
+  sensorReadings.write(sampledReadings);
+}
+
+// Sensor acquisition task, pinned to the core that doesn't run the loop
+void samplerTask(void *parameters)
+{
+  for (;;)
+  {
+    uint32_t idle = samplerScheduler.tick();
+    vTaskDelay(max((TickType_t)1, (TickType_t)pdMS_TO_TICKS(idle / 1000))); // Always let the idle task of this core run
   }
+}
 
-  // When switch is moved to OFF, then turn off the response
-  if (!isTimeA && !isTimeB && !isTimeC)
+// Rebuild the index of the journal, then write the records the loop hands over.
+// The flash writes stay out of the loop
+void journalTaskLoop(void *parameters)
+{
+  xSemaphoreTake(journalLock, portMAX_DELAY);
+  journal.begin();
+  xSemaphoreGive(journalLock);
+
+  for (;;)
   {
-    timerResponseIsActive = false;
-    motors23Activated = false;
-    noTone(BUZZER_PIN);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    xSemaphoreTake(journalLock, portMAX_DELAY);
+    roastRecorder.flush(journal);
+    xSemaphoreGive(journalLock);
   }
+}
 
-  // If there is a switch after the counter finished, handle the response
-  if (timerResponseIsActive)
+// Take the latest readings & run the profile with them. The first run ends the boot
+void handleReadings()
+{
+  static bool first = true;
+  if (first)
   {
-    handleBuzzer();
+    bootTimeline.mark("control");
+    Serial.printf("Boot: control after %u us (target %u us)\n", bootTimeline.endOf("control"), BOOT_CONTROL_TARGET);
+    first = false;
+  }
 
-    // Only turn the motors once every timer response
-    if (!motors23Activated)
-    {
-      digitalWrite(MOTOR2_PIN, HIGH);
-      digitalWrite(MOTOR3_PIN, HIGH);
+  SensorReadings latest = sensorReadings.read();
+  roaster.handleReadings(latest.values);
+}
 
-      motors23Activated = true;
+// Send the values that changed to the compact stream clients, or all of them on a keyframe
+void sendCompactEvents()
+{
+  static uint32_t lastKeyframe = 0;
 
-      // Send new motor statuses to server
-      events.send(getMotorStates().c_str(), "states", millis());
-    }
+  if (compactEvents.count() == 0)
+  {
+    compactKeyframePending = true;
+    return;
+  }
+
+  bool keyframe = compactKeyframePending || millis() - lastKeyframe >= KEYFRAME_PERIOD;
+  if (keyframe)
+  {
+    compactKeyframePending = false;
+    lastKeyframe = millis();
+  }
+
+  Readings readings = roaster.getReadings();
+  TimerValues timerValues = roaster.getTimeValues();
+  MotorStates states = roaster.getMotorStates();
+
+  TelemetryFrame frame;
+  frame.temperature = readings.temperature;
+  frame.humidity = readings.humidity;
+  frame.total = timerValues.total;
+  frame.time = timerValues.time;
+  frame.motors = (states.motor1 ? 1 : 0) | (states.motor2 ? 2 : 0) | (states.motor3 ? 4 : 0);
+  frame.quality = readings.temperatureQuality | (readings.humidityQuality << 4);
+  frame.ror = roaster.getMetrics().ror;
+
+  char payload[TELEMETRY_BUFFER_SIZE];
+  if (compactEncoder.encode(payload, sizeof(payload), frame, keyframe))
+  {
+    METRIC_PROBE(boardMetrics.compactSend);
+    compactEvents.send(payload, keyframe ? "k" : "d", millis());
   }
 }
 
-// Handle actions depending on the temperature
-void handleTemperature()
+// Hand the samples of a running profile to the journal task, from its start to its end
+void recordRoast(const HistorySample &sample)
 {
-  int tempLimit = 0;
-  float timerDuration = 0;
+  const ProfileRunner &runner = roaster.getProfileRunner();
+  bool roasting = runner.getPhase() == ProfileRunner::Ramp || runner.getPhase() == ProfileRunner::Hold;
 
-  if (isTimeA)
+  if (roasting && !roastRecorder.recording())
   {
-    // Mani
-    tempLimit = 180;
-    timerDuration = TIMER_DURATION_DEBUG ? TIMER_DURATION_DEBUG : 20;
+    roastRecorder.begin(roaster.getMode(), runner.getProfile()->name, HISTORY_PERIOD);
   }
-  else if (isTimeB)
+  if (!roastRecorder.recording())
   {
-    // Cacao
-    tempLimit = 140;
-    timerDuration = TIMER_DURATION_DEBUG ? TIMER_DURATION_DEBUG : 33;
+    return;
   }
-  else if (isTimeC)
+
+  if (roasting)
   {
-    // Cafe
-    tempLimit = 170;
-    timerDuration = TIMER_DURATION_DEBUG ? TIMER_DURATION_DEBUG : 12;
+    roastRecorder.sample(sample.temperature);
   }
   else
   {
-    tempLimit = MAX_TEMP_LIMIT;
+    roastRecorder.end(runner.getPhase() == ProfileRunner::Done, roaster.getMetrics().phases);
   }
 
-  // Check if temperature exceeds the limit and if it is rising & start timer if it's not already running
-  static int prevTemp = 0;
-  if (temperature >= tempLimit && temperature > prevTemp && prevTemp < tempLimit && !timerIsOn && timerDuration > 0)
+  if (roastRecorder.pending())
   {
-    digitalWrite(MOTOR1_PIN, HIGH);
+    xTaskNotifyGive(journalTask);
+  }
+}
 
-    // Send new motor statuses to server
-    events.send(getMotorStates().c_str(), "states", millis());
+// Append the current state of the roast to the history
+void recordSample()
+{
+  MotorStates states = roaster.getMotorStates();
+  TimerValues timerValues = roaster.getTimeValues();
+
+  HistorySample sample;
+  sample.temperature = constrain(roaster.getTemperature(), INT16_MIN, INT16_MAX);
+  sample.humidity = constrain(roaster.getHumidity(), 0, 100);
+  sample.timer = roaster.isTimerOn() ? constrain(timerValues.time, 0, UINT16_MAX) : 0;
+  sample.flags = (states.motor1 ? SAMPLE_MOTOR1 : 0) |
+                 (states.motor2 ? SAMPLE_MOTOR2 : 0) |
+                 (states.motor3 ? SAMPLE_MOTOR3 : 0) |
+                 (roaster.isTimerOn() ? SAMPLE_TIMER_ON : 0) |
+                 (roaster.isTemperatureUsable() ? 0 : SAMPLE_NO_TEMPERATURE) |
+                 (roaster.getMode() << SAMPLE_MODE_SHIFT);
+
+  history.push(sample);
+  recordRoast(sample);
+}
 
-    // Start the timer
-    totalTimeInSeconds = timerDuration * 60;
-    counter = totalTimeInSeconds;
-    timerCount++;
-    timerIsOn = true;
-  }
-  prevTemp = temperature;
+// Send Events to the client with the Sensor Readings
+void sendEvents()
+{
+  control.cleanupClients(); // Closes the oldest pages beyond the limit of the library
+  publishEvent("ping", NULL);
+  sendReadingsEvent();
+  sendTimerEvent();
+  sendAnalyticsEvent();
 }
 
-// Handle adding 1 minute with interrupt
-void IRAM_ATTR handleAddTime()
+// Safety supervisor task: checks the loop, the thermocouple & the limits of the profile every SAFETY_PERIOD
+void safetyTask(void *parameters)
 {
-  if (millis() - lastMillis > 60)
-  { // Software debouncing button
-    totalTimeInSeconds += 60;
-    counter += 60;
-    timerIsOn = true;
+  TickType_t wake = xTaskGetTickCount();
+  for (;;)
+  {
+    SensorReadings latest = sensorReadings.read();
+    roaster.getSafety().run(latest.values.temperature, latest.values.temperatureQuality, latest.temperatureMillis, millis());
+    vTaskDelayUntil(&wake, pdMS_TO_TICKS(SAFETY_PERIOD));
   }
-  lastMillis = millis();
 }
 
-// Handle reducing 1 minute with interrupt
-void IRAM_ATTR handleReduceTime()
+// Start the sensor acquisition task
+void initSampler()
 {
-  if (millis() - lastMillis > 60)
-  { // Software debouncing button
-    totalTimeInSeconds -= 60;
-    counter -= 60;
-  }
-  lastMillis = millis();
+  // Nothing was read yet
+  sampledReadings.values.temperatureQuality = QUALITY_STALE;
+  sampledReadings.values.humidityQuality = QUALITY_STALE;
+  sensorReadings.write(sampledReadings);
+
+  samplerScheduler.add("thermocouple", sampleThermocouple, THERMOCOUPLE_PERIOD);
+  samplerScheduler.add("dht", sampleHumidity, DHT_PERIOD);
+
+  xTaskCreatePinnedToCore(samplerTask, "sampler", SAMPLER_STACK, NULL, SAMPLER_PRIORITY, &samplerHandle, SAMPLER_CORE);
+}
+
+// Start the task that writes the roast journal
+void initJournal()
+{
+  journalLock = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(journalTaskLoop, "journal", JOURNAL_STACK, NULL, JOURNAL_PRIORITY, &journalTask, JOURNAL_CORE);
 }
 
+// Register every periodic job of the loop
+void initScheduler()
+{
+  scheduler.add("switches", postSwitch, SWITCHES_PERIOD);
+  scheduler.add("control", handleReadings, CONTROL_PERIOD);
+  timerTaskId = scheduler.add("timer", handleTimer, TIMER_PERIOD); // Also woken by the countdown esp_timer
+  lcdTaskId = scheduler.add("lcd", refreshLCD, LCD_PERIOD);
+  scheduler.add("sse", sendEvents, SSE_PERIOD);
+  scheduler.add("compact", sendCompactEvents, COMPACT_PERIOD);
+  scheduler.add("history", recordSample, HISTORY_PERIOD);
+  scheduler.add("analytics", []() { roaster.sampleAnalytics(); }, ANALYTICS_PERIOD);
+  scheduler.add("pid", []() { roaster.handleHeater(); }, PID_PERIOD);
+  scheduler.add("heater", []() { roaster.driveHeater(); }, HEATER_PERIOD);
+  wifiTaskId = scheduler.add("wifi", handleWifi, WIFI_PERIOD); // Also woken by the connection events
+}
+
+// Bring up what the roaster can work without, in this order, while the loop runs
+void initTask(void *parameters)
+{
+  int stage = bootTimeline.begin("lcd");
+  initLCD();
+  bootTimeline.end(stage);
+
+  stage = bootTimeline.begin("wifi");
+  initWifi(WIFI_SSID, WIFI_PASSWORD);
+  bootTimeline.end(stage);
+
+  stage = bootTimeline.begin("assets");
+  initAssets();
+  bootTimeline.end(stage);
+
+  stage = bootTimeline.begin("server");
+  initServer();
+  bootTimeline.end(stage);
+
+  Serial.printf("Boot: peripherals up after %u us\n", (uint32_t)micros());
+  vTaskDelete(NULL);
+}
+
+// Only what the control needs runs here, the outputs first: after a brownout the
+// loop is back within BOOT_CONTROL_TARGET, the LCD & the network come up meanwhile
 void setup()
 {
+  int stage = bootTimeline.begin("outputs");
+  roaster.beginOutputs();
+  bootTimeline.end(stage);
+
   Serial.begin(115200);
 
-  dht.begin();
+  loopTask = xTaskGetCurrentTaskHandle();
+  eventsLock = xSemaphoreCreateMutex();
+  esp_timer_create_args_t countdownTimerArgs = {};
+  countdownTimerArgs.callback = countdownWake;
+  countdownTimerArgs.name = "countdown";
+  esp_timer_create(&countdownTimerArgs, &countdownTimer);
+
+  stage = bootTimeline.begin("sensors");
+  halSensorsBegin();
+  initSampler();
+  xTaskCreatePinnedToCore(safetyTask, "safety", SAFETY_STACK, NULL, SAFETY_PRIORITY, NULL, SAFETY_CORE);
+  bootTimeline.end(stage);
+
+  stage = bootTimeline.begin("storage");
+  halStorageBegin();
+  bootTimeline.end(stage);
+
+  stage = bootTimeline.begin("settings");
+  roaster.loadSettings();
+  initJournal();
+  bootTimeline.end(stage);
 
-  pinMode(MOTOR1_PIN, OUTPUT);
-  pinMode(MOTOR2_PIN, OUTPUT);
-  pinMode(MOTOR3_PIN, OUTPUT);
-  pinMode(BUZZER_PIN, OUTPUT);
-  pinMode(TIME_A, INPUT);
-  pinMode(TIME_B, INPUT);
-  pinMode(TIME_C, INPUT);
   pinMode(TIME_ADDER, INPUT);
   pinMode(TIME_REDUCER, INPUT);
   attachInterrupt(TIME_ADDER, handleAddTime, FALLING);
   attachInterrupt(TIME_REDUCER, handleReduceTime, FALLING);
 
-  initLCD(mainTitle);
-  initWifi(WIFI_SSID, WIFI_PASSWORD);
-  initSPIFFS();
-  initServer();
-
-  delay(2000);
+  setLCDRow(0, mainTitle); // Written once the LCD is up
+  initScheduler();
+  xTaskCreatePinnedToCore(initTask, "init", INIT_STACK, NULL, INIT_PRIORITY, NULL, INIT_CORE);
 }
 
 void loop()
 {
-  // Get switch readings
-  isTimeA = digitalRead(TIME_A);
-  isTimeB = digitalRead(TIME_B);
-  isTimeC = digitalRead(TIME_C);
-
-  // Send Events to the client with the Sensor Readings
-  events.send("ping", NULL, millis());
-  events.send(getSensorReadings().c_str(), "readings", millis());
-  events.send(getTimeValues().c_str(), "timer", millis());
-
-  handleTemperature();
-  handleTimerAndResponse();
-
-  delay(1000);
+  // Run the due tasks and sleep until the next release, or until something is queued
+  handleQueuedEvents();
+  uint32_t idle = scheduler.tick();
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(idle / 1000));
 }
\ No newline at end of file
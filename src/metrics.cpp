@@ -0,0 +1,128 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "scheduler.h"
+
+#ifdef METRICS
+CycleHistogram journalFlushCycles;
+CycleHistogram exportFillCycles;
+#endif
+
+CycleHistogram::CycleHistogram() : buckets(), sum(0), count(0), max(0) {}
+
+void CycleHistogram::add(uint32_t cycles)
+{
+  // Smallest bound 2^(8 + 2i) that holds it
+  uint8_t bits = cycles > 1 ? 32 - __builtin_clz(cycles - 1) : 0;
+  uint8_t bucket = bits > 8 ? (bits - 8 + 1) / 2 : 0;
+
+  buckets[bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS]++;
+  sum += cycles;
+  count++;
+  if (cycles > max)
+  {
+    max = cycles;
+  }
+}
+
+MetricsWriter::MetricsWriter(MetricsOutput output, void *context) : output(output), context(context) {}
+
+void MetricsWriter::line(const char *format, ...)
+{
+  char text[METRICS_LINE_MAX];
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(text, sizeof(text), format, arguments);
+  va_end(arguments);
+  output(text, context);
+}
+
+void MetricsWriter::family(const char *name, const char *type, const char *help)
+{
+  line("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void MetricsWriter::value(const char *name, const char *labels, uint64_t value)
+{
+  line("%s%s%s%s %llu\n", name, labels ? "{" : "", labels ? labels : "", labels ? "}" : "", (unsigned long long)value);
+}
+
+void MetricsWriter::histogram(const char *name, const char *labels, const CycleHistogram &histogram)
+{
+  const char *comma = labels ? "," : "";
+  labels = labels ? labels : "";
+
+  uint32_t runs = 0;
+  for (uint8_t i = 0; i < METRICS_BUCKETS; i++)
+  {
+    runs += histogram.buckets[i];
+    line("%s_bucket{%s%sle=\"%lu\"} %u\n", name, labels, comma, 256ul << (2 * i), runs);
+  }
+  line("%s_bucket{%s%sle=\"+Inf\"} %u\n", name, labels, comma, histogram.count);
+  line("%s_sum%s%s%s %llu\n", name, *labels ? "{" : "", labels, *labels ? "}" : "", (unsigned long long)histogram.sum);
+  line("%s_count%s%s%s %u\n", name, *labels ? "{" : "", labels, *labels ? "}" : "", histogram.count);
+}
+
+void writeMetrics(MetricsWriter &out, const Scheduler *const *schedulers, size_t count)
+{
+  char labels[48];
+
+  HalMemoryStats memory = halMemoryStats();
+  out.family("roaster_heap_free_bytes", "gauge", "Free heap");
+  out.value("roaster_heap_free_bytes", NULL, memory.free);
+  out.family("roaster_heap_min_free_bytes", "gauge", "Lowest free heap since the start");
+  out.value("roaster_heap_min_free_bytes", NULL, memory.minFree);
+  out.family("roaster_heap_max_block_bytes", "gauge", "Largest block that can be allocated");
+  out.value("roaster_heap_max_block_bytes", NULL, memory.maxBlock);
+  out.family("roaster_cpu_cycles_per_second", "gauge", "Rate of the cycle counter of the probes");
+  out.value("roaster_cpu_cycles_per_second", NULL, (uint64_t)halCyclesPerMicro() * 1000000);
+
+  out.family("roaster_task_runs_total", "counter", "Runs of a scheduled task");
+  for (size_t s = 0; s < count; s++)
+  {
+    for (size_t i = 0; i < schedulers[s]->size(); i++)
+    {
+      snprintf(labels, sizeof(labels), "task=\"%s\"", schedulers[s]->task(i).name);
+      out.value("roaster_task_runs_total", labels, schedulers[s]->task(i).runs);
+    }
+  }
+
+  out.family("roaster_task_misses_total", "counter", "Releases of a scheduled task started after their deadline");
+  for (size_t s = 0; s < count; s++)
+  {
+    for (size_t i = 0; i < schedulers[s]->size(); i++)
+    {
+      snprintf(labels, sizeof(labels), "task=\"%s\"", schedulers[s]->task(i).name);
+      out.value("roaster_task_misses_total", labels, schedulers[s]->task(i).misses);
+    }
+  }
+
+#ifdef METRICS
+  out.family("roaster_task_cycles", "histogram", "CPU cycles of a run of a scheduled task");
+  for (size_t s = 0; s < count; s++)
+  {
+    for (size_t i = 0; i < schedulers[s]->size(); i++)
+    {
+      snprintf(labels, sizeof(labels), "task=\"%s\"", schedulers[s]->task(i).name);
+      out.histogram("roaster_task_cycles", labels, schedulers[s]->task(i).cycles);
+    }
+  }
+
+  out.family("roaster_task_max_cycles", "gauge", "Longest run of a scheduled task, in CPU cycles");
+  for (size_t s = 0; s < count; s++)
+  {
+    for (size_t i = 0; i < schedulers[s]->size(); i++)
+    {
+      snprintf(labels, sizeof(labels), "task=\"%s\"", schedulers[s]->task(i).name);
+      out.value("roaster_task_max_cycles", labels, schedulers[s]->task(i).cycles.max);
+    }
+  }
+
+  out.family("roaster_journal_flush_cycles", "histogram", "CPU cycles of the writes of a batch of the roast journal");
+  out.histogram("roaster_journal_flush_cycles", NULL, journalFlushCycles);
+  out.family("roaster_export_fill_cycles", "histogram", "CPU cycles of a chunk of a roast export");
+  out.histogram("roaster_export_fill_cycles", NULL, exportFillCycles);
+#endif
+}
@@ -0,0 +1,87 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+// Probes of the hot paths, compiled in with -D METRICS (see platformio.ini).
+// Without it METRIC_PROBE() & METRIC_ADD() are empty & cost nothing. The
+// board writes them at /metrics & the simulator with -p, in the Prometheus
+// text format
+
+#define METRICS_BUCKETS 12 // Upper bounds of the histograms: 2^8, 2^10 ... 2^30 cycles, & +Inf
+#define METRICS_LINE_MAX 160
+
+// Cycles taken by the runs of a probe. One task writes it, any reads it
+class CycleHistogram
+{
+public:
+  CycleHistogram();
+
+  void add(uint32_t cycles);
+
+  uint32_t buckets[METRICS_BUCKETS + 1]; // Runs up to each bound (not cumulative), the last one above them all
+  uint64_t sum;
+  uint32_t count;
+  uint32_t max;
+};
+
+// Adds the cycles of its scope to a histogram
+class CycleProbe
+{
+public:
+  explicit CycleProbe(CycleHistogram &histogram) : histogram(histogram), start(halCycles()) {}
+  ~CycleProbe() { histogram.add(halCycles() - start); }
+
+private:
+  CycleHistogram &histogram;
+  uint32_t start;
+};
+
+#define METRIC_CONCAT(a, b) a##b
+#define METRIC_NAME(a, b) METRIC_CONCAT(a, b)
+
+#ifdef METRICS
+#define METRIC_PROBE(histogram) CycleProbe METRIC_NAME(probe, __LINE__)(histogram)
+#define METRIC_ADD(counter, n) ((counter) += (n))
+#else
+#define METRIC_PROBE(histogram) ((void)0)
+#define METRIC_ADD(counter, n) ((void)0)
+#endif
+
+// Writes the metrics in the Prometheus text format, a line at a time
+typedef void (*MetricsOutput)(const char *line, void *context);
+
+class MetricsWriter
+{
+public:
+  MetricsWriter(MetricsOutput output, void *context);
+
+  // The HELP & TYPE lines of a family (type: counter, gauge or histogram)
+  void family(const char *name, const char *type, const char *help);
+
+  // A sample of the family, labels as `task="lcd"` or NULL
+  void value(const char *name, const char *labels, uint64_t value);
+  void histogram(const char *name, const char *labels, const CycleHistogram &histogram);
+
+private:
+  void line(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+  MetricsOutput output;
+  void *context;
+};
+
+// Probes of the code shared by the board & the host
+#ifdef METRICS
+extern CycleHistogram journalFlushCycles; // RoastRecorder::flush(), the flash writes of the journal
+extern CycleHistogram exportFillCycles;   // RoastExport::fill(), a chunk of an export
+#endif
+
+class Scheduler;
+
+// The memory, the tasks of the schedulers (runs, misses & cycles) & the probes of the shared code
+void writeMetrics(MetricsWriter &out, const Scheduler *const *schedulers, size_t count);
+
+#endif
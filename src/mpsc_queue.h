@@ -0,0 +1,98 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free ring for any number of producers (tasks on either core & ISRs)
+// & one consumer. A producer claims a slot with a compare & swap on the head,
+// writes its item and publishes it through the sequence number of the slot,
+// so producers never wait for each other & the items come out in the order
+// their slots were claimed. push() fails when the ring is full (and counts
+// the drop). An item whose producer was interrupted between its claim & its
+// publication holds back the ones after it until it's published: pop() reports
+// the ring empty meanwhile. N must be a power of two. T must be trivially copyable
+template <typename T, size_t N>
+class MpscQueue
+{
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  MpscQueue() : head(0), tail(0), drops(0)
+  {
+    for (uint32_t i = 0; i < N; i++)
+    {
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Producer side, from any task or ISR. False if full. Always inlined, so an ISR in IRAM doesn't call into flash
+  inline __attribute__((always_inline)) bool push(const T &value)
+  {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;)
+    {
+      slot = &slots[h & (N - 1)];
+      int32_t ahead = (int32_t)(slot->sequence.load(std::memory_order_acquire) - h);
+      if (ahead == 0)
+      {
+        // Free for the turn h of the ring: claim it (h is reloaded if another producer got there first)
+        if (head.compare_exchange_weak(h, h + 1, std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+      else if (ahead < 0)
+      {
+        // Still holds the item of the previous turn
+        drops.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      else
+      {
+        h = head.load(std::memory_order_relaxed);
+      }
+    }
+
+    slot->item = value;
+    slot->sequence.store(h + 1, std::memory_order_release); // Publish the item
+    return true;
+  }
+
+  // Consumer side. False if empty (or the next item isn't published yet)
+  bool pop(T &value)
+  {
+    Slot &slot = slots[tail & (N - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != tail + 1)
+    {
+      return false;
+    }
+
+    value = slot.item;
+    slot.sequence.store(tail + N, std::memory_order_release); // Free the slot for the next turn
+    tail++;
+    return true;
+  }
+
+  // Items claimed & not taken yet, from the consumer side
+  size_t size() const { return head.load(std::memory_order_acquire) - tail; }
+
+  // Items the producers couldn't push
+  uint32_t dropped() const { return drops.load(std::memory_order_relaxed); }
+
+private:
+  struct Slot
+  {
+    std::atomic<uint32_t> sequence; // Turn the slot is at: free for turn t at t, holds its item at t + 1
+    T item;
+  };
+
+  Slot slots[N];
+  std::atomic<uint32_t> head; // Next slot to claim, by the producers
+  uint32_t tail;              // Next slot to take, by the consumer only
+  std::atomic<uint32_t> drops;
+};
+
+#endif
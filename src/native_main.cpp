@@ -0,0 +1,147 @@
+// Workstation build of the roaster (env:native): the same logic & scheduler
+// as the board, on the Linux backend of the HAL. The readings are taken from
+// stdin ("<temperature> <humidity>" per line), and the display, motors,
+// buzzer & heater are printed when they change. Usage: firmware [mode 1-3]
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "filter.h"
+#include "hal.h"
+#include "hal_linux.h"
+#include "lcd_frame.h"
+#include "periods.h"
+#include "pins.h"
+#include "roaster.h"
+#include "scheduler.h"
+
+LcdFrame lcdFrame;
+Scheduler scheduler(halMicros);
+int lcdTaskId = -1;
+
+void setLCDRow(uint8_t row, const char *text)
+{
+  if (lcdFrame.print(row, text))
+  {
+    scheduler.trigger(lcdTaskId);
+  }
+}
+
+void printStates()
+{
+  printf("%8.1f motors %d%d%d\n", halMillis() / 1000.0, halDigitalRead(MOTOR1_PIN), halDigitalRead(MOTOR2_PIN), halDigitalRead(MOTOR3_PIN));
+}
+
+Roaster roaster(setLCDRow, printStates);
+
+// Write the changed cells & print the display
+void refreshLCD()
+{
+  if (lcdFrame.dirty())
+  {
+    lcdFrame.flush(halDisplayWrite);
+    printf("%8.1f [%s] [%s]\n", halMillis() / 1000.0, halLinuxDisplayRow(0), halLinuxDisplayRow(1));
+  }
+}
+
+// Print the outputs that aren't reported by the roaster
+void printOutputs()
+{
+  static bool heater = false;
+  static uint16_t tone = 0;
+  static uint8_t phase = PHASE_IDLE;
+
+  if (halDigitalRead(HEATER_PIN) != heater)
+  {
+    heater = !heater;
+    printf("%8.1f heater %s (duty %.2f)\n", halMillis() / 1000.0, heater ? "on" : "off", roaster.getHeaterDuty());
+  }
+  if (halLinuxTone(BUZZER_PIN) != tone)
+  {
+    tone = halLinuxTone(BUZZER_PIN);
+    printf("%8.1f buzzer %u Hz\n", halMillis() / 1000.0, tone);
+  }
+
+  const RoastMetrics &metrics = roaster.getMetrics();
+  if (metrics.phase != phase)
+  {
+    phase = metrics.phase;
+    printf("%8.1f phase %u (RoR %.1f C/min, drying %u s, browning %u s, development %u s)\n", halMillis() / 1000.0, phase,
+           metrics.ror / 10.0, metrics.phases[0], metrics.phases[1], metrics.phases[2]);
+  }
+}
+
+// Take a line of readings from stdin, false on EOF
+bool readInput()
+{
+  char line[64];
+  if (!fgets(line, sizeof(line), stdin))
+  {
+    return false;
+  }
+
+  float temperature, humidity = 0;
+  if (sscanf(line, "%f %f", &temperature, &humidity) >= 1)
+  {
+    halLinuxSetReadings(temperature, humidity);
+  }
+  return true;
+}
+
+// Filter the latest input & run the profile with it
+void handleReadings()
+{
+  static SensorFilter thermocoupleFilter(THERMOCOUPLE_FILTER);
+  static SensorFilter humidityFilter(HUMIDITY_FILTER);
+
+  thermocoupleFilter.update(halReadThermocouple(), halMillis());
+  humidityFilter.update(halReadHumidity(), halMillis());
+
+  Readings readings = {thermocoupleFilter.rounded(), humidityFilter.rounded(), thermocoupleFilter.quality(), humidityFilter.quality()};
+  roaster.handleReadings(readings);
+}
+
+int main(int argc, char **argv)
+{
+  setvbuf(stdout, NULL, _IOLBF, 0); // Print each change right away, also into a pipe
+
+  int mode = argc > 1 ? atoi(argv[1]) : 1;
+  halLinuxSetPin(TIME_A, mode == 1);
+  halLinuxSetPin(TIME_B, mode == 2);
+  halLinuxSetPin(TIME_C, mode == 3);
+  halLinuxSetReadings(25, 50);
+
+  halDisplayBegin();
+  halStorageBegin();
+  roaster.begin();
+  setLCDRow(0, mainTitle);
+
+  scheduler.add("switches", []() { roaster.pollSwitches(); }, SWITCHES_PERIOD);
+  scheduler.add("control", handleReadings, CONTROL_PERIOD);
+  scheduler.add("timer", []() { roaster.handleTimer(); }, TIMER_PERIOD);
+  lcdTaskId = scheduler.add("lcd", refreshLCD, LCD_PERIOD);
+  scheduler.add("pid", []() { roaster.handleHeater(); }, PID_PERIOD);
+  scheduler.add("heater", []() { roaster.driveHeater(); }, HEATER_PERIOD);
+  scheduler.add("analytics", []() { roaster.sampleAnalytics(); }, ANALYTICS_PERIOD);
+
+  bool input = true;
+  for (;;)
+  {
+    uint32_t idle = scheduler.tick();
+    printOutputs();
+
+    // Sleep until the next release, or until a new line of readings
+    pollfd stdinPoll = {STDIN_FILENO, POLLIN, 0};
+    if (input && poll(&stdinPoll, 1, idle / 1000) > 0)
+    {
+      input = readInput();
+    }
+    else if (!input)
+    {
+      halDelay(idle / 1000);
+    }
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef PERIODS_H
+#define PERIODS_H
+
+// Task periods (ms)
+#define SWITCHES_PERIOD 20      // Rotary switch polling
+#define THERMOCOUPLE_PERIOD 220 // MAX6675 conversion time
+#define DHT_PERIOD 2000         // DHT22 minimum sampling period
+#define CONTROL_PERIOD 220      // Temperature triggers, run at the thermocouple rate
+#define TIMER_PERIOD 1000       // Countdown resolution
+#define LCD_PERIOD 250          // Display refresh (only changed rows are written)
+#define SSE_PERIOD 1000         // Readings & timer events to the web clients
+#define HISTORY_PERIOD 1000     // Roast samples kept for /history
+#define ANALYTICS_PERIOD 1000   // Rate of rise & phases of the roast
+#define COMPACT_PERIOD 250      // Changes sent to the compact stream clients
+#define KEYFRAME_PERIOD 30000   // Full frame to the compact stream clients, also acts as keep alive
+#define PID_PERIOD 1000         // Heater regulation
+#define HEATER_PERIOD 50        // Heater output resolution (within its window)
+#define WIFI_PERIOD 250         // Join timeouts & retries (the connection events wake it sooner)
+#define SAFETY_PERIOD 50        // Checks of the safety supervisor (a task of its own)
+
+#endif
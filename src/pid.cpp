@@ -0,0 +1,187 @@
+#include "pid.h"
+
+#include <math.h>
+
+#define DERIVATIVE_FILTER_S 2.0f // Time constant of the derivative filter, the thermocouple steps by whole degrees
+#define RELAY_AMPLITUDE 0.5f     // Half the span of the autotune output (0 - 1)
+
+static float clamp(float value, float low, float high)
+{
+  return value < low ? low : value > high ? high : value;
+}
+
+Pid::Pid(float outputMin, float outputMax)
+    : gains(), outputMin(outputMin), outputMax(outputMax), integral(0), lastMeasurement(0), derivative(0), output(0), started(false) {}
+
+void Pid::setGains(const PidGains &newGains)
+{
+  gains = newGains;
+}
+
+void Pid::reset(float measurement)
+{
+  integral = 0;
+  lastMeasurement = measurement;
+  derivative = 0;
+  output = 0;
+  started = true;
+}
+
+float Pid::update(float setpoint, float measurement, float dtSeconds)
+{
+  if (!started)
+  {
+    reset(measurement);
+  }
+  if (dtSeconds <= 0)
+  {
+    return output;
+  }
+
+  float error = setpoint - measurement;
+
+  // Derivative on measurement, low-pass filtered
+  float rate = (measurement - lastMeasurement) / dtSeconds;
+  derivative += dtSeconds / (dtSeconds + DERIVATIVE_FILTER_S) * (rate - derivative);
+  lastMeasurement = measurement;
+
+  float proportional = gains.kp * error;
+  float damping = -gains.kd * derivative;
+
+  // Only integrate when it doesn't push further into saturation
+  float candidate = integral + gains.ki * error * dtSeconds;
+  float unclamped = proportional + candidate + damping;
+  bool windingUp = (unclamped > outputMax && error > 0) || (unclamped < outputMin && error < 0);
+  if (!windingUp)
+  {
+    integral = clamp(candidate, outputMin, outputMax);
+  }
+
+  output = clamp(proportional + integral + damping, outputMin, outputMax);
+  return output;
+}
+
+TimeProportioner::TimeProportioner(uint32_t windowMs, uint32_t minSwitchMs)
+    : windowMs(windowMs), minSwitchMs(minSwitchMs), windowStart(0), started(false) {}
+
+bool TimeProportioner::update(float duty, uint32_t nowMs)
+{
+  if (!started)
+  {
+    windowStart = nowMs;
+    started = true;
+  }
+
+  // Keep the windows aligned even if an update was late
+  uint32_t elapsed = nowMs - windowStart;
+  if (elapsed >= windowMs)
+  {
+    windowStart += elapsed - elapsed % windowMs;
+    elapsed %= windowMs;
+  }
+
+  uint32_t onMs = (uint32_t)(clamp(duty, 0, 1) * windowMs);
+  if (onMs < minSwitchMs)
+  {
+    onMs = 0;
+  }
+  else if (onMs > windowMs - minSwitchMs)
+  {
+    onMs = windowMs;
+  }
+
+  return elapsed < onMs;
+}
+
+RelayAutotuner::RelayAutotuner()
+    : state(Idle), setpoint(0), hysteresis(0), cycles(0), startMs(0), timeoutMs(0), heating(false), peakHigh(0), peakLow(0),
+      lastRiseMs(0), measured(0), amplitudeSum(0), periodSum(0), gains(), ultimateGain(0), ultimatePeriod(0) {}
+
+void RelayAutotuner::start(float newSetpoint, float newHysteresis, uint8_t newCycles, uint32_t newTimeoutMs, uint32_t nowMs)
+{
+  state = Running;
+  setpoint = newSetpoint;
+  hysteresis = newHysteresis;
+  cycles = newCycles ? newCycles : 1;
+  startMs = nowMs;
+  timeoutMs = newTimeoutMs;
+
+  heating = true;
+  peakHigh = -INFINITY;
+  peakLow = INFINITY;
+  lastRiseMs = 0;
+  measured = 0;
+  amplitudeSum = 0;
+  periodSum = 0;
+}
+
+float RelayAutotuner::update(float measurement, uint32_t nowMs)
+{
+  if (state != Running)
+  {
+    return 0;
+  }
+  if (nowMs - startMs > timeoutMs)
+  {
+    state = Failed;
+    return 0;
+  }
+
+  if (heating)
+  {
+    peakLow = fminf(peakLow, measurement);
+
+    if (measurement > setpoint + hysteresis)
+    {
+      heating = false;
+      peakHigh = -INFINITY;
+    }
+  }
+  else
+  {
+    peakHigh = fmaxf(peakHigh, measurement);
+
+    if (measurement < setpoint - hysteresis)
+    {
+      heating = true;
+
+      // A full cycle ended (rise to rise). What comes before the first rise is the transient from the start & isn't measured
+      if (lastRiseMs)
+      {
+        if (isfinite(peakLow))
+        {
+          amplitudeSum += (peakHigh - peakLow) / 2;
+          periodSum += (nowMs - lastRiseMs) / 1000.0f;
+          measured++;
+        }
+
+        if (measured >= cycles)
+        {
+          float amplitude = amplitudeSum / measured;
+          ultimatePeriod = periodSum / measured;
+
+          if (amplitude <= 0 || ultimatePeriod <= 0)
+          {
+            state = Failed;
+            return 0;
+          }
+
+          ultimateGain = 4 * RELAY_AMPLITUDE / ((float)M_PI * amplitude);
+
+          // Tyreus-Luyben: Kp = Ku / 2.2, Ti = 2.2 Tu, Td = Tu / 6.3
+          gains.kp = ultimateGain / 2.2f;
+          gains.ki = gains.kp / (2.2f * ultimatePeriod);
+          gains.kd = gains.kp * ultimatePeriod / 6.3f;
+
+          state = Done;
+          return 0;
+        }
+      }
+
+      lastRiseMs = nowMs ? nowMs : 1;
+      peakLow = INFINITY;
+    }
+  }
+
+  return heating ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+#ifndef PID_H
+#define PID_H
+
+#include <stdint.h>
+
+struct PidGains
+{
+  float kp; // Output per ºC of error
+  float ki; // Output per ºC·s of accumulated error
+  float kd; // Output per ºC/s of change of the measurement
+};
+
+// PID controller with the output clamped to [min, max]. The derivative acts
+// on the (filtered) measurement, so setpoint steps don't kick the output, and
+// the integral stops accumulating while the output is saturated (anti-windup)
+class Pid
+{
+public:
+  Pid(float outputMin, float outputMax);
+
+  void setGains(const PidGains &gains);
+  const PidGains &getGains() const { return gains; }
+
+  // Start again from the current measurement, with no accumulated error
+  void reset(float measurement);
+
+  // Compute the output for the time elapsed since the last update
+  float update(float setpoint, float measurement, float dtSeconds);
+
+  float getOutput() const { return output; }
+
+private:
+  PidGains gains;
+  float outputMin, outputMax;
+  float integral;        // Integral term, in output units
+  float lastMeasurement; // For the derivative
+  float derivative;      // Filtered rate of change of the measurement (ºC/s)
+  float output;
+  bool started;
+};
+
+// Slow PWM for a relay or SSR: the duty cycle is applied over a fixed window,
+// with a minimum on/off time to spare the relay
+class TimeProportioner
+{
+public:
+  TimeProportioner(uint32_t windowMs, uint32_t minSwitchMs);
+
+  // Returns whether the output should be on now for the given duty (0 - 1)
+  bool update(float duty, uint32_t nowMs);
+
+private:
+  uint32_t windowMs, minSwitchMs;
+  uint32_t windowStart;
+  bool started;
+};
+
+// Relay autotuning (Åström-Hägglund): switch the output fully on & off around
+// the setpoint, measure the amplitude & period of the oscillation, and derive
+// PID gains from the ultimate gain & period (Tyreus-Luyben rules, less
+// aggressive than Ziegler-Nichols, which overshoots slow thermal plants)
+class RelayAutotuner
+{
+public:
+  RelayAutotuner();
+
+  // Oscillate around setpoint ± hysteresis (ºC) for a number of cycles, giving up after timeoutMs
+  void start(float setpoint, float hysteresis, uint8_t cycles, uint32_t timeoutMs, uint32_t nowMs);
+
+  // Returns the duty (0 or 1) for the current measurement
+  float update(float measurement, uint32_t nowMs);
+
+  void cancel() { state = Idle; }
+
+  bool running() const { return state == Running; }
+  bool done() const { return state == Done; }
+  bool failed() const { return state == Failed; }
+
+  // Result, once done
+  const PidGains &getGains() const { return gains; }
+  float getUltimateGain() const { return ultimateGain; }
+  float getUltimatePeriod() const { return ultimatePeriod; }
+
+private:
+  enum State
+  {
+    Idle,
+    Running,
+    Done,
+    Failed
+  } state;
+
+  float setpoint, hysteresis;
+  uint8_t cycles;
+  uint32_t startMs, timeoutMs;
+
+  bool heating;
+  float peakHigh, peakLow;  // Extremes of the current half cycles
+  uint32_t lastRiseMs;      // Time of the last switch to heating
+  uint8_t measured;         // Full cycles measured (the first one is skipped)
+  float amplitudeSum;       // Sum of the peak to peak amplitudes
+  float periodSum;          // Sum of the periods (s)
+
+  PidGains gains;
+  float ultimateGain, ultimatePeriod;
+};
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef PINS_H
+#define PINS_H
+
+#define LCD_SDA 21
+#define LCD_SCL 22
+#define MAX_SCK 5
+#define MAX_CS 23
+#define MAX_SO 19
+#define DHT_PIN 18
+#define MOTOR1_PIN 25 // 25, but internal LED (2) for debugging
+#define MOTOR2_PIN 26
+#define MOTOR3_PIN 27
+#define BUZZER_PIN 14
+#define HEATER_PIN 32 // Relay / SSR of the heater
+#define TIME_A 36
+#define TIME_B 34
+#define TIME_C 35
+#define TIME_ADDER 12
+#define TIME_REDUCER 13
+
+#endif
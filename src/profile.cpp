@@ -0,0 +1,97 @@
+#include "profile.h"
+
+#include <stddef.h>
+
+ProfileRunner::ProfileRunner() : profile(NULL), phase(Idle), segment(0), setpoint(0), rising(true), lastMs(0) {}
+
+void ProfileRunner::start(const Profile *newProfile, float temperature, uint32_t nowMs)
+{
+  profile = newProfile;
+  segment = 0;
+  lastMs = nowMs;
+  phase = profile && profile->count ? Ramp : Done;
+
+  // The first ramp starts from where the roaster is
+  setpoint = temperature;
+  if (phase == Ramp)
+  {
+    beginSegment();
+  }
+}
+
+void ProfileRunner::beginSegment()
+{
+  const ProfileSegment &current = profile->segments[segment];
+
+  rising = current.target >= setpoint;
+  if (current.ramp <= 0)
+  {
+    setpoint = current.target;
+  }
+}
+
+void ProfileRunner::stop()
+{
+  profile = NULL;
+  phase = Idle;
+}
+
+bool ProfileRunner::update(float temperature, uint32_t nowMs)
+{
+  if (phase != Ramp)
+  {
+    lastMs = nowMs;
+    return false;
+  }
+
+  const ProfileSegment &current = profile->segments[segment];
+  float target = current.target;
+
+  // Move the setpoint towards the target
+  if (current.ramp > 0)
+  {
+    float step = current.ramp * (nowMs - lastMs) / 60000.0f;
+    setpoint = rising ? (setpoint + step > target ? target : setpoint + step) : (setpoint - step < target ? target : setpoint - step);
+  }
+
+  lastMs = nowMs;
+
+  // Reached when the setpoint is there & so is the temperature
+  if (setpoint == target && (rising ? temperature >= target : temperature <= target))
+  {
+    phase = Hold;
+    return true;
+  }
+  return false;
+}
+
+uint8_t ProfileRunner::finishSegment(uint32_t nowMs)
+{
+  if (phase != Ramp && phase != Hold)
+  {
+    return 0;
+  }
+
+  uint8_t motors = profile->segments[segment].motors;
+
+  // The next ramp starts from this target
+  setpoint = profile->segments[segment].target;
+  lastMs = nowMs;
+
+  if (++segment >= profile->count)
+  {
+    phase = Done;
+  }
+  else
+  {
+    phase = Ramp;
+    beginSegment();
+  }
+
+  return motors;
+}
+
+uint16_t ProfileRunner::holdSeconds() const
+{
+  return profile && segment < profile->count ? profile->segments[segment].hold : 0;
+}
@@ -0,0 +1,78 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#define PROFILE_MAX_SEGMENTS 8
+#define PROFILE_NAME_LENGTH 11
+
+// Bits of ProfileSegment::motors
+#define PROFILE_MOTOR1 0x01
+#define PROFILE_MOTOR2 0x02
+#define PROFILE_MOTOR3 0x04
+
+// Ramp to a target temperature, then hold it
+struct ProfileSegment
+{
+  float ramp;      // Setpoint change in ºC/min, 0 jumps straight to the target
+  int16_t target;  // ºC
+  uint16_t hold;   // Seconds to hold once the temperature reaches the target
+  uint8_t motors;  // Motors turned on when the segment ends (PROFILE_MOTOR* bits)
+};
+
+struct Profile
+{
+  char name[PROFILE_NAME_LENGTH + 1];
+  uint8_t count; // Segments in use
+  ProfileSegment segments[PROFILE_MAX_SEGMENTS];
+  int16_t maxTemperature; // ºC the safety supervisor trips over, 0 for its default (see safety.h)
+  int16_t maxRor;         // ºC/min the safety supervisor trips over, 0 for its default
+};
+
+// Runs a profile, one segment after another. The setpoint moves from the
+// previous target towards the segment target at the ramp rate; the target is
+// reached once the setpoint is there & the temperature gets to it. The hold itself
+// is timed by the caller (the roast timer, which the buttons can extend),
+// which then calls finishSegment(). Nothing is allocated while running
+class ProfileRunner
+{
+public:
+  enum Phase
+  {
+    Idle,
+    Ramp, // Going to the target of the segment
+    Hold, // Target reached, waiting for finishSegment()
+    Done  // Every segment finished
+  };
+
+  ProfileRunner();
+
+  void start(const Profile *profile, float temperature, uint32_t nowMs);
+  void stop();
+
+  // Advance the setpoint with a new measurement. Returns true once, when the
+  // target of the segment is reached: its hold starts (see holdSeconds())
+  bool update(float temperature, uint32_t nowMs);
+
+  // End the current segment & go to the next one. Returns the motors to turn on
+  uint8_t finishSegment(uint32_t nowMs);
+
+  Phase getPhase() const { return phase; }
+  const Profile *getProfile() const { return profile; }
+  uint8_t getSegment() const { return segment; }
+  float getSetpoint() const { return setpoint; }
+  bool isRising() const { return rising; } // Whether the segment heats up
+  uint16_t holdSeconds() const;
+
+private:
+  void beginSegment(); // Start going from the setpoint to the target of the segment
+
+  const Profile *profile;
+  Phase phase;
+  uint8_t segment;
+  float setpoint;
+  bool rising;     // Whether the segment heats up (or cools down)
+  uint32_t lastMs; // Time of the last setpoint update
+};
+
+#endif
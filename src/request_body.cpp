@@ -0,0 +1,45 @@
+#include "request_body.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+uint8_t gatherBody(void **storage, const uint8_t *data, size_t len, size_t index, size_t total, const char **body, size_t *length)
+{
+  if (index == 0)
+  {
+    if (total > REQUEST_BODY_MAX)
+    {
+      return BODY_TOO_LARGE;
+    }
+
+    // All in one chunk, the usual case
+    if (len == total)
+    {
+      *body = (const char *)data;
+      *length = len;
+      return BODY_COMPLETE;
+    }
+
+    *storage = malloc(total);
+    if (!*storage)
+    {
+      return BODY_NO_MEMORY;
+    }
+  }
+
+  // No buffer: the body was refused on its first chunk
+  if (!*storage || index + len > total)
+  {
+    return BODY_PARTIAL;
+  }
+
+  memcpy((uint8_t *)*storage + index, data, len);
+  if (index + len < total)
+  {
+    return BODY_PARTIAL;
+  }
+
+  *body = (const char *)*storage;
+  *length = total;
+  return BODY_COMPLETE;
+}
@@ -0,0 +1,22 @@
+#ifndef REQUEST_BODY_H
+#define REQUEST_BODY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REQUEST_BODY_MAX 512 // Longest body of the commands of the page
+
+// Outcome of a chunk given to gatherBody()
+#define BODY_PARTIAL 0   // More chunks to come (or the chunk of a body already refused)
+#define BODY_COMPLETE 1  // *body & *length hold the whole body
+#define BODY_TOO_LARGE 2 // Over REQUEST_BODY_MAX, answer 413 (given for the first chunk only)
+#define BODY_NO_MEMORY 3 // Couldn't allocate it (first chunk only)
+
+// Gather the body of a request from the chunks the web server hands over in
+// order (data: len bytes at offset index of a body of total bytes). A body in
+// a single chunk is used in place. Otherwise it's copied into a buffer
+// allocated with malloc() in *storage (the request's _tempObject, which the
+// server frees with the request), and given whole with the last chunk
+uint8_t gatherBody(void **storage, const uint8_t *data, size_t len, size_t index, size_t total, const char **body, size_t *length);
+
+#endif
@@ -0,0 +1,233 @@
+#include "roast_export.h"
+
+#include <string.h>
+
+#include "metrics.h"
+#include "telemetry.h"
+
+#define JSON_VALUE_MAX 7 // ,-32768
+#define CSV_ROW_MAX 19   // 4294967.295,-32768 & the line break
+
+// Write a number, returns its length
+static size_t formatNumber(char *out, int32_t value)
+{
+  char digits[10];
+  size_t count = 0, length = 0;
+  uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+
+  do
+  {
+    digits[count++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude);
+
+  if (value < 0)
+  {
+    out[length++] = '-';
+  }
+  while (count)
+  {
+    out[length++] = digits[--count];
+  }
+  return length;
+}
+
+static void put16(uint8_t *bytes, uint16_t value)
+{
+  bytes[0] = value;
+  bytes[1] = value >> 8;
+}
+
+RoastExport::RoastExport(const JournalEntry &entry, uint8_t format)
+    : entry(entry), format(format), stage(Header), sample(0), pending(NULL), pendingCount(0)
+{
+}
+
+bool RoastExport::open()
+{
+  stage = Header;
+  sample = 0;
+  pendingCount = 0;
+  return reader.open(entry);
+}
+
+const char *RoastExport::contentType() const
+{
+  switch (format)
+  {
+  case EXPORT_CSV:
+    return "text/csv";
+  case EXPORT_BINARY:
+    return "application/octet-stream";
+  default:
+    return "application/json";
+  }
+}
+
+size_t RoastExport::header(uint8_t *buffer, size_t size)
+{
+  if (format == EXPORT_BINARY)
+  {
+    if (size < EXPORT_BINARY_HEADER)
+    {
+      return 0;
+    }
+
+    memcpy(buffer, "RST", 3);
+    buffer[3] = EXPORT_BINARY_VERSION;
+    put16(buffer + 4, entry.id);
+    put16(buffer + 6, entry.id >> 16);
+    put16(buffer + 8, entry.periodMs);
+    put16(buffer + 10, entry.samples);
+    buffer[12] = entry.mode;
+    buffer[13] = (entry.complete ? EXPORT_COMPLETE : 0) | (entry.finished ? EXPORT_FINISHED : 0);
+    for (uint8_t i = 0; i < 3; i++)
+    {
+      put16(buffer + 14 + 2 * i, entry.phases[i]);
+    }
+    memcpy(buffer + 20, entry.name, PROFILE_NAME_LENGTH + 1);
+    return EXPORT_BINARY_HEADER;
+  }
+
+  JsonWriter out((char *)buffer, size);
+  if (format == EXPORT_CSV)
+  {
+    out.raw("seconds,temperature\n");
+  }
+  else
+  {
+    char roast[ROAST_JSON_MAX + 1];
+    writeRoastEntry(roast, sizeof(roast), entry);
+    out.raw("{\"roast\":").raw(roast).raw(",\"temperatures\":[");
+  }
+  return out.length();
+}
+
+size_t RoastExport::values(uint8_t *buffer, size_t size)
+{
+  char *out = (char *)buffer;
+  size_t used = 0;
+
+  if (format == EXPORT_BINARY)
+  {
+    // A block of the batch: its count, the first temperature & the differences
+    if (size < 3)
+    {
+      return 0;
+    }
+
+    size_t count = pendingCount < 255 ? pendingCount : 255;
+    if (count > size - 2)
+    {
+      count = size - 2;
+    }
+
+    buffer[used++] = count;
+    put16(buffer + used, pending[0]);
+    used += 2;
+    for (size_t i = 1; i < count; i++)
+    {
+      buffer[used++] = (int8_t)(pending[i] - pending[i - 1]);
+    }
+
+    pending += count;
+    pendingCount -= count;
+    sample += count;
+    return used;
+  }
+
+  while (pendingCount > 0)
+  {
+    if (format == EXPORT_CSV)
+    {
+      if (size - used < CSV_ROW_MAX)
+      {
+        break;
+      }
+
+      // Seconds since the start, with the milliseconds if the period has them
+      uint64_t ms = (uint64_t)sample * entry.periodMs;
+      used += formatNumber(out + used, ms / 1000);
+      if (entry.periodMs % 1000)
+      {
+        out[used++] = '.';
+        out[used++] = '0' + ms / 100 % 10;
+        out[used++] = '0' + ms / 10 % 10;
+        out[used++] = '0' + ms % 10;
+      }
+      out[used++] = ',';
+      used += formatNumber(out + used, *pending);
+      out[used++] = '\n';
+    }
+    else
+    {
+      if (size - used < JSON_VALUE_MAX)
+      {
+        break;
+      }
+
+      if (sample > 0)
+      {
+        out[used++] = ',';
+      }
+      used += formatNumber(out + used, *pending);
+    }
+
+    pending++;
+    pendingCount--;
+    sample++;
+  }
+
+  return used;
+}
+
+size_t RoastExport::fill(uint8_t *buffer, size_t size)
+{
+  METRIC_PROBE(exportFillCycles);
+  size_t used = 0;
+
+  if (stage == Header)
+  {
+    used = header(buffer, size);
+    if (used == 0)
+    {
+      return 0;
+    }
+    stage = Body;
+  }
+
+  while (stage == Body)
+  {
+    if (pendingCount == 0)
+    {
+      pendingCount = reader.nextBatch(pending);
+      if (pendingCount == 0)
+      {
+        stage = Footer;
+        break;
+      }
+    }
+
+    size_t written = values(buffer + used, size - used);
+    if (written == 0)
+    {
+      break;
+    }
+    used += written;
+  }
+
+  if (stage == Footer)
+  {
+    // The closing brackets, or the count of 0
+    const char *footer = format == EXPORT_JSON ? "]}" : "";
+    size_t length = format == EXPORT_BINARY ? 1 : strlen(footer);
+    if (size - used >= length)
+    {
+      memcpy(buffer + used, footer, length); // The binary one is the terminator
+      used += length;
+      stage = Done;
+    }
+  }
+
+  return used;
+}
@@ -0,0 +1,63 @@
+#ifndef ROAST_EXPORT_H
+#define ROAST_EXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "journal.h"
+
+// Formats of an export
+#define EXPORT_JSON 0   // {"roast":{...},"temperatures":[t,...]}
+#define EXPORT_CSV 1    // A seconds,temperature row per sample
+#define EXPORT_BINARY 2 // See RoastExport
+
+#define EXPORT_BINARY_HEADER 32
+#define EXPORT_BINARY_VERSION 1
+
+// Flags of the binary header
+#define EXPORT_COMPLETE 0x01
+#define EXPORT_FINISHED 0x02
+
+// Streams a roast of the journal straight from the flash, a chunk at a time:
+// it only ever holds a batch of the journal, whatever the length of the roast.
+// The binary format is a header, little endian: "RST", the version, id (4),
+// period in ms (2), samples (2), mode, EXPORT_* flags, the phases (3 x 2, in
+// seconds) & the name (12, null padded). Then blocks of a count (1 - 255), the
+// first temperature (2) & the difference to the previous one of each other
+// (1, signed), up to a count of 0
+class RoastExport
+{
+public:
+  RoastExport(const JournalEntry &entry, uint8_t format);
+
+  // False if the segment of the roast was reused since
+  bool open();
+
+  // Write the next part of the export. Returns its length, 0 if nothing fit or at the end (see done())
+  size_t fill(uint8_t *buffer, size_t size);
+  bool done() const { return stage == Done; }
+
+  const char *contentType() const;
+
+private:
+  enum Stage
+  {
+    Header,
+    Body,
+    Footer,
+    Done
+  };
+
+  size_t header(uint8_t *buffer, size_t size);
+  size_t values(uint8_t *buffer, size_t size); // As many of the pending temperatures as fit
+
+  JournalEntry entry;
+  uint8_t format;
+  JournalReader reader;
+  Stage stage;
+  uint32_t sample;        // Index of the next temperature
+  const int16_t *pending; // Rest of the batch being written
+  size_t pendingCount;
+};
+
+#endif
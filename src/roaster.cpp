@@ -0,0 +1,542 @@
+#include "roaster.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <ArduinoJson.h>
+
+#include "filter.h"
+#include "hal.h"
+#include "periods.h"
+#include "pins.h"
+
+const char *mainTitle = "Tostador                ";
+
+const float TIMER_DURATION_DEBUG = 0; // Set a default hold duration (minutes) for debugging. Set 0 for production
+
+// Profiles of the positions of the 3-state switch, used when /profiles.json can't be loaded:
+// heat to the temperature & turn on motor 1, then hold it for the time of the mode
+const Profile DEFAULT_PROFILES[] = {
+    {"Mani", 2, {{0, 180, 0, PROFILE_MOTOR1}, {0, 180, 20 * 60, 0}}},
+    {"Cacao", 2, {{0, 140, 0, PROFILE_MOTOR1}, {0, 140, 33 * 60, 0}}},
+    {"Cafe", 2, {{0, 170, 0, PROFILE_MOTOR1}, {0, 170, 12 * 60, 0}}}};
+
+const PidGains DEFAULT_GAINS = {0.02, 0.0001, 0.3}; // Used until a mode is autotuned
+
+const uint8_t MOTOR_PINS[] = {MOTOR1_PIN, MOTOR2_PIN, MOTOR3_PIN};
+
+Roaster::Roaster(RoasterRowCallback showRow, RoasterCallback statesChanged)
+    : showRow(showRow), statesChanged(statesChanged), temperature(0), humidity(0),
+      temperatureQuality(QUALITY_STALE), humidityQuality(QUALITY_STALE),
+      timerResponseIsActive(false),
+      isTimeA(false), isTimeB(false), isTimeC(false), motors23Activated(false),
+      profileCount(0), selectedProfile(-1), lastProfileIndex(-1),
+      pid(0, 1), heaterOutput(HEATER_WINDOW, HEATER_MIN_SWITCH), heaterDuty(0),
+      autotuneMode(0), autotuneRequest(0), lastHeaterMicros(0), lastHeaterMode(0),
+      analytics(ANALYTICS_PERIOD)
+{
+  profileCount = sizeof(DEFAULT_PROFILES) / sizeof(DEFAULT_PROFILES[0]);
+  memcpy(profiles, DEFAULT_PROFILES, sizeof(DEFAULT_PROFILES));
+}
+
+void Roaster::begin()
+{
+  beginOutputs();
+  loadSettings();
+}
+
+void Roaster::beginOutputs()
+{
+  for (uint8_t motor = 0; motor < 3; motor++)
+  {
+    halPinMode(MOTOR_PINS[motor], HAL_OUTPUT);
+    halDigitalWrite(MOTOR_PINS[motor], false);
+  }
+  halPinMode(BUZZER_PIN, HAL_OUTPUT);
+  halPinMode(HEATER_PIN, HAL_OUTPUT);
+  halDigitalWrite(HEATER_PIN, false);
+  halPinMode(TIME_A, HAL_INPUT);
+  halPinMode(TIME_B, HAL_INPUT);
+  halPinMode(TIME_C, HAL_INPUT);
+}
+
+void Roaster::loadSettings()
+{
+  loadGains();
+  loadProfiles("/profiles.json");
+}
+
+// Key of the gains of a mode in the settings
+static void gainsKey(char *key, size_t size, uint8_t mode)
+{
+  snprintf(key, size, "gains%u", mode);
+}
+
+// Load the gains of each mode
+void Roaster::loadGains()
+{
+  for (uint8_t mode = 1; mode <= 3; mode++)
+  {
+    char key[16];
+    gainsKey(key, sizeof(key), mode);
+    if (!halLoadSetting(key, &modeGains[mode], sizeof(PidGains)))
+    {
+      modeGains[mode] = DEFAULT_GAINS;
+    }
+  }
+}
+
+// Load the roast profiles from a JSON file, the built-in ones are kept if it can't be read
+void Roaster::loadProfiles(const char *path)
+{
+  static char json[PROFILES_FILE_SIZE];
+  size_t length = halReadFile(path, json, sizeof(json));
+  if (!length)
+  {
+    halLog("No %s, using the built-in profiles", path);
+    return;
+  }
+
+  DynamicJsonDocument data(PROFILES_JSON_SIZE);
+  DeserializationError error = deserializeJson(data, (const char *)json, length);
+
+  if (error)
+  {
+    halLog("Invalid %s: %s", path, error.c_str());
+    return;
+  }
+
+  static Profile loaded[PROFILES_MAX];
+  uint8_t count = 0;
+
+  for (JsonObject item : data.as<JsonArray>())
+  {
+    if (count == PROFILES_MAX)
+    {
+      break;
+    }
+
+    Profile &profile = loaded[count];
+    snprintf(profile.name, sizeof(profile.name), "%s", item["name"] | "");
+    profile.count = 0;
+    profile.maxTemperature = item["maxTemperature"] | 0;
+    profile.maxRor = item["maxRor"] | 0;
+
+    for (JsonObject step : item["segments"].as<JsonArray>())
+    {
+      if (profile.count == PROFILE_MAX_SEGMENTS)
+      {
+        break;
+      }
+
+      ProfileSegment &segment = profile.segments[profile.count++];
+      segment.ramp = step["ramp"] | 0.0f;
+      segment.target = step["target"] | 0;
+      segment.hold = step["hold"] | 0;
+      segment.motors = 0;
+
+      for (int motor : step["motors"].as<JsonArray>())
+      {
+        if (motor >= 1 && motor <= 3)
+        {
+          segment.motors |= 1 << (motor - 1);
+        }
+      }
+    }
+
+    if (profile.count)
+    {
+      count++;
+    }
+  }
+
+  if (count)
+  {
+    memcpy(profiles, loaded, sizeof(Profile) * count);
+    profileCount = count;
+  }
+
+  halLog("Loaded %u profiles", profileCount);
+}
+
+bool Roaster::addProfile(const Profile &profile)
+{
+  if (profileCount == PROFILES_MAX)
+  {
+    return false;
+  }
+  profiles[profileCount++] = profile;
+  return true;
+}
+
+void Roaster::pollSwitches()
+{
+  setMode(readSwitch());
+}
+
+uint8_t Roaster::readSwitch() const
+{
+  return halDigitalRead(TIME_A) ? 1 : halDigitalRead(TIME_B) ? 2 : halDigitalRead(TIME_C) ? 3 : 0;
+}
+
+void Roaster::setMode(uint8_t mode)
+{
+  isTimeA = mode == 1;
+  isTimeB = mode == 2;
+  isTimeC = mode == 3;
+}
+
+uint8_t Roaster::getMode() const
+{
+  return isTimeA ? 1 : isTimeB ? 2 : isTimeC ? 3 : 0;
+}
+
+TimerValues Roaster::getTimeValues() const
+{
+  return {countdown.total(), countdown.remaining(halMillis())};
+}
+
+MotorStates Roaster::getMotorStates() const
+{
+  return {halDigitalRead(MOTOR1_PIN), halDigitalRead(MOTOR2_PIN), halDigitalRead(MOTOR3_PIN)};
+}
+
+void Roaster::handleReadings(const Readings &readings)
+{
+  // The control runs: the loop is making progress
+  safety.heartbeat(halMillis(), getMode() == 0);
+
+  temperature = readings.temperature;
+  humidity = readings.humidity;
+  temperatureQuality = readings.temperatureQuality;
+  humidityQuality = readings.humidityQuality;
+
+  // Show the latest readings on the second row of the LCD, a failed sensor as "--"
+  char row[32], temperatureText[6], humidityText[6];
+  snprintf(temperatureText, sizeof(temperatureText), isTemperatureUsable() ? "%d" : "--", temperature);
+  snprintf(humidityText, sizeof(humidityText), humidityQuality & QUALITY_UNUSABLE ? "--" : "%d", humidity);
+  snprintf(row, sizeof(row), "T: %sC H: %s%%", temperatureText, humidityText);
+  showRow(1, row);
+
+  // Without a temperature the profile waits where it is
+  if (isTemperatureUsable())
+  {
+    handleProfile();
+  }
+}
+
+Readings Roaster::getReadings() const
+{
+  Readings readings = {temperature, humidity, temperatureQuality, humidityQuality};
+  return readings;
+}
+
+bool Roaster::isTemperatureUsable() const
+{
+  return !(temperatureQuality & QUALITY_UNUSABLE);
+}
+
+// Index of the profile to run: the one selected from the web, or the one of the switch position. -1 when Off
+int Roaster::getProfileIndex() const
+{
+  uint8_t mode = getMode();
+  if (mode == 0)
+  {
+    return -1;
+  }
+
+  int selected = selectedProfile;
+  if (selected >= 0)
+  {
+    return selected;
+  }
+  return mode <= profileCount ? mode - 1 : -1;
+}
+
+// End the segment of the profile: turn on its motors, & start the timer response after the last one
+void Roaster::finishProfileSegment()
+{
+  uint8_t motors = profileRunner.finishSegment(halMillis());
+
+  if (motors && !safety.motorsHeld())
+  {
+    for (uint8_t motor = 0; motor < 3; motor++)
+    {
+      if (motors & (1 << motor))
+      {
+        halDigitalWrite(MOTOR_PINS[motor], true);
+      }
+    }
+
+    // Send new motor statuses to server
+    statesChanged();
+  }
+
+  if (profileRunner.getPhase() == ProfileRunner::Done)
+  {
+    timerResponseIsActive = true;
+  }
+}
+
+// Run the selected profile with the latest temperature
+void Roaster::handleProfile()
+{
+  // Selecting another profile (or moving the switch to Off) starts again
+  int index = getProfileIndex();
+  if (index != lastProfileIndex)
+  {
+    if (index < 0)
+    {
+      profileRunner.stop();
+      safety.disarm();
+    }
+    else
+    {
+      const Profile &profile = profiles[index];
+      profileRunner.start(&profile, temperature, halMillis());
+      analytics.start(DRY_END_TEMPERATURE, profile.segments[profile.count - 1].target);
+      safety.arm(safetyLimitsOf(profile));
+    }
+    lastProfileIndex = index;
+  }
+
+  if (profileRunner.update(temperature, halMillis()))
+  {
+    // Target reached: hold it with the timer, or go on with the next segment
+    int hold = profileRunner.holdSeconds();
+    if (hold > 0)
+    {
+      countdown.start(TIMER_DURATION_DEBUG ? TIMER_DURATION_DEBUG * 60 : hold, halMillis());
+    }
+    else
+    {
+      finishProfileSegment();
+    }
+  }
+}
+
+// Show the remaining time as mm:ss & the name of the profile
+void Roaster::showTime(int minutes, int seconds)
+{
+  const Profile *profile = profileRunner.getProfile();
+
+  char row[32];
+  snprintf(row, sizeof(row), "%02d:%02d %s", minutes, seconds, profile ? profile->name : ""); // TODO: handle accents
+  showRow(0, row);
+}
+
+// Handle all timer logic with the 3-state switch
+void Roaster::handleTimer()
+{
+  uint32_t now = halMillis();
+  uint8_t changes = countdown.update(now);
+
+  if (changes & COUNTDOWN_SECOND)
+  {
+    int remaining = countdown.remaining(now);
+    showTime(remaining / 60, remaining % 60);
+  }
+
+  if (changes & COUNTDOWN_EXPIRED)
+  {
+    // The end of a hold goes on with the profile, any other timer starts the response
+    if (profileRunner.getPhase() == ProfileRunner::Hold)
+    {
+      finishProfileSegment();
+    }
+    else
+    {
+      timerResponseIsActive = true;
+    }
+
+    // Print the title again
+    showRow(0, mainTitle);
+  }
+
+  // When switch is moved to OFF, then turn off the response
+  if (!isTimeA && !isTimeB && !isTimeC)
+  {
+    timerResponseIsActive = false;
+    motors23Activated = false;
+    halNoTone(BUZZER_PIN);
+  }
+
+  // If there is a switch after the counter finished, handle the response
+  if (timerResponseIsActive)
+  {
+    // Make noise with the buzzer, unless the alarm of a trip sounds
+    if (!safety.tripped())
+    {
+      halTone(BUZZER_PIN, 440);
+    }
+
+    // Only turn the motors once every timer response (not while the supervisor holds them off)
+    if (!motors23Activated && !safety.motorsHeld())
+    {
+      halDigitalWrite(MOTOR2_PIN, true);
+      halDigitalWrite(MOTOR3_PIN, true);
+
+      motors23Activated = true;
+
+      // Send new motor statuses to server
+      statesChanged();
+    }
+  }
+}
+
+void Roaster::addTime(int seconds)
+{
+  countdown.add(seconds, halMillis());
+}
+
+void Roaster::reduceTime(int seconds)
+{
+  countdown.reduce(seconds);
+}
+
+uint32_t Roaster::untilNextSecond() const
+{
+  return countdown.untilNextSecond(halMillis());
+}
+
+void Roaster::setMotor(uint8_t motor, bool on)
+{
+  if (motor < 1 || motor > 3 || (on && safety.motorsHeld()))
+  {
+    return;
+  }
+  halDigitalWrite(MOTOR_PINS[motor - 1], on);
+
+  // When motor2 or motor3 are manually turned off, then we reset the timerResponse so another timer can turn both motors on again
+  if (motor > 1 && !on)
+  {
+    motors23Activated = false;
+    timerResponseIsActive = false;
+  }
+}
+
+bool Roaster::selectProfile(int index)
+{
+  if (!hasProfile(index))
+  {
+    return false;
+  }
+  selectedProfile = index < 0 ? -1 : index;
+  return true;
+}
+
+bool Roaster::requestAutotune(int mode)
+{
+  if (mode == -1)
+  {
+    autotuneRequest = -1;
+    return true;
+  }
+  if (!canAutotune(mode))
+  {
+    return false;
+  }
+  autotuneRequest = mode;
+  return true;
+}
+
+const char *Roaster::getAutotuneState() const
+{
+  return autotuner.running() ? "running" : autotuner.done() ? "done" : autotuner.failed() ? "failed" : "idle";
+}
+
+// Temperature held by the profile of a switch position (its last target), used to autotune that mode
+int Roaster::getModeTemperature(uint8_t mode) const
+{
+  const Profile &profile = profiles[mode - 1];
+  return profile.segments[profile.count - 1].target;
+}
+
+// Regulate the heater to the setpoint of the running profile, or autotune a mode
+void Roaster::handleHeater()
+{
+  // Use the measured interval, so a late run doesn't skew the integral & derivative
+  uint32_t now = halMicros();
+  float dt = lastHeaterMicros ? (now - lastHeaterMicros) / 1e6f : 0;
+  lastHeaterMicros = now;
+
+  uint8_t mode = getMode();
+
+  int request = autotuneRequest;
+  if (request)
+  {
+    autotuneRequest = 0;
+    if (request > 0)
+    {
+      autotuneMode = request;
+      autotuner.start(getModeTemperature(autotuneMode), AUTOTUNE_HYSTERESIS, AUTOTUNE_CYCLES, AUTOTUNE_TIMEOUT, halMillis());
+    }
+    else
+    {
+      autotuner.cancel();
+    }
+  }
+
+  // Moving the switch to Off, losing the thermocouple or a trip of the supervisor stops everything, autotuning included
+  if (!isTemperatureUsable() || safety.tripped())
+  {
+    autotuner.cancel();
+    heaterDuty = 0;
+    lastHeaterMode = 0;
+    return;
+  }
+  if (autotuner.running() && mode == 0)
+  {
+    autotuner.cancel();
+  }
+
+  if (autotuner.running())
+  {
+    heaterDuty = autotuner.update(temperature, halMillis());
+
+    if (autotuner.done())
+    {
+      modeGains[autotuneMode] = autotuner.getGains();
+
+      char key[16];
+      gainsKey(key, sizeof(key), autotuneMode);
+      halSaveSetting(key, &modeGains[autotuneMode], sizeof(PidGains));
+
+      halLog("Autotuned mode %u: Kp %.4f Ki %.5f Kd %.3f", autotuneMode, modeGains[autotuneMode].kp, modeGains[autotuneMode].ki, modeGains[autotuneMode].kd);
+      lastHeaterMode = 0; // Load the new gains
+    }
+    return;
+  }
+
+  // Heat while a profile runs, until its last segment ends
+  ProfileRunner::Phase phase = profileRunner.getPhase();
+  if (mode == 0 || timerResponseIsActive || (phase != ProfileRunner::Ramp && phase != ProfileRunner::Hold))
+  {
+    heaterDuty = 0;
+    lastHeaterMode = 0;
+    return;
+  }
+
+  if (mode != lastHeaterMode)
+  {
+    pid.setGains(modeGains[mode]);
+    pid.reset(temperature);
+    lastHeaterMode = mode;
+  }
+
+  heaterDuty = pid.update(profileRunner.getSetpoint(), temperature, dt);
+}
+
+// The trip is checked right before the write: the supervisor drives the heater off again on its next run if a trip came in between
+void Roaster::driveHeater()
+{
+  bool on = heaterOutput.update(heaterDuty, halMillis());
+  halDigitalWrite(HEATER_PIN, on && !safety.tripped());
+}
+
+// While the thermocouple fails the last good temperature is used, so the rate of rise drops to 0
+void Roaster::sampleAnalytics()
+{
+  ProfileRunner::Phase phase = profileRunner.getPhase();
+  analytics.push(temperature, phase == ProfileRunner::Ramp || phase == ProfileRunner::Hold);
+}
@@ -0,0 +1,141 @@
+#ifndef ROASTER_H
+#define ROASTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "analytics.h"
+#include "countdown.h"
+#include "pid.h"
+#include "profile.h"
+#include "safety.h"
+#include "telemetry.h"
+
+#define PROFILES_MAX 8          // Roast profiles loaded from /profiles.json
+#define PROFILES_FILE_SIZE 2048 // Longest /profiles.json
+#define PROFILES_JSON_SIZE 4096 // Memory to parse it
+
+#define HEATER_WINDOW 2000     // Time proportioning window of the heater output (ms)
+#define HEATER_MIN_SWITCH 100  // Shortest on/off time of the heater output (ms)
+#define AUTOTUNE_HYSTERESIS 2  // ºC around the setpoint before switching the relay when autotuning
+#define AUTOTUNE_CYCLES 4      // Oscillations measured when autotuning
+#define AUTOTUNE_TIMEOUT 3600000
+#define DRY_END_TEMPERATURE 100 // ºC, end of the drying phase of a roast (capped at its roast temperature)
+
+extern const char *mainTitle;
+
+// Shows a text on a row of the display
+typedef void (*RoasterRowCallback)(uint8_t row, const char *text);
+
+// Called when the motors were turned on or off by the roaster
+typedef void (*RoasterCallback)();
+
+// Logic of the roaster: the rotary switch, the profiles, the timer & its
+// response, the motors and the heater. It only talks to the hardware through
+// the HAL, so it runs the same on the board & on a workstation. The periodic
+// methods are meant to be called by the scheduler of the loop
+class Roaster
+{
+public:
+  Roaster(RoasterRowCallback showRow, RoasterCallback statesChanged);
+
+  // Set up the pins, load the PID gains & the profiles
+  void begin();
+
+  // The halves of begin(): the pins, with every output off (the first thing at
+  // boot, it needs nothing else), then the gains & profiles (needs the storage)
+  void beginOutputs();
+  void loadSettings();
+
+  // Add a profile after the loaded ones (the simulator's faulty ones). False when there are PROFILES_MAX
+  bool addProfile(const Profile &profile);
+
+  // Periodic work
+  void pollSwitches();                                 // Follow the 3-state switch: setMode(readSwitch())
+  void handleReadings(const Readings &readings);       // Take new readings & run the profile with them
+  void handleTimer();                                  // Follow the countdown (at least every second) & handle its response
+  void handleHeater();                                 // Update the duty of the heater from the PID or the autotuner
+  void driveHeater();                                  // Switch the heater relay following that duty
+  void sampleAnalytics();                              // Feed the temperature to the analytics (every ANALYTICS_PERIOD)
+
+  // Commands, from the buttons, the switch & the web
+  // Only from the task that runs the periodic work: the others post them to it (commands.h)
+  void addTime(int seconds);    // Also starts the timer if there isn't one
+  void reduceTime(int seconds); // Of a running timer
+  void setMotor(uint8_t motor, bool on); // 1 - 3. Not turned on while a trip holds the motors off
+  void setMode(uint8_t mode);            // Position of the 3-state switch, 0 - 3
+  bool selectProfile(int index);         // -1 follows the switch again. False if there is no such profile
+  bool requestAutotune(int mode);        // Mode 1 - 3, or -1 to cancel. False if there is no such mode
+
+  // Checks of the commands, from any task once the settings are loaded
+  bool hasProfile(int index) const { return index < profileCount; } // Negative follows the switch
+  bool canAutotune(int mode) const { return mode >= 1 && mode <= 3 && mode <= profileCount; }
+
+  // State
+  int getTemperature() const { return temperature; }
+  int getHumidity() const { return humidity; }
+  Readings getReadings() const;
+  bool isTemperatureUsable() const; // The thermocouple works, getTemperature() is current
+  uint8_t getMode() const; // Position of the 3-state switch (0 is Off), as last set
+  uint8_t readSwitch() const; // Position of the 3-state switch on its pins
+  TimerValues getTimeValues() const;
+  MotorStates getMotorStates() const;
+  bool isTimerOn() const { return countdown.running(); }
+  uint32_t untilNextSecond() const; // ms until the timer shows another second, 0 if off
+  const CountdownStats &getTimerStats() const { return countdown.getStats(); }
+
+  uint8_t getProfileCount() const { return profileCount; }
+  const Profile &getProfile(uint8_t index) const { return profiles[index]; }
+  int getSelectedProfile() const { return selectedProfile; }
+  const ProfileRunner &getProfileRunner() const { return profileRunner; }
+
+  float getHeaterDuty() const { return heaterDuty; }
+  const char *getAutotuneState() const;
+  const PidGains &getGains(uint8_t mode) const { return modeGains[mode]; }
+  const RoastMetrics &getMetrics() const { return analytics.getMetrics(); }
+
+  // Watch over the loop, the thermocouple & the limits of the profiles, run by a task of its own (see safety.h)
+  SafetySupervisor &getSafety() { return safety; }
+  const SafetySupervisor &getSafety() const { return safety; }
+
+private:
+  void loadGains();
+  void loadProfiles(const char *path);
+  int getProfileIndex() const;
+  int getModeTemperature(uint8_t mode) const;
+  void finishProfileSegment();
+  void handleProfile();
+  void showTime(int minutes, int seconds);
+
+  RoasterRowCallback showRow;
+  RoasterCallback statesChanged;
+
+  int temperature, humidity;
+  uint8_t temperatureQuality, humidityQuality; // QUALITY_* bits of the readings
+
+  Countdown countdown;        // Timer of the holds & the buttons
+  bool timerResponseIsActive; // Represent a timer response (after a timer finishes) is active
+  bool isTimeA, isTimeB, isTimeC; // Represent the selection of a timer configuration for the 3-state switch. Only one is true
+  bool motors23Activated;     // Used to turn on the motors 2 & 3 only once every timer response
+
+  Profile profiles[PROFILES_MAX];
+  uint8_t profileCount;
+  ProfileRunner profileRunner;    // Setpoint & segment of the running profile
+  int selectedProfile;            // Profile selected from the web, -1 to follow the switch
+  int lastProfileIndex;           // Profile started by the runner
+
+  Pid pid;                        // Heater duty (0 - 1) from the temperature
+  TimeProportioner heaterOutput;  // Heater relay from the duty
+  RelayAutotuner autotuner;
+  PidGains modeGains[4];          // Gains of each mode, stored in the settings
+  float heaterDuty;               // Last output of the PID (or the autotuner)
+  uint8_t autotuneMode;           // Mode being autotuned
+  int autotuneRequest;            // From the web: mode to autotune, or -1 to cancel
+  uint32_t lastHeaterMicros;      // Time of the last heater update
+  uint8_t lastHeaterMode;         // Mode whose gains the PID has
+
+  RoastAnalytics analytics;       // Rate of rise & phases of the running profile
+  SafetySupervisor safety;        // Its trips hold the heater off, & the motors with the loop stuck
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include "safety.h"
+
+#include "filter.h"
+#include "hal.h"
+#include "pins.h"
+
+SafetyLimits safetyLimitsOf(const Profile &profile)
+{
+  int highest = 0;
+  for (uint8_t i = 0; i < profile.count; i++)
+  {
+    highest = profile.segments[i].target > highest ? profile.segments[i].target : highest;
+  }
+
+  int ceiling = profile.maxTemperature ? profile.maxTemperature : highest + SAFETY_TEMPERATURE_MARGIN;
+  SafetyLimits limits = {true, (int16_t)(ceiling < SAFETY_TEMPERATURE_MAX ? ceiling : SAFETY_TEMPERATURE_MAX),
+                         (int16_t)(profile.maxRor > 0 ? profile.maxRor : SAFETY_ROR_MAX)};
+  return limits;
+}
+
+// SafetyLimits in one word: maxTemperature in bits 0-15, maxRor in 16-30 & armed in 31
+static uint32_t packLimits(const SafetyLimits &limits)
+{
+  return (uint16_t)limits.maxTemperature | (uint32_t)(limits.maxRor & 0x7fff) << 16 | (uint32_t)limits.armed << 31;
+}
+
+static SafetyLimits unpackLimits(uint32_t packed)
+{
+  SafetyLimits limits = {(packed >> 31) != 0, (int16_t)(packed & 0xffff), (int16_t)(packed >> 16 & 0x7fff)};
+  return limits;
+}
+
+SafetySupervisor::SafetySupervisor()
+    : lastHeartbeatMs(0), idle(true), cause(SAFETY_OK), rorSamples(), rorCount(0), rorNext(0), lastRorMs(0), lastArmed(false), watching(false), stats()
+{
+  disarm();
+}
+
+void SafetySupervisor::heartbeat(uint32_t nowMs, bool atOff)
+{
+  idle.store(atOff, std::memory_order_relaxed);
+  lastHeartbeatMs.store(nowMs ? nowMs : 1, std::memory_order_release); // 0 means no run yet
+}
+
+void SafetySupervisor::arm(const SafetyLimits &profileLimits)
+{
+  limits.store(packLimits(profileLimits), std::memory_order_release);
+}
+
+void SafetySupervisor::disarm()
+{
+  SafetyLimits none = {false, SAFETY_TEMPERATURE_MAX, SAFETY_ROR_MAX};
+  limits.store(packLimits(none), std::memory_order_release);
+}
+
+SafetyLimits SafetySupervisor::getLimits() const
+{
+  return unpackLimits(limits.load(std::memory_order_acquire));
+}
+
+bool SafetySupervisor::motorsHeld() const
+{
+  return safetyHoldsMotors(getCause());
+}
+
+bool SafetySupervisor::loopAlive(uint32_t nowMs) const
+{
+  uint32_t heartbeat = lastHeartbeatMs.load(std::memory_order_acquire);
+  return heartbeat && (int32_t)(nowMs - heartbeat) <= SAFETY_LOOP_TIMEOUT;
+}
+
+// Keep a temperature a second, and measure the rise over the window once it's full
+void SafetySupervisor::sampleRor(int temperature, bool usable, uint32_t nowMs)
+{
+  if (!usable)
+  {
+    rorCount = 0;
+    stats.ror = 0;
+    return;
+  }
+  if (rorCount && nowMs - lastRorMs < 1000)
+  {
+    return;
+  }
+
+  lastRorMs = nowMs;
+  rorSamples[rorNext] = temperature;
+  rorNext = (rorNext + 1) % (SAFETY_ROR_WINDOW + 1);
+  if (rorCount <= SAFETY_ROR_WINDOW)
+  {
+    rorCount++;
+  }
+
+  // The next slot holds the oldest sample once the window is full
+  stats.ror = rorCount > SAFETY_ROR_WINDOW ? (temperature - rorSamples[rorNext]) * 60 / SAFETY_ROR_WINDOW : 0;
+}
+
+uint8_t SafetySupervisor::check(int temperature, uint8_t quality, uint32_t readMs, uint32_t nowMs)
+{
+  // At Off nothing heats: only the loop & the ceiling are watched
+  SafetyLimits current = getLimits();
+  bool armed = current.armed && !idle.load(std::memory_order_relaxed);
+  if (armed && !lastArmed)
+  {
+    rorCount = 0; // A new roast, measured from its start
+  }
+  lastArmed = armed;
+
+  bool usable = !(quality & QUALITY_UNUSABLE);
+  sampleRor(temperature, usable, nowMs);
+
+  uint32_t heartbeat = lastHeartbeatMs.load(std::memory_order_acquire);
+  int32_t gap = heartbeat ? (int32_t)(nowMs - heartbeat) : 0;
+  if (gap > (int32_t)stats.maxLoopGapMs)
+  {
+    stats.maxLoopGapMs = gap;
+  }
+
+  uint8_t found = SAFETY_OK;
+  if (gap > SAFETY_LOOP_TIMEOUT)
+  {
+    found = SAFETY_LOOP_STUCK;
+  }
+  else if (armed && (!usable || (int32_t)(nowMs - readMs) > SAFETY_STALE_TIMEOUT))
+  {
+    found = SAFETY_SENSOR_STALE;
+  }
+  else if (usable && temperature > (armed ? current.maxTemperature : SAFETY_TEMPERATURE_MAX))
+  {
+    found = SAFETY_OVER_TEMPERATURE;
+  }
+  else if (armed && stats.ror > current.maxRor)
+  {
+    found = SAFETY_OVER_ROR;
+  }
+
+  // A trip holds until the switch is at Off & nothing is wrong anymore
+  uint8_t was = cause.load(std::memory_order_relaxed);
+  if (was == SAFETY_OK && found != SAFETY_OK)
+  {
+    cause.store(found, std::memory_order_release);
+    stats.trips[found]++;
+    stats.lastTripMs = nowMs;
+    return found;
+  }
+  if (was != SAFETY_OK && found == SAFETY_OK && idle.load(std::memory_order_relaxed))
+  {
+    cause.store(SAFETY_OK, std::memory_order_release);
+  }
+  return SAFETY_OK;
+}
+
+void SafetySupervisor::run(int temperature, uint8_t quality, uint32_t readMs, uint32_t nowMs)
+{
+  // The pins are driven again on every run, the alarm only started on the trip
+  if (check(temperature, quality, readMs, nowMs) != SAFETY_OK)
+  {
+    safetyDriveOutputs(getCause(), true);
+  }
+  else if (tripped())
+  {
+    safetyDriveOutputs(getCause(), false);
+  }
+
+  // Watched from the first control run on, so a slow boot (a storage being formatted) doesn't reset the board
+  if (loopAlive(nowMs))
+  {
+    if (!watching)
+    {
+      halWatchdogBegin(SAFETY_WATCHDOG_TIMEOUT);
+      watching = true;
+    }
+    halWatchdogFeed();
+    stats.feeds++;
+  }
+}
+
+// The heater goes off whatever the cause, the motors only with the loop stuck:
+// - loop stuck: nothing follows the switch or the buttons anymore, so nothing
+//   is left running unattended (the watchdog resets the board next, & it
+//   boots with every output off)
+// - sensor stale: the batch may be hot & nothing tells how hot. The drum
+//   keeps it moving & the cooling motors keep taking heat away
+// - over temperature, over rate of rise: the batch is too hot, and the drum &
+//   the cooling motors are what bring it down. They stay as the loop (still
+//   running) drives them, and can be turned on during the trip
+bool safetyHoldsMotors(uint8_t cause)
+{
+  return cause == SAFETY_LOOP_STUCK;
+}
+
+void safetyDriveOutputs(uint8_t cause, bool alarm)
+{
+  halDigitalWrite(HEATER_PIN, false);
+  if (safetyHoldsMotors(cause))
+  {
+    halDigitalWrite(MOTOR1_PIN, false);
+    halDigitalWrite(MOTOR2_PIN, false);
+    halDigitalWrite(MOTOR3_PIN, false);
+  }
+  if (alarm)
+  {
+    halTone(BUZZER_PIN, SAFETY_ALARM_TONE);
+  }
+}
+
+const char *safetyCauseName(uint8_t cause)
+{
+  static const char *NAMES[] = {"ok", "loop stuck", "sensor stale", "over temperature", "over rate of rise"};
+  return cause < SAFETY_CAUSES ? NAMES[cause] : "unknown";
+}
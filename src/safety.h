@@ -0,0 +1,112 @@
+#ifndef SAFETY_H
+#define SAFETY_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "profile.h"
+
+#define SAFETY_LOOP_TIMEOUT 1000      // ms without a control run before the loop is taken as stuck (~4 runs)
+#define SAFETY_STALE_TIMEOUT 1500     // ms without a thermocouple read while a profile runs (~7 reads)
+#define SAFETY_TEMPERATURE_MAX 260    // ºC, ceiling whatever runs (or nothing)
+#define SAFETY_TEMPERATURE_MARGIN 25  // ºC over the highest target of a profile, its ceiling unless it sets one
+#define SAFETY_ROR_MAX 90             // ºC/min, unless the profile sets one. The heater alone gives ~60 from ambient
+#define SAFETY_ROR_WINDOW 10          // s over which the rate of rise is measured
+#define SAFETY_WATCHDOG_TIMEOUT 5000  // ms, the board resets once the supervisor stops feeding the watchdog
+#define SAFETY_ALARM_TONE 880         // Hz, buzzer of a trip
+
+// Causes of a trip
+#define SAFETY_OK 0
+#define SAFETY_LOOP_STUCK 1       // No control run for SAFETY_LOOP_TIMEOUT
+#define SAFETY_SENSOR_STALE 2     // No usable thermocouple read for SAFETY_STALE_TIMEOUT
+#define SAFETY_OVER_TEMPERATURE 3 // Over the ceiling of the profile (or SAFETY_TEMPERATURE_MAX)
+#define SAFETY_OVER_ROR 4         // Rising faster than the profile allows
+#define SAFETY_CAUSES 5
+
+// Limits of the running profile
+struct SafetyLimits
+{
+  bool armed;              // A profile runs: the sensor & the rate of rise are checked too
+  int16_t maxTemperature;  // ºC
+  int16_t maxRor;          // ºC/min, over 0
+};
+
+// Limits of a profile: its own, or a margin over its highest target & SAFETY_ROR_MAX, under SAFETY_TEMPERATURE_MAX
+SafetyLimits safetyLimitsOf(const Profile &profile);
+
+struct SafetyStats
+{
+  uint32_t trips[SAFETY_CAUSES]; // By cause
+  uint32_t lastTripMs;           // When the last one happened
+  uint32_t maxLoopGapMs;         // Longest time seen without a control run
+  uint32_t feeds;                // Of the watchdog
+  int16_t ror;                   // Last rate of rise measured (ºC/min), 0 until the window is full
+};
+
+// Independent watch over the roaster, run by a task of its own above the
+// loop (run()). The loop proves it makes progress with heartbeat() on every
+// control run, and publishes the limits of the profile it runs. When the
+// loop stops, the thermocouple goes stale, or the temperature or its rate of
+// rise go over the limits, it trips: the heater is driven off (and held off,
+// the roaster checks tripped() before it drives it), the motors too when the
+// loop is stuck (see safetyHoldsMotors()) & the buzzer sounds. A trip holds until the switch is at Off & its cause is
+// gone. The watchdog is only fed while the loop makes progress, so a loop
+// stuck for SAFETY_WATCHDOG_TIMEOUT resets the board
+class SafetySupervisor
+{
+public:
+  SafetySupervisor();
+
+  // Control loop: a control run happened. idle: the switch is at Off, which clears a trip once its cause is gone
+  void heartbeat(uint32_t nowMs, bool idle);
+
+  // Control loop: a profile started (its limits), or none runs
+  void arm(const SafetyLimits &profileLimits);
+  void disarm();
+
+  // Supervisor task: check the latest thermocouple reading (its value,
+  // QUALITY_* bits & when it was read). Returns the cause of a new trip
+  uint8_t check(int temperature, uint8_t quality, uint32_t readMs, uint32_t nowMs);
+
+  // Supervisor task, every SAFETY_PERIOD: check(), hold the outputs safe
+  // while tripped & feed the watchdog while the loop makes progress (it's
+  // started on the first control run)
+  void run(int temperature, uint8_t quality, uint32_t readMs, uint32_t nowMs);
+
+  // From any task
+  bool tripped() const { return cause.load(std::memory_order_acquire) != SAFETY_OK; }
+  bool motorsHeld() const; // The trip holds the motors off too
+  uint8_t getCause() const { return cause.load(std::memory_order_acquire); }
+  bool loopAlive(uint32_t nowMs) const;
+  SafetyLimits getLimits() const;
+  const SafetyStats &getStats() const { return stats; }
+
+private:
+  void sampleRor(int temperature, bool usable, uint32_t nowMs);
+
+  std::atomic<uint32_t> lastHeartbeatMs; // Of the last control run, 0 before the first one
+  std::atomic<bool> idle;                // The switch was at Off on the last control run
+  std::atomic<uint8_t> cause;            // SAFETY_OK, or the cause of the trip
+  std::atomic<uint32_t> limits;          // SafetyLimits in one word (see packLimits()), so no task ever waits on another for them
+
+  // Supervisor task only
+  int16_t rorSamples[SAFETY_ROR_WINDOW + 1]; // A temperature per second, the oldest is SAFETY_ROR_WINDOW s before the newest
+  uint8_t rorCount;                          // Samples in the window
+  uint8_t rorNext;
+  uint32_t lastRorMs;
+  bool lastArmed;                            // On the last check
+  bool watching;                             // The watchdog was started
+  SafetyStats stats;
+};
+
+// Whether a trip of that cause holds the motors off, and not just the heater
+bool safetyHoldsMotors(uint8_t cause);
+
+// Drive the outputs to their safe state for a trip: heater off, the motors off
+// if the cause holds them, & the alarm on the buzzer (alarm) or as it was
+void safetyDriveOutputs(uint8_t cause, bool alarm);
+
+const char *safetyCauseName(uint8_t cause);
+
+#endif
@@ -0,0 +1,152 @@
+#include "scheduler.h"
+
+// Wraparound-safe "a is at or after b" for the 32-bit microsecond clock
+static inline bool reached(uint32_t a, uint32_t b)
+{
+  return (int32_t)(a - b) >= 0;
+}
+
+Scheduler::Scheduler(SchedulerClock clock) : clock(clock), tasks(), count(0) {}
+
+int Scheduler::add(const char *name, TaskCallback callback, uint32_t periodMs, uint32_t deadlineMs)
+{
+  if (count >= SCHEDULER_MAX_TASKS || periodMs == 0)
+  {
+    return -1;
+  }
+
+  ScheduledTask &task = tasks[count];
+  task = ScheduledTask();
+  task.name = name;
+  task.callback = callback;
+  task.periodUs = periodMs * 1000;
+  task.deadlineUs = (deadlineMs ? deadlineMs : periodMs) * 1000;
+  task.nextRunUs = clock(); // First release is immediate
+  task.enabled = true;
+
+  return (int)count++;
+}
+
+void Scheduler::trigger(int id)
+{
+  if (id >= 0 && (size_t)id < count)
+  {
+    tasks[id].pending = true;
+  }
+}
+
+void Scheduler::setEnabled(int id, bool enabled)
+{
+  if (id < 0 || (size_t)id >= count)
+  {
+    return;
+  }
+
+  // Re-anchor the releases so that the disabled time is not counted as misses
+  if (enabled && !tasks[id].enabled)
+  {
+    tasks[id].nextRunUs = clock();
+  }
+  tasks[id].enabled = enabled;
+}
+
+uint32_t Scheduler::tick()
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    ScheduledTask &task = tasks[i];
+    if (!task.enabled)
+    {
+      continue;
+    }
+
+    uint32_t start = clock();
+    bool due = reached(start, task.nextRunUs);
+    if (!due && !task.pending)
+    {
+      continue;
+    }
+
+    task.pending = false;
+    {
+      METRIC_PROBE(task.cycles);
+      task.callback();
+    }
+
+    uint32_t end = clock();
+    task.lastRunUs = end - start;
+    if (task.lastRunUs > task.maxRunUs)
+    {
+      task.maxRunUs = task.lastRunUs;
+    }
+    task.runs++;
+
+    // A triggered run does not consume the periodic release
+    if (!due)
+    {
+      continue;
+    }
+
+    uint32_t jitter = start - task.nextRunUs;
+    task.lastJitterUs = jitter;
+    task.totalJitterUs += jitter;
+    if (jitter > task.maxJitterUs)
+    {
+      task.maxJitterUs = jitter;
+    }
+    if (jitter > task.deadlineUs)
+    {
+      task.misses++;
+    }
+
+    task.nextRunUs += task.periodUs;
+
+    // Fell more than a whole period behind: skip the lost releases instead of running them back to back
+    if (reached(end, task.nextRunUs))
+    {
+      uint32_t skipped = (end - task.nextRunUs) / task.periodUs + 1;
+      task.misses += skipped;
+      task.nextRunUs += skipped * task.periodUs;
+    }
+  }
+
+  // Time until the earliest release
+  uint32_t now = clock();
+  uint32_t idle = UINT32_MAX;
+  for (size_t i = 0; i < count; i++)
+  {
+    const ScheduledTask &task = tasks[i];
+    if (!task.enabled)
+    {
+      continue;
+    }
+    if (task.pending || reached(now, task.nextRunUs))
+    {
+      return 0;
+    }
+    if (task.nextRunUs - now < idle)
+    {
+      idle = task.nextRunUs - now;
+    }
+  }
+
+  return idle;
+}
+
+void Scheduler::resetStats()
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    ScheduledTask &task = tasks[i];
+    task.runs = 0;
+    task.misses = 0;
+    task.lastJitterUs = 0;
+    task.maxJitterUs = 0;
+    task.totalJitterUs = 0;
+    task.lastRunUs = 0;
+    task.maxRunUs = 0;
+#ifdef METRICS
+    task.cycles = CycleHistogram();
+#endif
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "metrics.h"
+
+#define SCHEDULER_MAX_TASKS 12
+
+// Microsecond clock source (micros() on the board, a fake clock on the host)
+typedef uint32_t (*SchedulerClock)();
+
+// Task body
+typedef void (*TaskCallback)();
+
+// A periodic job with its own rate, deadline and timing statistics
+struct ScheduledTask
+{
+  const char *name;
+  TaskCallback callback;
+  uint32_t periodUs;   // Time between releases
+  uint32_t deadlineUs; // Max allowed lateness of a release before it counts as a miss
+  uint32_t nextRunUs;  // Absolute release time of the next run
+  bool enabled;
+  bool pending; // Set by trigger() to run on the next tick regardless of the period
+
+  uint32_t runs;          // Number of times the task ran
+  uint32_t misses;        // Number of releases started after their deadline (or skipped)
+  uint32_t lastJitterUs;  // Lateness of the last release
+  uint32_t maxJitterUs;   // Worst lateness seen
+  uint64_t totalJitterUs; // Sum of lateness, for the average
+  uint32_t lastRunUs;     // Execution time of the last run
+  uint32_t maxRunUs;      // Worst execution time seen
+#ifdef METRICS
+  CycleHistogram cycles; // CPU cycles of each run
+#endif
+};
+
+// Cooperative, deadline-driven scheduler. Tasks never preempt each other, each
+// one runs to completion when its release time has passed. Releases are
+// anchored to absolute times, so a late run does not push the next ones back
+class Scheduler
+{
+public:
+  explicit Scheduler(SchedulerClock clock);
+
+  // Register a task with a period (and optional deadline, defaults to the period). Returns its id or -1 if full
+  int add(const char *name, TaskCallback callback, uint32_t periodMs, uint32_t deadlineMs = 0);
+
+  // Run the task on the next tick, without waiting for its period (e.g. a display on change)
+  void trigger(int id);
+
+  void setEnabled(int id, bool enabled);
+
+  // Run every due task once. Returns the microseconds until the next release
+  uint32_t tick();
+
+  // Clear the statistics of every task
+  void resetStats();
+
+  size_t size() const { return count; }
+  const ScheduledTask &task(int id) const { return tasks[id]; }
+
+private:
+  SchedulerClock clock;
+  ScheduledTask tasks[SCHEDULER_MAX_TASKS];
+  size_t count;
+};
+
+#endif
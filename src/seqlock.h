@@ -0,0 +1,62 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+// Single-writer, multi-reader snapshot. The writer never waits and readers
+// never block it. The value is kept twice: while the writer fills one copy
+// (odd sequence number) readers take the other, so a reader never waits on a
+// write, even one preempted by the reader itself. A reader only copies again
+// when a write went on during its copy, so it can't see a torn value.
+// T must be trivially copyable
+template <typename T>
+class Seqlock
+{
+public:
+  Seqlock() : sequence(0), data() {}
+
+  // Publish a new value. Only one task may write
+  void write(const T &value)
+  {
+    uint32_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy((void *)&data[0], &value, sizeof(T));
+
+    sequence.store(seq + 2, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy((void *)&data[1], &value, sizeof(T));
+  }
+
+  // Get a consistent copy of the latest value. Safe from any task or core
+  T read() const
+  {
+    T value;
+    uint32_t before, after;
+    do
+    {
+      before = sequence.load(std::memory_order_acquire);
+      memcpy(&value, (const void *)&data[before & 1], sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence.load(std::memory_order_relaxed);
+    } while (before != after);
+
+    return value;
+  }
+
+  // Number of writes so far
+  uint32_t version() const
+  {
+    return sequence.load(std::memory_order_acquire) >> 1;
+  }
+
+private:
+  std::atomic<uint32_t> sequence;
+  volatile T data[2]; // [0] while the sequence number is even, [1] while a write fills [0]
+};
+
+#endif
@@ -0,0 +1,1550 @@
+// Checks of the modules on their own (env:sim, sim -c <check>): each one
+// drives a module the way the firmware does, on a fake clock where it takes
+// one, and checks what the module promises. They print what they measured
+// and end with "ok" or "FAILED"
+
+#include "sim_checks.h"
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "commands.h"
+#include "control_channel.h"
+#include "event_backlog.h"
+#include "filter.h"
+#include "hal.h"
+#include "hal_linux.h"
+#include "history.h"
+#include "pid.h"
+#include "profile.h"
+#include "roaster.h"
+#include "scheduler.h"
+#include "seqlock.h"
+#include "telemetry.h"
+
+static uint32_t fakeMicros; // Clock of the scheduler under check
+
+static uint32_t fakeClock()
+{
+  return fakeMicros;
+}
+
+#define SCHEDULER_TASKS 3
+#define SCHEDULER_START 1000000 // µs
+#define SCHEDULER_STALL 35000   // A run of the first task that takes 3.5 of its periods (µs)
+#define SCHEDULER_WRAP 100000   // The wrap check starts this long before the clock wraps (µs)
+
+static const uint32_t SCHEDULER_PERIODS[SCHEDULER_TASKS] = {10, 25, 50}; // ms
+
+// A run of a task: which one & when it started
+struct SchedulerRun
+{
+  uint8_t task;
+  uint32_t micros;
+};
+
+static std::vector<SchedulerRun> schedulerRuns;
+static uint32_t schedulerStall; // Time the next run of the first task takes (µs)
+
+template <uint8_t TASK>
+static void schedulerTask()
+{
+  schedulerRuns.push_back({TASK, fakeMicros});
+  if (TASK == 0)
+  {
+    fakeMicros += schedulerStall;
+    schedulerStall = 0;
+  }
+}
+
+// Tick for a while, sleeping to the next release as the loop does. Returns the longest sleep
+static uint32_t tickScheduler(Scheduler &scheduler, uint32_t durationUs)
+{
+  uint32_t end = fakeMicros + durationUs, longest = 0;
+  while ((int32_t)(end - fakeMicros) > 0)
+  {
+    uint32_t idle = scheduler.tick();
+    longest = std::max(longest, idle);
+    fakeMicros += std::min(idle, end - fakeMicros);
+  }
+  return longest;
+}
+
+static void addSchedulerTasks(Scheduler &scheduler)
+{
+  scheduler.add("fast", schedulerTask<0>, SCHEDULER_PERIODS[0]);
+  scheduler.add("medium", schedulerTask<1>, SCHEDULER_PERIODS[1]);
+  scheduler.add("slow", schedulerTask<2>, SCHEDULER_PERIODS[2]);
+}
+
+// Runs of a task from the index from on, & the ones on the grid of its releases from start
+static uint32_t countRuns(uint8_t task, size_t from, uint32_t start, uint32_t *onGrid)
+{
+  uint32_t runs = 0;
+  *onGrid = 0;
+  for (size_t i = from; i < schedulerRuns.size(); i++)
+  {
+    if (schedulerRuns[i].task == task)
+    {
+      runs++;
+      *onGrid += (schedulerRuns[i].micros - start) % (SCHEDULER_PERIODS[task] * 1000) == 0;
+    }
+  }
+  return runs;
+}
+
+// Two runs of a task at the same instant: a burst of releases run back to back
+static uint32_t countBursts(size_t from)
+{
+  uint32_t bursts = 0;
+  for (size_t i = from; i < schedulerRuns.size(); i++)
+  {
+    for (size_t j = i + 1; j < schedulerRuns.size() && schedulerRuns[j].micros == schedulerRuns[i].micros; j++)
+    {
+      bursts += schedulerRuns[j].task == schedulerRuns[i].task;
+    }
+  }
+  return bursts;
+}
+
+// Three tasks on a fake clock: every release runs on time & in order of its
+// release, a run that holds the loop 3.5 periods is followed by one late run
+// (the lost releases are counted as misses, not run back to back) & the
+// releases stay on their grid, and the clock wrapping at 2^32 µs changes nothing
+static int checkScheduler(uint32_t seed)
+{
+  bool ok = true;
+
+  // On time: each release runs when it's due, the earliest first (the first added on a tie)
+  fakeMicros = SCHEDULER_START;
+  schedulerRuns.clear();
+  Scheduler scheduler(fakeClock);
+  addSchedulerTasks(scheduler);
+  uint32_t longest = tickScheduler(scheduler, 1000000);
+
+  uint32_t late = 0, outOfOrder = 0, runs[SCHEDULER_TASKS] = {0}, misses = 0;
+  for (size_t i = 0; i < schedulerRuns.size(); i++)
+  {
+    const SchedulerRun &run = schedulerRuns[i];
+    late += (run.micros - SCHEDULER_START) != runs[run.task]++ * SCHEDULER_PERIODS[run.task] * 1000;
+    outOfOrder += i > 0 && (run.micros < schedulerRuns[i - 1].micros || (run.micros == schedulerRuns[i - 1].micros && run.task < schedulerRuns[i - 1].task));
+  }
+  bool counts = true;
+  for (uint8_t task = 0; task < SCHEDULER_TASKS; task++)
+  {
+    counts &= runs[task] == 1000 / SCHEDULER_PERIODS[task];
+    misses += scheduler.task(task).misses;
+  }
+  bool onTime = late == 0 && outOfOrder == 0 && counts && misses == 0 && longest <= SCHEDULER_PERIODS[0] * 1000;
+  printf("On time: %zu runs in 1 s, %u late, %u out of order, %u misses, longest sleep %u µs: %s\n",
+         schedulerRuns.size(), late, outOfOrder, misses, longest, onTime ? "ok" : "FAILED");
+  ok &= onTime;
+
+  // A trigger between two releases runs the task on the next tick & leaves its releases where they were
+  tickScheduler(scheduler, 5000);
+  size_t before = schedulerRuns.size();
+  scheduler.trigger(2);
+  tickScheduler(scheduler, 100000 - 5000);
+  uint32_t onGrid, triggered = countRuns(2, before, SCHEDULER_START, &onGrid);
+  bool trigger = triggered == 2 && onGrid == 1 && schedulerRuns[before].task == 2 && schedulerRuns[before].micros == SCHEDULER_START + 1005000;
+  printf("Trigger: %u runs of the slow task in 100 ms, %u on its grid: %s\n", triggered, onGrid, trigger ? "ok" : "FAILED");
+  ok &= trigger;
+
+  // A run that holds the loop: one late run of each task, no burst, the grid kept
+  before = schedulerRuns.size();
+  uint32_t missesBefore = scheduler.task(0).misses;
+  schedulerStall = SCHEDULER_STALL;
+  tickScheduler(scheduler, 200000);
+  uint32_t fastRuns = countRuns(0, before, SCHEDULER_START, &onGrid);
+  uint32_t bursts = countBursts(before), lost = scheduler.task(0).misses - missesBefore;
+  uint32_t maxRuns = 200000 / (SCHEDULER_PERIODS[0] * 1000) - SCHEDULER_STALL / (SCHEDULER_PERIODS[0] * 1000);
+  bool catchUp = bursts == 0 && fastRuns <= maxRuns && onGrid == fastRuns && lost == SCHEDULER_STALL / (SCHEDULER_PERIODS[0] * 1000);
+  printf("Stall of %u ms: fast task ran %u times in 200 ms (at most %u), %u on its grid, %u releases counted as missed, %u bursts: %s\n",
+         SCHEDULER_STALL / 1000, fastRuns, maxRuns, onGrid, lost, bursts, catchUp ? "ok" : "FAILED");
+  ok &= catchUp;
+
+  // Across the wrap of the clock: the same periods, no long sleep
+  fakeMicros = UINT32_MAX - SCHEDULER_WRAP + 1 + seed % 1000;
+  uint32_t wrapStart = fakeMicros;
+  schedulerRuns.clear();
+  Scheduler wrapping(fakeClock);
+  addSchedulerTasks(wrapping);
+  longest = tickScheduler(wrapping, 3 * SCHEDULER_WRAP);
+
+  uint32_t wrong = 0;
+  uint32_t last[SCHEDULER_TASKS] = {0};
+  bool seen[SCHEDULER_TASKS] = {false};
+  for (const SchedulerRun &run : schedulerRuns)
+  {
+    wrong += seen[run.task] && run.micros - last[run.task] != SCHEDULER_PERIODS[run.task] * 1000;
+    last[run.task] = run.micros;
+    seen[run.task] = true;
+  }
+  counts = true;
+  misses = 0;
+  for (uint8_t task = 0; task < SCHEDULER_TASKS; task++)
+  {
+    uint32_t taskRuns = countRuns(task, 0, wrapStart, &onGrid);
+    counts &= taskRuns == 3 * SCHEDULER_WRAP / (SCHEDULER_PERIODS[task] * 1000) && onGrid == taskRuns;
+    misses += wrapping.task(task).misses;
+  }
+  bool wrap = wrong == 0 && counts && misses == 0 && longest <= SCHEDULER_PERIODS[0] * 1000;
+  printf("Wrap: %zu runs across 2^32 µs, %u periods off, %u misses, longest sleep %u µs: %s\n",
+         schedulerRuns.size(), wrong, misses, longest, wrap ? "ok" : "FAILED");
+  ok &= wrap;
+
+  return ok ? 0 : 1;
+}
+
+#define SEQLOCK_READERS 4      // Threads reading the snapshot at once (the tasks of both cores)
+#define SEQLOCK_WRITES 2000000 // By the writer (the sampler)
+#define SEQLOCK_WORDS 64       // Size of the snapshot, large enough for a copy to be cut by a write
+
+// A snapshot whose every word comes from the number of the write
+struct SeqlockSnapshot
+{
+  uint32_t write;
+  uint32_t words[SEQLOCK_WORDS];
+};
+
+// What a reader saw
+struct SeqlockReader
+{
+  uint64_t reads;
+  uint64_t torn;      // Words from two writes in one copy
+  uint64_t backwards; // A copy older than the one before it
+};
+
+static void readSeqlock(const Seqlock<SeqlockSnapshot> *snapshot, const std::atomic<bool> *done, SeqlockReader *reader)
+{
+  uint32_t last = 0;
+  while (!done->load(std::memory_order_relaxed))
+  {
+    SeqlockSnapshot copy = snapshot->read();
+    bool torn = false;
+    for (uint32_t i = 0; i < SEQLOCK_WORDS; i++)
+    {
+      torn |= copy.words[i] != copy.write * (i + 1);
+    }
+    reader->torn += torn;
+    reader->backwards += copy.write < last;
+    last = copy.write;
+    reader->reads++;
+  }
+}
+
+#define SEQLOCK_PAUSE_MS 200 // Longest a read may take while the writer is stopped in the middle of a write
+
+static std::atomic<bool> seqlockWriterPaused, seqlockWriterResumed;
+static char *seqlockPage; // Holding the copies of the value, read only to stop the writer
+
+// The writer touched the read-only page: stopped there, as a task preempted
+// in the middle of a write, until it's let go
+static void pauseSeqlockWriter(int, siginfo_t *, void *)
+{
+  seqlockWriterPaused.store(true);
+  while (!seqlockWriterResumed.load())
+  {
+  }
+  mprotect(seqlockPage, getpagesize(), PROT_READ | PROT_WRITE);
+}
+
+// A writer stopped in the middle of a write (a task preempted by a reader of
+// higher priority on the same core) doesn't hold the readers: they get the
+// value before it, then the new one once the write ends
+static bool checkSeqlockPausedWriter()
+{
+  // The sequence number at the end of a page, the copies on the next one
+  static_assert(sizeof(Seqlock<SeqlockSnapshot>) == sizeof(uint32_t) + 2 * sizeof(SeqlockSnapshot), "Copies right after the sequence number");
+  long page = getpagesize();
+  char *pages = (char *)mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  seqlockPage = pages + page;
+  Seqlock<SeqlockSnapshot> *snapshot = new (seqlockPage - sizeof(uint32_t)) Seqlock<SeqlockSnapshot>();
+  SeqlockSnapshot value = {};
+  value.write = 1;
+  snapshot->write(value);
+
+  struct sigaction pause = {}, previous;
+  pause.sa_sigaction = pauseSeqlockWriter;
+  pause.sa_flags = SA_SIGINFO;
+  sigaction(SIGSEGV, &pause, &previous);
+  seqlockWriterPaused.store(false);
+  seqlockWriterResumed.store(false);
+  mprotect(seqlockPage, page, PROT_READ);
+
+  value.write = 2;
+  std::thread writer([&]() { snapshot->write(value); });
+  while (!seqlockWriterPaused.load())
+  {
+  }
+
+  std::atomic<bool> read(false);
+  uint32_t during = 0;
+  std::thread reader([&]() {
+    during = snapshot->read().write;
+    read.store(true);
+  });
+  uint32_t waited = 0;
+  while (!read.load() && waited < SEQLOCK_PAUSE_MS)
+  {
+    usleep(1000);
+    waited++;
+  }
+  bool readPaused = read.load();
+
+  seqlockWriterResumed.store(true);
+  writer.join();
+  reader.join();
+  uint32_t after = snapshot->read().write;
+  sigaction(SIGSEGV, &previous, NULL);
+  snapshot->~Seqlock<SeqlockSnapshot>();
+  munmap(pages, 2 * page);
+
+  bool ok = readPaused && during == 1 && after == 2;
+  printf("Writer stopped in a write: read %s in %u ms (write %u), then write %u: %s\n", readPaused ? "done" : "still waiting",
+         waited, during, after, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// One writer thread publishes snapshots as fast as it can while readers copy
+// them on other threads: no copy mixes two writes, and each reader only sees
+// newer snapshots
+static int checkSeqlock(uint32_t seed)
+{
+  static Seqlock<SeqlockSnapshot> snapshot;
+  std::atomic<bool> done(false);
+  SeqlockReader readers[SEQLOCK_READERS] = {};
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < SEQLOCK_READERS; i++)
+  {
+    threads.push_back(std::thread(readSeqlock, &snapshot, &done, &readers[i]));
+  }
+
+  SeqlockSnapshot value;
+  for (uint32_t write = 1; write <= SEQLOCK_WRITES; write++)
+  {
+    value.write = write;
+    for (uint32_t i = 0; i < SEQLOCK_WORDS; i++)
+    {
+      value.words[i] = write * (i + 1);
+    }
+    snapshot.write(value);
+  }
+  done.store(true);
+
+  SeqlockReader total = {};
+  for (uint32_t i = 0; i < SEQLOCK_READERS; i++)
+  {
+    threads[i].join();
+    total.reads += readers[i].reads;
+    total.torn += readers[i].torn;
+    total.backwards += readers[i].backwards;
+  }
+
+  bool ok = total.torn == 0 && total.backwards == 0 && snapshot.version() == SEQLOCK_WRITES && snapshot.read().write == SEQLOCK_WRITES;
+  printf("Seqlock: %u writes of %zu bytes, %llu reads on %u threads, %llu torn, %llu older than the one before: %s\n", SEQLOCK_WRITES,
+         sizeof(SeqlockSnapshot), (unsigned long long)total.reads, SEQLOCK_READERS, (unsigned long long)total.torn,
+         (unsigned long long)total.backwards, ok ? "ok" : "FAILED");
+
+  bool paused = checkSeqlockPausedWriter();
+  return ok && paused ? 0 : 1;
+}
+
+#define CONTROL_COMMANDS 20000 // Sent by the page in the random run
+#define CONTROL_FIRST 65000    // Sequence number of the first one, so that it wraps
+#define CONTROL_BUSY_ODDS 4    // One post in this many finds the queue full
+#define CONTROL_IN_FLIGHT 8    // Newer commands sent before a busy ack comes back
+
+// Send a command on a connection as handleControlFrame() does: checked, then
+// applied unless the queue is full (busy). Returns the status of its ack
+static uint8_t sendControlCommand(ControlSessions &sessions, uint32_t connection, uint16_t seq, bool busy)
+{
+  uint8_t status = sessions.check(connection, seq);
+  if (status == CONTROL_APPLIED && busy)
+  {
+    return CONTROL_BUSY;
+  }
+  if (status == CONTROL_APPLIED)
+  {
+    sessions.applied(connection, seq);
+  }
+  return status;
+}
+
+// Sessions of the control channel: a command acked busy & sent again after
+// newer ones is still applied, one sent again after it was applied isn't,
+// across reconnections & the wrap of the sequence numbers
+static int checkControlSessions(uint32_t seed)
+{
+  bool ok = true;
+
+  // Busy N, applied N + 1, N again
+  ControlSessions sessions;
+  sessions.open(1, 0xc0ffee);
+  uint8_t first = sendControlCommand(sessions, 1, 10, true), second = sendControlCommand(sessions, 1, 11, false);
+  uint8_t retry = sendControlCommand(sessions, 1, 10, false), again = sendControlCommand(sessions, 1, 10, false);
+  bool right = first == CONTROL_BUSY && second == CONTROL_APPLIED && retry == CONTROL_APPLIED && again == CONTROL_DUPLICATE;
+  printf("Busy 10, 11, 10 again & once more: %u %u %u %u: %s\n", first, second, retry, again, right ? "ok" : "FAILED");
+  ok &= right;
+
+  // The same page on a new connection, & a command older than the window
+  sessions.close(1);
+  sessions.open(2, 0xc0ffee);
+  uint8_t replayed = sendControlCommand(sessions, 2, 11, false), next = sendControlCommand(sessions, 2, 12, true);
+  sendControlCommand(sessions, 2, 12 + CONTROL_WINDOW, false);
+  uint8_t stale = sendControlCommand(sessions, 2, 12, false), unbound = sendControlCommand(sessions, 1, 13, false);
+  right = replayed == CONTROL_DUPLICATE && next == CONTROL_BUSY && stale == CONTROL_DUPLICATE && unbound == CONTROL_INVALID;
+  printf("Reconnected: 11 %u, 12 %u, 12 past the window %u, on the closed connection %u: %s\n", replayed, next, stale, unbound,
+         right ? "ok" : "FAILED");
+  ok &= right;
+
+  // A page sending commands, some found busy & sent again after newer ones,
+  // some sent again after they were applied (their ack lost)
+  ControlSessions board;
+  board.open(3, 0xbeef);
+  std::vector<uint32_t> appliedTimes(CONTROL_COMMANDS, 0);
+  std::vector<uint32_t> waiting;
+  uint32_t random = seed | 1, command = 0, inFlight = 0, lost = 0, wrongDuplicates = 0, resent = 0;
+  while (command < CONTROL_COMMANDS || !waiting.empty())
+  {
+    // The newer commands already sent when a busy ack comes back get ahead of
+    // it, the page holds the rest until the busy ones are sent again
+    std::vector<uint32_t> sends;
+    if (!waiting.empty() && (inFlight >= CONTROL_IN_FLIGHT || command >= CONTROL_COMMANDS))
+    {
+      sends.swap(waiting);
+    }
+    else
+    {
+      inFlight += !waiting.empty();
+      sends.push_back(command++);
+    }
+
+    for (uint32_t sent : sends)
+    {
+      random = random * 1664525 + 1013904223;
+      uint8_t status = sendControlCommand(board, 3, (uint16_t)(CONTROL_FIRST + sent), (random >> 16) % CONTROL_BUSY_ODDS == 0);
+      if (status == CONTROL_BUSY)
+      {
+        waiting.push_back(sent);
+        continue;
+      }
+      wrongDuplicates += status == CONTROL_DUPLICATE && appliedTimes[sent] == 0;
+      appliedTimes[sent] += status == CONTROL_APPLIED;
+
+      // Its ack lost now & then: sent again, it must be a duplicate
+      if ((random >> 4) % 16 == 0)
+      {
+        resent++;
+        wrongDuplicates += sendControlCommand(board, 3, (uint16_t)(CONTROL_FIRST + sent), false) != CONTROL_DUPLICATE;
+      }
+    }
+    if (waiting.empty())
+    {
+      inFlight = 0;
+    }
+  }
+  uint32_t twice = 0;
+  for (uint32_t times : appliedTimes)
+  {
+    lost += times == 0;
+    twice += times > 1;
+  }
+  right = lost == 0 && twice == 0 && wrongDuplicates == 0;
+  printf("%u commands from %u on, 1 in %u busy, %u sent again after their ack: %u lost, %u applied twice, %u wrong acks: %s\n",
+         CONTROL_COMMANDS, CONTROL_FIRST, CONTROL_BUSY_ODDS, resent, lost, twice, wrongDuplicates, right ? "ok" : "FAILED");
+  ok &= right;
+
+  return ok ? 0 : 1;
+}
+
+#define HISTORY_OVERRUN 1000    // Samples pushed past the capacity, so that the ring has wrapped
+#define HISTORY_MARGIN 2        // Oldest samples a read of a full ring leaves out, the writer may be on them
+#define HISTORY_RACE 20000000   // Samples pushed by the writer thread while the reader streams
+#define HISTORY_CHUNK_MAX 1436  // Largest chunk the web server asks for (a TCP segment)
+
+// The sample number n, with each field made from n so that a copy of the wrong slot shows
+static HistorySample historySample(uint32_t n)
+{
+  HistorySample sample;
+  sample.temperature = (int16_t)(n * 7 % 700) - 50;
+  sample.timer = (uint16_t)n;
+  sample.humidity = n % 100;
+  sample.flags = n & 0x7f;
+  return sample;
+}
+
+static bool isHistorySample(uint32_t n, const HistorySample &sample)
+{
+  HistorySample expected = historySample(n);
+  return sample.temperature == expected.temperature && sample.timer == expected.timer && sample.humidity == expected.humidity &&
+         sample.flags == expected.flags;
+}
+
+// Stream [from, to) in chunks of random sizes, as the web server asks for them
+static std::string streamHistory(const History &history, uint32_t from, uint32_t to, uint32_t *random)
+{
+  HistoryStream stream(history, from, to);
+  std::string text;
+  uint8_t buffer[HISTORY_CHUNK_MAX];
+
+  while (!stream.done())
+  {
+    *random = *random * 1664525 + 1013904223;
+    size_t size = SAMPLE_JSON_MAX + 1 + (*random >> 8) % (HISTORY_CHUNK_MAX - SAMPLE_JSON_MAX);
+    size_t length = stream.fill(buffer, size);
+    if (length == 0 || length > size)
+    {
+      return "chunk of " + std::to_string(length) + " bytes for " + std::to_string(size);
+    }
+    text.append((const char *)buffer, length);
+  }
+  return text;
+}
+
+// Parse a streamed range: samples in a row from *first on, each one matching its number.
+// Returns the number of samples, -1 if the text is wrong
+static long parseHistory(const std::string &text, uint32_t *first)
+{
+  const char *p = text.c_str();
+  if (*p++ != '[')
+  {
+    return -1;
+  }
+
+  long count = 0;
+  while (*p == '[')
+  {
+    unsigned n, humidity, timer, flags;
+    int temperature, length = 0;
+    if (sscanf(p, "[%u,%d,%u,%u,%u]%n", &n, &temperature, &humidity, &timer, &flags, &length) != 5 || length == 0)
+    {
+      return -1;
+    }
+
+    HistorySample sample;
+    sample.temperature = temperature;
+    sample.humidity = humidity;
+    sample.timer = timer;
+    sample.flags = flags;
+    if ((count == 0 ? n < *first : n != *first + count) || !isHistorySample(n, sample))
+    {
+      return -1;
+    }
+    if (count == 0)
+    {
+      *first = n;
+    }
+
+    count++;
+    p += length;
+    if (*p == ',')
+    {
+      p++;
+    }
+  }
+  return *p == ']' && p[1] == 0 ? count : -1;
+}
+
+// A ring that has wrapped: reads across the end of the slots & from before
+// the oldest sample return the right samples, /history ranges stream in
+// chunks of any size, and a reader streaming while a writer thread pushes
+// never gets a sample overwritten under it
+static int checkHistory(uint32_t seed)
+{
+  static History history;
+  bool ok = true;
+  uint32_t random = seed;
+
+  uint32_t total = HISTORY_CAPACITY + HISTORY_OVERRUN;
+  for (uint32_t n = 0; n < total; n++)
+  {
+    history.push(historySample(n));
+  }
+  bool kept = history.first() == HISTORY_OVERRUN && history.end() == total;
+  printf("History: %u pushed, [%u, %u) kept: %s\n", total, history.first(), history.end(), kept ? "ok" : "FAILED");
+  ok &= kept;
+
+  // The slots wrap between samples CAPACITY - 1 & CAPACITY
+  HistorySample samples[32];
+  uint32_t from = HISTORY_CAPACITY - 16;
+  size_t count = history.read(&from, samples, 32);
+  bool wrapped = from == HISTORY_CAPACITY - 16 && count == 32;
+  for (size_t i = 0; i < count; i++)
+  {
+    wrapped &= isHistorySample(from + i, samples[i]);
+  }
+  printf("Read across the end of the slots: %zu samples from %u: %s\n", count, from, wrapped ? "ok" : "FAILED");
+  ok &= wrapped;
+
+  from = 0;
+  count = history.read(&from, samples, 32);
+  bool moved = from == HISTORY_OVERRUN + HISTORY_MARGIN && count == 32 - HISTORY_MARGIN;
+  for (size_t i = 0; i < count; i++)
+  {
+    moved &= isHistorySample(from + i, samples[i]);
+  }
+  uint32_t start = from;
+  from = total - 10;
+  size_t newest = history.read(&from, samples, 32);
+  moved &= from == total - 10 && newest == 10;
+  printf("Read from before the oldest sample: %zu samples from %u, %zu at the newest: %s\n", count, start, newest,
+         moved ? "ok" : "FAILED");
+  ok &= moved;
+
+  // Ranges of /history, clamped to what is kept
+  uint32_t oldest = HISTORY_OVERRUN + HISTORY_MARGIN;
+  struct
+  {
+    uint32_t from, to;
+    long samples;
+  } ranges[] = {
+      {0, total, HISTORY_CAPACITY - HISTORY_MARGIN},
+      {0, HISTORY_OVERRUN + 100, 100 - HISTORY_MARGIN},
+      {HISTORY_CAPACITY - 50, HISTORY_CAPACITY + 50, 100},
+      {total - 1, total + 1000, 1},
+      {0, HISTORY_OVERRUN, 0},
+      {total, total, 0},
+  };
+  for (const auto &range : ranges)
+  {
+    std::string text = streamHistory(history, range.from, range.to, &random);
+    uint32_t first = std::max(range.from, oldest);
+    long samples = parseHistory(text, &first);
+    bool right = samples == range.samples && (samples == 0 || first == std::max(range.from, oldest));
+    printf("Stream [%u, %u): %ld samples in %zu bytes: %s\n", range.from, range.to, samples, text.size(), right ? "ok" : "FAILED");
+    ok &= right;
+  }
+
+  // A chunk too small for a sample is left empty without ending the stream
+  HistoryStream stream(history, total - 2, total);
+  uint8_t buffer[HISTORY_CHUNK_MAX];
+  size_t opened = stream.fill(buffer, SAMPLE_JSON_MAX);
+  size_t empty = stream.fill(buffer, SAMPLE_JSON_MAX);
+  bool open = !stream.done();
+  size_t rest = stream.fill(buffer, sizeof(buffer));
+  bool small = opened == 1 && empty == 0 && open && rest > 0 && stream.done();
+  printf("Chunks too small for a sample: %zu, %zu & then %zu bytes: %s\n", opened, empty, rest, small ? "ok" : "FAILED");
+  ok &= small;
+
+  // The writer laps the reader: whatever was overwritten is left out, never copied
+  std::atomic<bool> done(false);
+  std::thread writer([&done, total]()
+                     {
+                       for (uint32_t n = total; n < total + HISTORY_RACE; n++)
+                       {
+                         history.push(historySample(n));
+                       }
+                       done.store(true); });
+
+  uint32_t streams = 0, wrong = 0;
+  uint64_t streamed = 0;
+  while (!done.load())
+  {
+    uint32_t first = history.first();
+    std::string text = streamHistory(history, first, first + HISTORY_CAPACITY, &random);
+    long samples = parseHistory(text, &first);
+    wrong += samples < 0;
+    streamed += samples > 0 ? samples : 0;
+    streams++;
+  }
+  writer.join();
+  bool raced = wrong == 0 && streams > 0 && history.end() == total + HISTORY_RACE;
+  printf("Stream while %u samples are pushed: %u streams, %llu samples, %u wrong: %s\n", HISTORY_RACE, streams,
+         (unsigned long long)streamed, wrong, raced ? "ok" : "FAILED");
+  ok &= raced;
+
+  return ok ? 0 : 1;
+}
+
+#define BACKLOG_EVENTS (EVENT_BACKLOG_SIZE + 40) // Events published, so that the backlog has wrapped
+#define BACKLOG_CHUNK 1024                       // Buffer of a replay burst (as events.onConnect)
+
+static const char *const BACKLOG_NAMES[] = {"readings", "timer", "states"};
+
+// An /events event as a client gets it
+struct BacklogEvent
+{
+  uint32_t id;
+  std::string event, data;
+};
+
+// Event i of the stream: ids apart like millis() & data of varied lengths
+static BacklogEvent backlogEvent(uint32_t i)
+{
+  BacklogEvent event;
+  event.id = 1000 + i * 7;
+  event.event = BACKLOG_NAMES[i % 3];
+  event.data = "{\"n\":" + std::to_string(i) + ",\"pad\":\"" + std::string(i * 13 % 60, 'x') + "\"}";
+  return event;
+}
+
+// Split replayed SSE text into its events. Returns false if it isn't made of whole events
+static bool parseEvents(const std::string &text, std::vector<BacklogEvent> *events)
+{
+  size_t at = 0;
+  while (at < text.size())
+  {
+    size_t end = text.find("\r\n\r\n", at);
+    if (end == std::string::npos)
+    {
+      return false;
+    }
+
+    std::string block = text.substr(at, end + 2 - at);
+    size_t event = block.find("\r\nevent: "), data = block.find("\r\ndata: ");
+    if (block.compare(0, 4, "id: ") || event == std::string::npos || data == std::string::npos || data < event)
+    {
+      return false;
+    }
+
+    BacklogEvent parsed;
+    parsed.id = strtoul(block.c_str() + 4, NULL, 10);
+    parsed.event = block.substr(event + 9, data - event - 9);
+    parsed.data = block.substr(data + 8, block.size() - data - 10);
+    events->push_back(parsed);
+    at = end + 4;
+  }
+  return true;
+}
+
+// A client that got the events up to Last-Event-ID after reconnects: replay
+// what it missed in bursts of chunk bytes. Returns false if a burst is cut
+// inside an event or leaves room for the next one
+static bool replayEvents(const EventBacklog &backlog, uint32_t after, size_t chunk, std::vector<BacklogEvent> *events,
+                         uint32_t *bursts)
+{
+  char buffer[BACKLOG_CHUNK];
+  size_t length;
+  bool whole = true;
+  *bursts = 0;
+
+  while ((length = backlog.replay(&after, buffer, chunk)))
+  {
+    std::vector<BacklogEvent> burst;
+    whole &= length < chunk && parseEvents(std::string(buffer, length), &burst) && !burst.empty() && burst.back().id == after;
+
+    // The event after the burst (if any) didn't fit
+    char next[BACKLOG_CHUNK];
+    uint32_t peek = after;
+    size_t nextLength = backlog.replay(&peek, next, sizeof(next));
+    std::vector<BacklogEvent> following;
+    if (nextLength && parseEvents(std::string(next, nextLength), &following))
+    {
+      size_t first = std::string(next, nextLength).find("\r\n\r\n") + 4;
+      whole &= length + first >= chunk;
+    }
+
+    events->insert(events->end(), burst.begin(), burst.end());
+    (*bursts)++;
+  }
+  return whole;
+}
+
+// Whether the events are the ones of the stream from first to last, in order
+static bool isEventRun(const std::vector<BacklogEvent> &events, uint32_t first, uint32_t last)
+{
+  bool right = events.size() == last + 1 - first;
+  for (size_t i = 0; right && i < events.size(); i++)
+  {
+    BacklogEvent expected = backlogEvent(first + i);
+    right = events[i].id == expected.id && events[i].event == expected.event && events[i].data == expected.data;
+  }
+  return right;
+}
+
+// A backlog that has wrapped: clients reconnecting with a Last-Event-ID
+// inside it get every event they missed in order, whether or not they lie
+// across the end of the slots, a Last-Event-ID that is gone falls back to the
+// latest event of each name, and the replay bursts hold whole events, as many
+// as fit
+static int checkEventBacklog(uint32_t seed)
+{
+  static EventBacklog backlog;
+  bool ok = true;
+
+  for (uint32_t i = 0; i < BACKLOG_EVENTS; i++)
+  {
+    BacklogEvent event = backlogEvent(i);
+    backlog.add(event.id, BACKLOG_NAMES[i % 3], event.data.c_str());
+  }
+
+  // The oldest event kept is BACKLOG_EVENTS - SIZE, the slots wrap at event SIZE
+  uint32_t last = BACKLOG_EVENTS - 1, oldest = BACKLOG_EVENTS - EVENT_BACKLOG_SIZE;
+  struct
+  {
+    const char *name;
+    uint32_t got; // Last event the client got
+    bool covered;
+  } clients[] = {
+      {"inside", EVENT_BACKLOG_SIZE + 10, true},
+      {"across the wrap", oldest + 2, true},
+      {"at the oldest", oldest - 1, true},
+      {"up to date", last, true},
+      {"outside", oldest - 2, false},
+  };
+
+  for (const auto &client : clients)
+  {
+    uint32_t after = backlogEvent(client.got).id;
+    bool covered = backlog.covers(after);
+    std::vector<BacklogEvent> events;
+    uint32_t bursts = 0;
+    bool whole = true, right;
+
+    if (covered)
+    {
+      whole = replayEvents(backlog, after, BACKLOG_CHUNK, &events, &bursts);
+      right = client.got == last ? events.empty() : isEventRun(events, client.got + 1, last);
+    }
+    else
+    {
+      // The latest of each name, in id order
+      char buffer[BACKLOG_CHUNK];
+      size_t length = backlog.latest(buffer, sizeof(buffer));
+      whole = parseEvents(std::string(buffer, length), &events);
+      right = events.size() == 3;
+      for (size_t i = 0; right && i < 3; i++)
+      {
+        right = isEventRun(std::vector<BacklogEvent>(1, events[i]), last - 2 + i, last - 2 + i);
+      }
+      bursts = length > 0;
+    }
+
+    bool passed = covered == client.covered && whole && right;
+    printf("Reconnect %s (Last-Event-ID %u): %s, %zu events in %u bursts: %s\n", client.name, after,
+           covered ? "replayed" : "latest values", events.size(), bursts, passed ? "ok" : "FAILED");
+    ok &= passed;
+  }
+
+  // Bursts of every size from one event up: same events, whole & as many as fit
+  uint32_t random = seed;
+  uint32_t sizes = 0, wrong = 0;
+  for (size_t chunk = 140; chunk <= BACKLOG_CHUNK; chunk += 1 + (random = random * 1664525 + 1013904223) % 16, sizes++)
+  {
+    std::vector<BacklogEvent> events;
+    uint32_t bursts;
+    bool whole = replayEvents(backlog, backlogEvent(oldest).id, chunk, &events, &bursts);
+    wrong += !whole || !isEventRun(events, oldest + 1, last);
+  }
+  printf("Replay in bursts of %u sizes from 140 to %u bytes: %u wrong: %s\n", sizes, BACKLOG_CHUNK, wrong, wrong ? "FAILED" : "ok");
+  ok &= wrong == 0;
+
+  // An event too long to keep: the clients that missed it can't be replayed
+  uint32_t before = backlog.lastId();
+  backlog.add(before + 7, "analytics", std::string(EVENT_BACKLOG_DATA + 1, 'x').c_str());
+  bool dropped = !backlog.covers(before) && backlog.covers(before + 7) && backlog.lastId() == before;
+  printf("Event too long for the backlog: clients before it get the latest values: %s\n", dropped ? "ok" : "FAILED");
+  ok &= dropped;
+
+  return ok ? 0 : 1;
+}
+
+// Plant of the PID check: the drum heats up to ambient + heating / loss with
+// the heater on, after a dead time, and the probe lags it. Harder than the
+// model of the roasts (simulator.cpp) because of the dead time
+#define PLANT_AMBIENT 25.0f
+#define PLANT_HEATING 1.0f       // ºC/s at ambient
+#define PLANT_LOSS (1 / 300.0f)  // 1/s
+#define PLANT_DEAD_TIME 20       // s from the heater to the drum
+#define PLANT_PROBE_LAG 3.0f     // s
+#define PLANT_NOISE 0.5f         // ºC, at most
+#define PLANT_STEP_MS 100
+#define PID_PERIOD_MS 1000       // Of the control task
+#define PID_SEEDS 5              // Plants with different noise
+#define PID_BAND 2.0f            // ºC around the setpoint that counts as settled
+#define PID_OVERSHOOT_MAX 5.0f   // ºC
+#define PID_SETTLING_MAX 720000  // ms
+#define AUTOTUNE_ERROR_MAX 0.4f  // Of the ultimate gain & period found, from the ones of the model
+
+struct PidPlant
+{
+  float drum, probe;
+  std::deque<bool> line; // Heater states on their way to the drum
+  uint32_t random;
+
+  explicit PidPlant(uint32_t seed)
+      : drum(PLANT_AMBIENT), probe(PLANT_AMBIENT), line(PLANT_DEAD_TIME * 1000 / PLANT_STEP_MS, false), random(seed) {}
+
+  // The thermocouple: noisy, in steps of 0.25 ºC (MAX6675)
+  float read()
+  {
+    random = random * 1664525 + 1013904223;
+    float noise = ((random >> 8) / 16777216.0f * 2 - 1) * PLANT_NOISE;
+    return roundf((probe + noise) * 4) / 4;
+  }
+
+  void step(bool heater)
+  {
+    float dt = PLANT_STEP_MS / 1000.0f;
+    line.push_back(heater);
+    float steady = PLANT_AMBIENT + (line.front() ? PLANT_HEATING / PLANT_LOSS : 0);
+    line.pop_front();
+    drum = steady + (drum - steady) * expf(-PLANT_LOSS * dt);
+    probe += (drum - probe) * (1 - expf(-dt / PLANT_PROBE_LAG));
+  }
+};
+
+// Ultimate gain & period (s) of the linear model: where its phase is -180º
+static void ultimatePoint(float *gain, float *period)
+{
+  float tau = 1 / PLANT_LOSS, low = 0.0001f, high = 1;
+  for (int i = 0; i < 60; i++)
+  {
+    float w = (low + high) / 2;
+    float phase = w * PLANT_DEAD_TIME + atanf(w * tau) + atanf(w * PLANT_PROBE_LAG);
+    (phase < (float)M_PI ? low : high) = w;
+  }
+  float w = low, staticGain = PLANT_HEATING / PLANT_LOSS;
+  *gain = sqrtf(1 + w * tau * w * tau) * sqrtf(1 + w * PLANT_PROBE_LAG * w * PLANT_PROBE_LAG) / staticGain;
+  *period = 2 * (float)M_PI / w;
+}
+
+// Relay autotune of the plant at a setpoint, as the roaster runs it. Returns the time it took (ms), 0 if it failed
+static uint32_t autotunePlant(PidPlant &plant, float setpoint, RelayAutotuner &tuner)
+{
+  TimeProportioner output(HEATER_WINDOW, HEATER_MIN_SWITCH);
+  float duty = 0;
+  tuner.start(setpoint, AUTOTUNE_HYSTERESIS, AUTOTUNE_CYCLES, AUTOTUNE_TIMEOUT, PID_PERIOD_MS);
+
+  for (uint32_t now = PID_PERIOD_MS; tuner.running(); now += PLANT_STEP_MS)
+  {
+    if (now % PID_PERIOD_MS == 0)
+    {
+      duty = tuner.update(plant.read(), now);
+    }
+    plant.step(output.update(duty, now));
+    if (tuner.done())
+    {
+      return now - PID_PERIOD_MS;
+    }
+  }
+  return 0;
+}
+
+// How the drum went to a new setpoint under the PID
+struct StepResponse
+{
+  float overshoot; // ºC past the setpoint
+  uint32_t settled; // ms until it stayed within the band
+};
+
+static StepResponse pidStep(PidPlant &plant, const PidGains &gains, float setpoint, uint32_t durationMs)
+{
+  Pid pid(0, 1);
+  TimeProportioner output(HEATER_WINDOW, HEATER_MIN_SWITCH);
+  pid.setGains(gains);
+  pid.reset(plant.read());
+
+  bool rising = setpoint > plant.drum;
+  StepResponse response = {0, 0};
+  float duty = 0;
+  for (uint32_t now = 0; now < durationMs; now += PLANT_STEP_MS)
+  {
+    if (now % PID_PERIOD_MS == 0)
+    {
+      duty = pid.update(setpoint, plant.read(), PID_PERIOD_MS / 1000.0f);
+    }
+    plant.step(output.update(duty, now));
+
+    float past = rising ? plant.drum - setpoint : setpoint - plant.drum;
+    response.overshoot = std::max(response.overshoot, past);
+    if (fabsf(plant.drum - setpoint) > PID_BAND)
+    {
+      response.settled = now + PLANT_STEP_MS;
+    }
+  }
+  return response;
+}
+
+// Relay autotuning on a plant with a dead time finds its ultimate gain &
+// period (those of the linear model, within the error of the describing
+// function) on plants with different noise, and the PID with the gains
+// found takes the drum from ambient to a roast temperature & on to a
+// higher one with a bounded overshoot & settling time
+static int checkPid(uint32_t seed)
+{
+  bool ok = true;
+  float modelGain, modelPeriod;
+  ultimatePoint(&modelGain, &modelPeriod);
+  printf("Model: ultimate gain %.4f, period %.1f s\n", modelGain, modelPeriod);
+
+  for (uint32_t i = 0; i < PID_SEEDS; i++)
+  {
+    PidPlant plant(seed + i);
+    RelayAutotuner tuner;
+    uint32_t tuned = autotunePlant(plant, 180, tuner);
+    float gainError = fabsf(tuner.getUltimateGain() / modelGain - 1);
+    float periodError = fabsf(tuner.getUltimatePeriod() / modelPeriod - 1);
+    bool converged = tuned && gainError <= AUTOTUNE_ERROR_MAX && periodError <= AUTOTUNE_ERROR_MAX;
+    printf("Plant %u: autotuned in %.1f min, ultimate gain %.4f (%+.0f%%), period %.1f s (%+.0f%%), Kp %.4f Ki %.5f Kd %.3f: %s\n", i,
+           tuned / 60000.0f, tuner.getUltimateGain(), (tuner.getUltimateGain() / modelGain - 1) * 100, tuner.getUltimatePeriod(),
+           (tuner.getUltimatePeriod() / modelPeriod - 1) * 100, tuner.getGains().kp, tuner.getGains().ki, tuner.getGains().kd,
+           converged ? "ok" : "FAILED");
+    ok &= converged;
+    if (!converged)
+    {
+      continue;
+    }
+
+    PidPlant cold(seed + i);
+    StepResponse steps[2] = {pidStep(cold, tuner.getGains(), 180, 2 * PID_SETTLING_MAX),
+                             pidStep(cold, tuner.getGains(), 220, 2 * PID_SETTLING_MAX)};
+    for (int step = 0; step < 2; step++)
+    {
+      bool bounded = steps[step].overshoot <= PID_OVERSHOOT_MAX && steps[step].settled <= PID_SETTLING_MAX;
+      printf("Plant %u: %s: overshoot %.1f ºC, within %.0f ºC after %.1f min: %s\n", i, step ? "180 to 220 ºC" : "25 to 180 ºC",
+             steps[step].overshoot, PID_BAND, steps[step].settled / 60000.0f, bounded ? "ok" : "FAILED");
+      ok &= bounded;
+    }
+  }
+
+  return ok ? 0 : 1;
+}
+
+// Reads of the sensors recorded by sim -o (see sim/traces)
+#define TRACE_CAFE "sim/traces/cafe.csv"         // A Cafe roast (mode 3) & 5 minutes of cooling down
+#define TRACE_SPIKES "sim/traces/spikes.csv"     // 10 minutes of one, with a spike every 100 reads (-x 0.01 -l 10)
+#define TRACE_DROPOUTS "sim/traces/dropouts.csv" // One with runs of failed reads, tripped by the thermocouple (-d 0.004 -s 6 -l 10)
+
+// A read of a trace: NAN for the sensors not read then, or a failed read. The
+// lines with the probe are reads of the thermocouple, the others of the DHT
+struct TraceRead
+{
+  uint32_t ms;
+  float probe; // True temperature, of the model
+  float thermocouple;
+  float humidity;
+};
+
+static bool loadTrace(const char *path, std::vector<TraceRead> *reads)
+{
+  FILE *file = fopen(path, "r");
+  if (!file)
+  {
+    perror(path);
+    return false;
+  }
+
+  char line[128];
+  bool ok = fgets(line, sizeof(line), file) && strncmp(line, "ms,", 3) == 0; // Header
+  while (ok && fgets(line, sizeof(line), file))
+  {
+    // Empty fields are sensors not read
+    TraceRead read = {0, NAN, NAN, NAN};
+    char *field = line, *end;
+    float *values[] = {&read.probe, &read.thermocouple, &read.humidity};
+    read.ms = strtoul(field, &end, 10);
+    ok = *end == ',';
+    for (int i = 0; ok && i < 3; i++)
+    {
+      field = end + 1;
+      float value = strtof(field, &end);
+      *values[i] = end == field ? NAN : value;
+      ok = *end == (i < 2 ? ',' : '\n') || (i == 2 && *end == 0);
+    }
+    reads->push_back(read);
+  }
+  fclose(file);
+
+  if (!ok || reads->empty())
+  {
+    fprintf(stderr, "%s: bad line %zu\n", path, reads->size() + 1);
+  }
+  return ok && !reads->empty();
+}
+
+// A segment reached, or finished, in a replay
+struct SegmentEvent
+{
+  uint8_t segment;
+  uint32_t reachedMs, finishedMs;
+  uint8_t motors; // Returned by finishSegment()
+};
+
+// Replay a profile on a trace as the roaster runs it: the thermocouple
+// through its filter, the runner updated at each read, and each hold timed
+// from the read that reached the target. Counts the setpoints off the ramp
+// (straight from the previous target at its rate, from the start of the
+// segment), and the reads where the runner reached its target or not when
+// it should have done the opposite
+static std::vector<SegmentEvent> replayProfile(const Profile &profile, const std::vector<TraceRead> &reads, uint32_t *offRamp,
+                                               uint32_t *wrongReach)
+{
+  std::vector<SegmentEvent> events;
+  SensorFilter filter(THERMOCOUPLE_FILTER);
+  ProfileRunner runner;
+  bool started = false;
+  uint32_t segmentMs = 0, holdEndMs = 0;
+  float from = 0;
+  *offRamp = *wrongReach = 0;
+
+  for (const TraceRead &read : reads)
+  {
+    if (isnan(read.probe))
+    {
+      continue; // A read of the DHT
+    }
+    filter.update(read.thermocouple, read.ms);
+    if (filter.quality() & QUALITY_UNUSABLE)
+    {
+      continue;
+    }
+    float temperature = filter.rounded();
+
+    if (!started)
+    {
+      runner.start(&profile, temperature, read.ms);
+      started = true;
+      segmentMs = read.ms;
+      from = temperature;
+    }
+
+    // The hold of the segment ends
+    if (runner.getPhase() == ProfileRunner::Hold && read.ms >= holdEndMs)
+    {
+      SegmentEvent &event = events.back();
+      event.finishedMs = read.ms;
+      event.motors = runner.finishSegment(read.ms);
+      from = profile.segments[event.segment].target;
+      segmentMs = read.ms;
+    }
+    if (runner.getPhase() != ProfileRunner::Ramp)
+    {
+      continue;
+    }
+
+    const ProfileSegment &segment = profile.segments[runner.getSegment()];
+    bool rising = segment.target >= from;
+    float moved = segment.ramp > 0 ? segment.ramp * (read.ms - segmentMs) / 60000 : INFINITY;
+    float expected = rising ? std::min(from + moved, (float)segment.target) : std::max(from - moved, (float)segment.target);
+
+    uint8_t index = runner.getSegment();
+    bool reached = runner.update(temperature, read.ms);
+    *offRamp += fabsf(runner.getSetpoint() - expected) > 0.01f;
+
+    // The setpoint at the target (it is on its ramp, see above) & the temperature there
+    bool there = runner.getSetpoint() == segment.target && (rising ? temperature >= segment.target : temperature <= segment.target);
+    *wrongReach += reached != there;
+
+    if (reached)
+    {
+      events.push_back({index, read.ms, 0, 0});
+      holdEndMs = read.ms + runner.holdSeconds() * 1000;
+      if (runner.holdSeconds() == 0)
+      {
+        SegmentEvent &event = events.back();
+        event.finishedMs = read.ms;
+        event.motors = runner.finishSegment(read.ms);
+        from = segment.target;
+        segmentMs = read.ms;
+      }
+    }
+  }
+  return events;
+}
+
+// A roast recorded as the firmware sees it, replayed through the profile
+// runner: the roast's own profile & one with ramps & a cooling segment
+static int checkProfileReplay(uint32_t seed)
+{
+  std::vector<TraceRead> reads;
+  if (!loadTrace(TRACE_CAFE, &reads))
+  {
+    return 1;
+  }
+
+  // (ramp ºC/min, target ºC, hold s, motors)
+  static const Profile cafe = {"Cafe", 2, {{0, 170, 0, PROFILE_MOTOR1}, {0, 170, 12 * 60, 0}}};
+  static const Profile ramps = {"Ramps",
+                                4,
+                                {{20, 100, 30, PROFILE_MOTOR1},
+                                 {8, 165, 60, PROFILE_MOTOR2},
+                                 {0, 170, 120, 0},
+                                 {30, 120, 0, PROFILE_MOTOR2 | PROFILE_MOTOR3}}};
+
+  bool ok = true;
+  printf("Trace %s: %zu reads over %.1f min\n", TRACE_CAFE, reads.size(), reads.back().ms / 60000.0f);
+  for (const Profile *replay : {&cafe, &ramps})
+  {
+    const Profile &profile = *replay;
+    uint32_t offRamp, wrongReach;
+    std::vector<SegmentEvent> events = replayProfile(profile, reads, &offRamp, &wrongReach);
+
+    bool right = events.size() == profile.count && offRamp == 0 && wrongReach == 0;
+    for (size_t i = 0; i < events.size(); i++)
+    {
+      const SegmentEvent &event = events[i];
+      const ProfileSegment &segment = profile.segments[i];
+      bool timed = event.segment == i && event.finishedMs - event.reachedMs >= segment.hold * 1000U &&
+                   event.finishedMs - event.reachedMs < segment.hold * 1000U + 1000;
+      bool motors = event.motors == segment.motors;
+      printf("%s segment %u: reached at %.1f min, finished at %.1f min, motors %u%u%u: %s\n", profile.name, event.segment,
+             event.reachedMs / 60000.0f, event.finishedMs / 60000.0f, event.motors & 1, event.motors >> 1 & 1, event.motors >> 2 & 1,
+             timed && motors ? "ok" : "FAILED");
+      right &= timed && motors;
+    }
+    printf("%s: %zu of %u segments, %u setpoints off their ramp, %u targets reached wrongly: %s\n", profile.name, events.size(),
+           profile.count, offRamp, wrongReach, right ? "ok" : "FAILED");
+    ok &= right;
+  }
+
+  return ok ? 0 : 1;
+}
+
+#define JSON_EXTRA_PROFILES 7 // One-segment profiles after the first two, one more than PROFILES_MAX takes
+
+// Segment as loadProfiles() should give it
+static bool sameSegment(const ProfileSegment &segment, float ramp, int16_t target, uint16_t hold, uint8_t motors)
+{
+  return segment.ramp == ramp && segment.target == target && segment.hold == hold && segment.motors == motors;
+}
+
+// Load profiles from a file written for the check, in a storage of its own. False if it can't be written
+static bool loadProfilesFrom(const char *root, const std::string &json, Roaster &roaster)
+{
+  halLinuxSetStorageRoot(root);
+  halRemoveFile("/profiles.json");
+  bool written = halAppendFile("/profiles.json", json.data(), json.size());
+  roaster.loadSettings();
+  halRemoveFile("/profiles.json");
+  halLinuxSetStorageRoot("data");
+  return written;
+}
+
+// A body, the commands it should give & how it should be answered
+struct BodyCase
+{
+  uint8_t type;
+  const char *body;
+  uint16_t status;
+  uint8_t count;
+  Command commands[BODY_COMMANDS]; // Their type, arg & value
+};
+
+// The JSON inputs parsed by ArduinoJson, on the host as on the board: the
+// profiles of data/profiles.json & of a file with every field and limit, a
+// broken file, and the bodies of each POST of the page into their commands
+static int checkJson(uint32_t seed)
+{
+  (void)seed;
+  bool ok = true;
+
+  // The profiles of the repo
+  halLinuxSetStorageRoot("data");
+  Roaster shipped(NULL, NULL);
+  shipped.loadSettings();
+  static const char *NAMES[] = {"Mani", "Cacao", "Cafe"};
+  static const int16_t TARGETS[] = {180, 140, 170};
+  static const uint16_t HOLDS[] = {1200, 1980, 720};
+  bool right = shipped.getProfileCount() == 3;
+  for (uint8_t i = 0; right && i < 3; i++)
+  {
+    const Profile &profile = shipped.getProfile(i);
+    right = !strcmp(profile.name, NAMES[i]) && profile.count == 2 &&
+            sameSegment(profile.segments[0], 0, TARGETS[i], 0, PROFILE_MOTOR1) &&
+            sameSegment(profile.segments[1], 0, TARGETS[i], HOLDS[i], 0);
+  }
+  printf("data/profiles.json: %u profiles: %s\n", shipped.getProfileCount(), right ? "ok" : "FAILED");
+  ok &= right;
+
+  char root[] = "/tmp/jsonXXXXXX";
+  if (!mkdtemp(root))
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  // Every field, a motor that doesn't exist, a profile without segments, a
+  // long name, too many segments & too many profiles
+  std::string json = "[{\"name\": \"Ramped\", \"maxTemperature\": 230, \"maxRor\": 25, \"segments\": ["
+                     "{\"ramp\": 12.5, \"target\": 150, \"motors\": [1, 2]},"
+                     "{\"target\": 200, \"hold\": 90, \"motors\": [2, 3, 5]},"
+                     "{\"ramp\": 30, \"target\": 120}]},"
+                     "{\"name\": \"Empty\", \"segments\": []},"
+                     "{\"name\": \"A name longer than the display\", \"segments\": [";
+  for (int segment = 0; segment <= PROFILE_MAX_SEGMENTS; segment++)
+  {
+    json += (segment ? ", {\"target\": " : "{\"target\": ") + std::to_string(100 + segment) + ", \"hold\": 10}";
+  }
+  json += "]}";
+  for (int extra = 0; extra < JSON_EXTRA_PROFILES; extra++)
+  {
+    json += ", {\"name\": \"Extra " + std::to_string(extra) + "\", \"segments\": [{\"target\": 160, \"hold\": 60}]}";
+  }
+  json += "]";
+
+  Roaster loaded(NULL, NULL);
+  bool written = loadProfilesFrom(root, json, loaded);
+  const Profile &ramped = loaded.getProfile(0), &capped = loaded.getProfile(1), &last = loaded.getProfile(PROFILES_MAX - 1);
+  right = written && loaded.getProfileCount() == PROFILES_MAX &&
+          !strcmp(ramped.name, "Ramped") && ramped.count == 3 && ramped.maxTemperature == 230 && ramped.maxRor == 25 &&
+          sameSegment(ramped.segments[0], 12.5f, 150, 0, PROFILE_MOTOR1 | PROFILE_MOTOR2) &&
+          sameSegment(ramped.segments[1], 0, 200, 90, PROFILE_MOTOR2 | PROFILE_MOTOR3) &&
+          sameSegment(ramped.segments[2], 30, 120, 0, 0) &&
+          strlen(capped.name) == PROFILE_NAME_LENGTH && capped.count == PROFILE_MAX_SEGMENTS &&
+          sameSegment(capped.segments[PROFILE_MAX_SEGMENTS - 1], 0, 100 + PROFILE_MAX_SEGMENTS - 1, 10, 0) &&
+          capped.maxTemperature == 0 && !strcmp(last.name, "Extra 5");
+  printf("Every field & limit: %u profiles, \"%s\" with %u segments, \"%s\" last: %s\n", loaded.getProfileCount(),
+         capped.name, capped.count, last.name, right ? "ok" : "FAILED");
+  ok &= right;
+
+  // A file cut short keeps the built-in profiles
+  Roaster broken(NULL, NULL);
+  written = loadProfilesFrom(root, json.substr(0, json.size() / 2), broken);
+  right = written && broken.getProfileCount() == 3 && !strcmp(broken.getProfile(2).name, "Cafe");
+  printf("Cut short: %u profiles, the built-in ones: %s\n", broken.getProfileCount(), right ? "ok" : "FAILED");
+  ok &= right;
+  rmdir(root);
+
+  // The bodies of the POSTs, checked against the 3 profiles of the repo
+  static const BodyCase BODIES[] = {
+      {COMMAND_PROFILE, "{\"profile\": 2}", 200, 1, {{COMMAND_PROFILE, COMMAND_FROM_WEB, 0, 2, 0}}},
+      {COMMAND_PROFILE, "{\"profile\": -1}", 200, 1, {{COMMAND_PROFILE, COMMAND_FROM_WEB, 0, -1, 0}}},
+      {COMMAND_PROFILE, "{}", 200, 1, {{COMMAND_PROFILE, COMMAND_FROM_WEB, 0, -1, 0}}},
+      {COMMAND_PROFILE, "{\"profile\": 3}", 400, 0, {}},
+      {COMMAND_PROFILE, "{\"profile\": 2", 404, 0, {}},
+      {COMMAND_AUTOTUNE, "{\"mode\": 3}", 200, 1, {{COMMAND_AUTOTUNE, COMMAND_FROM_WEB, 0, 3, 0}}},
+      {COMMAND_AUTOTUNE, "{\"mode\": 0}", 400, 0, {}},
+      {COMMAND_AUTOTUNE, "{\"cancel\": true}", 200, 1, {{COMMAND_AUTOTUNE, COMMAND_FROM_WEB, 0, -1, 0}}},
+      {COMMAND_AUTOTUNE, "{\"cancel\": false}", 200, 0, {}},
+      {COMMAND_MOTOR, "{\"motor1\": true, \"motor2\": false, \"motor3\": true}", 200, 3,
+       {{COMMAND_MOTOR, COMMAND_FROM_WEB, 1, 1, 0}, {COMMAND_MOTOR, COMMAND_FROM_WEB, 2, 0, 0}, {COMMAND_MOTOR, COMMAND_FROM_WEB, 3, 1, 0}}},
+      {COMMAND_MOTOR, "{\"motor2\": true}", 200, 1, {{COMMAND_MOTOR, COMMAND_FROM_WEB, 2, 1, 0}}},
+      {COMMAND_MOTOR, "[true]", 200, 0, {}},
+      {COMMAND_TIME, "{\"time\": 60, \"action\": \"add\"}", 200, 1, {{COMMAND_TIME, COMMAND_FROM_WEB, 0, 60, 0}}},
+      {COMMAND_TIME, "{\"action\": \"reduce\", \"time\": 120}", 200, 1, {{COMMAND_TIME, COMMAND_FROM_WEB, 0, -120, 0}}},
+      {COMMAND_TIME, "{\"time\": 60, \"action\": \"skip\"}", 200, 0, {}},
+      {COMMAND_TIME, "{\"time\": 60}", 200, 0, {}},
+      {COMMAND_TIME, "not json", 404, 0, {}},
+  };
+  unsigned wrong = 0;
+  for (const BodyCase &test : BODIES)
+  {
+    BodyCommands parsed = parseBodyCommands(test.type, test.body, strlen(test.body), shipped);
+    bool same = parsed.status == test.status && parsed.count == test.count && (parsed.status == 200 || parsed.error);
+    for (uint8_t i = 0; same && i < parsed.count; i++)
+    {
+      const Command &command = parsed.commands[i], &expected = test.commands[i];
+      same = command.type == expected.type && command.source == expected.source && command.arg == expected.arg &&
+             command.value == expected.value;
+    }
+    if (!same)
+    {
+      printf("%s %s: %u with %u commands: FAILED\n", commandTypeName(test.type), test.body, parsed.status, parsed.count);
+      wrong++;
+    }
+  }
+  printf("Bodies of the POSTs: %u of %zu parsed wrong: %s\n", wrong, sizeof(BODIES) / sizeof(BODIES[0]), wrong ? "FAILED" : "ok");
+  ok &= !wrong;
+
+  return ok ? 0 : 1;
+}
+
+#define FILTER_SPIKE 10          // A read this far from the probe is a spike (ºC)
+#define FILTER_MAX_ERROR 3       // Of the usable temperature from the probe, with spikes or not (ºC)
+#define FILTER_SPIKE_STEP 0.5f   // Most a spike moves the temperature, as much as a read without one (ºC)
+#define FILTER_SLOPE_MS 1000     // The lag is measured against the speed of the probe over this long
+#define FILTER_MIN_SLOPE 0.5f    // ºC/s the probe moves at least for the lag to be measured
+#define FILTER_MAX_LAG 1000      // Of the usable temperature behind the probe on average (ms)
+#define FILTER_HUMIDITY 40       // % the simulated DHT reads around (HUMIDITY of simulator.cpp)
+#define FILTER_HUMIDITY_ERROR 4  // Of the usable humidity, twice the noise of the reads (%)
+
+// What a filter did with the reads of a sensor of a trace
+struct FilterReplay
+{
+  uint32_t reads, failed, spikes, faults; // Faults: reads flagged QUALITY_FAULT
+  uint32_t wrongFlags; // Reads whose quality isn't what the read & the failed ones before it make it
+  uint32_t moved;      // Failed reads that changed the value
+  float maxError;      // Of the usable value from the truth (ºC or %)
+  float spikeStep;     // Most the value moved at a spike (ºC)
+  float lagMs;         // Behind the probe on average while it moves (thermocouple)
+};
+
+// Replay the reads of the thermocouple (the lines with the probe) or of the
+// DHT (the others) of a trace through the filter of the sensor, checking the
+// quality of each read against the read itself
+static FilterReplay replayFilter(const std::vector<TraceRead> &reads, bool thermocouple)
+{
+  const FilterConfig &config = thermocouple ? THERMOCOUPLE_FILTER : HUMIDITY_FILTER;
+  SensorFilter filter(config);
+  FilterReplay replay = {};
+  std::deque<const TraceRead *> recent; // Of the last FILTER_SLOPE_MS, for the speed of the probe
+  uint8_t failures = 0;
+  bool started = false;
+  double lagSum = 0;
+  uint32_t lagReads = 0;
+
+  for (const TraceRead &read : reads)
+  {
+    if (isnan(read.probe) == thermocouple)
+    {
+      continue;
+    }
+    float raw = thermocouple ? read.thermocouple : read.humidity;
+    bool failed = !(raw >= config.min && raw <= config.max);
+    int32_t before = filter.value();
+    filter.update(raw, read.ms);
+    replay.reads++;
+
+    failures = failed ? failures + 1 : 0;
+    started |= !failed;
+    uint8_t expected = (failed ? QUALITY_REJECTED : 0) | (failures >= config.faultReads ? QUALITY_FAULT : 0) |
+                       (started ? 0 : QUALITY_STALE);
+    replay.failed += failed;
+    replay.faults += (filter.quality() & QUALITY_FAULT) != 0;
+    replay.wrongFlags += (filter.quality() & ~QUALITY_CLAMPED) != expected;
+    replay.moved += failed && filter.value() != before;
+    if (filter.quality() & QUALITY_UNUSABLE)
+    {
+      continue;
+    }
+
+    float value = filter.value() / (float)FILTER_ONE;
+    if (!thermocouple)
+    {
+      replay.maxError = std::max(replay.maxError, fabsf(value - FILTER_HUMIDITY));
+      continue;
+    }
+    if (!failed && fabsf(raw - read.probe) > FILTER_SPIKE)
+    {
+      replay.spikes++;
+      replay.spikeStep = std::max(replay.spikeStep, fabsf(filter.value() - before) / FILTER_ONE);
+    }
+    replay.maxError = std::max(replay.maxError, fabsf(value - read.probe));
+
+    // Lag: how long the probe took to move as far as the value is behind it
+    recent.push_back(&read);
+    while (read.ms - recent.front()->ms > FILTER_SLOPE_MS)
+    {
+      recent.pop_front();
+    }
+    uint32_t span = read.ms - recent.front()->ms;
+    float slope = span ? (read.probe - recent.front()->probe) * 1000 / span : 0;
+    if (fabsf(slope) >= FILTER_MIN_SLOPE)
+    {
+      lagSum += (read.probe - value) / slope * 1000;
+      lagReads++;
+    }
+  }
+  replay.lagMs = lagReads ? lagSum / lagReads : 0;
+  return replay;
+}
+
+// Recorded roasts, clean, with spikes & with runs of failed reads, through the
+// filters of the thermocouple & the DHT: the spikes never get through, the
+// temperature stays close behind the probe, and the quality of each read is
+// what the reads make it (rejected, fault after enough of them, stale until
+// the first good one)
+static int checkFilter(uint32_t seed)
+{
+  (void)seed;
+  static const char *TRACES[] = {TRACE_CAFE, TRACE_SPIKES, TRACE_DROPOUTS};
+  bool ok = true;
+
+  for (uint8_t trace = 0; trace < sizeof(TRACES) / sizeof(TRACES[0]); trace++)
+  {
+    const char *path = TRACES[trace];
+    std::vector<TraceRead> reads;
+    if (!loadTrace(path, &reads))
+    {
+      return 1;
+    }
+
+    FilterReplay temperature = replayFilter(reads, true), humidity = replayFilter(reads, false);
+    bool right = temperature.wrongFlags == 0 && temperature.moved == 0 && temperature.spikeStep <= FILTER_SPIKE_STEP &&
+                 temperature.maxError <= FILTER_MAX_ERROR && temperature.lagMs <= FILTER_MAX_LAG;
+    printf("%s thermocouple: %u reads, %u failed, %u spikes moving it %.2f ºC, %u faults, %u wrong qualities, "
+           "%u failed reads moved it, %.2f ºC off the probe, %.0f ms behind: %s\n",
+           path, temperature.reads, temperature.failed, temperature.spikes, temperature.spikeStep, temperature.faults,
+           temperature.wrongFlags, temperature.moved, temperature.maxError, temperature.lagMs, right ? "ok" : "FAILED");
+    ok &= right;
+
+    right = humidity.wrongFlags == 0 && humidity.moved == 0 && humidity.maxError <= FILTER_HUMIDITY_ERROR;
+    printf("%s DHT: %u reads, %u failed, %u faults, %u wrong qualities, %u failed reads moved it, %.2f %% off: %s\n", path,
+           humidity.reads, humidity.failed, humidity.faults, humidity.wrongFlags, humidity.moved, humidity.maxError,
+           right ? "ok" : "FAILED");
+    ok &= right;
+
+    // What each trace was recorded for
+    if (trace == 1)
+    {
+      right = temperature.spikes > 0;
+      printf("%s has spikes: %s\n", path, right ? "ok" : "FAILED");
+      ok &= right;
+    }
+    if (trace == 2)
+    {
+      right = temperature.faults > 0 && humidity.faults > 0 && temperature.failed > temperature.faults &&
+              humidity.failed > humidity.faults;
+      printf("%s has short runs of failed reads & faults of both sensors: %s\n", path, right ? "ok" : "FAILED");
+      ok &= right;
+    }
+  }
+
+  return ok ? 0 : 1;
+}
+
+// A check & what it covers
+struct SimCheck
+{
+  const char *name;
+  int (*run)(uint32_t seed);
+  const char *description;
+};
+
+static const SimCheck CHECKS[] = {
+    {"scheduler", checkScheduler, "releases on a fake clock: order, catch-up after a stall, clock wrap"},
+    {"seqlock", checkSeqlock, "one writer & several reader threads on a snapshot: no torn or older copy"},
+    {"control", checkControlSessions, "sessions of the control channel: busy commands sent again after newer ones, duplicates"},
+    {"events", checkEventBacklog, "backlog of /events: reconnects inside, outside & across its wrap, replay bursts"},
+    {"lcd", checkLcd, "LiquidCrystal_I2C on a fake bus: async bytes as the sync path, enable pulses & settle times"},
+    {"pid", checkPid, "relay autotune & PID on a plant with a dead time: ultimate point, overshoot & settling"},
+    {"filter", checkFilter, "recorded reads of both sensors: spikes rejected, lag behind the probe, quality of each read"},
+    {"profile", checkProfileReplay, "profiles replayed on a recorded roast: transitions, ramp setpoints, motors"},
+    {"json", checkJson, "profiles & bodies of the POSTs through ArduinoJson: every field, the limits, broken input"},
+    {"history", checkHistory, "ring of samples: reads across the wrap & before the oldest, chunked ranges, a writer racing"},
+};
+
+int runChecks(const char *name, uint32_t seed)
+{
+  bool all = strcmp(name, "all") == 0, found = false;
+  int failed = 0;
+
+  for (const SimCheck &check : CHECKS)
+  {
+    if (all || strcmp(name, check.name) == 0)
+    {
+      printf("== %s: %s\n", check.name, check.description);
+      int result = check.run(seed);
+      printf("%s\n", result ? "FAILED" : "ok");
+      failed += result;
+      found = true;
+    }
+  }
+
+  if (!found)
+  {
+    fprintf(stderr, "No check %s, one of: all", name);
+    for (const SimCheck &check : CHECKS)
+    {
+      fprintf(stderr, " %s", check.name);
+    }
+    fprintf(stderr, "\n");
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,13 @@
+#ifndef SIM_CHECKS_H
+#define SIM_CHECKS_H
+
+#include <stdint.h>
+
+// Run the check of a module (env:sim, sim -c <name>), or every one ("all").
+// Returns 0 if they passed, 1 if one failed or there is no such check
+int runChecks(const char *name, uint32_t seed);
+
+// Checks with a file of their own
+int checkLcd(uint32_t seed); // sim_lcd.cpp
+
+#endif
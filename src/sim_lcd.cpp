@@ -0,0 +1,363 @@
+// Check of LiquidCrystal_I2C (sim -c lcd) on a fake board: the Wire records
+// each byte the expander takes & when, on a fake clock that the delays of the
+// sync path & the ticks of the async drain task advance. The display side
+// decodes the enable pulses as an HD44780 latches them & checks the times of
+// its datasheet. The stubs of the Arduino core & of FreeRTOS are in sim/stubs
+
+#include "sim_checks.h"
+
+#include <stdio.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <LiquidCrystal_I2C.h>
+
+#define LCD_ADDRESS 0x27
+#define LCD_BUS_HZ 100000       // The PCF8574's
+#define LCD_FAST_BUS_HZ 3400000 // So fast that only the waits of the library keep the times of the display
+#define LCD_TICK_NS (portTICK_PERIOD_MS * 1000000ULL)
+
+// HD44780 times (ns)
+#define HD44780_POWER_UP 40000000   // From power on to the first instruction
+#define HD44780_PULSE 450           // Enable high
+#define HD44780_CYCLE 1000          // From one enable pulse to the next
+#define HD44780_EXECUTE 37000       // Most instructions
+#define HD44780_WRITE 41000         // Writing data to the RAM
+#define HD44780_CLEAR 1520000       // Clear & return home
+static const uint32_t HD44780_INIT[] = {4100000, 100000, 37000, 37000}; // After each 8-bit mode nibble of the reset sequence
+
+static uint64_t lcdNanos; // Fake clock
+static uint32_t busHz;    // Clock of the I2C bus
+
+// A byte the expander took: its pins from then on
+struct BusByte
+{
+  uint8_t pins;
+  uint64_t at; // ns
+};
+
+static std::vector<BusByte> busBytes;
+static std::vector<uint8_t> transaction;
+static uint32_t wrongAddresses;
+
+void delay(uint32_t ms)
+{
+  lcdNanos += ms * 1000000ULL;
+}
+
+void delayMicroseconds(uint32_t us)
+{
+  lcdNanos += us * 1000ULL;
+}
+
+TwoWire Wire;
+
+void TwoWire::begin() {}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  wrongAddresses += address != LCD_ADDRESS;
+  transaction.clear();
+}
+
+size_t TwoWire::write(uint8_t byte)
+{
+  transaction.push_back(byte);
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *bytes, size_t length)
+{
+  transaction.insert(transaction.end(), bytes, bytes + length);
+  return length;
+}
+
+// Start & address, then 9 clocks per byte: the expander sets its pins at the ack
+uint8_t TwoWire::endTransmission()
+{
+  uint64_t byteNanos = 9 * 1000000000ULL / busHz;
+  lcdNanos += byteNanos;
+  for (uint8_t byte : transaction)
+  {
+    lcdNanos += byteNanos;
+    busBytes.push_back({byte, lcdNanos});
+  }
+  lcdNanos += byteNanos / 9; // Stop
+  return 0;
+}
+
+struct SimQueue
+{
+  std::deque<std::vector<uint8_t>> items;
+  size_t length, itemSize;
+};
+
+// Thrown by a receive on an empty queue: the drain task would block, back to the check
+struct DrainIdle
+{
+};
+
+static TaskFunction_t lcdTask;
+static void *lcdTaskParameter;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+  SimQueue *queue = new SimQueue;
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+  delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+  if (queue->items.size() == queue->length)
+  {
+    return pdFALSE;
+  }
+  queue->items.push_back(std::vector<uint8_t>((const uint8_t *)item, (const uint8_t *)item + queue->itemSize));
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+  if (queue->items.empty())
+  {
+    throw DrainIdle();
+  }
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  return queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+  return queue->length - queue->items.size();
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack, void *parameter, UBaseType_t priority,
+                                   TaskHandle_t *handle, BaseType_t core)
+{
+  lcdTask = task;
+  lcdTaskParameter = parameter;
+  return pdPASS;
+}
+
+// The worst case: the first tick comes right after the call
+void vTaskDelay(TickType_t ticks)
+{
+  lcdNanos += ticks ? (ticks - 1) * LCD_TICK_NS + 1 : 0;
+}
+
+// Run the drain task until the queue is empty
+static void drainLcd()
+{
+  try
+  {
+    lcdTask(lcdTaskParameter);
+  }
+  catch (const DrainIdle &)
+  {
+  }
+}
+
+// What the display saw
+struct LcdTiming
+{
+  uint32_t pulses;
+  uint32_t badPulses;     // Too short, or the data lines changed while En was high
+  uint64_t shortestPulse; // ns
+  uint32_t instructions;
+  uint32_t early;    // Instructions sent before the previous one was done
+  int64_t leastSlack; // Shortest time to spare after an instruction (ns)
+  uint64_t powerUp;  // From the start to the first instruction (ns)
+};
+
+// Decode the enable pulses of the bytes as the display latches them: the 4
+// nibbles of the reset sequence, then instructions & data in nibble pairs
+static LcdTiming decodeLcd(const std::vector<BusByte> &bytes, uint64_t start, std::vector<uint16_t> *instructions)
+{
+  LcdTiming timing = {0, 0, UINT64_MAX, 0, 0, INT64_MAX, 0};
+  uint8_t pins = 0, high = 0, nibbles = 0;
+  uint64_t rise = 0, lastRise = 0, ready = start + HD44780_POWER_UP;
+  bool first = true;
+
+  for (const BusByte &byte : bytes)
+  {
+    bool wasHigh = pins & En, isHigh = byte.pins & En;
+    if (!wasHigh && isHigh)
+    {
+      // The display takes a new pulse only once done with the last instruction
+      int64_t slack = (int64_t)(byte.at - ready);
+      timing.early += slack < 0;
+      timing.leastSlack = slack < timing.leastSlack ? slack : timing.leastSlack;
+      timing.badPulses += !first && byte.at - lastRise < HD44780_CYCLE;
+      if (first)
+      {
+        timing.powerUp = byte.at - start;
+        first = false;
+      }
+      rise = lastRise = byte.at;
+      high = byte.pins;
+    }
+    else if (wasHigh && !isHigh)
+    {
+      timing.pulses++;
+      uint64_t pulse = byte.at - rise;
+      timing.shortestPulse = pulse < timing.shortestPulse ? pulse : timing.shortestPulse;
+      timing.badPulses += pulse < HD44780_PULSE || (byte.pins & ~En) != (high & ~En);
+
+      // Latched: an instruction is done once its time has passed
+      uint8_t nibble = high >> 4;
+      bool data = high & Rs;
+      if (nibbles < 4)
+      {
+        ready = byte.at + HD44780_INIT[nibbles];
+        instructions->push_back(nibble);
+        timing.instructions++;
+      }
+      else if ((nibbles - 4) % 2 == 0)
+      {
+        instructions->push_back((data ? 0x100 : 0) | nibble << 4);
+        ready = byte.at + HD44780_CYCLE;
+      }
+      else
+      {
+        uint16_t &instruction = instructions->back();
+        instruction |= nibble;
+        bool slow = !data && (instruction == LCD_CLEARDISPLAY || (instruction & ~1) == LCD_RETURNHOME);
+        ready = byte.at + (data ? HD44780_WRITE : slow ? HD44780_CLEAR : HD44780_EXECUTE);
+        timing.instructions++;
+      }
+      nibbles++;
+    }
+    pins = byte.pins;
+  }
+  return timing;
+}
+
+static const char *const LCD_TEXT = "Temp 201C   55%";
+
+// What the firmware does with the display, through either path (runs: with
+// writeAt(), which leaves the pacing of its characters to the bus). Returns
+// the time its caller was held
+static uint64_t useLcd(LiquidCrystal_I2C &lcd, bool async, bool runs)
+{
+  static uint8_t bell[8] = {0x04, 0x0e, 0x0e, 0x0e, 0x1f, 0x00, 0x04, 0x00};
+
+  uint64_t start = lcdNanos;
+  lcd.init();
+  uint64_t held = lcdNanos - start;
+  if (async)
+  {
+    drainLcd(); // The reset sequence takes most of the queue
+  }
+
+  start = lcdNanos;
+  lcd.backlight();
+  lcd.clear();
+  lcd.setCursor(2, 1);
+  lcd.print("Roasting");
+  if (runs)
+  {
+    lcd.writeAt(0, 0, (const uint8_t *)LCD_TEXT, strlen(LCD_TEXT));
+  }
+  lcd.createChar(0, bell);
+  lcd.home();
+  lcd.noDisplay();
+  lcd.display();
+  return held + lcdNanos - start;
+}
+
+// The same calls through the sync path & through the async queue, with the
+// bus at the speed of the PCF8574 & at one so fast that only the waits of the
+// library keep the times of the display (the sub-ms ones included): the async
+// path sends the same bytes in the same order, without holding its caller,
+// and neither path sends an enable pulse too short or an instruction before
+// the last one is done. A run that doesn't fit in the queue is dropped whole
+int checkLcd(uint32_t seed)
+{
+  static const uint32_t rates[] = {LCD_BUS_HZ, LCD_FAST_BUS_HZ};
+  bool ok = true;
+
+  for (uint32_t rate : rates)
+  {
+    busHz = rate;
+    std::vector<uint8_t> sent[2];
+    std::vector<uint16_t> seen[2];
+    bool timed = true;
+    uint64_t held = 0;
+
+    for (int async = 0; async < 2; async++)
+    {
+      LiquidCrystal_I2C lcd(LCD_ADDRESS, 16, 2);
+      busBytes.clear();
+      wrongAddresses = 0;
+      lcdNanos = 1000000000ULL + seed % 1000 * 1000;
+      uint64_t start = lcdNanos;
+
+      if (async)
+      {
+        lcd.beginAsync();
+      }
+      held = useLcd(lcd, async, rate == LCD_BUS_HZ);
+      if (async)
+      {
+        drainLcd();
+      }
+
+      for (const BusByte &byte : busBytes)
+      {
+        sent[async].push_back(byte.pins);
+      }
+      LcdTiming timing = decodeLcd(busBytes, start, &seen[async]);
+      bool right = timing.badPulses == 0 && timing.early == 0 && timing.powerUp >= HD44780_POWER_UP && wrongAddresses == 0 &&
+                   lcd.i2cBytes() == busBytes.size();
+      printf("%s at %u kHz: %zu bytes, %u enable pulses (shortest %.2f µs), %u bad, %u instructions, %u early (least to spare %.1f µs), "
+             "first after %.1f ms: %s\n",
+             async ? "Async" : "Sync", rate / 1000, busBytes.size(), timing.pulses, timing.shortestPulse / 1000.0, timing.badPulses,
+             timing.instructions, timing.early, timing.leastSlack / 1000.0, timing.powerUp / 1e6, right ? "ok" : "FAILED");
+      timed &= right;
+    }
+
+    bool same = sent[0] == sent[1] && seen[0] == seen[1] && !sent[0].empty();
+    printf("Async at %u kHz: same bytes as sync: %s, caller held %.1f µs: %s\n", rate / 1000, sent[0] == sent[1] ? "yes" : "no",
+           held / 1000.0, same && held == 0 ? "ok" : "FAILED");
+    ok &= timed && same && held == 0;
+  }
+
+  // A full queue drops the run whole: no data byte of it reaches the display
+  LiquidCrystal_I2C lcd(LCD_ADDRESS, 16, 2);
+  lcd.beginAsync();
+  lcd.init();
+  drainLcd();
+  while (lcd.pendingOps() < 63)
+  {
+    lcd.display();
+  }
+  busBytes.clear();
+  bool taken = lcd.writeAt(0, 0, (const uint8_t *)LCD_TEXT, strlen(LCD_TEXT)); // 2 ops, 1 left
+  drainLcd();
+  uint32_t data = 0;
+  for (const BusByte &byte : busBytes)
+  {
+    data += (byte.pins & Rs) != 0;
+  }
+  bool dropped = !taken && data == 0 && lcd.droppedOps() == 2;
+  printf("Run with the queue full: %s, %u ops dropped, %u data bytes sent: %s\n", taken ? "taken" : "dropped", lcd.droppedOps(), data,
+         dropped ? "ok" : "FAILED");
+  ok &= dropped;
+
+  return ok ? 0 : 1;
+}
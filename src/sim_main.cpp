@@ -0,0 +1,1414 @@
+// Roaster simulator (env:sim): runs many roasts of the real logic against a
+// thermal model, on a virtual clock, and reports the latencies of the
+// control loop. Usage: sim [-n roasts] [-m mode 1-3, 0 for all] [-s seed]
+// [-l limit minutes] [-x spike probability] [-d dropout probability] [-o trace.csv] [-r] [-t] [-b] [-k] [-q] [-j] [-e] [-w] [-p] [-f] [-c check]
+// (-r gives the raw reads to the roaster, -t prints every transition of the
+// first roast, -o records the reads of the sensors in the first roast & the
+// cool down after it, -b times the per-sample stages & the telemetry payloads
+// (against /data built as before), and checks the payloads allocate nothing, -k
+// counts the bytes of a minute on /events & on /events/compact, instead, -q stresses the queue of
+// the commands & their replay instead, -j cuts the power of the roast journal -n
+// times instead, -e times the exports of a day of roasts instead, -w boots
+// -n times on an emulated network instead, -p prints the probes of the run
+// as /metrics does on the board, -f injects each fault of the safety
+// supervisor in -n roasts instead, -c runs the check of a module, or all of
+// them, instead: see sim_checks.cpp)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <ArduinoJson.h>
+
+#include "commands.h"
+#include "countdown.h"
+#include "hal.h"
+#include "hal_linux.h"
+#include "journal.h"
+#include "metrics.h"
+#include "roast_export.h"
+#include "periods.h"
+#include "request_body.h"
+#include "sim_checks.h"
+#include "simulator.h"
+#include "telemetry.h"
+#include "wifi_link.h"
+
+// Plant of a typical batch, the heating power changes ±LOAD_VARIATION between batches
+const PlantParameters PLANT = {
+    25,        // ambient ºC
+    1.0f,      // ºC/s heating at ambient
+    1 / 300.0f, // loss, up to ~325 ºC with the heater always on
+    3,         // s of probe lag
+    0.5f,      // ºC of noise
+    0.0002f,   // spikes
+    0};        // dropouts
+#define LOAD_VARIATION 0.15f
+#define RECORD_COOLING 300000 // Recorded after the end of the roast, with the heater off (ms)
+
+#define BENCHMARK_SAMPLES 10000000
+#define BENCHMARK_PAYLOADS 2000000
+#define BENCHMARK_BASELINE_PAYLOADS 200000 // Of /data as it was built before telemetry.cpp, far slower
+
+// Heap allocations made while counting (every malloc of the program, new
+// included, goes through here). glibc only, and not under a sanitizer that
+// takes malloc over
+static bool countingAllocations = false;
+static uint64_t allocations = 0;
+static uint64_t allocatedBytes = 0;
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define COUNTS_ALLOCATIONS 1
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+  allocations += countingAllocations;
+  allocatedBytes += countingAllocations ? size : 0;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+  allocations += countingAllocations;
+  allocatedBytes += countingAllocations ? count * size : 0;
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+  allocations += countingAllocations;
+  allocatedBytes += countingAllocations ? size : 0;
+  return __libc_realloc(pointer, size);
+}
+#else
+#define COUNTS_ALLOCATIONS 0
+#endif
+
+// Nanoseconds since some point
+static uint64_t nanoseconds()
+{
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Cycles of the CPU (its time stamp counter) since some point, 0 where it has none
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// Time the work done for each sample by the filter & the analytics, on a noisy ramp
+static void benchmark()
+{
+  SensorFilter filter(THERMOCOUPLE_FILTER);
+  RoastAnalytics analytics(ANALYTICS_PERIOD);
+  analytics.start(DRY_END_TEMPERATURE, 200);
+  volatile int32_t sink = 0; // Keeps the results alive
+
+  uint64_t start = nanoseconds();
+  for (uint32_t i = 0; i < BENCHMARK_SAMPLES; i++)
+  {
+    filter.update(25 + (i % 4096) / 20.0f + (i * 2654435761u >> 30), i * THERMOCOUPLE_PERIOD);
+    sink = sink + filter.value();
+  }
+  uint64_t filterTime = nanoseconds() - start;
+
+  start = nanoseconds();
+  for (uint32_t i = 0; i < BENCHMARK_SAMPLES; i++)
+  {
+    analytics.push(25 + (i % 4096) / 20 + (i * 2654435761u >> 30), true);
+    sink = sink + analytics.getMetrics().ror;
+  }
+  uint64_t analyticsTime = nanoseconds() - start;
+
+  printf("Per sample: filter %.1f ns, analytics %.1f ns (%u samples)\n",
+         (double)filterTime / BENCHMARK_SAMPLES, (double)analyticsTime / BENCHMARK_SAMPLES, BENCHMARK_SAMPLES);
+}
+
+// The /data payload as it was built before telemetry.cpp (std::string for
+// the String of the board): each part in a StaticJsonDocument of its own, its
+// numbers as strings, serialized, parsed back & added to a DynamicJsonDocument
+// serialized in turn
+static size_t writeDataBefore(std::string &json, const Readings &readings, const TimerValues &timer, const MotorStates &states)
+{
+  StaticJsonDocument<64> readingsDocument;
+  readingsDocument["temperature"] = std::to_string(readings.temperature);
+  readingsDocument["humidity"] = std::to_string(readings.humidity);
+  std::string readingsJson;
+  serializeJson(readingsDocument, readingsJson);
+
+  StaticJsonDocument<64> timerDocument;
+  timerDocument["total"] = std::to_string(timer.total);
+  timerDocument["time"] = std::to_string(timer.time);
+  std::string timerJson;
+  serializeJson(timerDocument, timerJson);
+
+  StaticJsonDocument<128> statesDocument;
+  statesDocument["motor1"] = states.motor1;
+  statesDocument["motor2"] = states.motor2;
+  statesDocument["motor3"] = states.motor3;
+  std::string statesJson;
+  serializeJson(statesDocument, statesJson);
+
+  DynamicJsonDocument data(256);
+  StaticJsonDocument<64> timerValues;
+  StaticJsonDocument<64> readingsValues;
+  StaticJsonDocument<128> statesValues;
+  deserializeJson(timerValues, timerJson);
+  deserializeJson(readingsValues, readingsJson);
+  deserializeJson(statesValues, statesJson);
+  data["timer"] = timerValues.as<JsonVariant>();
+  data["readings"] = readingsValues.as<JsonVariant>();
+  data["states"] = statesValues.as<JsonVariant>();
+
+  json.clear();
+  serializeJson(data, json);
+  return json.size();
+}
+
+// Time each telemetry payload written into a buffer of the caller, on values
+// that change every time, & count the heap allocations meanwhile (must be 0).
+// The last row is /data built as before, for a baseline
+static int benchmarkPayloads()
+{
+  char buffer[TELEMETRY_BUFFER_SIZE];
+  volatile size_t sink = 0;
+  DeltaEncoder encoder;
+  JournalEntry entry = {42, 3, 1024, 1000, 900, 2, "Cafe \"dark\"", true, true, {240, 300, 90}};
+
+  std::string before;
+
+  static const char *NAMES[] = {"readings", "timer", "states", "analytics", "data", "sample", "roast entry", "delta frame", "keyframe",
+                                "data (before)"};
+  const int PAYLOADS = sizeof(NAMES) / sizeof(NAMES[0]);
+  const int BASELINE = PAYLOADS - 1;
+
+  printf("Payload        ns/payload  cycles/payload  allocations/payload  heap bytes/payload  bytes\n");
+  uint64_t allocated = 0;
+  uint32_t unfit = 0;
+  for (int payload = 0; payload < PAYLOADS; payload++)
+  {
+    size_t length = 0;
+    uint32_t count = payload == BASELINE ? BENCHMARK_BASELINE_PAYLOADS : BENCHMARK_PAYLOADS;
+    allocations = 0;
+    allocatedBytes = 0;
+    countingAllocations = true;
+    uint64_t start = nanoseconds(), startCycles = cycles();
+    for (uint32_t i = 0; i < count; i++)
+    {
+      int t = 25 + (i % 2000) / 10;
+      Readings readings = {t, 40 + (int)(i % 7), 0, (uint8_t)(i & 1)};
+      TimerValues timer = {1200, 1200 - (int)(i % 1200)};
+      MotorStates states = {(i & 1) != 0, (i & 2) != 0, (i & 4) != 0};
+      RoastMetrics metrics = {(int16_t)(i % 900), (int16_t)(i % 800), (uint16_t)(i % 600), (uint8_t)(i % 4), {(uint16_t)i, 300, 90}};
+      HistorySample sample = {(int16_t)t, (uint16_t)timer.time, 40, (uint8_t)(i & 3)};
+      TelemetryFrame frame = {t, 40, 1200, timer.time, states.motor1, 0, metrics.ror};
+
+      switch (payload)
+      {
+      case 0:
+        length = writeReadings(buffer, sizeof(buffer), readings);
+        break;
+      case 1:
+        length = writeTimer(buffer, sizeof(buffer), timer);
+        break;
+      case 2:
+        length = writeStates(buffer, sizeof(buffer), states);
+        break;
+      case 3:
+        length = writeAnalytics(buffer, sizeof(buffer), metrics);
+        break;
+      case 4:
+        length = writeData(buffer, sizeof(buffer), readings, timer, states, metrics);
+        break;
+      case 5:
+        length = writeSample(buffer, sizeof(buffer), i, sample);
+        break;
+      case 6:
+        entry.id = i;
+        length = writeRoastEntry(buffer, sizeof(buffer), entry);
+        break;
+      case 7:
+      case 8:
+        length = encoder.encode(buffer, sizeof(buffer), frame, payload == 8);
+        break;
+      default:
+        length = writeDataBefore(before, readings, timer, states);
+        break;
+      }
+      sink = sink + length;
+    }
+    uint64_t elapsed = nanoseconds() - start, elapsedCycles = cycles() - startCycles;
+    countingAllocations = false;
+
+    printf("%-14s %10.1f  %14.0f  %19.1f  %18.1f  %5zu%s\n", NAMES[payload], (double)elapsed / count, (double)elapsedCycles / count,
+           (double)allocations / count, (double)allocatedBytes / count, length, length ? "" : " (DIDN'T FIT)");
+    if (payload != BASELINE)
+    {
+      allocated += allocations;
+      unfit += length == 0;
+    }
+  }
+
+#if COUNTS_ALLOCATIONS
+  printf("Heap allocations: %llu in %u payloads of each kind (but the one before)\n", (unsigned long long)allocated, BENCHMARK_PAYLOADS);
+#else
+  printf("Heap allocations: not counted in this build\n");
+#endif
+  bool ok = allocated == 0 && unfit == 0;
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+
+#define STREAM_MINUTE 60000   // ms of telemetry sent to each stream
+#define STREAM_UPTIME 600000  // ms since boot at its start, for the length of the ids (millis() on the board)
+
+// Bytes of an event on the wire as AsyncEventSource frames it: its id, its
+// name (none for the pings) & its data, each on a line, then a blank line
+static size_t sseEventBytes(uint32_t id, const char *event, const char *payload)
+{
+  char frame[TELEMETRY_BUFFER_SIZE + 64];
+  int length = event ? snprintf(frame, sizeof(frame), "id: %u\r\nevent: %s\r\ndata: %s\r\n\r\n", id, event, payload)
+                     : snprintf(frame, sizeof(frame), "id: %u\r\ndata: %s\r\n\r\n", id, payload);
+  return length;
+}
+
+// Bytes sent in a minute to an /events client (a ping, the readings, the timer
+// & the analytics every SSE_PERIOD) & to an /events/compact one (the changes
+// every COMPACT_PERIOD, all the values every KEYFRAME_PERIOD), with the
+// encoders of the board. roasting: the timer runs & the temperature rises
+// 1 ºC every 3 s, else the timer is stopped & the readings are stable
+static void measureStreams(bool roasting, uint64_t *eventsBytes, uint64_t *compactBytes)
+{
+  DeltaEncoder encoder;
+  char payload[TELEMETRY_BUFFER_SIZE];
+  uint32_t lastKeyframe = 0;
+  *eventsBytes = 0;
+  *compactBytes = 0;
+  for (uint32_t ms = 0; ms < STREAM_MINUTE; ms += COMPACT_PERIOD)
+  {
+    uint32_t now = STREAM_UPTIME + ms, seconds = ms / 1000;
+    Readings readings = {roasting ? 150 + (int)seconds / 3 : 25, 40, 0, 0};
+    TimerValues timer = {1200, roasting ? 900 - (int)seconds : 1200};
+    MotorStates states = {roasting, false, false};
+    RoastMetrics metrics = {(int16_t)(roasting ? 200 : 0), (int16_t)(roasting ? 200 : 0), 0,
+                            (uint8_t)(roasting ? PHASE_DRYING : PHASE_IDLE), {(uint16_t)(roasting ? 300 + seconds : 0), 0, 0}};
+
+    if (ms % SSE_PERIOD == 0)
+    {
+      // publishEvent() gives each one an id of its own, from millis()
+      *eventsBytes += sseEventBytes(now, NULL, "ping");
+      writeReadings(payload, sizeof(payload), readings);
+      *eventsBytes += sseEventBytes(now + 1, "readings", payload);
+      writeTimer(payload, sizeof(payload), timer);
+      *eventsBytes += sseEventBytes(now + 2, "timer", payload);
+      writeAnalytics(payload, sizeof(payload), metrics);
+      *eventsBytes += sseEventBytes(now + 3, "analytics", payload);
+    }
+
+    bool keyframe = ms == 0 || ms - lastKeyframe >= KEYFRAME_PERIOD;
+    lastKeyframe = keyframe ? ms : lastKeyframe;
+    TelemetryFrame frame = {readings.temperature, readings.humidity, timer.total, timer.time, (uint8_t)(states.motor1 ? 1 : 0), 0, metrics.ror};
+    if (encoder.encode(payload, sizeof(payload), frame, keyframe))
+    {
+      *compactBytes += sseEventBytes(now, keyframe ? "k" : "d", payload);
+    }
+  }
+}
+
+// Print the bytes a minute of telemetry takes on /events & on /events/compact
+static int benchmarkStreams()
+{
+  printf("Bytes per minute, SSE framing included\n");
+  printf("                /events  /events/compact\n");
+  bool ok = true;
+  for (int roasting = 1; roasting >= 0; roasting--)
+  {
+    uint64_t eventsBytes, compactBytes;
+    measureStreams(roasting, &eventsBytes, &compactBytes);
+    printf("%-14s %8llu  %15llu\n", roasting ? "roasting" : "stopped", (unsigned long long)eventsBytes, (unsigned long long)compactBytes);
+    ok &= compactBytes < eventsBytes;
+  }
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+
+#define STRESS_COMMANDS 250000 // Per producer
+#define STRESS_START 3600      // Seconds of the countdown before the commands
+#define STRESS_SWITCH 1000     // Drains between two moves of the switch
+
+// What a producer posted, to check the roaster against
+struct StressProducer
+{
+  uint32_t seed;
+  int64_t seconds;       // Added by its commands that weren't bounces
+  uint32_t bounces;      // Presses closer than BUTTON_DEBOUNCE
+  uint32_t retries;      // Posts refused by a full queue
+  int32_t lastValue[4];  // Of the last command for each arg (-2 when none)
+};
+
+// Post a command, retrying until the queue takes it
+static void postStressCommand(CommandPipeline *commands, StressProducer *producer, const Command &command)
+{
+  while (!commands->post(command))
+  {
+    producer->retries++;
+    std::this_thread::yield();
+  }
+}
+
+static uint32_t nextRandom(uint32_t *seed)
+{
+  *seed = *seed * 1664525 + 1013904223;
+  return *seed >> 8;
+}
+
+// The button ISRs: presses a few ms to 120 ms apart, some of them bounces. micros is the time of the press
+static void produceButtons(CommandPipeline *commands, StressProducer *producer)
+{
+  uint32_t micros = 0, last = 0;
+  for (uint32_t i = 0; i < STRESS_COMMANDS; i++)
+  {
+    micros += nextRandom(&producer->seed) % 120000 + 1;
+    uint8_t add = nextRandom(&producer->seed) & 1;
+    if (micros - last <= BUTTON_DEBOUNCE)
+    {
+      producer->bounces++;
+    }
+    else
+    {
+      producer->seconds += add ? BUTTON_SECONDS : -BUTTON_SECONDS;
+    }
+    last = micros;
+
+    Command command = {COMMAND_BUTTON, COMMAND_FROM_BUTTON, add, 0, micros};
+    postStressCommand(commands, producer, command);
+  }
+}
+
+// The web & the control channel (AsyncTCP task): time, motor & profile commands. micros is their order
+static void produceWeb(CommandPipeline *commands, StressProducer *producer, int profiles)
+{
+  for (uint32_t i = 0; i < STRESS_COMMANDS; i++)
+  {
+    uint32_t random = nextRandom(&producer->seed);
+    Command command = {COMMAND_TIME, COMMAND_FROM_WEB, 0, 0, i + 1};
+    switch (random % 3)
+    {
+    case 0:
+      command.value = (int32_t)(random >> 8) % 120 + 1;
+      command.value = random & 0x80 ? -command.value : command.value;
+      producer->seconds += command.value;
+      break;
+
+    case 1:
+      command.type = COMMAND_MOTOR;
+      command.source = COMMAND_FROM_CONTROL;
+      command.arg = (random >> 8) % 3 + 1;
+      command.value = (random >> 16) & 1;
+      producer->lastValue[command.arg] = command.value;
+      break;
+
+    default:
+      // Past the last profile now & then, for the rejected ones
+      command.type = COMMAND_PROFILE;
+      command.value = (int32_t)((random >> 8) % (profiles + 2)) - 1;
+      if (command.value < profiles)
+      {
+        producer->lastValue[0] = command.value;
+      }
+    }
+    postStressCommand(commands, producer, command);
+  }
+}
+
+// State of the roaster the commands change
+struct StressState
+{
+  int total;
+  MotorStates motors;
+  int profile;
+  uint8_t mode;
+};
+
+static StressState stressState(const Roaster &roaster)
+{
+  StressState state = {roaster.getTimeValues().total, roaster.getMotorStates(), roaster.getSelectedProfile(), roaster.getMode()};
+  return state;
+}
+
+static bool sameState(const StressState &a, const StressState &b)
+{
+  return a.total == b.total && a.motors.motor1 == b.motors.motor1 && a.motors.motor2 == b.motors.motor2 &&
+         a.motors.motor3 == b.motors.motor3 && a.profile == b.profile && a.mode == b.mode;
+}
+
+// Gather a body cut at every point, in two & in three chunks, as the web
+// server hands them over. Returns the cuts that didn't give it back whole
+static uint32_t checkBodies()
+{
+  const char *body = "{\"time\":60,\"action\":\"add\",\"padding\":\"0123456789\"}";
+  size_t total = strlen(body);
+  uint32_t failures = 0, cuts = 0;
+
+  for (size_t first = 1; first <= total; first++)
+  {
+    for (size_t second = first; second <= total; second++)
+    {
+      size_t ends[] = {first, second, total};
+      void *storage = NULL;
+      const char *gathered = NULL;
+      size_t length = 0, index = 0;
+      uint8_t result = BODY_PARTIAL;
+      for (size_t end : ends)
+      {
+        if (end > index)
+        {
+          result = gatherBody(&storage, (const uint8_t *)body + index, end - index, index, total, &gathered, &length);
+          index = end;
+        }
+      }
+      failures += result != BODY_COMPLETE || length != total || memcmp(gathered, body, total) != 0;
+      cuts++;
+      free(storage);
+    }
+  }
+
+  // Over the limit: refused on its first chunk, the next ones ignored
+  static char large[REQUEST_BODY_MAX + 2];
+  void *storage = NULL;
+  const char *gathered;
+  size_t length;
+  failures += gatherBody(&storage, (const uint8_t *)large, 1, 0, sizeof(large), &gathered, &length) != BODY_TOO_LARGE;
+  failures += gatherBody(&storage, (const uint8_t *)large + 1, sizeof(large) - 1, 1, sizeof(large), &gathered, &length) != BODY_PARTIAL;
+  failures += storage != NULL;
+
+  printf("Bodies: %u cuts of a %zu byte body, %u not gathered whole\n", cuts, total, failures);
+  return failures;
+}
+
+// Two threads (the button ISRs, and the AsyncTCP task on the board) post
+// commands at the roaster while this one (the loop) moves the switch &
+// applies them in batches. Checks that every command got to the roaster, each
+// source in the order it posted them, that the refused posts are all
+// counted, and that replaying the log on a new roaster ends in the same state
+static int stressQueues()
+{
+  halLinuxUseVirtualClock(1000000);
+  Roaster roaster([](uint8_t row, const char *text) {}, []() {});
+  roaster.begin();
+  int profiles = roaster.getProfileCount();
+
+  static CommandPipeline commands;
+  Command start = {COMMAND_TIME, COMMAND_FROM_WEB, 0, STRESS_START, 0};
+  commands.post(start);
+
+  StressProducer buttons = {1, 0, 0, 0, {-2, -2, -2, -2}}, web = {2, 0, 0, 0, {-2, -2, -2, -2}};
+  uint64_t begin = nanoseconds();
+  std::thread buttonThread(produceButtons, &commands, &buttons);
+  std::thread webThread(produceWeb, &commands, &web, profiles);
+
+  // Follow the log after each batch, as a client of /debug/commands?after= would
+  std::vector<LoggedCommand> applied;
+  uint32_t lastMicros[4] = {0, 0, 0, 0}, outOfOrder = 0, ignored = 0, drains = 0, switches = 0, switchRetries = 0;
+  uint8_t position = 0, posted = 0xff;
+  while (applied.size() < 2 * STRESS_COMMANDS + 1 + switches || posted != position)
+  {
+    if (++drains % STRESS_SWITCH == 0)
+    {
+      position = (position + 1) % 4;
+    }
+    if (posted != position)
+    {
+      Command command = {COMMAND_SWITCH, COMMAND_FROM_SWITCH, position, 0, drains};
+      if (commands.post(command))
+      {
+        posted = position;
+        switches++;
+      }
+      else
+      {
+        switchRetries++;
+      }
+    }
+
+    CommandBatch batch = commands.drain(roaster, drains);
+    if (!batch.applied)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+
+    CommandLog log = commands.getLog();
+    for (uint32_t seq = applied.size(); seq < log.count; seq++)
+    {
+      const LoggedCommand &entry = log.entries[seq % COMMAND_LOG_SIZE];
+      uint8_t source = entry.command.source == COMMAND_FROM_CONTROL ? COMMAND_FROM_WEB : entry.command.source;
+      outOfOrder += entry.seq != seq || (seq > 0 && (int32_t)(entry.command.micros - lastMicros[source]) <= 0); // The presses wrap around
+      lastMicros[source] = entry.command.micros;
+      ignored += entry.command.type == COMMAND_BUTTON && entry.result == COMMAND_IGNORED;
+      applied.push_back(entry);
+    }
+  }
+
+  buttonThread.join();
+  webThread.join();
+  double elapsed = (nanoseconds() - begin) / 1e9;
+  StressState after = stressState(roaster);
+
+  int64_t expected = STRESS_START + buttons.seconds + web.seconds;
+  bool motors = (web.lastValue[1] < 0 || after.motors.motor1 == (web.lastValue[1] == 1)) &&
+                (web.lastValue[2] < 0 || after.motors.motor2 == (web.lastValue[2] == 1)) &&
+                (web.lastValue[3] < 0 || after.motors.motor3 == (web.lastValue[3] == 1));
+  bool state = after.total == expected && motors && (web.lastValue[0] == -2 || after.profile == web.lastValue[0]) && after.mode == position;
+  bool counted = commands.dropped() == buttons.retries + web.retries + switchRetries;
+
+  // Replay from the same state: a new roaster & pipeline (for the debounce), the commands in the order of the log
+  Roaster replayed([](uint8_t row, const char *text) {}, []() {});
+  replayed.begin();
+  CommandPipeline replay;
+  uint32_t differences = 0;
+  for (const LoggedCommand &entry : applied)
+  {
+    differences += replay.apply(replayed, entry.command) != entry.result;
+  }
+  bool same = sameState(stressState(replayed), after);
+
+  printf("Commands: %zu in %.2f s (%u drains), %u posts retried on a full queue (%u counted), %u bounces (%u expected), %u out of order\n",
+         applied.size(), elapsed, drains, buttons.retries + web.retries + switchRetries, commands.dropped(), ignored, buttons.bounces, outOfOrder);
+  printf("Roaster: countdown %d s (expected %lld s), motors %s, profile %d, mode %u: %s\n", after.total, (long long)expected,
+         motors ? "as last set" : "NOT as last set", after.profile, after.mode, state ? "ok" : "MISMATCH");
+  printf("Replay: %u results differ, same state: %s\n", differences, same ? "yes" : "NO");
+
+  bool ok = state && counted && ignored == buttons.bounces && outOfOrder == 0 && differences == 0 && same;
+  ok &= checkBodies() == 0;
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+
+#define FUZZ_ROASTS 3         // Most roasts written between two power cuts
+#define FUZZ_BUDGET 3000      // Most bytes written before the power goes
+#define FUZZ_SAMPLES 1500     // Most samples of a roast
+
+// A roast handed to the journal
+struct FuzzRoast
+{
+  std::vector<int16_t> temperatures;
+  bool acknowledged; // Its end record was written
+};
+
+// Results of the power cuts
+struct FuzzResults
+{
+  uint32_t roasts;       // Begun
+  uint32_t acknowledged; // Ended
+  uint32_t cuts;         // Power losses during a write
+  uint32_t recovered;    // Roasts listed after a reboot
+  uint32_t incomplete;   // Of them, cut before their end record
+  uint32_t lost;         // Ended roasts missing after a reboot (must be 0)
+  uint32_t mismatches;   // Roasts read back with other samples than written (must be 0)
+};
+
+// After a reboot: every roast listed reads back as written (up to its last
+// record), & none of the ended ones newer than the oldest listed is missing
+static void checkJournal(const RoastJournal &journal, const std::map<uint32_t, FuzzRoast> &written, FuzzResults &results)
+{
+  uint32_t oldest = journal.count() ? journal.entry(0).id : UINT32_MAX;
+  for (std::map<uint32_t, FuzzRoast>::const_iterator roast = written.begin(); roast != written.end(); ++roast)
+  {
+    const JournalEntry *entry = journal.find(roast->first);
+    if (roast->second.acknowledged && roast->first >= oldest && (!entry || !entry->complete))
+    {
+      results.lost++;
+    }
+  }
+
+  for (uint8_t i = 0; i < journal.count(); i++)
+  {
+    const JournalEntry &entry = journal.entry(i);
+    std::map<uint32_t, FuzzRoast>::const_iterator roast = written.find(entry.id);
+    JournalReader reader;
+    if (roast == written.end() || !reader.open(entry))
+    {
+      results.mismatches++;
+      continue;
+    }
+
+    const std::vector<int16_t> &expected = roast->second.temperatures;
+    int16_t temperatures[64];
+    size_t read = 0, count;
+    bool same = true;
+    while ((count = reader.read(temperatures, 64)) > 0)
+    {
+      for (size_t j = 0; j < count; j++, read++)
+      {
+        same = same && read < expected.size() && temperatures[j] == expected[read];
+      }
+    }
+
+    if (!same || read != entry.samples || (entry.complete && read != expected.size()))
+    {
+      results.mismatches++;
+    }
+    results.recovered++;
+    results.incomplete += !entry.complete;
+  }
+}
+
+// Write roasts to the journal on files (the flash of the native build) & cut
+// the power at a random byte, then reboot & check what's left, over & over
+static int fuzzJournal(unsigned cuts, uint32_t seed)
+{
+  char root[] = "/tmp/journalXXXXXX";
+  if (!mkdtemp(root))
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  halLinuxSetStorageRoot(root);
+  srand(seed);
+
+  std::map<uint32_t, FuzzRoast> written;
+  FuzzResults results = {};
+  JournalStats total = {};
+  const uint16_t phases[3] = {240, 300, 90};
+
+  for (unsigned i = 0; i < cuts; i++)
+  {
+    // Reboot
+    halLinuxCutPowerAfter(-1);
+    RoastJournal journal;
+    journal.begin();
+    checkJournal(journal, written, results);
+
+    halLinuxCutPowerAfter(rand() % FUZZ_BUDGET);
+    RoastRecorder recorder;
+    int16_t temperature = 25;
+
+    for (int roasts = 1 + rand() % FUZZ_ROASTS; roasts > 0; roasts--)
+    {
+      recorder.begin(1 + rand() % 3, "Fuzz", HISTORY_PERIOD);
+      recorder.flush(journal);
+      uint32_t id = journal.current();
+      if (id)
+      {
+        written[id] = FuzzRoast();
+        results.roasts++;
+      }
+
+      // A noisy ramp with a few jumps that don't fit a byte
+      for (int samples = 1 + rand() % FUZZ_SAMPLES; samples > 0; samples--)
+      {
+        temperature += rand() % 100 == 0 ? rand() % 601 - 300 : rand() % 7 - 2;
+        recorder.sample(temperature);
+        if (id)
+        {
+          written[id].temperatures.push_back(temperature);
+        }
+        if (recorder.pending())
+        {
+          recorder.flush(journal);
+        }
+      }
+
+      recorder.end(rand() % 2, phases);
+      recorder.flush(journal);
+      const JournalEntry *entry = id ? journal.find(id) : NULL;
+      if (entry && entry->complete)
+      {
+        written[id].acknowledged = true;
+        results.acknowledged++;
+      }
+    }
+
+    const JournalStats &stats = journal.getStats();
+    results.cuts += stats.failures > 0;
+    total.records += stats.records;
+    total.bytes += stats.bytes;
+    total.segments += stats.segments;
+  }
+
+  halLinuxCutPowerAfter(-1);
+  RoastJournal journal;
+  journal.begin();
+  checkJournal(journal, written, results);
+
+  for (uint8_t slot = 0; slot < JOURNAL_SLOTS; slot++)
+  {
+    char path[JOURNAL_PATH_LENGTH];
+    snprintf(path, sizeof(path), "/journal%u.log", slot);
+    halRemoveFile(path);
+  }
+  rmdir(root);
+
+  bool ok = results.lost == 0 && results.mismatches == 0;
+  printf("Journal: %u reboots, %u power cuts during a write, %u roasts begun & %u ended\n",
+         cuts, results.cuts, results.roasts, results.acknowledged);
+  printf("Read back over the reboots: %u roasts (%u cut before their end), %u ended ones lost, %u mismatches: %s\n",
+         results.recovered, results.incomplete, results.lost, results.mismatches, ok ? "ok" : "FAILED");
+  printf("Writes: %u records, %.1f bytes each, %u segments started (each slot rewritten %.1f times)\n",
+         total.records, total.records ? (double)total.bytes / total.records : 0.0, total.segments,
+         (double)total.segments / JOURNAL_SLOTS);
+  return ok ? 0 : 1;
+}
+
+#define EXPORT_ROASTS 24    // A day of roasts
+#define EXPORT_SAMPLES 3600 // Of an hour each
+#define EXPORT_CHUNK 1436   // Bytes asked for by the web server, about a TCP segment
+
+// Temperatures of an export, decoded back
+static std::vector<int16_t> decodeExport(const std::string &data, uint8_t format)
+{
+  std::vector<int16_t> temperatures;
+
+  if (format == EXPORT_BINARY)
+  {
+    size_t at = EXPORT_BINARY_HEADER;
+    while (at < data.size() && data[at] != 0)
+    {
+      uint8_t count = data[at];
+      int16_t temperature = (uint8_t)data[at + 1] | (uint8_t)data[at + 2] << 8;
+      temperatures.push_back(temperature);
+      for (uint8_t i = 1; i < count; i++)
+      {
+        temperature += (int8_t)data[at + 2 + i];
+        temperatures.push_back(temperature);
+      }
+      at += 2 + count;
+    }
+    return temperatures;
+  }
+
+  // The numbers after the header: the temperatures, or the seconds & the temperature of each row
+  const char *text = data.c_str();
+  text = format == EXPORT_CSV ? strchr(text, '\n') : strstr(text, "\"temperatures\":[") + 15;
+  while (text && *text)
+  {
+    if (format == EXPORT_CSV)
+    {
+      text = strchr(text, ',');
+      if (!text)
+      {
+        break;
+      }
+    }
+    char *end;
+    long value = strtol(text + 1, &end, 10);
+    if (end == text + 1)
+    {
+      break;
+    }
+    temperatures.push_back(value);
+    text = end;
+  }
+  return temperatures;
+}
+
+// Write a day of roasts to the journal on files, then export every one of
+// them in each format through chunks of the size the web server asks for:
+// the time taken, the size & that they decode back to what was written
+static int benchmarkExport(uint32_t seed)
+{
+  char root[] = "/tmp/journalXXXXXX";
+  if (!mkdtemp(root))
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  halLinuxSetStorageRoot(root);
+  srand(seed);
+
+  RoastJournal journal;
+  RoastRecorder recorder;
+  std::map<uint32_t, std::vector<int16_t> > written;
+  const uint16_t phases[3] = {240, 300, 90};
+  journal.begin();
+
+  for (int roast = 0; roast < EXPORT_ROASTS; roast++)
+  {
+    recorder.begin(1 + roast % 3, "Export", HISTORY_PERIOD);
+    recorder.flush(journal);
+    std::vector<int16_t> &temperatures = written[journal.current()];
+
+    int16_t temperature = 25;
+    for (int sample = 0; sample < EXPORT_SAMPLES; sample++)
+    {
+      temperature += rand() % 7 - 2;
+      recorder.sample(temperature);
+      temperatures.push_back(temperature);
+      recorder.flush(journal);
+    }
+    recorder.end(true, phases);
+    recorder.flush(journal);
+  }
+
+  const char *names[] = {"JSON", "CSV", "binary"};
+  bool ok = true;
+  uint64_t samples = 0;
+  for (std::map<uint32_t, std::vector<int16_t> >::const_iterator roast = written.begin(); roast != written.end(); ++roast)
+  {
+    samples += roast->second.size();
+  }
+
+  printf("Exports of %u roasts of %u samples, %u bytes of journal, %u byte chunks (%u bytes of state each):\n",
+         EXPORT_ROASTS, EXPORT_SAMPLES, journal.getStats().bytes, EXPORT_CHUNK, (unsigned)sizeof(RoastExport));
+
+  for (uint8_t format = EXPORT_JSON; format <= EXPORT_BINARY; format++)
+  {
+    std::vector<std::string> exports;
+    uint8_t chunk[EXPORT_CHUNK];
+    uint64_t bytes = 0;
+    uint32_t chunks = 0;
+
+    uint64_t start = nanoseconds();
+    for (uint8_t i = 0; i < journal.count(); i++)
+    {
+      RoastExport roast(journal.entry(i), format);
+      std::string data;
+      if (!roast.open())
+      {
+        ok = false;
+        continue;
+      }
+
+      size_t length;
+      while ((length = roast.fill(chunk, sizeof(chunk))) > 0 || !roast.done())
+      {
+        data.append((const char *)chunk, length);
+        chunks++;
+      }
+      bytes += data.size();
+      exports.push_back(data);
+    }
+    double elapsed = (nanoseconds() - start) / 1e9;
+
+    bool same = exports.size() == written.size();
+    for (uint8_t i = 0; i < exports.size() && same; i++)
+    {
+      same = decodeExport(exports[i], format) == written[journal.entry(i).id];
+    }
+    ok = ok && same;
+
+    printf("  %-6s %8.2f MB, %5.2f bytes per sample, %5u chunks in %6.1f ms: %6.1f MB/s, %s\n",
+           names[format], bytes / 1e6, (double)bytes / samples, chunks, elapsed * 1000, bytes / 1e6 / elapsed,
+           same ? "ok" : "MISMATCH");
+  }
+
+  for (uint8_t slot = 0; slot < JOURNAL_SLOTS; slot++)
+  {
+    char path[JOURNAL_PATH_LENGTH];
+    snprintf(path, sizeof(path), "/journal%u.log", slot);
+    halRemoveFile(path);
+  }
+  rmdir(root);
+  return ok ? 0 : 1;
+}
+
+#define BOOT_STEP 1000 // µs between looks at the network events (they wake the loop on the board)
+
+// How the router behaves around a boot
+struct BootScenario
+{
+  const char *name;
+  bool known;       // The router of the last connection is saved (a boot before this one joined it)
+  uint8_t channel;  // Of the router, the saved one is on 6
+  int32_t downAtMs; // When the router goes down, -1 never
+  uint32_t outageMs;
+  uint32_t limitMs;
+};
+
+static const BootScenario BOOT_SCENARIOS[] = {
+    {"first boot", false, 6, -1, 0, 60000},
+    {"reboot", true, 6, -1, 0, 60000},
+    {"router on another channel", true, 11, -1, 0, 60000},
+    {"router off for 60 s at boot", true, 6, 0, 60000, 180000},
+    {"router off for 20 s", true, 6, 10000, 20000, 120000},
+    {"router off for 90 s", true, 6, 10000, 90000, 240000},
+};
+
+// Outcome of a boot
+struct BootRun
+{
+  uint32_t controlMs; // Boot to the first control run, UINT32_MAX if it never ran
+  uint32_t onlineMs;  // Router back (or boot) to online, UINT32_MAX if it never got there
+  bool fastJoin;      // The last join skipped the scan
+  bool accessPoint;   // The access point was started
+};
+
+static WifiLink *bootLink;
+static bool bootControlled;
+static uint32_t bootControlMs;
+static bool bootJoinFailed;
+
+static void bootNetworkEvent(uint8_t event)
+{
+  bootLink->post(event);
+}
+
+static void bootControl()
+{
+  if (!bootControlled)
+  {
+    bootControlled = true;
+    bootControlMs = halMillis();
+  }
+}
+
+static void bootWifi()
+{
+  bootLink->poll();
+}
+
+// Whether the router is up at a time of the scenario
+static bool routerUp(const BootScenario &scenario, uint32_t ms)
+{
+  return scenario.downAtMs < 0 || ms < (uint32_t)scenario.downAtMs || ms >= scenario.downAtMs + scenario.outageMs;
+}
+
+// A boot of the firmware: the loop (control & WiFi tasks) starts right away & the link joins meanwhile
+static BootRun bootFirmware(const BootScenario &scenario, uint32_t scanMs, uint32_t joinMs)
+{
+  halLinuxUseVirtualClock(0);
+  halLinuxSetRouter(routerUp(scenario, 0), scenario.channel, scanMs, joinMs);
+
+  WifiLink link;
+  Scheduler loop(halMicros);
+  bootLink = &link;
+  bootControlled = false;
+  loop.add("control", bootControl, CONTROL_PERIOD);
+  int wifiTask = loop.add("wifi", bootWifi, WIFI_PERIOD);
+
+  halNetworkBegin(bootNetworkEvent);
+  link.begin("Shop", "password", "Roaster", "password");
+
+  uint32_t upAt = scenario.downAtMs < 0 ? 0 : scenario.downAtMs + scenario.outageMs;
+  bool up = routerUp(scenario, 0);
+  BootRun run = {UINT32_MAX, UINT32_MAX, false, false};
+
+  while (halMillis() < scenario.limitMs && run.onlineMs == UINT32_MAX)
+  {
+    if (routerUp(scenario, halMillis()) != up)
+    {
+      up = !up;
+      halLinuxSetRouter(up, scenario.channel, scanMs, joinMs);
+    }
+
+    if (link.pending())
+    {
+      loop.trigger(wifiTask);
+    }
+    uint32_t idle = loop.tick();
+
+    if (link.isOnline() && halMillis() >= upAt)
+    {
+      run.onlineMs = halMillis() - upAt;
+    }
+    halLinuxAdvance(idle < BOOT_STEP ? idle : BOOT_STEP);
+  }
+
+  run.controlMs = bootControlled ? bootControlMs : UINT32_MAX;
+  run.fastJoin = link.getStats().fastJoins > 0 && link.getStats().lastJoinMs < scanMs;
+  run.accessPoint = link.getStats().accessPoints > 0;
+  return run;
+}
+
+static void bootJoinEvent(uint8_t event)
+{
+  bootJoinFailed = event == HAL_NETWORK_DISCONNECTED;
+}
+
+// A boot of the firmware before the link: setup() waited for the connection
+// (with the retries of the WiFi driver) before the loop could run
+static uint32_t bootBlocking(const BootScenario &scenario, uint32_t scanMs, uint32_t joinMs)
+{
+  halLinuxUseVirtualClock(0);
+  halLinuxSetRouter(routerUp(scenario, 0), scenario.channel, scanMs, joinMs);
+  halNetworkBegin(bootJoinEvent);
+  bootJoinFailed = false;
+  halNetworkJoin("Shop", "password", NULL);
+
+  while (!halNetworkConnected())
+  {
+    if (halMillis() >= scenario.limitMs)
+    {
+      return UINT32_MAX;
+    }
+    halDelay(1000);
+
+    halLinuxSetRouter(routerUp(scenario, halMillis()), scenario.channel, scanMs, joinMs);
+    if (bootJoinFailed)
+    {
+      bootJoinFailed = false;
+      halNetworkJoin("Shop", "password", NULL);
+    }
+  }
+  return halMillis();
+}
+
+// Print a distribution of ms, or how many runs never got there
+static void printBootTimes(std::vector<uint32_t> &ms)
+{
+  std::sort(ms.begin(), ms.end());
+  size_t never = std::count(ms.begin(), ms.end(), UINT32_MAX);
+  if (never == ms.size())
+  {
+    printf(" %20s", "never");
+    return;
+  }
+
+  char text[32];
+  snprintf(text, sizeof(text), "%u / %u", ms[(ms.size() - never - 1) / 2], ms[ms.size() - never - 1]);
+  printf(" %15s%5s", text, never ? "(!)" : "");
+}
+
+// Boot many times on an emulated network, with the scan & join times of each
+// boot drawn at random, & compare how long the roaster was held back by the
+// WiFi before & after the link, and how long it took to get online
+static int benchmarkBoot(unsigned boots, uint32_t seed)
+{
+  srand(seed);
+  bool ok = true;
+
+  char title[32];
+  snprintf(title, sizeof(title), "Boots (ms, p50 / max of %u)", boots);
+  printf("%-28s %20s %20s %20s %11s %13s\n", title, "control before", "control now", "online", "fast joins", "access point");
+  for (size_t i = 0; i < sizeof(BOOT_SCENARIOS) / sizeof(BOOT_SCENARIOS[0]); i++)
+  {
+    const BootScenario &scenario = BOOT_SCENARIOS[i];
+    std::vector<uint32_t> blocking, control, online;
+    unsigned fastJoins = 0, accessPoints = 0;
+
+    for (unsigned boot = 0; boot < boots; boot++)
+    {
+      uint32_t scanMs = 1500 + rand() % 2000;
+      uint32_t joinMs = 200 + rand() % 600;
+
+      // The boot before saves the router, or the settings are blank
+      if (scenario.known)
+      {
+        BootScenario before = {"", false, 6, -1, 0, 60000};
+        bootFirmware(before, scanMs, joinMs);
+      }
+      else
+      {
+        HalNetworkLink blank = {};
+        halSaveSetting(WIFI_LINK_SETTING, &blank, sizeof(blank));
+      }
+
+      BootRun run = bootFirmware(scenario, scanMs, joinMs);
+      control.push_back(run.controlMs);
+      online.push_back(run.onlineMs);
+      fastJoins += run.fastJoin;
+      accessPoints += run.accessPoint;
+      ok = ok && run.controlMs < CONTROL_PERIOD && run.onlineMs != UINT32_MAX;
+
+      if (scenario.downAtMs <= 0)
+      {
+        blocking.push_back(bootBlocking(scenario, scanMs, joinMs));
+      }
+    }
+
+    printf("%-28s", scenario.name);
+    if (blocking.empty())
+    {
+      printf(" %20s", "-");
+    }
+    else
+    {
+      printBootTimes(blocking);
+    }
+    printBootTimes(control);
+    printBootTimes(online);
+    printf(" %10.0f%% %12.0f%%\n", 100.0 * fastJoins / boots, 100.0 * accessPoints / boots);
+  }
+
+  printf("Control running within a period of the boot & every boot online: %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+
+#define FAULT_SLACK 50 // ms a check of the supervisor may come after the fault (SAFETY_PERIOD)
+
+// Fault, the cause it must trip with & the latest it may make the outputs safe (ms)
+struct FaultCase
+{
+  const char *name;
+  uint8_t cause;
+  uint32_t boundMs;
+};
+
+static const FaultCase FAULT_CASES[FAULTS] = {
+    {"loop", SAFETY_LOOP_STUCK, SAFETY_LOOP_TIMEOUT + FAULT_SLACK},
+    {"sensor", SAFETY_SENSOR_STALE, SAFETY_STALE_TIMEOUT + FAULT_SLACK},
+    {"temperature", SAFETY_OVER_TEMPERATURE, FAULT_SLACK},
+    {"rate of rise", SAFETY_OVER_ROR, 1000 + FAULT_SLACK}, // The rate of rise is measured once a second
+};
+
+// Inject each fault in runs roasts, and check the supervisor makes the
+// outputs safe in time with the right cause, holds them safe, & lets the
+// watchdog reset the board for a stuck loop only
+static int injectFaults(unsigned runs, uint32_t seed, const PlantParameters &plant, uint32_t limitMs)
+{
+  srand(seed);
+  bool passed = true;
+
+  printf("%-13s %5s %7s %9s %9s %9s %7s %9s %5s %6s\n", "Fault", "runs", "tripped", "p50 (ms)", "p99 (ms)", "max (ms)", "bound", "overshoot", "held", "resets");
+  for (uint8_t fault = 0; fault < FAULTS; fault++)
+  {
+    const FaultCase &expected = FAULT_CASES[fault];
+    Simulator simulator(seed + fault, NULL);
+    LatencyRecorder latency;
+    unsigned tripped = 0, held = 0, resets = 0;
+    float maxOvershoot = 0;
+
+    for (unsigned i = 0; i < runs; i++)
+    {
+      PlantParameters batch = plant;
+      batch.heating *= 1 + LOAD_VARIATION * (2.0f * rand() / RAND_MAX - 1);
+
+      FaultResult result = simulator.roastWithFault(fault, batch, limitMs);
+      if (result.cause == expected.cause)
+      {
+        tripped++;
+        latency.add(result.latencyUs);
+      }
+      held += result.held;
+      resets += result.reset;
+      maxOvershoot = std::max(maxOvershoot, result.overshoot);
+    }
+
+    uint32_t maxUs = latency.percentile(100);
+    bool ok = tripped == runs && held == runs && maxUs <= expected.boundMs * 1000 && resets == (fault == FAULT_LOOP ? runs : 0);
+    passed &= ok;
+
+    printf("%-13s %5u %7u %9.1f %9.1f %9.1f %7u %8.1fC %5u %6u %s\n", expected.name, runs, tripped,
+           latency.percentile(50) / 1000.0, latency.percentile(99) / 1000.0, maxUs / 1000.0, expected.boundMs, maxOvershoot, held, resets,
+           ok ? "ok" : "FAILED");
+  }
+
+  return passed ? 0 : 1;
+}
+
+static void printMetricsLine(const char *line, void *context)
+{
+  fputs(line, stdout);
+}
+
+// Print the probes of the run (& of the tasks of a simulator), as the board does at /metrics
+static void printMetrics(const Simulator *simulator)
+{
+  const Scheduler *schedulers[2];
+  size_t count = 0;
+  if (simulator)
+  {
+    schedulers[count++] = &simulator->loopScheduler();
+    schedulers[count++] = &simulator->samplerScheduler();
+  }
+
+  printf("\n");
+  MetricsWriter out(printMetricsLine, NULL);
+  writeMetrics(out, schedulers, count);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned roasts = 1000;
+  int mode = 0;
+  uint32_t seed = 1;
+  uint32_t limitMinutes = 90;
+  bool trace = false;
+  bool raw = false;
+  bool journal = false;
+  bool boot = false;
+  bool exports = false;
+  bool metrics = false;
+  bool faults = false;
+  const char *check = NULL;
+  const char *record = NULL;
+  PlantParameters plant = PLANT;
+
+  int option;
+  while ((option = getopt(argc, argv, "n:m:s:l:x:d:o:rtbkqjewpfc:")) != -1)
+  {
+    switch (option)
+    {
+    case 'n':
+      roasts = atoi(optarg);
+      break;
+    case 'm':
+      mode = atoi(optarg);
+      break;
+    case 's':
+      seed = strtoul(optarg, NULL, 10);
+      break;
+    case 'l':
+      limitMinutes = atoi(optarg);
+      break;
+    case 'x':
+      plant.spikes = atof(optarg);
+      break;
+    case 'd':
+      plant.dropouts = atof(optarg);
+      break;
+    case 'o':
+      record = optarg;
+      break;
+    case 'r':
+      raw = true;
+      break;
+    case 't':
+      trace = true;
+      break;
+    case 'b':
+      benchmark();
+      return benchmarkPayloads();
+    case 'k':
+      return benchmarkStreams();
+    case 'q':
+      return stressQueues();
+    case 'j':
+      journal = true;
+      break;
+    case 'e':
+      exports = true;
+      break;
+    case 'w':
+      boot = true;
+      break;
+    case 'p':
+      metrics = true;
+      break;
+    case 'f':
+      faults = true;
+      break;
+    case 'c':
+      check = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n roasts] [-m mode] [-s seed] [-l limit minutes] [-x spike probability] [-d dropout probability] [-o trace.csv] [-r] [-t] [-b] [-k] [-q] [-j] [-e] [-w] [-p] [-f] [-c check]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (journal || exports)
+  {
+    int result = journal ? fuzzJournal(roasts, seed) : benchmarkExport(seed);
+    if (metrics)
+    {
+      printMetrics(NULL);
+    }
+    return result;
+  }
+  if (boot)
+  {
+    return benchmarkBoot(roasts, seed);
+  }
+  if (check)
+  {
+    return runChecks(check, seed);
+  }
+  if (faults)
+  {
+    return injectFaults(roasts, seed, plant, limitMinutes * 60000);
+  }
+
+  Simulator simulator(seed, trace ? stdout : NULL);
+  simulator.setFiltering(!raw);
+  srand(seed);
+
+  FILE *recording = record ? fopen(record, "w") : NULL;
+  if (record && !recording)
+  {
+    perror(record);
+    return 1;
+  }
+  simulator.setRecording(recording);
+
+  unsigned finished = 0, early = 0;
+  uint64_t simulatedMs = 0, transitions = 0;
+  float maxOvershoot = 0, totalOvershoot = 0;
+
+  clock_t start = clock();
+
+  for (unsigned i = 0; i < roasts; i++)
+  {
+    uint8_t roastMode = mode ? mode : 1 + i % 3;
+
+    PlantParameters batch = plant;
+    batch.heating *= 1 + LOAD_VARIATION * (2.0f * rand() / RAND_MAX - 1);
+
+    RoastResult result = simulator.roast(roastMode, batch, limitMinutes * 60000);
+    simulator.setTrace(NULL);
+    if (recording)
+    {
+      simulator.rest(RECORD_COOLING);
+      simulator.setRecording(NULL);
+      fclose(recording);
+      recording = NULL;
+    }
+
+    finished += result.finished;
+    early += result.early;
+    simulatedMs += result.durationMs;
+    transitions += result.transitions;
+
+    float overshoot = result.peak - simulator.targetOf(roastMode);
+    totalOvershoot += overshoot;
+    if (overshoot > maxOvershoot)
+    {
+      maxOvershoot = overshoot;
+    }
+  }
+
+  double wall = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("Roasts: %u (%u finished), %.1f h simulated in %.2f s of CPU: %.0fx real time, %.0f roasts/min\n",
+         roasts, finished, simulatedMs / 3.6e6, wall, simulatedMs / 1000.0 / wall, roasts / wall * 60);
+  printf("Clock advances: %llu, transitions: %llu, targets seen early (noise): %u\n",
+         (unsigned long long)simulator.steps, (unsigned long long)transitions, early);
+  printf("Overshoot: %.1fC mean, %.1fC max\n", roasts ? totalOvershoot / roasts : 0, maxOvershoot);
+  printf("\nLatency (ms)  count       p50       p90       p99       max\n");
+  simulator.sampleAge.print(stdout, "sample age");
+  simulator.triggerLatency.print(stdout, "trigger");
+  simulator.responseLatency.print(stdout, "response");
+
+  const CountdownStats &countdown = simulator.countdownStats();
+  printf("\nCountdown: %u seconds shown %.2f ms late on average (%u ms max, %u skipped), %u ends\n",
+         countdown.seconds, countdown.seconds ? (double)countdown.totalLateMs / countdown.seconds : 0.0,
+         countdown.maxLateMs, countdown.skipped, countdown.expiries);
+
+  // Nothing is wrong with these roasts: a trip is a false alarm
+  const SafetyStats &safety = simulator.safetyStats();
+  uint32_t trips = 0;
+  for (uint8_t cause = 1; cause < SAFETY_CAUSES; cause++)
+  {
+    trips += safety.trips[cause];
+  }
+  printf("Safety: %u trips, %u ms longest without a control run, %u feeds of the watchdog\n", trips, safety.maxLoopGapMs, safety.feeds);
+
+  if (metrics)
+  {
+    printMetrics(&simulator);
+  }
+  return trips ? 1 : 0;
+}
@@ -0,0 +1,537 @@
+#include "simulator.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "hal.h"
+#include "hal_linux.h"
+#include "periods.h"
+#include "pins.h"
+
+#define SIMULATION_START 1000000 // Virtual time of the first tick (µs), 0 means "never" for some timestamps
+#define SWITCH_OFF_TIME 2000     // Time with the switch at Off between roasts (ms)
+#define CONVERSION_PERIOD 200000 // The MAX6675 converts on its own clock, the reads get the last conversion (µs)
+#define SPIKE_MIN 20             // Size of a spike of the thermocouple (ºC)
+#define SPIKE_RANGE 40
+#define DROPOUT_RUN 8            // Longest run of failed reads, past the fault of either filter
+#define EARLY_MARGIN 1.0f // The readings are whole degrees: a target seen closer than this isn't early
+#define HUMIDITY 40     // %
+#define HUMIDITY_NOISE 2
+#define FAULT_ONSET 60000        // Roast time before the loop or the sampler get stuck (ms)
+#define FAULT_RESUME 2000        // Time the roast goes on once the fault is gone, the trip must hold (ms)
+
+// Profiles that heat past their own limits
+const Profile RUNAWAY_PROFILE = {"Runaway", 2, {{0, 220, 0, PROFILE_MOTOR1}, {0, 220, 600, 0}}, 190, 0};
+const Profile FAST_PROFILE = {"Fast", 2, {{0, 180, 0, PROFILE_MOTOR1}, {0, 180, 600, 0}}, 0, 30};
+
+void LatencyRecorder::add(uint32_t us)
+{
+  values.push_back(us);
+  sorted = false;
+}
+
+uint32_t LatencyRecorder::percentile(float p)
+{
+  if (values.empty())
+  {
+    return 0;
+  }
+  if (!sorted)
+  {
+    std::sort(values.begin(), values.end());
+    sorted = true;
+  }
+
+  size_t index = (size_t)(p / 100 * (values.size() - 1) + 0.5f);
+  return values[index];
+}
+
+void LatencyRecorder::print(FILE *out, const char *name)
+{
+  fprintf(out, "%-10s %8zu %9.1f %9.1f %9.1f %9.1f\n", name, count(),
+          percentile(50) / 1000.0, percentile(90) / 1000.0, percentile(99) / 1000.0, percentile(100) / 1000.0);
+}
+
+Simulator *Simulator::active = NULL;
+
+Simulator::Simulator(uint32_t seed, FILE *trace)
+    : steps(0), roaster(showRow, statesChanged), loop(halMicros), sampler(halMicros), safety(halMicros), timerTask(-1), trace(trace), recording(NULL), state(seed ? seed : 1),
+      filtering(true), thermocoupleFilter(THERMOCOUPLE_FILTER), humidityFilter(HUMIDITY_FILTER),
+      thermocoupleDropout(0), humidityDropout(0),
+      plant(), drum(0), probe(0), readings(), temperatureMicros(0), readMs(0), startMicros(0),
+      motors(0), buzzer(false), heater(false), timerOn(false), phase(ProfileRunner::Idle), segment(0), roastPhase(PHASE_IDLE),
+      reachedMicros(0), timerEndMicros(0), conversionPhase(0), fault(-1), loopStuck(false), samplerStuck(false), faultMicros(0),
+      safeMicros(0), tripMotors(0), held(true), faultProfile(-1), rorReads(), rorReadMicros(), rorCount(0), faultLimits(), result()
+{
+  active = this;
+
+  halLinuxUseVirtualClock(SIMULATION_START);
+  conversionPhase = random() % CONVERSION_PERIOD;
+  roaster.begin();
+
+  sampler.add("thermocouple", sampleThermocouple, THERMOCOUPLE_PERIOD);
+  sampler.add("dht", sampleHumidity, DHT_PERIOD);
+
+  loop.add("switches", []() { active->roaster.pollSwitches(); }, SWITCHES_PERIOD);
+  loop.add("control", handleReadings, CONTROL_PERIOD);
+  timerTask = loop.add("timer", []() { active->roaster.handleTimer(); }, TIMER_PERIOD);
+  loop.add("pid", []() { active->roaster.handleHeater(); }, PID_PERIOD);
+  loop.add("heater", []() { active->roaster.driveHeater(); }, HEATER_PERIOD);
+  loop.add("analytics", []() { active->roaster.sampleAnalytics(); }, ANALYTICS_PERIOD);
+
+  safety.add("safety", supervise, SAFETY_PERIOD);
+}
+
+void Simulator::showRow(uint8_t row, const char *text) {}
+
+void Simulator::statesChanged() {}
+
+void Simulator::setRecording(FILE *out)
+{
+  recording = out;
+  if (recording)
+  {
+    fprintf(recording, "ms,probe,thermocouple,humidity\n");
+  }
+}
+
+// Read the thermocouple (sampler task)
+void Simulator::sampleThermocouple()
+{
+  Simulator &sim = *active;
+
+  // Last conversion of the MAX6675, the probe hardly moves in between
+  uint32_t now = halMicros();
+  uint32_t converted = now - (now - sim.conversionPhase) % CONVERSION_PERIOD;
+
+  float reading = sim.probe + sim.plant.noise * sim.gaussian();
+  if (sim.random() < sim.plant.spikes * UINT32_MAX)
+  {
+    reading += (sim.random() & 1 ? 1 : -1) * (float)(SPIKE_MIN + sim.random() % SPIKE_RANGE);
+  }
+  reading = floorf(reading * 4) / 4; // MAX6675 resolution
+  if (sim.readFails(sim.thermocoupleDropout))
+  {
+    reading = NAN; // Open thermocouple
+  }
+
+  halLinuxSetReadings(reading, NAN);
+  if (sim.recording)
+  {
+    fprintf(sim.recording, "%u,%.2f,%.2f,\n", (now - sim.startMicros) / 1000, sim.probe, reading);
+  }
+  sim.thermocoupleFilter.update(halReadThermocouple(), halMillis());
+  sim.readings.temperature = sim.filtering ? sim.thermocoupleFilter.rounded() : isnan(reading) ? sim.readings.temperature : (int)reading;
+  sim.readings.temperatureQuality = sim.filtering ? sim.thermocoupleFilter.quality() : 0;
+  sim.temperatureMicros = converted;
+  sim.readMs = halMillis();
+
+  // Onset of the faults of the profiles, as the supervisor sees the readings (filtered)
+  int filtered = sim.thermocoupleFilter.rounded();
+  if (sim.fault == FAULT_TEMPERATURE && !sim.faultMicros && filtered > sim.faultLimits.maxTemperature)
+  {
+    sim.faultMicros = now;
+  }
+  if (sim.fault == FAULT_ROR)
+  {
+    sim.rorReads[sim.rorCount % FAULT_ROR_READS] = filtered;
+    sim.rorReadMicros[sim.rorCount % FAULT_ROR_READS] = now;
+    sim.rorCount++;
+
+    // The rise since the newest reading at least the window of the supervisor old
+    for (uint32_t back = 1; !sim.faultMicros && back < std::min(sim.rorCount, (uint32_t)FAULT_ROR_READS); back++)
+    {
+      uint32_t old = (sim.rorCount - 1 - back) % FAULT_ROR_READS;
+      if (now - sim.rorReadMicros[old] >= SAFETY_ROR_WINDOW * 1000000)
+      {
+        if ((filtered - sim.rorReads[old]) * 60 / SAFETY_ROR_WINDOW > sim.faultLimits.maxRor)
+        {
+          sim.faultMicros = now;
+        }
+        break;
+      }
+    }
+  }
+}
+
+// Read the humidity sensor (sampler task)
+void Simulator::sampleHumidity()
+{
+  Simulator &sim = *active;
+
+  float reading = HUMIDITY + HUMIDITY_NOISE * sim.gaussian();
+  if (sim.readFails(sim.humidityDropout))
+  {
+    reading = NAN; // The DHT timed out
+  }
+  halLinuxSetReadings(NAN, reading);
+  if (sim.recording)
+  {
+    fprintf(sim.recording, "%u,,,%.2f\n", (halMicros() - sim.startMicros) / 1000, reading);
+  }
+  sim.humidityFilter.update(halReadHumidity(), halMillis());
+  sim.readings.humidity = sim.filtering ? sim.humidityFilter.rounded() : isnan(reading) ? sim.readings.humidity : (int)reading;
+  sim.readings.humidityQuality = sim.filtering ? sim.humidityFilter.quality() : 0;
+}
+
+// Take the latest readings (control task)
+void Simulator::handleReadings()
+{
+  Simulator &sim = *active;
+
+  sim.sampleAge.add(halMicros() - sim.temperatureMicros);
+  sim.roaster.handleReadings(sim.readings);
+}
+
+// Watch over the roaster with the filtered reading, as the sampler publishes it on the board (supervisor task)
+void Simulator::supervise()
+{
+  Simulator &sim = *active;
+
+  sim.roaster.getSafety().run(sim.thermocoupleFilter.rounded(), sim.thermocoupleFilter.quality(), sim.readMs, halMillis());
+}
+
+uint32_t Simulator::random()
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Standard normal (Box-Muller)
+float Simulator::gaussian()
+{
+  float u1 = (random() + 1.0f) / 4294967296.0f;
+  float u2 = random() / 4294967296.0f;
+  return sqrtf(-2 * logf(u1)) * cosf(2 * (float)M_PI * u2);
+}
+
+// Whether a read of a sensor fails: runs of 1 - DROPOUT_RUN failed reads start
+// with the probability of the plant (left: reads of the run still to fail)
+bool Simulator::readFails(uint8_t &left)
+{
+  if (!left && plant.dropouts > 0 && random() < plant.dropouts * UINT32_MAX)
+  {
+    left = 1 + random() % DROPOUT_RUN;
+  }
+  if (!left)
+  {
+    return false;
+  }
+  left--;
+  return true;
+}
+
+// Move the drum & the probe forward, with the heater as it is now
+void Simulator::advancePlant(uint32_t us)
+{
+  float dt = us / 1e6f;
+  float steady = plant.ambient + (heater ? plant.heating / plant.loss : 0);
+  float before = drum;
+
+  drum = steady + (drum - steady) * expf(-plant.loss * dt);
+  probe += (drum - probe) * (1 - expf(-dt / plant.probeLag));
+
+  if (drum > result.peak)
+  {
+    result.peak = drum;
+  }
+
+  // Exact time the drum crossed the target of the segment being ramped
+  const Profile *profile = roaster.getProfileRunner().getProfile();
+  if (phase == ProfileRunner::Ramp && !reachedMicros && profile)
+  {
+    float target = profile->segments[segment].target;
+    bool crossed = roaster.getProfileRunner().isRising() ? (before < target && drum >= target) : (before > target && drum <= target);
+    if (crossed)
+    {
+      float t = logf((target - steady) / (before - steady)) / -plant.loss;
+      reachedMicros = halMicros() + (uint32_t)(t * 1e6f);
+    }
+  }
+}
+
+// Record the changes of the outputs & of the profile
+void Simulator::observe()
+{
+  uint32_t now = halMicros();
+  double time = (now - startMicros) / 1e6;
+
+  MotorStates states = roaster.getMotorStates();
+  uint8_t newMotors = (states.motor1 ? 1 : 0) | (states.motor2 ? 2 : 0) | (states.motor3 ? 4 : 0);
+  if (newMotors != motors)
+  {
+    motors = newMotors;
+    result.transitions++;
+    if (trace)
+    {
+      fprintf(trace, "%9.3f motors %d%d%d\n", time, states.motor1, states.motor2, states.motor3);
+    }
+  }
+
+  bool newHeater = halDigitalRead(HEATER_PIN);
+  if (newHeater != heater)
+  {
+    heater = newHeater;
+    result.transitions++;
+    if (trace)
+    {
+      fprintf(trace, "%9.3f heater %s (duty %.2f, drum %.1fC)\n", time, heater ? "on" : "off", roaster.getHeaterDuty(), drum);
+    }
+  }
+
+  bool newTimerOn = roaster.isTimerOn();
+  if (newTimerOn != timerOn)
+  {
+    timerOn = newTimerOn;
+    result.transitions++;
+    if (!timerOn)
+    {
+      timerEndMicros = now;
+    }
+    if (trace)
+    {
+      fprintf(trace, "%9.3f timer %s (%d s)\n", time, timerOn ? "start" : "end", roaster.getTimeValues().total);
+    }
+  }
+
+  bool newBuzzer = halLinuxTone(BUZZER_PIN) != 0;
+  if (newBuzzer != buzzer)
+  {
+    buzzer = newBuzzer;
+    result.transitions++;
+    if (buzzer && timerEndMicros)
+    {
+      responseLatency.add(now - timerEndMicros);
+      timerEndMicros = 0;
+    }
+    if (trace)
+    {
+      fprintf(trace, "%9.3f buzzer %s\n", time, buzzer ? "on" : "off");
+    }
+  }
+
+  const RoastMetrics &metrics = roaster.getMetrics();
+  if (metrics.phase != roastPhase)
+  {
+    roastPhase = metrics.phase;
+    if (trace)
+    {
+      fprintf(trace, "%9.3f phase %u (RoR %.1fC/min, drum %.1fC)\n", time, roastPhase, metrics.ror / 10.0, drum);
+    }
+  }
+
+  // Once tripped the heater must go off & stay off, with the alarm sounding.
+  // The motors too with the loop stuck, otherwise the trip must not turn off
+  // the ones that were on
+  if (fault >= 0 && !roaster.getSafety().tripped())
+  {
+    tripMotors = motors;
+  }
+  else if (fault >= 0)
+  {
+    bool safe = !heater && halLinuxTone(BUZZER_PIN) == SAFETY_ALARM_TONE &&
+                (fault == FAULT_LOOP ? !motors : (motors & tripMotors) == tripMotors);
+    if (!safeMicros && safe)
+    {
+      safeMicros = now;
+      faultMicros = faultMicros ? faultMicros : now; // The supervisor saw the rise before the window of the simulator
+      if (trace)
+      {
+        fprintf(trace, "%9.3f safe (%s, drum %.1fC)\n", time, safetyCauseName(roaster.getSafety().getCause()), drum);
+      }
+    }
+    else if (safeMicros && !safe)
+    {
+      held = false;
+    }
+  }
+
+  // The profile moved on from a ramp: it saw the target
+  const ProfileRunner &runner = roaster.getProfileRunner();
+  if (runner.getPhase() != phase || runner.getSegment() != segment)
+  {
+    if (phase == ProfileRunner::Ramp && runner.getProfile())
+    {
+      if (reachedMicros && (int32_t)(now - reachedMicros) >= 0)
+      {
+        triggerLatency.add(now - reachedMicros);
+      }
+      else if (fabsf(drum - runner.getProfile()->segments[segment].target) > EARLY_MARGIN)
+      {
+        result.early++;
+      }
+      if (trace)
+      {
+        fprintf(trace, "%9.3f segment %u reached (drum %.1fC)\n", time, segment, drum);
+      }
+    }
+
+    phase = runner.getPhase();
+    segment = runner.getSegment();
+    reachedMicros = 0;
+
+    // Already there when the ramp starts
+    if (phase == ProfileRunner::Ramp)
+    {
+      float target = runner.getProfile()->segments[segment].target;
+      if (runner.isRising() ? drum >= target : drum <= target)
+      {
+        reachedMicros = now;
+      }
+    }
+  }
+}
+
+// Run the tasks for a while, or until the timer response starts, or until the outputs are safe after a trip.
+// The supervisor runs first, as its task is above the others on the board. A stuck scheduler doesn't run at all
+void Simulator::run(uint32_t durationMs, Until until)
+{
+  uint64_t elapsed = 0;
+
+  while (elapsed < (uint64_t)durationMs * 1000)
+  {
+    uint32_t safetyIdle = safety.tick();
+    uint32_t samplerIdle = samplerStuck ? UINT32_MAX : sampler.tick();
+    uint32_t loopIdle = loopStuck ? UINT32_MAX : loop.tick();
+    observe();
+
+    if ((until == UntilResponse && buzzer) || (until == UntilSafe && safeMicros))
+    {
+      break;
+    }
+
+    // The tasks take no time: when one is still due, tick again before moving the clock
+    uint32_t step = std::min(safetyIdle, std::min(samplerIdle, loopIdle));
+    if (step == 0)
+    {
+      continue;
+    }
+
+    // As the esp_timer on the board, wake the timer task when the countdown moves to another second
+    uint32_t countdownUs = roaster.untilNextSecond() * 1000;
+    bool wakeTimer = countdownUs && countdownUs <= step;
+    if (wakeTimer)
+    {
+      step = countdownUs;
+    }
+
+    advancePlant(step);
+    halLinuxAdvance(step);
+    elapsed += step;
+    steps++;
+
+    if (wakeTimer)
+    {
+      loop.trigger(timerTask);
+    }
+  }
+
+  result.durationMs = elapsed / 1000;
+}
+
+int Simulator::targetOf(uint8_t mode) const
+{
+  const Profile &profile = roaster.getProfile(mode - 1);
+  return profile.segments[profile.count - 1].target;
+}
+
+// Empty the roaster (switch to Off & stop the motors) & put a new batch in. The
+// recording starts with the new batch
+void Simulator::emptyRoaster(const PlantParameters &parameters)
+{
+  FILE *out = recording;
+  recording = NULL;
+
+  halLinuxSetPin(TIME_A, false);
+  halLinuxSetPin(TIME_B, false);
+  halLinuxSetPin(TIME_C, false);
+  run(SWITCH_OFF_TIME, ForTime);
+  for (uint8_t motor = 1; motor <= 3; motor++)
+  {
+    roaster.setMotor(motor, false);
+  }
+  observe();
+
+  // New batch, the probe goes from the old one to ambient at once
+  plant = parameters;
+  drum = probe = plant.ambient;
+  thermocoupleFilter.reset();
+  recording = out;
+  result = RoastResult();
+  result.peak = drum;
+  startMicros = halMicros();
+  timerEndMicros = 0;
+}
+
+RoastResult Simulator::roast(uint8_t mode, const PlantParameters &parameters, uint32_t limitMs)
+{
+  emptyRoaster(parameters);
+
+  halLinuxSetPin(TIME_A, mode == 1);
+  halLinuxSetPin(TIME_B, mode == 2);
+  halLinuxSetPin(TIME_C, mode == 3);
+  run(limitMs, UntilResponse);
+
+  result.finished = buzzer;
+  return result;
+}
+
+FaultResult Simulator::roastWithFault(uint8_t injected, const PlantParameters &parameters, uint32_t limitMs)
+{
+  emptyRoaster(parameters);
+
+  if (faultProfile < 0)
+  {
+    faultProfile = roaster.getProfileCount();
+    roaster.addProfile(RUNAWAY_PROFILE);
+    roaster.addProfile(FAST_PROFILE);
+  }
+
+  // The loop & the sampler fail during a roast of the switch, the profiles fail on their own
+  int index = injected == FAULT_TEMPERATURE ? faultProfile : injected == FAULT_ROR ? faultProfile + 1 : -1;
+  roaster.selectProfile(index);
+  faultLimits = safetyLimitsOf(roaster.getProfile(index < 0 ? 0 : index));
+
+  fault = injected;
+  faultMicros = safeMicros = 0;
+  tripMotors = 0;
+  held = true;
+  rorCount = 0;
+
+  halLinuxSetPin(TIME_A, true);
+  for (uint8_t motor = 1; motor <= 3; motor++)
+  {
+    roaster.setMotor(motor, true); // As from the web, for the trip to drive them as its cause wants
+  }
+  if (injected == FAULT_LOOP || injected == FAULT_SENSOR)
+  {
+    run(FAULT_ONSET + random() % 1000, ForTime); // At any point of the periods of the tasks
+    loopStuck = injected == FAULT_LOOP;
+    samplerStuck = injected == FAULT_SENSOR;
+    faultMicros = halMicros();
+    if (trace)
+    {
+      fprintf(trace, "%9.3f %s stuck\n", (faultMicros - startMicros) / 1e6, loopStuck ? "loop" : "sampler");
+    }
+  }
+  run(limitMs, UntilSafe);
+
+  FaultResult outcome = FaultResult();
+  outcome.cause = safeMicros ? roaster.getSafety().getCause() : SAFETY_OK;
+  outcome.latencyUs = safeMicros ? safeMicros - faultMicros : UINT32_MAX;
+
+  // Still stuck past the timeout of the watchdog, then the roast goes on without the fault, the switch where it was
+  run(SAFETY_WATCHDOG_TIMEOUT + 1000, ForTime);
+  outcome.reset = halLinuxWatchdogExpired();
+  loopStuck = samplerStuck = false;
+  run(FAULT_RESUME, ForTime);
+
+  outcome.overshoot = std::max(0.0f, result.peak - faultLimits.maxTemperature);
+  outcome.held = held;
+  fault = -1;
+  roaster.selectProfile(-1);
+  return outcome;
+}
@@ -0,0 +1,180 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "filter.h"
+#include "roaster.h"
+#include "scheduler.h"
+
+// Thermal model of the roaster: the temperature of the drum follows the
+// heater with a first order response, and the probe follows the drum with
+// its own lag. The readings add noise, spikes, runs of failed reads & the
+// MAX6675 resolution
+struct PlantParameters
+{
+  float ambient;  // ºC
+  float heating;  // ºC/s with the heater fully on, at ambient temperature
+  float loss;     // 1/s, heat lost to the ambient
+  float probeLag; // s, time constant of the thermocouple
+  float noise;    // ºC, standard deviation of the readings
+  float spikes;   // Probability of a reading being off by tens of degrees
+  float dropouts; // Probability of a run of failed reads (NAN) starting, on each sensor
+};
+
+// Values of a latency, in microseconds, for its percentiles
+class LatencyRecorder
+{
+public:
+  void add(uint32_t us);
+  size_t count() const { return values.size(); }
+  uint32_t percentile(float p); // 0 - 100
+  void print(FILE *out, const char *name);
+
+private:
+  std::vector<uint32_t> values;
+  bool sorted = false;
+};
+
+// Faults injected by Simulator::roastWithFault()
+#define FAULT_LOOP 0        // The loop stops mid-roast (stuck in a wait), the outputs as they were
+#define FAULT_SENSOR 1      // The sampler stops mid-roast (a stuck DHT read)
+#define FAULT_TEMPERATURE 2 // A profile heats past its maximum temperature
+#define FAULT_ROR 3         // A profile heats faster than its maximum rate of rise
+#define FAULTS 4
+#define FAULT_ROR_READS 64  // Readings kept for the onset of FAULT_ROR, more than SAFETY_ROR_WINDOW s of them
+
+// What the supervisor did about a fault
+struct FaultResult
+{
+  uint8_t cause;      // Of the trip (SAFETY_*), SAFETY_OK if there was none
+  uint32_t latencyUs; // From the fault to the heater off (& the motors, with the loop stuck)
+  float overshoot;    // ºC the drum went over the maximum temperature of the profile
+  bool held;          // The heater stayed off until the switch went to Off, the motors off or on as the cause wants
+  bool reset;         // The watchdog went unfed for its timeout: the board would have reset
+};
+
+struct RoastResult
+{
+  bool finished;        // The profile ended (timer response) before the limit
+  uint32_t durationMs;  // Until the response, or the limit
+  float peak;           // Highest drum temperature (ºC)
+  uint32_t transitions; // Changes of the motors, buzzer, heater & timer
+  uint32_t early;       // Targets taken as reached while the drum was still over a degree away (noise)
+};
+
+// Runs the real roaster logic & scheduler against the plant on the virtual
+// clock of the Linux HAL: time jumps from one release of a task to the next,
+// so a roast takes milliseconds. Same seed, same roasts. There is one
+// roaster, as on the board: between roasts the switch goes to Off, the motors
+// are stopped & a new batch (at ambient temperature) goes in
+class Simulator
+{
+public:
+  Simulator(uint32_t seed, FILE *trace);
+
+  RoastResult roast(uint8_t mode, const PlantParameters &plant, uint32_t limitMs);
+
+  // Roast with a fault (FAULT_*) until the supervisor makes the outputs safe
+  // (or limitMs), then keep the fault on past the timeout of the watchdog
+  FaultResult roastWithFault(uint8_t fault, const PlantParameters &plant, uint32_t limitMs);
+
+  // Let the roaster go on as it is, e.g. cooling down after a roast
+  void rest(uint32_t durationMs) { run(durationMs, ForTime); }
+
+  void setTrace(FILE *out) { trace = out; }
+
+  // Write the raw reads of the sensors as CSV (ms since the batch went in,
+  // true probe temperature, thermocouple, humidity), NULL to stop
+  void setRecording(FILE *out);
+
+  // Give the raw reads to the roaster, as whole numbers, instead of filtering them
+  void setFiltering(bool on) { filtering = on; }
+
+  // Temperature held by the profile of a mode (its last target)
+  int targetOf(uint8_t mode) const;
+
+  LatencyRecorder sampleAge;       // Age of the thermocouple conversion used by each control run
+  LatencyRecorder triggerLatency;  // From the drum reaching a target to the roaster acting on it
+  LatencyRecorder responseLatency; // From the end of the timer to the buzzer
+  const CountdownStats &countdownStats() const { return roaster.getTimerStats(); }
+  const Scheduler &loopScheduler() const { return loop; }
+  const Scheduler &samplerScheduler() const { return sampler; }
+  const SafetyStats &safetyStats() const { return roaster.getSafety().getStats(); }
+  uint64_t steps;                  // Clock advances simulated
+
+private:
+  static void showRow(uint8_t row, const char *text);
+  static void statesChanged();
+  static void sampleThermocouple();
+  static void sampleHumidity();
+  static void handleReadings();
+  static void supervise();
+
+  enum Until
+  {
+    ForTime,
+    UntilResponse, // The timer response starts
+    UntilSafe      // The supervisor tripped & the outputs are safe
+  };
+
+  void emptyRoaster(const PlantParameters &parameters);
+  void run(uint32_t durationMs, Until until);
+  void advancePlant(uint32_t us);
+  void observe();
+  float gaussian();
+  uint32_t random();
+  bool readFails(uint8_t &left);
+
+  static Simulator *active; // The callbacks of the tasks are plain functions
+
+  Roaster roaster;
+  Scheduler loop;    // Tasks of the loop
+  Scheduler sampler; // Tasks of the sampler (another core on the board)
+  Scheduler safety;  // The safety supervisor (a task above the loop on the board)
+  int timerTask;
+  FILE *trace;
+  FILE *recording;
+  uint32_t state; // xorshift32
+  bool filtering;
+  SensorFilter thermocoupleFilter, humidityFilter;
+  uint8_t thermocoupleDropout, humidityDropout; // Failed reads left in the run of each sensor
+
+  PlantParameters plant;
+  float drum, probe;          // True temperatures (ºC)
+  Readings readings;           // Last readings, published by the sampler
+  uint32_t temperatureMicros;  // When the MAX6675 converted the reading
+  uint32_t readMs;             // When the sampler read it
+  uint32_t startMicros;        // Start of the roast
+
+  // Last values seen by observe()
+  uint8_t motors;
+  bool buzzer, heater, timerOn;
+  ProfileRunner::Phase phase;
+  uint8_t segment;
+  uint8_t roastPhase;     // Of the analytics
+  uint32_t reachedMicros; // When the drum reached the target of the segment, 0 if not yet
+  uint32_t timerEndMicros;
+  uint32_t conversionPhase; // Of the conversions of the MAX6675
+
+  // Fault being injected
+  int fault;                 // FAULT_*, -1 for none
+  bool loopStuck, samplerStuck;
+  uint32_t faultMicros;      // When it happened, 0 until then
+  uint32_t safeMicros;       // When the outputs were safe after the trip, 0 until then
+  uint8_t tripMotors;        // Motors on before the trip
+  bool held;                 // The outputs stayed safe since
+  int faultProfile;          // Index of the first faulty profile, -1 until they're added
+  int16_t rorReads[FAULT_ROR_READS]; // Filtered readings, for the onset of FAULT_ROR
+  uint32_t rorReadMicros[FAULT_ROR_READS];
+  uint32_t rorCount;         // Readings taken, the last one at (rorCount - 1) % FAULT_ROR_READS
+  SafetyLimits faultLimits;  // Of the profile roasted with the fault
+
+  RoastResult result;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free ring for one producer & one consumer, e.g. an ISR handing events
+// to the loop. Neither side ever waits: push() fails when the ring is full
+// (and counts the drop), pop() when it's empty. N must be a power of two.
+// T must be trivially copyable
+template <typename T, size_t N>
+class SpscQueue
+{
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  SpscQueue() : head(0), tail(0), drops(0) {}
+
+  // Producer side. False if full. Always inlined, so an ISR in IRAM doesn't call into flash
+  inline __attribute__((always_inline)) bool push(const T &value)
+  {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= N)
+    {
+      drops.store(drops.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    items[h & (N - 1)] = value;
+    head.store(h + 1, std::memory_order_release); // Publish the item
+    return true;
+  }
+
+  // Consumer side. False if empty
+  bool pop(T &value)
+  {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+
+    value = items[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release); // Free the slot
+    return true;
+  }
+
+  // Items waiting, from either side
+  size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+
+  // Items the producer couldn't push
+  uint32_t dropped() const { return drops.load(std::memory_order_relaxed); }
+
+private:
+  T items[N];
+  std::atomic<uint32_t> head; // Written by the producer only
+  std::atomic<uint32_t> tail; // Written by the consumer only
+  std::atomic<uint32_t> drops;
+};
+
+#endif
@@ -0,0 +1,305 @@
+#include "telemetry.h"
+
+JsonWriter::JsonWriter(char *buffer, size_t size) : buffer(buffer), size(size), used(0), overflow(size == 0), first(true)
+{
+  if (size)
+  {
+    buffer[0] = '\0';
+  }
+}
+
+JsonWriter &JsonWriter::raw(char c)
+{
+  if (overflow || used + 1 >= size)
+  {
+    overflow = true;
+    return *this;
+  }
+
+  buffer[used++] = c;
+  buffer[used] = '\0';
+  return *this;
+}
+
+JsonWriter &JsonWriter::raw(const char *text)
+{
+  while (*text && !overflow)
+  {
+    raw(*text++);
+  }
+  return *this;
+}
+
+JsonWriter &JsonWriter::unsignedNumber(uint32_t value)
+{
+  char digits[10];
+  size_t count = 0;
+
+  do
+  {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+
+  while (count)
+  {
+    raw(digits[--count]);
+  }
+  return *this;
+}
+
+JsonWriter &JsonWriter::number(int32_t value)
+{
+  // Work with the magnitude as unsigned so INT32_MIN doesn't overflow
+  if (value < 0)
+  {
+    return raw('-').unsignedNumber(0u - (uint32_t)value);
+  }
+  return unsignedNumber((uint32_t)value);
+}
+
+JsonWriter &JsonWriter::boolean(bool value)
+{
+  return raw(value ? "true" : "false");
+}
+
+JsonWriter &JsonWriter::string(const char *text)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  raw('"');
+  for (; *text && !overflow; text++)
+  {
+    uint8_t c = *text;
+    if (c == '"' || c == '\\')
+    {
+      raw('\\').raw((char)c);
+    }
+    else if (c < 0x20)
+    {
+      raw("\\u00").raw(hex[c >> 4]).raw(hex[c & 0x0F]);
+    }
+    else
+    {
+      raw((char)c);
+    }
+  }
+  return raw('"');
+}
+
+JsonWriter &JsonWriter::key(const char *name)
+{
+  if (!first)
+  {
+    raw(',');
+  }
+  first = false;
+
+  raw('"');
+  raw(name);
+  return raw("\":");
+}
+
+JsonWriter &JsonWriter::beginObject()
+{
+  first = true;
+  return raw('{');
+}
+
+JsonWriter &JsonWriter::endObject()
+{
+  first = false; // The object itself is a member of its parent
+  return raw('}');
+}
+
+size_t JsonWriter::length() const
+{
+  return overflow ? 0 : used;
+}
+
+// Members of each payload, shared by the single payloads & /data
+
+static void readingsMembers(JsonWriter &json, const Readings &readings)
+{
+  json.key("temperature").number(readings.temperature);
+  json.key("humidity").number(readings.humidity);
+  json.key("tq").unsignedNumber(readings.temperatureQuality);
+  json.key("hq").unsignedNumber(readings.humidityQuality);
+}
+
+static void timerMembers(JsonWriter &json, const TimerValues &timer)
+{
+  json.key("total").number(timer.total);
+  json.key("time").number(timer.time);
+}
+
+static void statesMembers(JsonWriter &json, const MotorStates &states)
+{
+  json.key("motor1").boolean(states.motor1);
+  json.key("motor2").boolean(states.motor2);
+  json.key("motor3").boolean(states.motor3);
+}
+
+static void analyticsMembers(JsonWriter &json, const RoastMetrics &metrics)
+{
+  json.key("ror").number(metrics.ror);
+  json.key("ror60").number(metrics.rorLong);
+  json.key("above").unsignedNumber(metrics.above);
+  json.key("phase").unsignedNumber(metrics.phase);
+  json.key("phases").raw('[').unsignedNumber(metrics.phases[0]);
+  json.raw(',').unsignedNumber(metrics.phases[1]);
+  json.raw(',').unsignedNumber(metrics.phases[2]).raw(']');
+}
+
+size_t writeReadings(char *buffer, size_t size, const Readings &readings)
+{
+  JsonWriter json(buffer, size);
+  json.beginObject();
+  readingsMembers(json, readings);
+  json.endObject();
+  return json.length();
+}
+
+size_t writeTimer(char *buffer, size_t size, const TimerValues &timer)
+{
+  JsonWriter json(buffer, size);
+  json.beginObject();
+  timerMembers(json, timer);
+  json.endObject();
+  return json.length();
+}
+
+size_t writeStates(char *buffer, size_t size, const MotorStates &states)
+{
+  JsonWriter json(buffer, size);
+  json.beginObject();
+  statesMembers(json, states);
+  json.endObject();
+  return json.length();
+}
+
+size_t writeSample(char *buffer, size_t size, uint32_t n, const HistorySample &sample)
+{
+  JsonWriter json(buffer, size);
+  json.raw('[').unsignedNumber(n);
+  json.raw(',').number(sample.temperature);
+  json.raw(',').unsignedNumber(sample.humidity);
+  json.raw(',').unsignedNumber(sample.timer);
+  json.raw(',').unsignedNumber(sample.flags);
+  json.raw(']');
+  return json.length();
+}
+
+size_t writeRoastEntry(char *buffer, size_t size, const JournalEntry &entry)
+{
+  JsonWriter json(buffer, size);
+  json.beginObject();
+  json.key("id").unsignedNumber(entry.id);
+  json.key("name").string(entry.name);
+  json.key("mode").unsignedNumber(entry.mode);
+  json.key("period").unsignedNumber(entry.periodMs);
+  json.key("samples").unsignedNumber(entry.samples);
+  json.key("complete").boolean(entry.complete);
+  json.key("finished").boolean(entry.finished);
+  json.key("phases").raw('[').unsignedNumber(entry.phases[0]);
+  json.raw(',').unsignedNumber(entry.phases[1]);
+  json.raw(',').unsignedNumber(entry.phases[2]).raw(']');
+  json.endObject();
+  return json.length();
+}
+
+DeltaEncoder::DeltaEncoder() : last(), seq(0), started(false) {}
+
+// Append the fields of a frame, all of them or only the ones different to previous
+static void frameFields(JsonWriter &out, const TelemetryFrame &frame, const TelemetryFrame *previous)
+{
+  if (!previous || frame.temperature != previous->temperature)
+  {
+    out.raw('T').number(frame.temperature);
+  }
+  if (!previous || frame.humidity != previous->humidity)
+  {
+    out.raw('H').number(frame.humidity);
+  }
+  if (!previous || frame.total != previous->total)
+  {
+    out.raw('N').number(frame.total);
+  }
+  if (!previous || frame.time != previous->time)
+  {
+    out.raw('C').number(frame.time);
+  }
+  if (!previous || frame.motors != previous->motors)
+  {
+    out.raw('M').unsignedNumber(frame.motors);
+  }
+  if (!previous || frame.quality != previous->quality)
+  {
+    out.raw('Q').unsignedNumber(frame.quality);
+  }
+  if (!previous || frame.ror != previous->ror)
+  {
+    out.raw('R').number(frame.ror);
+  }
+}
+
+static bool sameFrame(const TelemetryFrame &a, const TelemetryFrame &b)
+{
+  return a.temperature == b.temperature && a.humidity == b.humidity && a.total == b.total && a.time == b.time && a.motors == b.motors && a.quality == b.quality && a.ror == b.ror;
+}
+
+size_t DeltaEncoder::encode(char *buffer, size_t size, const TelemetryFrame &frame, bool keyframe)
+{
+  keyframe = keyframe || !started;
+  if (!keyframe && sameFrame(frame, last))
+  {
+    return 0;
+  }
+
+  JsonWriter out(buffer, size);
+  out.unsignedNumber(seq + 1);
+  frameFields(out, frame, keyframe ? nullptr : &last);
+
+  size_t length = out.length();
+  if (length)
+  {
+    seq++;
+    last = frame;
+    started = true;
+  }
+  return length;
+}
+
+size_t writeAnalytics(char *buffer, size_t size, const RoastMetrics &metrics)
+{
+  JsonWriter json(buffer, size);
+  json.beginObject();
+  analyticsMembers(json, metrics);
+  json.endObject();
+  return json.length();
+}
+
+size_t writeData(char *buffer, size_t size, const Readings &readings, const TimerValues &timer, const MotorStates &states, const RoastMetrics &metrics)
+{
+  JsonWriter json(buffer, size);
+  json.beginObject();
+
+  json.key("timer").beginObject();
+  timerMembers(json, timer);
+  json.endObject();
+
+  json.key("readings").beginObject();
+  readingsMembers(json, readings);
+  json.endObject();
+
+  json.key("states").beginObject();
+  statesMembers(json, states);
+  json.endObject();
+
+  json.key("analytics").beginObject();
+  analyticsMembers(json, metrics);
+  json.endObject();
+
+  json.endObject();
+  return json.length();
+}
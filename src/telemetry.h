@@ -0,0 +1,132 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "analytics.h"
+#include "history.h"
+#include "journal.h"
+
+// Size of a buffer that fits any single payload
+#define TELEMETRY_BUFFER_SIZE 320
+
+// Longest output of writeSample()
+#define SAMPLE_JSON_MAX 34
+
+// Longest output of writeRoastEntry() (a name of escaped control characters)
+#define ROAST_JSON_MAX 200
+
+struct TimerValues
+{
+  int total; // Total time of the timer in seconds
+  int time;  // Remaining seconds
+};
+
+struct MotorStates
+{
+  bool motor1;
+  bool motor2;
+  bool motor3;
+};
+
+// JSON encoders for the payloads of /data and the SSE events. They write into
+// the caller's buffer without allocating and return the length of the payload
+// (the buffer is always null terminated), or 0 if it didn't fit
+
+// Sensor values & their QUALITY_* bits (filter.h)
+struct Readings
+{
+  int temperature;
+  int humidity;
+  uint8_t temperatureQuality;
+  uint8_t humidityQuality;
+};
+
+// {"temperature":t,"humidity":h,"tq":q,"hq":q}
+size_t writeReadings(char *buffer, size_t size, const Readings &readings);
+
+// {"total":n,"time":n}
+size_t writeTimer(char *buffer, size_t size, const TimerValues &timer);
+
+// {"motor1":b,"motor2":b,"motor3":b}
+size_t writeStates(char *buffer, size_t size, const MotorStates &states);
+
+// {"ror":r,"ror60":r,"above":s,"phase":p,"phases":[drying,browning,development]}
+// (rates of rise in tenths of ºC/min, times in seconds)
+size_t writeAnalytics(char *buffer, size_t size, const RoastMetrics &metrics);
+
+// {"timer":{...},"readings":{...},"states":{...},"analytics":{...}}
+size_t writeData(char *buffer, size_t size, const Readings &readings, const TimerValues &timer, const MotorStates &states, const RoastMetrics &metrics);
+
+// [n,temperature,humidity,timer,flags] where n is the sequence number of the sample
+size_t writeSample(char *buffer, size_t size, uint32_t n, const HistorySample &sample);
+
+// {"id":n,"name":s,"mode":m,"period":ms,"samples":n,"complete":b,"finished":b,"phases":[drying,browning,development]}
+size_t writeRoastEntry(char *buffer, size_t size, const JournalEntry &entry);
+
+// Values carried by the compact stream
+struct TelemetryFrame
+{
+  int temperature;
+  int humidity;
+  int total;      // Total time of the timer in seconds
+  int time;       // Remaining seconds
+  uint8_t motors; // Bit 0 motor1, bit 1 motor2, bit 2 motor3
+  uint8_t quality; // Quality bits of the temperature, & of the humidity shifted 4 bits
+  int ror;         // Rate of rise (tenths of ºC/min)
+};
+
+// Encoder of the compact stream. Each frame is the sequence number followed by
+// the fields, as a letter & an integer: T temperature, H humidity, N total
+// time, C remaining time, M motor bits, Q quality bits, R rate of rise. e.g. "42C1233" or "43T181H44N1200C1232M1".
+// A keyframe carries every field, a delta only the ones that changed since the
+// previous frame
+class DeltaEncoder
+{
+public:
+  DeltaEncoder();
+
+  // Encode the next frame. Returns its length, or 0 if it's a delta & nothing changed (no sequence number is used)
+  size_t encode(char *buffer, size_t size, const TelemetryFrame &frame, bool keyframe);
+
+  // Sequence number of the last frame
+  uint32_t sequence() const { return seq; }
+
+private:
+  TelemetryFrame last;
+  uint32_t seq;
+  bool started; // Nothing was sent yet, the first frame is always a keyframe
+};
+
+// Appends text & numbers to a fixed buffer. Once something doesn't fit, every
+// following append is ignored and length() returns 0
+class JsonWriter
+{
+public:
+  JsonWriter(char *buffer, size_t size);
+
+  JsonWriter &raw(const char *text);
+  JsonWriter &raw(char c);
+  JsonWriter &number(int32_t value);
+  JsonWriter &unsignedNumber(uint32_t value);
+  JsonWriter &boolean(bool value);
+  JsonWriter &string(const char *text); // Quoted & escaped
+
+  // Append "key": (with the comma when it isn't the first member)
+  JsonWriter &key(const char *name);
+
+  JsonWriter &beginObject();
+  JsonWriter &endObject();
+
+  size_t length() const;
+
+private:
+  char *buffer;
+  size_t size;
+  size_t used;
+  bool overflow;
+  bool first; // No member written yet in the current object
+};
+
+#endif
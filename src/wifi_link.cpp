@@ -0,0 +1,146 @@
+#include "wifi_link.h"
+
+#include <string.h>
+
+WifiLink::WifiLink()
+    : ssid(NULL), password(NULL), accessPointSsid(NULL), accessPointPassword(NULL), state(Off), link(), linkKnown(false),
+      fastJoin(false), scanNext(false), accessPoint(false), retries(0), joinStart(0), retryAt(0), offlineSince(0), random(1), stats()
+{
+}
+
+void WifiLink::begin(const char *ssid, const char *password, const char *accessPointSsid, const char *accessPointPassword)
+{
+  this->ssid = ssid;
+  this->password = password;
+  this->accessPointSsid = accessPointSsid;
+  this->accessPointPassword = accessPointPassword;
+
+  linkKnown = halLoadSetting(WIFI_LINK_SETTING, &link, sizeof(link)) && link.channel;
+  random = halMicros() | 1;
+  offlineSince = halMillis();
+  join(offlineSince);
+}
+
+// Start a join, to the known router if there's one
+void WifiLink::join(uint32_t now)
+{
+  fastJoin = linkKnown && !scanNext;
+  scanNext = false;
+  halNetworkJoin(ssid, password, fastJoin ? &link : NULL);
+  joinStart = now;
+  state = Joining;
+}
+
+// The join failed: scan right away if it was to the known router (it may have moved to
+// another channel), or wait longer each time. Every retry tries the known router first
+void WifiLink::fail(uint32_t now)
+{
+  stats.failures++;
+  state = Waiting;
+
+  if (fastJoin)
+  {
+    scanNext = true;
+    retryAt = now + WIFI_RETRY_MIN;
+    return;
+  }
+
+  retries++;
+  retryAt = now + backoff();
+}
+
+// Wait before the next join: doubles with each failure, ±25% so the roasters of a shop don't retry together
+uint32_t WifiLink::backoff()
+{
+  uint32_t delay = retries < 7 ? WIFI_RETRY_MIN << retries : WIFI_RETRY_MAX;
+  if (delay > WIFI_RETRY_MAX)
+  {
+    delay = WIFI_RETRY_MAX;
+  }
+
+  random ^= random << 13;
+  random ^= random >> 17;
+  random ^= random << 5;
+  return delay - delay / 4 + random % (delay / 2 + 1);
+}
+
+bool WifiLink::poll()
+{
+  if (state == Off)
+  {
+    return false;
+  }
+
+  uint32_t now = halMillis();
+  bool changed = false;
+
+  uint8_t event;
+  while (events.pop(event))
+  {
+    if (event == HAL_NETWORK_CONNECTED && state != Online)
+    {
+      state = Online;
+      retries = 0;
+      stats.joins++;
+      stats.fastJoins += fastJoin;
+      stats.lastJoinMs = now - joinStart;
+      if (now - offlineSince > stats.maxOfflineMs)
+      {
+        stats.maxOfflineMs = now - offlineSince;
+      }
+
+      // Keep the router for the next join (a flash write only when it changed)
+      HalNetworkLink joined;
+      if (halNetworkLink(&joined))
+      {
+        if (memcmp(&joined, &link, sizeof(link)) != 0)
+        {
+          link = joined;
+          halSaveSetting(WIFI_LINK_SETTING, &link, sizeof(link));
+        }
+        linkKnown = true;
+      }
+
+      // The page is reachable through the router again
+      if (accessPoint)
+      {
+        halNetworkStopAccessPoint();
+        accessPoint = false;
+      }
+      changed = true;
+    }
+    else if (event == HAL_NETWORK_DISCONNECTED && state == Online)
+    {
+      // Rejoin the same router right away
+      stats.drops++;
+      offlineSince = now;
+      state = Waiting;
+      retryAt = now + WIFI_RETRY_MIN;
+      changed = true;
+    }
+    else if (event == HAL_NETWORK_DISCONNECTED && state == Joining)
+    {
+      fail(now);
+    }
+  }
+
+  if (state == Joining && now - joinStart >= (fastJoin ? WIFI_FAST_JOIN_TIMEOUT : WIFI_JOIN_TIMEOUT))
+  {
+    halNetworkDisconnect();
+    fail(now);
+  }
+  if (state == Waiting && (int32_t)(now - retryAt) >= 0)
+  {
+    join(now);
+  }
+
+  if (state != Online && !accessPoint && now - offlineSince >= WIFI_ACCESS_POINT_AFTER)
+  {
+    halNetworkStartAccessPoint(accessPointSsid, accessPointPassword);
+    accessPoint = true;
+    stats.accessPoints++;
+    changed = true;
+  }
+
+  return changed;
+}
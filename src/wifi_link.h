@@ -0,0 +1,85 @@
+#ifndef WIFI_LINK_H
+#define WIFI_LINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+#include "spsc_queue.h"
+
+#define WIFI_JOIN_TIMEOUT 15000       // ms for a join that scans every channel
+#define WIFI_FAST_JOIN_TIMEOUT 3000   // ms for a join to the router of the last connection
+#define WIFI_RETRY_MIN 500            // ms before the first retry (the event of the abandoned join goes by meanwhile)
+#define WIFI_RETRY_MAX 15000          // ms, longest wait between two joins
+#define WIFI_ACCESS_POINT_AFTER 30000 // ms offline before the access point is started
+#define WIFI_LINK_SETTING "wifi"      // Where the router of the last connection is kept
+
+// Joins, drops & fallbacks of the network
+struct WifiStats
+{
+  uint32_t joins;        // Successful
+  uint32_t fastJoins;    // Of them, to the known BSSID & channel, without a scan
+  uint32_t failures;     // Joins that failed or timed out
+  uint32_t drops;        // Connections lost
+  uint32_t lastJoinMs;   // Duration of the last successful join
+  uint32_t maxOfflineMs; // Longest time without a connection
+  uint32_t accessPoints; // Times the access point was started
+};
+
+// Connection of the station to the router, as a state machine that never
+// blocks: joins are started & their outcome arrives later as an event of the
+// HAL, posted from the network task. It retries with an exponential backoff,
+// first to the router of the last connection (BSSID & channel, kept in the
+// settings) without scanning, then with a scan, and starts an access point of its own when it
+// has been offline too long, so the page stays reachable
+class WifiLink
+{
+public:
+  enum State
+  {
+    Off,
+    Joining, // Waiting for the outcome of a join
+    Online,
+    Waiting // Backing off until the next join
+  };
+
+  WifiLink();
+
+  // Start joining. The strings must outlive the link
+  void begin(const char *ssid, const char *password, const char *accessPointSsid, const char *accessPointPassword);
+
+  // An event of the HAL (HAL_NETWORK_*), from the network task
+  void post(uint8_t event) { events.push(event); }
+  bool pending() const { return events.size() > 0; }
+
+  // Apply the posted events & the timeouts. True if it went on or offline, or started the access point
+  bool poll();
+
+  State getState() const { return state; }
+  bool isOnline() const { return state == Online; }
+  bool accessPointOn() const { return accessPoint; }
+  const WifiStats &getStats() const { return stats; }
+
+private:
+  void join(uint32_t now);
+  void fail(uint32_t now);
+  uint32_t backoff();
+
+  SpscQueue<uint8_t, 8> events;
+  const char *ssid, *password, *accessPointSsid, *accessPointPassword;
+
+  State state;
+  HalNetworkLink link; // Router of the last connection, as saved in the settings
+  bool linkKnown;      // link is worth a try
+  bool fastJoin;       // The join in progress skips the scan
+  bool scanNext;       // The known router wasn't there, the next join scans
+  bool accessPoint;
+  uint8_t retries;         // Failed joins in a row
+  uint32_t joinStart;      // When the join in progress started (ms)
+  uint32_t retryAt;        // When to join again (ms)
+  uint32_t offlineSince;   // ms
+  uint32_t random;         // xorshift32, spreads the retries of several roasters
+  WifiStats stats;
+};
+
+#endif